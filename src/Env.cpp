@@ -5,4 +5,4 @@
 
 #include "Env.h"
 
-PTR(Env) Env::empty = NEW(EmptyEnv)();
+thread_local PTR(Env) Env::empty = NEW(EmptyEnv)();
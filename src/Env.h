@@ -5,31 +5,45 @@
 
 #pragma once
 
+#include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "budget.h"
 #include "pointers.h"
-
-class Val;
+#include "stats.h"
+#include "Val.h"            /* Val, complete for ref_ptr's inline destructor */
 
 /**
  * \class Env
  * \brief A "dictionary" for results of substituted (recursive, mostly)
  *        expressions
  */
-class Env {
+COUNTED(Env) {
 public:
 
-    static PTR(Env) empty;
+    /*
+     * One per thread: every interp() call starts from empty, and a single
+     * shared instance would have all threads bumping the same reference count.
+     */
+    static thread_local PTR(Env) empty;
+
+    size_t length = 0; ///< Bindings in this chain
 
-    virtual PTR(Val) lookup(std::string find_name) = 0;
+    virtual PTR(Val) lookup(const std::string &find_name) = 0;
 };
 
 class EmptyEnv : public Env {
 public:
 
-    PTR(Val) lookup(std::string find_name) override {
-        throw std::runtime_error("Var cannot call interp()");
+    /* Below every binding are the primitives (see Prim) */
+    PTR(Val) lookup(const std::string &find_name) override {
+        PTR(Val) prim = PrimVal::bound(find_name);
+        if (prim == nullptr) {
+            throw std::runtime_error("Var cannot call interp()");
+        }
+        return prim;
     }
 };
 
@@ -41,12 +55,15 @@ public:
     PTR(Env) rest;
 
     ExtendedEnv(std::string name, PTR(Val) val, PTR(Env) env) {
+        budget_allocate(sizeof(ExtendedEnv));
         this->name = std::move(name);
-        this->val = val;
-        this->rest = env;
+        this->val = std::move(val);
+        this->rest = std::move(env);
+        this->length = (rest != nullptr ? rest->length : 0) + 1;
+        stats_env(this->length);
     }
 
-    PTR(Val) lookup(std::string find_name) override {
+    PTR(Val) lookup(const std::string &find_name) override {
         if (find_name == name) {
             return val;
         } else {
@@ -54,3 +71,40 @@ public:
         }
     }
 };
+
+/**
+ * \class FrameEnv
+ * \brief Every argument of one multi-argument call, bound in a single
+ *        environment instead of a chain of ExtendedEnvs
+ */
+class FrameEnv : public Env {
+public:
+
+    std::vector<std::pair<std::string, PTR(Val)>> bindings; ///< In order
+    PTR(Env) rest;
+
+    /**
+     * \brief Binds names[i] to vals[i] for each i < count
+     */
+    FrameEnv(const std::string *names, const PTR(Val) *vals, size_t count,
+             PTR(Env) env) {
+        budget_allocate(sizeof(FrameEnv) + count * sizeof(bindings[0]));
+        bindings.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            bindings.emplace_back(names[i], vals[i]);
+        }
+        this->rest = std::move(env);
+        this->length = (rest != nullptr ? rest->length : 0) + count;
+        stats_env(this->length);
+    }
+
+    /* Later bindings shadow earlier ones, as with nested ExtendedEnvs */
+    PTR(Val) lookup(const std::string &find_name) override {
+        for (auto it = bindings.rbegin(); it != bindings.rend(); ++it) {
+            if (it->first == find_name) {
+                return it->second;
+            }
+        }
+        return rest->lookup(find_name);
+    }
+};
@@ -3,10 +3,17 @@
  * \brief Expr bass class and derived class definitions
  */
 
+#include <algorithm>    /* std::find (for Fun::subst()) */
 #include <iostream>     /* Console I/O */
+#include <iterator>     /* std::make_move_iterator (for subst_tree()) */
+#include <typeinfo>     /* typeid (for Var::interp() and Call::interp()) */
 
+#include "budget.h"
 #include "Env.h"
 #include "Expr.h"
+#include "gc.h"
+#include "stats.h"
+#include "Type.h"
 #include "Val.h"
 
 /**
@@ -27,12 +34,296 @@ std::string Expr::to_pretty_string() {
     return stream.str();
 }
 
+/**
+ * This has a doc comment in the header file, to play nicely with Doxygen
+ */
+PTR(Type) Expr::typecheck(PTR(TypeEnv) tenv) {
+    if (tenv == nullptr) {
+        tenv = TypeEnv::empty;
+    }
+
+    TypeContext ctx;
+    PTR(Type) type = infer(tenv, ctx);
+
+    for (Expr *e: ctx.checked) {
+        e->typed_m = true;
+    }
+
+    return type->resolve();
+}
+
+/*
+ * Explicit-stack traversals
+ *
+ * A tree the parser builds can be deeper than the call stack allows, so
+ * destruction, equals(), has_variable(), and subst() walk the Expr classes
+ * below with explicit stacks rather than by recursion. Other Exprs (a Probe
+ * or a FlatRef) wrap another tree, and are handed their own methods.
+ */
+
+/// The queue of the outermost release() on this thread, while it drains it
+static thread_local std::vector<PTR(Expr)> *doomed = nullptr;
+
+/**
+ * This has a doc comment in the header file, to play nicely with Doxygen
+ */
+void Expr::release(PTR(Expr) &operand) {
+    if (operand == nullptr || operand.use_count() != 1) {
+        return; // Dropping a shared reference frees nothing
+    }
+    if (doomed != nullptr) {
+        doomed->push_back(std::move(operand));
+        return;
+    }
+
+    std::vector<PTR(Expr)> queue;
+    queue.push_back(std::move(operand));
+    doomed = &queue;
+    while (!queue.empty()) {
+        PTR(Expr) next = std::move(queue.back());
+        queue.pop_back();
+        next = nullptr; // Its destructor queues its own operands
+    }
+    doomed = nullptr;
+}
+
+/**
+ * \brief Lists a node's operands, in order
+ *
+ * \param e The node
+ * \param out Set to pointers to its operand members
+ * \return False if e is not one of the classes in this file, but a wrapper
+ *         whose own methods must be used
+ */
+static bool operands_of(Expr *e, std::vector<PTR(Expr) *> &out) {
+    out.clear();
+    const std::type_info &type = typeid(*e);
+    if (type == typeid(Num) || type == typeid(Bool) || type == typeid(Var)) {
+        return true;
+    } else if (type == typeid(Add)) {
+        out = {&static_cast<Add *>(e)->lhs_m, &static_cast<Add *>(e)->rhs_m};
+    } else if (type == typeid(Mult)) {
+        out = {&static_cast<Mult *>(e)->lhs_m, &static_cast<Mult *>(e)->rhs_m};
+    } else if (type == typeid(Eq)) {
+        out = {&static_cast<Eq *>(e)->lhs_m, &static_cast<Eq *>(e)->rhs_m};
+    } else if (type == typeid(Let)) {
+        out = {&static_cast<Let *>(e)->rhs_m, &static_cast<Let *>(e)->body_m};
+    } else if (type == typeid(LetRec)) {
+        out = {&static_cast<LetRec *>(e)->rhs_m, &static_cast<LetRec *>(e)->body_m};
+    } else if (type == typeid(If)) {
+        auto *if_expr = static_cast<If *>(e);
+        out = {&if_expr->test_m, &if_expr->then_m, &if_expr->else_m};
+    } else if (type == typeid(Fun)) {
+        out = {&static_cast<Fun *>(e)->body_m};
+    } else if (type == typeid(Call)) {
+        auto *call = static_cast<Call *>(e);
+        out.push_back(&call->to_be_called_m);
+        for (PTR(Expr) &actual_arg: call->actual_args_m) {
+            out.push_back(&actual_arg);
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Compares what two nodes of the same class hold besides operands
+ */
+static bool same_fields(Expr *lhs, Expr *rhs) {
+    const std::type_info &type = typeid(*lhs);
+    if (type == typeid(Num)) {
+        return static_cast<Num *>(lhs)->int_m == static_cast<Num *>(rhs)->int_m;
+    } else if (type == typeid(Bool)) {
+        return static_cast<Bool *>(lhs)->bool_m == static_cast<Bool *>(rhs)->bool_m;
+    } else if (type == typeid(Var)) {
+        return static_cast<Var *>(lhs)->str_m == static_cast<Var *>(rhs)->str_m;
+    } else if (type == typeid(Let)) {
+        return static_cast<Let *>(lhs)->lhs_m == static_cast<Let *>(rhs)->lhs_m;
+    } else if (type == typeid(LetRec)) {
+        return static_cast<LetRec *>(lhs)->lhs_m == static_cast<LetRec *>(rhs)->lhs_m;
+    } else if (type == typeid(Fun)) {
+        return static_cast<Fun *>(lhs)->formal_args_m == static_cast<Fun *>(rhs)->formal_args_m;
+    }
+    return true;
+}
+
+/**
+ * \brief equals() for the classes in this file
+ *
+ * \param lhs The node whose equals() was called
+ * \param rhs The Expr it was called with
+ * \return True if both trees have the same classes, fields, and shape
+ */
+static bool equal_trees(Expr *lhs, const PTR(Expr) &rhs) {
+    std::vector<std::pair<Expr *, const PTR(Expr) *>> pending{{lhs, &rhs}};
+    std::vector<PTR(Expr) *> lhs_operands;
+    std::vector<PTR(Expr) *> rhs_operands;
+
+    while (!pending.empty()) {
+        Expr *x = pending.back().first;
+        const PTR(Expr) &y = *pending.back().second;
+        pending.pop_back();
+
+        if (!operands_of(x, lhs_operands)) {
+            if (!x->equals(y)) {
+                return false;
+            }
+            continue;
+        }
+        if (y == nullptr || typeid(*x) != typeid(*y) || !same_fields(x, y.get())) {
+            return false;
+        }
+        operands_of(y.get(), rhs_operands);
+        if (lhs_operands.size() != rhs_operands.size()) {
+            return false;
+        }
+        for (size_t i = lhs_operands.size(); i-- > 0;) {
+            pending.emplace_back(lhs_operands[i]->get(), rhs_operands[i]);
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief has_variable() for the classes in this file
+ *
+ * \return True if a Var is found, looking into every operand except those
+ *         of a Call (see Call::has_variable())
+ */
+static bool tree_has_variable(Expr *root) {
+    std::vector<Expr *> pending{root};
+    std::vector<PTR(Expr) *> operands;
+
+    while (!pending.empty()) {
+        Expr *e = pending.back();
+        pending.pop_back();
+
+        if (!operands_of(e, operands)) {
+            if (e->has_variable()) {
+                return true;
+            }
+            continue;
+        }
+        if (typeid(*e) == typeid(Var)) {
+            return true;
+        } else if (typeid(*e) == typeid(Call)) {
+            continue;
+        }
+        for (PTR(Expr) *operand: operands) {
+            pending.push_back(operand->get());
+        }
+    }
+    return false;
+}
+
+/**
+ * \brief How many of a node's leading operands str is still free in
+ */
+static size_t free_operands(Expr *e, const std::string &str, size_t count) {
+    if (auto *let = dynamic_cast<Let *>(e)) {
+        return let->lhs_m == str ? 1 : 2;   // Just the rhs, if the body rebinds str
+    } else if (auto *letrec = dynamic_cast<LetRec *>(e)) {
+        return letrec->lhs_m == str ? 0 : 2;
+    } else if (auto *fun = dynamic_cast<Fun *>(e)) {
+        const std::vector<std::string> &formal_args = fun->formal_args_m;
+        return std::find(formal_args.begin(), formal_args.end(), str) != formal_args.end() ? 0 : 1;
+    }
+    return count;
+}
+
+/**
+ * \brief A new node of e's class and fields with the given operands
+ */
+static PTR(Expr) rebuild(Expr *e, const std::vector<PTR(Expr)> &operands) {
+    const std::type_info &type = typeid(*e);
+    if (type == typeid(Num)) {
+        return NEW(Num)(static_cast<Num *>(e)->int_m);
+    } else if (type == typeid(Bool)) {
+        return NEW(Bool)(static_cast<Bool *>(e)->bool_m);
+    } else if (type == typeid(Var)) {
+        return NEW(Var)(static_cast<Var *>(e)->str_m);
+    } else if (type == typeid(Add)) {
+        return NEW(Add)(operands[0], operands[1]);
+    } else if (type == typeid(Mult)) {
+        return NEW(Mult)(operands[0], operands[1]);
+    } else if (type == typeid(Eq)) {
+        return NEW(Eq)(operands[0], operands[1]);
+    } else if (type == typeid(Let)) {
+        return NEW(Let)(static_cast<Let *>(e)->lhs_m, operands[0], operands[1]);
+    } else if (type == typeid(LetRec)) {
+        return NEW(LetRec)(static_cast<LetRec *>(e)->lhs_m, operands[0], operands[1]);
+    } else if (type == typeid(If)) {
+        return NEW(If)(operands[0], operands[1], operands[2]);
+    } else if (type == typeid(Fun)) {
+        return NEW(Fun)(static_cast<Fun *>(e)->formal_args_m, operands[0]);
+    }
+    return NEW(Call)(operands[0], std::vector<PTR(Expr)>(operands.begin() + 1, operands.end()));
+}
+
+/**
+ * \brief subst() for the classes in this file
+ *
+ * \param root The node whose subst() was called
+ * \param str The variable to replace
+ * \param e The Expr to replace it with
+ * \return A copy of root with every free str replaced by e; operands str is
+ *         bound in are shared, not copied
+ *
+ * Builds the copy bottom-up: a node is rebuilt once the operands str is free
+ * in have been.
+ */
+static PTR(Expr) subst_tree(Expr *root, const std::string &str, const PTR(Expr) &e) {
+    struct Visit {
+        Expr *expr;
+        bool rebuild;
+        size_t substituted; ///< Leading operands replaced, once rebuild is set
+    };
+    std::vector<Visit> pending{{root, false, 0}};
+    std::vector<PTR(Expr)> done;
+    std::vector<PTR(Expr) *> operands;
+    std::vector<PTR(Expr)> new_operands;
+
+    while (!pending.empty()) {
+        Visit visit = pending.back();
+        pending.pop_back();
+
+        if (!operands_of(visit.expr, operands)) {
+            done.push_back(visit.expr->subst(str, e));
+            continue;
+        }
+
+        if (!visit.rebuild) {
+            auto *var = dynamic_cast<Var *>(visit.expr);
+            if (var != nullptr && var->str_m == str) {
+                done.push_back(e);
+                continue;
+            }
+            size_t substituted = free_operands(visit.expr, str, operands.size());
+            pending.push_back({visit.expr, true, substituted});
+            for (size_t i = substituted; i-- > 0;) {
+                pending.push_back({operands[i]->get(), false, 0});
+            }
+            continue;
+        }
+
+        new_operands.assign(std::make_move_iterator(done.end() - visit.substituted),
+                            std::make_move_iterator(done.end()));
+        done.resize(done.size() - visit.substituted);
+        for (size_t i = visit.substituted; i < operands.size(); i++) {
+            new_operands.push_back(*operands[i]);
+        }
+        done.push_back(rebuild(visit.expr, new_operands));
+    }
+    return done.back();
+}
+
 /**
  * \brief Constructs a Num object representing an integer expression
  *
- * \param val An int to define this Num object's int_m value
+ * \param val An Integer to define this Num object's int_m value
  */
-Num::Num(int val) {
+Num::Num(Integer val) {
     int_m = val;
 }
 
@@ -43,8 +334,8 @@ Num::Num(int val) {
  * \return True if the two objects are both Num objects and represent
  * equivalent int_m values
  */
-bool Num::equals(PTR(Expr) e) {
-    PTR(Num) num_cmp = CAST(Num)(e);
+bool Num::equals(const PTR(Expr) &e) {
+    Num *num_cmp = dynamic_cast<Num *>(e.get());
     return num_cmp != nullptr && int_m == num_cmp->int_m;
 }
 
@@ -53,7 +344,10 @@ bool Num::equals(PTR(Expr) e) {
  *
  * \return A NumVal object representing this Num object's integer value
  */
-PTR(Val) Num::interp(PTR(Env) env) {
+PTR(Val) Num::interp(const PTR(Env) &env) {
+    budget_step();
+    StatsFrame frame;
+
     return NEW(NumVal)(int_m);
 }
 
@@ -80,6 +374,17 @@ PTR(Expr) Num::subst(std::string str, PTR(Expr) e) {
     return NEW(Num)(int_m);
 }
 
+/**
+ * \brief Infers the type of a Num object
+ *
+ * \param tenv N/A
+ * \param ctx N/A
+ * \return Always an IntType, for objects of this type
+ */
+PTR(Type) Num::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    return NEW(IntType)();
+}
+
 /**
  * \brief Writes a Num object's string representation to an output stream
  *
@@ -89,7 +394,7 @@ PTR(Expr) Num::subst(std::string str, PTR(Expr) e) {
  * string, to the output stream. No parentheses or spaces are added.
  */
 void Num::print(std::ostream &stream) {
-    stream << std::to_string(int_m);
+    stream << int_m.to_string();
 }
 
 /**
@@ -108,8 +413,8 @@ Bool::Bool(bool val) {
  * \return True if the two objects are both Bool objects and represent
  * equivalent bool_m values
  */
-bool Bool::equals(PTR(Expr) e) {
-    PTR(Bool) bool_cmp = CAST(Bool)(e);
+bool Bool::equals(const PTR(Expr) &e) {
+    Bool *bool_cmp = dynamic_cast<Bool *>(e.get());
     return bool_cmp != nullptr && bool_m == bool_cmp->bool_m;
 }
 
@@ -118,7 +423,10 @@ bool Bool::equals(PTR(Expr) e) {
  *
  * \return A BoolVal object representing this Bool object's boolean value
  */
-PTR(Val) Bool::interp(PTR(Env) env) {
+PTR(Val) Bool::interp(const PTR(Env) &env) {
+    budget_step();
+    StatsFrame frame;
+
     return NEW(BoolVal)(bool_m);
 }
 
@@ -145,6 +453,17 @@ PTR(Expr) Bool::subst(std::string str, PTR(Expr) e) {
     return NEW(Bool)(bool_m);
 }
 
+/**
+ * \brief Infers the type of a Bool object
+ *
+ * \param tenv N/A
+ * \param ctx N/A
+ * \return Always a BoolType, for objects of this type
+ */
+PTR(Type) Bool::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    return NEW(BoolType)();
+}
+
 /**
  * \brief Writes a Bool object's string representation to an output stream
  *
@@ -170,6 +489,16 @@ void Bool::print(std::ostream &stream) {
 Eq::Eq(PTR(Expr) lhs, PTR(Expr) rhs) {
     lhs_m = lhs;
     rhs_m = rhs;
+    size_m = 1 + lhs->size_m + rhs->size_m;
+}
+
+/**
+ * \brief Destroys this Eq object, releasing its operands without
+ * recursing (see Expr::release())
+ */
+Eq::~Eq() {
+    release(lhs_m);
+    release(rhs_m);
 }
 
 /**
@@ -179,15 +508,12 @@ Eq::Eq(PTR(Expr) lhs, PTR(Expr) rhs) {
  * \return True if the two objects are both Eq objects and represent
  * equivalent lhs and rhs values
  *
- * Calls equals() recursively on both lhs and rhs values of this object. All
- * calls to equals(), including on nested expressions, must return true each
- * time for an Eq object to be considered equal to another Eq object.
+ * Compares both lhs and rhs values of this object, at every level of nesting,
+ * with an explicit stack (see equal_trees()). Every comparison must return
+ * true each time for an Eq object to be considered equal to another Eq object.
  */
-bool Eq::equals(PTR(Expr) e) {
-    PTR(Eq) eq_cmp = CAST(Eq)(e);
-    return eq_cmp != nullptr &&
-           lhs_m->equals(eq_cmp->lhs_m) &&
-           rhs_m->equals(eq_cmp->rhs_m);
+bool Eq::equals(const PTR(Expr) &e) {
+    return equal_trees(this, e);
 }
 
 /**
@@ -200,7 +526,10 @@ bool Eq::equals(PTR(Expr) e) {
  * NumVal object. If Vars are encountered, an exception is thrown
  * ( See: Var::interp() ).
  */
-PTR(Val) Eq::interp(PTR(Env) env) {
+PTR(Val) Eq::interp(const PTR(Env) &env) {
+    budget_step();
+    StatsFrame frame;
+
     bool res = (lhs_m->interp(env))->equals(rhs_m->interp(env));
     return NEW(BoolVal)(res);
 }
@@ -211,11 +540,12 @@ PTR(Val) Eq::interp(PTR(Env) env) {
  * \return True if an Eq object's lhs or rhs is a Var object (at any level),
  * or false if there are none.
  *
- * Employed recursively, this method returns true if this Expr object (or any
- * Expr object nested within it) have a lhs or rhs of type Var.
+ * Searching with an explicit stack (see tree_has_variable()), this method
+ * returns true if this Expr object (or any Expr object nested within it) have
+ * a lhs or rhs of type Var.
  */
 bool Eq::has_variable() {
-    return lhs_m->has_variable() || rhs_m->has_variable();
+    return tree_has_variable(this);
 }
 
 /**
@@ -228,12 +558,26 @@ bool Eq::has_variable() {
  * If an Eq contains a user-inputted string, the string will be replaced where
  * it occurs with another user-inputted parameter. The Var class is responsible
  * for checking whether the string that is searched for is actually contained
- * by the Expression calling it. (See: Var::subst() ). This method is called
- * recursively on both the lhs and rhs values of an Eq object. The "variable"
+ * by the Expression calling it. (See: Var::subst() ). This method works
+ * with an explicit stack (see subst_tree()) on both the lhs and rhs values of an Eq object. The "variable"
  * in question is replaced at all levels of nesting.
  */
 PTR(Expr) Eq::subst(std::string str, PTR(Expr) e) {
-    return NEW(Eq)(lhs_m->subst(str, e), rhs_m->subst(str, e));
+    return subst_tree(this, str, e);
+}
+
+/**
+ * \brief Infers the type of an Eq object
+ *
+ * \param tenv The types of the variables in scope
+ * \param ctx The current typecheck() pass
+ * \return Always a BoolType, for objects of this type
+ *
+ * Both operands must have the same type.
+ */
+PTR(Type) Eq::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    unify(lhs_m->infer(tenv, ctx), rhs_m->infer(tenv, ctx));
+    return NEW(BoolType)();
 }
 
 /**
@@ -313,6 +657,16 @@ void Eq::pretty_print_at(std::ostream &stream, prec_t caller_prec,
 Add::Add(PTR(Expr) lhs, PTR(Expr) rhs) {
     lhs_m = lhs;
     rhs_m = rhs;
+    size_m = 1 + lhs->size_m + rhs->size_m;
+}
+
+/**
+ * \brief Destroys this Add object, releasing its operands without
+ * recursing (see Expr::release())
+ */
+Add::~Add() {
+    release(lhs_m);
+    release(rhs_m);
 }
 
 /**
@@ -322,15 +676,13 @@ Add::Add(PTR(Expr) lhs, PTR(Expr) rhs) {
  * \return True if the Addition objects represent equivalent values; false
  * if not, or if the two objects compared are not both of type Add.
  *
- * Calls equals() recursively on both lhs and rhs values of this object. All
- * calls to equals(), including on nested expressions, must return true each
- * time for an Add object to be considered equal to another Addition object.
+ * Compares both lhs and rhs values of this object, at every level of nesting,
+ * with an explicit stack (see equal_trees()). Every comparison must return
+ * true each time for an Add object to be considered equal to another Addition
+ * object.
  */
-bool Add::equals(PTR(Expr) e) {
-    PTR(Add) add_cmp = CAST(Add)(e);
-    return add_cmp != nullptr &&
-           lhs_m->equals(add_cmp->lhs_m) &&
-           rhs_m->equals(add_cmp->rhs_m);
+bool Add::equals(const PTR(Expr) &e) {
+    return equal_trees(this, e);
 }
 
 /**
@@ -344,12 +696,21 @@ bool Add::equals(PTR(Expr) e) {
  * nested Expressions) summed. If Variables are encountered, an exception is
  * thrown (see: Var::interp()).
  */
-PTR(Val) Add::interp(PTR(Env) env) {
-    if (env == nullptr) {
-        env = Env::empty;
+PTR(Val) Add::interp(const PTR(Env) &env) {
+    budget_step();
+    StatsFrame frame;
+
+    const PTR(Env) &scope = env != nullptr ? env : Env::empty;
+
+    PTR(Val) lhs_val = lhs_m->interp(scope);
+    PTR(Val) rhs_val = rhs_m->interp(scope);
+
+    if (typed_m) {
+        return NEW(NumVal)(static_cast<NumVal *>(lhs_val.get())->int_m +
+                           static_cast<NumVal *>(rhs_val.get())->int_m);
     }
 
-    return lhs_m->interp(env)->add_to(rhs_m->interp(env));
+    return lhs_val->add_to(rhs_val);
 }
 
 /**
@@ -358,11 +719,12 @@ PTR(Val) Add::interp(PTR(Env) env) {
  * \return True if an Add object's lhs or rhs is a Var object (at any level),
  * or false if there are none.
  *
- * Employed recursively, this method returns true if this Expression (or any
- * Expression nested within it) have a lhs or rhs of type Variable.
+ * Searching with an explicit stack (see tree_has_variable()), this method
+ * returns true if this Expression (or any Expression nested within it) have a
+ * lhs or rhs of type Variable.
  */
 bool Add::has_variable() {
-    return lhs_m->has_variable() || rhs_m->has_variable();
+    return tree_has_variable(this);
 }
 
 /**
@@ -377,12 +739,29 @@ bool Add::has_variable() {
  * Expression value where it occurs. The Variable class is responsible for
  * checking whether the string that is searched for is actually contained by
  * the Expression calling it. If it is, its value is re-assigned. If not, it
- * simply returns a copy of itself. This method is called recursively on both
- * the lhs and rhs values of an Addition object. The Variable in question is
+ * simply returns a copy of itself. This method works with an explicit stack (see
+ * subst_tree()) on both the lhs and rhs values of an Addition object. The Variable in question is
  * replaced at all levels of nesting.
  */
 PTR(Expr) Add::subst(std::string str, PTR(Expr) e) {
-    return NEW(Add)(lhs_m->subst(str, e), rhs_m->subst(str, e));
+    return subst_tree(this, str, e);
+}
+
+/**
+ * \brief Infers the type of an Add object
+ *
+ * \param tenv The types of the variables in scope
+ * \param ctx The current typecheck() pass
+ * \return Always an IntType, for objects of this type
+ *
+ * Both operands must be ints; once that is proven, interp() may add them
+ * without checking.
+ */
+PTR(Type) Add::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    unify(lhs_m->infer(tenv, ctx), NEW(IntType)());
+    unify(rhs_m->infer(tenv, ctx), NEW(IntType)());
+    ctx.checked.push_back(this);
+    return NEW(IntType)();
 }
 
 /**
@@ -463,6 +842,16 @@ void Add::pretty_print_at(std::ostream &stream, prec_t caller_prec,
 Mult::Mult(PTR(Expr) lhs, PTR(Expr) rhs) {
     lhs_m = lhs;
     rhs_m = rhs;
+    size_m = 1 + lhs->size_m + rhs->size_m;
+}
+
+/**
+ * \brief Destroys this Mult object, releasing its operands without
+ * recursing (see Expr::release())
+ */
+Mult::~Mult() {
+    release(lhs_m);
+    release(rhs_m);
 }
 
 /**
@@ -473,16 +862,13 @@ Mult::Mult(PTR(Expr) lhs, PTR(Expr) rhs) {
  * false if not, or if the two objects compared are not both of type
  * Multiplication
  *
- * Calls equals() recursively on both lhs and rhs values of this object. All
- * calls to equals(), including on nested expressions, must return true each
- * time for an Multiplication object to be considered equal to another
- * Multiplication object.
+ * Compares both lhs and rhs values of this object, at every level of nesting,
+ * with an explicit stack (see equal_trees()). Every comparison must return
+ * true each time for an Multiplication object to be considered equal to
+ * another Multiplication object.
  */
-bool Mult::equals(PTR(Expr) e) {
-    PTR(Mult) mult_cmp = CAST(Mult)(e);
-    return mult_cmp != nullptr &&
-           lhs_m->equals(mult_cmp->lhs_m) &&
-           rhs_m->equals(mult_cmp->rhs_m);
+bool Mult::equals(const PTR(Expr) &e) {
+    return equal_trees(this, e);
 }
 
 /**
@@ -496,12 +882,21 @@ bool Mult::equals(PTR(Expr) e) {
  * (including nested Expressions) multiplied together. If Variables are
  * encountered, an exception is thrown (see: Var::interp()).
  */
-PTR(Val) Mult::interp(PTR(Env) env) {
-    if (env == nullptr) {
-        env = Env::empty;
+PTR(Val) Mult::interp(const PTR(Env) &env) {
+    budget_step();
+    StatsFrame frame;
+
+    const PTR(Env) &scope = env != nullptr ? env : Env::empty;
+
+    PTR(Val) lhs_val = lhs_m->interp(scope);
+    PTR(Val) rhs_val = rhs_m->interp(scope);
+
+    if (typed_m) {
+        return NEW(NumVal)(static_cast<NumVal *>(lhs_val.get())->int_m *
+                           static_cast<NumVal *>(rhs_val.get())->int_m);
     }
 
-    return lhs_m->interp(env)->mult_with(rhs_m->interp(env));
+    return lhs_val->mult_with(rhs_val);
 }
 
 /**
@@ -510,11 +905,12 @@ PTR(Val) Mult::interp(PTR(Env) env) {
  * \return True if a Multiplication object's lhs or rhs is a Variable object
  * (at any level), or false if there are none.
  *
- * Employed recursively, this method returns true if this Expression
- * (or any Expression nested within it) have a lhs or rhs of type Variable.
+ * Searching with an explicit stack (see tree_has_variable()), this method
+ * returns true if this Expression (or any Expression nested within it) have a
+ * lhs or rhs of type Variable.
  */
 bool Mult::has_variable() {
-    return lhs_m->has_variable() || rhs_m->has_variable();
+    return tree_has_variable(this);
 }
 
 /**
@@ -529,12 +925,29 @@ bool Mult::has_variable() {
  * Expression value where it occurs. The Variable class is responsible for
  * checking whether the string that is searched for is actually contained by
  * the Expression calling it. If it is, its value is re-assigned. If not, it
- * simply returns a copy of itself. This method is called recursively on both
- * the lhs and rhs values of a Multiplication object. The Variable in question
+ * simply returns a copy of itself. This method works with an explicit stack (see
+ * subst_tree()) on both the lhs and rhs values of a Multiplication object. The Variable in question
  * is replaced at all levels of nesting.
  */
 PTR(Expr) Mult::subst(std::string str, PTR(Expr) e) {
-    return NEW(Mult)(lhs_m->subst(str, e), rhs_m->subst(str, e));
+    return subst_tree(this, str, e);
+}
+
+/**
+ * \brief Infers the type of a Mult object
+ *
+ * \param tenv The types of the variables in scope
+ * \param ctx The current typecheck() pass
+ * \return Always an IntType, for objects of this type
+ *
+ * Both operands must be ints; once that is proven, interp() may multiply
+ * them without checking.
+ */
+PTR(Type) Mult::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    unify(lhs_m->infer(tenv, ctx), NEW(IntType)());
+    unify(rhs_m->infer(tenv, ctx), NEW(IntType)());
+    ctx.checked.push_back(this);
+    return NEW(IntType)();
 }
 
 /**
@@ -620,23 +1033,28 @@ Var::Var(std::string str) {
  * false if not, or if the two objects compared are not both of type Variable.
  *
  */
-bool Var::equals(PTR(Expr) e) {
-    PTR(Var) var_cmp = CAST(Var)(e);
+bool Var::equals(const PTR(Expr) &e) {
+    Var *var_cmp = dynamic_cast<Var *>(e.get());
     return var_cmp != nullptr && str_m == var_cmp->str_m;
 }
 
 /**
- * \brief This should not be called on a Variable object
+ * \brief Looks up this variable's value, forcing it if it is a ThunkVal
  *
- * \throws std::runtime_error You cannot call interp() on a Variable object
- * \return This function will never return
+ * \throws std::runtime_error If the variable is not bound
+ * \return The variable's value
  */
-PTR(Val) Var::interp(PTR(Env) env) {
-    if (env == nullptr) {
-        env = Env::empty;
-    }
+PTR(Val) Var::interp(const PTR(Env) &env) {
+    budget_step();
+    StatsFrame frame;
+
+    const PTR(Env) &scope = env != nullptr ? env : Env::empty;
 
-    return env->lookup(str_m);
+    PTR(Val) val = scope->lookup(str_m);
+    if (typeid(*val) == typeid(ThunkVal)) {
+        return static_cast<ThunkVal *>(val.get())->force();
+    }
+    return val;
 }
 
 /**
@@ -666,6 +1084,19 @@ PTR(Expr) Var::subst(std::string str, PTR(Expr) e) {
     return str == str_m ? e : NEW(Var)(str_m);
 }
 
+/**
+ * \brief Infers the type of a Var object
+ *
+ * \param tenv The types of the variables in scope
+ * \param ctx The current typecheck() pass
+ * \return A fresh instance of the variable's (possibly generic) type
+ *
+ * \throws std::runtime_error If the variable is not bound in tenv
+ */
+PTR(Type) Var::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    return tenv->lookup(str_m, ctx);
+}
+
 /**
  * \brief Writes a Variable object's string representation to an output stream
  *
@@ -695,6 +1126,16 @@ Let::Let(std::string lhs, PTR(Expr) rhs, PTR(Expr) body) {
     lhs_m = std::move(lhs);
     rhs_m = rhs;
     body_m = body;
+    size_m = 1 + rhs->size_m + body->size_m;
+}
+
+/**
+ * \brief Destroys this Let object, releasing its operands without
+ * recursing (see Expr::release())
+ */
+Let::~Let() {
+    release(rhs_m);
+    release(body_m);
 }
 
 /**
@@ -704,16 +1145,34 @@ Let::Let(std::string lhs, PTR(Expr) rhs, PTR(Expr) body) {
  * \return True if the Let objects represent equivalent values; false
  * if not, or if the two objects compared are not both of type Let.
  *
- * Calls equals() recursively on both lhs and rhs values of this object. All
- * calls to equals(), including on nested expressions, must return true each
- * time for a Let object to be considered equal to another Let object.
+ * Compares both lhs and rhs values of this object, at every level of nesting,
+ * with an explicit stack (see equal_trees()). Every comparison must return
+ * true each time for a Let object to be considered equal to another Let
+ * object.
  */
-bool Let::equals(PTR(Expr) e) {
-    PTR(Let) let_cmp = CAST(Let)(e);
-    return let_cmp != nullptr &&
-           lhs_m == (let_cmp->lhs_m) &&
-           rhs_m->equals(let_cmp->rhs_m) &&
-           body_m->equals(let_cmp->body_m);
+bool Let::equals(const PTR(Expr) &e) {
+    return equal_trees(this, e);
+}
+
+/**
+ * \brief The value to bind a _let rhs or a function argument to, which with
+ *        ThunkVal::enabled is a thunk unless it costs nothing to evaluate now
+ *
+ * A variable's value is shared as it is, forced or not; numbers, booleans,
+ * and _funs are evaluated.
+ */
+static PTR(Val) bind_value(const PTR(Expr) &e, const PTR(Env) &env) {
+    if (!ThunkVal::enabled) {
+        return e->interp(env);
+    }
+    if (auto *var = dynamic_cast<Var *>(e.get())) {
+        return env->lookup(var->str_m);
+    }
+    if (dynamic_cast<Num *>(e.get()) || dynamic_cast<Bool *>(e.get()) ||
+        dynamic_cast<Fun *>(e.get())) {
+        return e->interp(env);
+    }
+    return NEW(ThunkVal)(e, env);
 }
 
 /**
@@ -729,14 +1188,14 @@ bool Let::equals(PTR(Expr) e) {
  * Expressions) multiplied together. If Variables are encountered, an
  * exception is thrown (see: Var::interp()).
  */
-PTR(Val) Let::interp(PTR(Env) env) {
-    if (env == nullptr) {
-        env = Env::empty;
-    }
+PTR(Val) Let::interp(const PTR(Env) &env) {
+    budget_step();
+    StatsFrame frame;
+
+    const PTR(Env) &scope = env != nullptr ? env : Env::empty;
 
-    PTR(Val) rhs_val = rhs_m->interp(env);
-    PTR(Env) new_env = NEW(ExtendedEnv)(lhs_m, rhs_val, env);
-    return body_m->interp(new_env);
+    PTR(Val) rhs_val = bind_value(rhs_m, scope);
+    return body_m->interp(NEW(ExtendedEnv)(lhs_m, std::move(rhs_val), scope));
 }
 
 /**
@@ -745,11 +1204,12 @@ PTR(Val) Let::interp(PTR(Env) env) {
  * \return True if a Let object's rhs or body includes a Variable object
  * (at any level), or false if there are none.
  *
- * Employed recursively, this method returns true if this object (or any
- * Expression nested within it) have a lhs or rhs of type Variable.
+ * Searching with an explicit stack (see tree_has_variable()), this method
+ * returns true if this object (or any Expression nested within it) have a lhs
+ * or rhs of type Variable.
  */
 bool Let::has_variable() {
-    return rhs_m->has_variable() || body_m->has_variable();
+    return tree_has_variable(this);
 }
 
 /**
@@ -765,15 +1225,33 @@ bool Let::has_variable() {
  * user-inputted Expression value where it occurs. The Variable class is
  * responsible for checking whether the string that is searched for is
  * actually contained by the Expression calling it. If it is, its value is
- * re-assigned. If not, it simply returns a copy of itself. This method is
- * called recursively on both the rhs and body of a Let object. The Variable
+ * re-assigned. If not, it simply returns a copy of itself. This method works
+ * with an explicit stack (see subst_tree()) on both the rhs and body of a Let object. The Variable
  * in question is replaced at all levels of nesting. The Let object's lhs is
  * not targeted/replaced by this function.
  */
 PTR(Expr) Let::subst(std::string str, PTR(Expr) e) {
-    return lhs_m == str ?
-           NEW(Let)(lhs_m, rhs_m->subst(str, e), body_m) :
-           NEW(Let)(lhs_m, rhs_m->subst(str, e), body_m->subst(str, e));
+    return subst_tree(this, str, e);
+}
+
+/**
+ * \brief Infers the type of a Let object
+ *
+ * \param tenv The types of the variables in scope
+ * \param ctx The current typecheck() pass
+ * \return The type of this Let object's body
+ *
+ * The rhs is inferred one level deeper than the Let itself, so any type
+ * variables left unbound in it are generalized (let-polymorphism): the
+ * bound name may be used at a different type each time it occurs in the body.
+ */
+PTR(Type) Let::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    ctx.level++;
+    PTR(Type) rhs_type = rhs_m->infer(tenv, ctx);
+    ctx.level--;
+
+    return body_m->infer(NEW(ExtendedTypeEnv)(lhs_m, rhs_type, ctx.level, tenv),
+                         ctx);
 }
 
 /**
@@ -852,6 +1330,173 @@ void Let::pretty_print_at(std::ostream &stream, prec_t caller_prec,
     }
 }
 
+/**
+ * \brief Constructs a LetRec object representing a recursive binding
+ *
+ * \param lhs The function's name
+ * \param rhs The function, a Fun, in which lhs is bound to itself
+ * \param body An Expr object in which lhs is bound to the function
+ */
+LetRec::LetRec(std::string lhs, PTR(Expr) rhs, PTR(Expr) body) {
+    lhs_m = std::move(lhs);
+    rhs_m = rhs;
+    body_m = body;
+    size_m = 1 + rhs->size_m + body->size_m;
+}
+
+/**
+ * \brief Destroys this LetRec object, releasing its operands without
+ * recursing (see Expr::release())
+ */
+LetRec::~LetRec() {
+    release(rhs_m);
+    release(body_m);
+}
+
+/**
+ * \brief Compares two LetRec objects
+ *
+ * \param e The Expression to compare this object to
+ * \return True if e is a LetRec binding the same name to an equal function,
+ * with an equal body
+ */
+bool LetRec::equals(const PTR(Expr) &e) {
+    return equal_trees(this, e);
+}
+
+/**
+ * \brief Evaluates a LetRec object's body with its function bound
+ *
+ * \return The Val of the body
+ *
+ * Each recursive call extends the function's environment once, for its
+ * argument, with no extra FunVals or calls as with self-application.
+ */
+PTR(Val) LetRec::interp(const PTR(Env) &env) {
+    budget_step();
+    StatsFrame frame;
+
+    const PTR(Env) &scope = env != nullptr ? env : Env::empty;
+
+    return body_m->interp(bind(scope));
+}
+
+/**
+ * \brief Builds the environment a LetRec's body and function run in
+ *
+ * \param env The enclosing environment
+ * \return env extended with lhs_m bound to a FunVal whose environment is the
+ * returned environment itself
+ *
+ * The binding is created first and backpatched once the FunVal exists. That
+ * is a reference cycle, so the environment is registered with gc_candidate().
+ */
+PTR(Env) LetRec::bind(const PTR(Env) &env) {
+    PTR(ExtendedEnv) rec_env = NEW(ExtendedEnv)(lhs_m, nullptr, env);
+    rec_env->val = rhs_m->interp(rec_env);
+    gc_candidate(rec_env);
+    return rec_env;
+}
+
+/**
+ * \brief Evaluates whether a LetRec object includes a Variable as an operand
+ */
+bool LetRec::has_variable() {
+    return tree_has_variable(this);
+}
+
+/**
+ * \brief Replaces a free variable within a LetRec object with another Expr
+ *
+ * \param str The variable to replace
+ * \param e The Expression to replace it with
+ * \return A new LetRec object; if str is lhs_m, it is bound in both the rhs
+ * and the body, so this object is copied unchanged
+ */
+PTR(Expr) LetRec::subst(std::string str, PTR(Expr) e) {
+    return subst_tree(this, str, e);
+}
+
+/**
+ * \brief Infers the type of a LetRec object
+ *
+ * \param tenv The types of the variables in scope
+ * \param ctx The current typecheck() pass
+ * \return The type of this LetRec object's body
+ *
+ * Within its own definition the function has a single (monomorphic) type;
+ * in the body it is generalized, as with Let.
+ */
+PTR(Type) LetRec::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    ctx.level++;
+    PTR(Type) fun_type = ctx.fresh();
+    unify(fun_type, rhs_m->infer(
+            NEW(ExtendedTypeEnv)(lhs_m, fun_type, ctx.level, tenv), ctx));
+    ctx.level--;
+
+    return body_m->infer(NEW(ExtendedTypeEnv)(lhs_m, fun_type, ctx.level, tenv),
+                         ctx);
+}
+
+/**
+ * \brief Writes a LetRec's most basic string representation to an output
+ *        stream
+ *
+ * \param stream A reference to an output stream to write to
+ */
+void LetRec::print(std::ostream &stream) {
+    stream << "(_letrec " << lhs_m << "=";
+    rhs_m->print(stream);
+    stream << " _in ";
+    body_m->print(stream);
+    stream << ")";
+}
+
+/**
+ * \brief Driver method for pretty_print_at()
+ *
+ * \param stream A reference to an output stream to write to
+ */
+void LetRec::pretty_print(std::ostream &stream) {
+    prec_t driver_prec = NONE;
+    std::streampos driver_cursor_pos = 0;
+    bool driver_paren = false;
+
+    pretty_print_at(stream, driver_prec, driver_cursor_pos, driver_paren);
+}
+
+/**
+ * \brief Writes a LetRec's stylized string representation to an output stream
+ *
+ * Laid out like Let::pretty_print_at(), with "_in" padded to the width of
+ * "_letrec".
+ */
+void LetRec::pretty_print_at(std::ostream &stream, prec_t caller_prec,
+                             std::streampos &caller_pos, bool has_paren) {
+    bool close_paren = false;
+    if (caller_prec > NONE && !has_paren) {
+        stream << "(";
+        close_paren = true;
+    }
+
+    std::streampos start_pos = stream.tellp();
+    std::string kw_offset(start_pos - caller_pos, ' ');
+
+    stream << "_letrec " << lhs_m << " = ";
+
+    rhs_m->pretty_print_at(stream, NONE, caller_pos, has_paren);
+    stream << "\n";
+
+    caller_pos = stream.tellp();
+
+    stream << kw_offset << "_in     ";
+    body_m->pretty_print_at(stream, NONE, caller_pos, has_paren);
+
+    if (close_paren) {
+        stream << ")";
+    }
+}
+
 /**
  * \brief Constructs an If object representing a conditional operation
  *
@@ -863,6 +1508,17 @@ If::If(PTR(Expr) condition, PTR(Expr) first_branch, PTR(Expr) second_branch) {
     test_m = condition;
     then_m = first_branch;
     else_m = second_branch;
+    size_m = 1 + condition->size_m + first_branch->size_m + second_branch->size_m;
+}
+
+/**
+ * \brief Destroys this If object, releasing its operands without
+ * recursing (see Expr::release())
+ */
+If::~If() {
+    release(test_m);
+    release(then_m);
+    release(else_m);
 }
 
 /**
@@ -872,16 +1528,12 @@ If::If(PTR(Expr) condition, PTR(Expr) first_branch, PTR(Expr) second_branch) {
  * \return True if the two objects are both If objects and represent
  * equivalent operands
  *
- * Calls equals() recursively on all operands of this object. All
- * calls to equals(), including on nested expressions, must return true each
+ * Compares all operands of this object, at every level of nesting, with an
+ * explicit stack (see equal_trees()). Every comparison must return true each
  * time for this If object to be considered equal to another object.
  */
-bool If::equals(PTR(Expr) e) {
-    PTR(If) if_cmp = CAST(If)(e);
-    return if_cmp != nullptr &&
-           test_m->equals(if_cmp->test_m) &&
-           then_m->equals(if_cmp->then_m) &&
-           else_m->equals(if_cmp->else_m);
+bool If::equals(const PTR(Expr) &e) {
+    return equal_trees(this, e);
 }
 
 /**
@@ -893,8 +1545,17 @@ bool If::equals(PTR(Expr) e) {
  * The If object's condition operand is evaluated first. Based on the result of
  * this evaluation, either the then_m value is returned, or the else_m value.
  */
-PTR(Val) If::interp(PTR(Env) env) {
-    return test_m->interp()->is_true() ? then_m->interp() : else_m->interp();
+PTR(Val) If::interp(const PTR(Env) &env) {
+    budget_step();
+    StatsFrame frame;
+
+    const PTR(Env) &scope = env != nullptr ? env : Env::empty;
+
+    PTR(Val) test_val = test_m->interp(scope);
+    bool test_res = typed_m ? static_cast<BoolVal *>(test_val.get())->bool_m
+                            : test_val->is_true();
+
+    return test_res ? then_m->interp(scope) : else_m->interp(scope);
 }
 
 /**
@@ -903,13 +1564,12 @@ PTR(Val) If::interp(PTR(Env) env) {
  * \return True if any of an If object's operands include a Var object as an
  * operand.
  *
- * Employed recursively, this method returns true if this object (or any
- * Expression nested within it) have a lhs or rhs of type Variable.
+ * Searching with an explicit stack (see tree_has_variable()), this method
+ * returns true if this object (or any Expression nested within it) have a lhs
+ * or rhs of type Variable.
  */
 bool If::has_variable() {
-    return test_m->has_variable() ||
-           then_m->has_variable() ||
-           else_m->has_variable();
+    return tree_has_variable(this);
 }
 
 /**
@@ -922,14 +1582,29 @@ bool If::has_variable() {
  * If an If contains a user-inputted string, the string will be replaced where
  * it occurs with another user-inputted parameter. The Var class is responsible
  * for checking whether the string that is searched for is actually contained
- * by the Expression calling it. (See: Var::subst() ). This method is called
- * recursively on both the lhs and rhs values of an If object. The "variable"
+ * by the Expression calling it. (See: Var::subst() ). This method works
+ * with an explicit stack (see subst_tree()) on both the lhs and rhs values of an If object. The "variable"
  * in question is replaced at all levels of nesting.
  */
 PTR(Expr) If::subst(std::string str, PTR(Expr) e) {
-    return NEW(If)(test_m->subst(str, e),
-                   then_m->subst(str, e),
-                   else_m->subst(str, e));
+    return subst_tree(this, str, e);
+}
+
+/**
+ * \brief Infers the type of an If object
+ *
+ * \param tenv The types of the variables in scope
+ * \param ctx The current typecheck() pass
+ * \return The type shared by both branches
+ *
+ * The condition must be a bool, and both branches must have the same type.
+ */
+PTR(Type) If::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    unify(test_m->infer(tenv, ctx), NEW(BoolType)());
+    PTR(Type) then_type = then_m->infer(tenv, ctx);
+    unify(then_type, else_m->infer(tenv, ctx));
+    ctx.checked.push_back(this);
+    return then_type;
 }
 
 /**
@@ -1017,34 +1692,83 @@ void If::pretty_print_at(std::ostream &stream, prec_t caller_prec,
     }
 }
 
+/**
+ * \brief Writes a parameter or argument list, separated by ", "
+ */
+static void print_params(std::ostream &stream, const std::vector<std::string> &params) {
+    for (size_t i = 0; i < params.size(); i++) {
+        stream << (i > 0 ? ", " : "") << params[i];
+    }
+}
+
 Fun::Fun(std::string formal_arg, PTR(Expr) body) {
-    formal_arg_m = std::move(formal_arg);
+    formal_args_m.push_back(std::move(formal_arg));
     body_m = body;
+    size_m = 1 + body->size_m;
 }
 
-bool Fun::equals(PTR(Expr) e) {
-    PTR(Fun) fun_cmp = CAST(Fun)(e);
-    return fun_cmp != nullptr &&
-           formal_arg_m == fun_cmp->formal_arg_m &&
-           body_m->equals(fun_cmp->body_m);
+/**
+ * \brief Constructs a Fun object taking several arguments at once
+ *
+ * \param formal_args The parameter names, at least one
+ * \param body The function body
+ *
+ * Equivalent to nested one-argument Funs, but a call that supplies every
+ * argument binds them all in a single FrameEnv.
+ */
+Fun::Fun(std::vector<std::string> formal_args, PTR(Expr) body) {
+    formal_args_m = std::move(formal_args);
+    body_m = body;
+    size_m = 1 + body->size_m;
 }
 
-PTR(Val) Fun::interp(PTR(Env) env) {
-    return NEW(FunVal)(formal_arg_m, body_m, env);
+Fun::~Fun() {
+    release(body_m);
+}
+
+bool Fun::equals(const PTR(Expr) &e) {
+    return equal_trees(this, e);
+}
+
+PTR(Val) Fun::interp(const PTR(Env) &env) {
+    budget_step();
+    StatsFrame frame;
+
+    const PTR(Env) &scope = env != nullptr ? env : Env::empty;
+
+    return NEW(FunVal)(formal_args_m, body_m, scope);
 }
 
 bool Fun::has_variable() {
-    return body_m->has_variable();
+    return tree_has_variable(this);
 }
 
 PTR(Expr) Fun::subst(std::string str, PTR(Expr) e) {
-    return formal_arg_m == str ?
-           NEW(Fun)(formal_arg_m, body_m) :
-           NEW(Fun)(formal_arg_m, body_m->subst(str, e));
+    return subst_tree(this, str, e);
+}
+
+/**
+ * \brief Infers the type of a Fun object: curried, so "_fun (x, y) x + y" is
+ *        (int -> (int -> int))
+ */
+PTR(Type) Fun::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    std::vector<PTR(Type)> arg_types;
+    for (const std::string &formal_arg: formal_args_m) {
+        arg_types.push_back(ctx.fresh());
+        tenv = NEW(ExtendedTypeEnv)(formal_arg, arg_types.back(), ctx.level, tenv);
+    }
+
+    PTR(Type) type = body_m->infer(tenv, ctx);
+    for (size_t i = arg_types.size(); i-- > 0;) {
+        type = NEW(FunType)(arg_types[i], type);
+    }
+    return type;
 }
 
 void Fun::print(std::ostream &stream) {
-    stream << "(_fun (" << formal_arg_m << ") ";
+    stream << "(_fun (";
+    print_params(stream, formal_args_m);
+    stream << ") ";
     body_m->print(stream);
     stream << ")";
 }
@@ -1068,7 +1792,9 @@ void Fun::pretty_print_at(std::ostream &stream, prec_t caller_prec,
     std::streampos start_pos = stream.tellp();
     std::string kw_offset(start_pos - caller_pos, ' ');
 
-    stream << "_fun (" << formal_arg_m << ")";
+    stream << "_fun (";
+    print_params(stream, formal_args_m);
+    stream << ")";
     stream << "\n";
 
     caller_pos = stream.tellp();
@@ -1083,20 +1809,81 @@ void Fun::pretty_print_at(std::ostream &stream, prec_t caller_prec,
 
 Call::Call(PTR(Expr) to_be_called, PTR(Expr) actual_arg) {
     to_be_called_m = to_be_called;
-    actual_arg_m = actual_arg;
+    actual_args_m.push_back(actual_arg);
+    size_m = 1 + to_be_called->size_m + actual_arg->size_m;
 }
 
-bool Call::equals(PTR(Expr) e) {
-    PTR(Call) call_cmp = CAST(Call)(e);
-    return call_cmp != nullptr &&
-           to_be_called_m->equals(call_cmp->to_be_called_m) &&
-           actual_arg_m->equals(call_cmp->actual_arg_m);
+/**
+ * \brief Constructs a Call object passing several arguments at once
+ *
+ * \param to_be_called The function
+ * \param actual_args The arguments, at least one
+ *
+ * Equivalent to nested one-argument Calls, but when the function takes
+ * exactly this many arguments it is entered once, with one FrameEnv.
+ */
+Call::Call(PTR(Expr) to_be_called, std::vector<PTR(Expr)> actual_args) {
+    to_be_called_m = to_be_called;
+    actual_args_m = std::move(actual_args);
+    size_m = 1 + to_be_called->size_m;
+    for (const PTR(Expr) &actual_arg: actual_args_m) {
+        size_m += actual_arg->size_m;
+    }
 }
 
-PTR(Val) Call::interp(PTR(Env) env) {
-    PTR(Val) tbc_val = to_be_called_m->interp();
-    PTR(Val) arg_val = actual_arg_m->interp();
-    return tbc_val->call(arg_val);
+Call::~Call() {
+    release(to_be_called_m);
+    for (PTR(Expr) &actual_arg: actual_args_m) {
+        release(actual_arg);
+    }
+}
+
+bool Call::equals(const PTR(Expr) &e) {
+    return equal_trees(this, e);
+}
+
+PTR(Val) Call::interp(const PTR(Env) &env) {
+    budget_step();
+    StatsFrame frame;
+
+    const PTR(Env) &scope = env != nullptr ? env : Env::empty;
+
+    PTR(Val) tbc_val = to_be_called_m->interp(scope);
+
+    FunVal *fun = typeid(*tbc_val) == typeid(FunVal) ? static_cast<FunVal *>(tbc_val.get()) : nullptr;
+
+    /* Only _funs get thunks: primitives evaluate their arguments right away */
+    auto arg_val = [fun, &scope](const PTR(Expr) &actual_arg) {
+        return fun != nullptr ? bind_value(actual_arg, scope) : actual_arg->interp(scope);
+    };
+
+    size_t count = actual_args_m.size();
+    bool full = fun != nullptr && fun->formal_args_m.size() == count && count <= CACHE_MAX_ARGS;
+    if (full && fun->body_m.get() == cached_body_m.load(std::memory_order_relaxed)) {
+        eval_stats.call_cache_hits++;
+        PTR(Val) arg_vals[CACHE_MAX_ARGS];
+        for (size_t i = 0; i < count; i++) {
+            arg_vals[i] = arg_val(actual_args_m[i]);
+        }
+        return fun->enter(arg_vals, count);
+    }
+    eval_stats.call_cache_misses++;
+    if (full) {
+        cached_body_m.store(fun->body_m.get(), std::memory_order_relaxed);
+    }
+
+    /* The callee may be a FunVal or a PrimVal, whatever its type */
+    if (actual_args_m.size() == 1) {
+        return tbc_val->call(arg_val(actual_args_m[0]));
+    }
+
+    std::vector<PTR(Val)> arg_vals;
+    arg_vals.reserve(actual_args_m.size());
+    for (const PTR(Expr) &actual_arg: actual_args_m) {
+        arg_vals.push_back(arg_val(actual_arg));
+    }
+
+    return tbc_val->apply(arg_vals);
 }
 
 bool Call::has_variable() {
@@ -1104,13 +1891,33 @@ bool Call::has_variable() {
 }
 
 PTR(Expr) Call::subst(std::string str, PTR(Expr) e) {
-    return NEW(Call)(to_be_called_m->subst(str, e), actual_arg_m->subst(str, e));
+    return subst_tree(this, str, e);
+}
+
+PTR(Type) Call::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    PTR(Type) fun_type = to_be_called_m->infer(tenv, ctx);
+    for (const PTR(Expr) &actual_arg: actual_args_m) {
+        PTR(Type) arg_type = actual_arg->infer(tenv, ctx);
+        PTR(Type) result_type = ctx.fresh();
+        unify(fun_type, NEW(FunType)(arg_type, result_type));
+        fun_type = result_type;
+    }
+    return fun_type;
 }
 
 void Call::print(std::ostream &stream) {
     to_be_called_m->print(stream);
     stream << " ";
-    actual_arg_m->print(stream);
+    if (actual_args_m.size() == 1) {
+        actual_args_m[0]->print(stream);
+        return;
+    }
+    stream << "(";
+    for (size_t i = 0; i < actual_args_m.size(); i++) {
+        stream << (i > 0 ? ", " : "");
+        actual_args_m[i]->print(stream);
+    }
+    stream << ")";
 }
 
 void Call::pretty_print(std::ostream &stream) {
@@ -1125,6 +1932,9 @@ void Call::pretty_print_at(std::ostream &stream, prec_t caller_prec,
                            std::streampos &caller_pos, bool has_paren) {
     to_be_called_m->pretty_print_at(stream, NONE, caller_pos, has_paren);
     stream << '(';
-    actual_arg_m->pretty_print_at(stream, NONE, caller_pos, has_paren);
+    for (size_t i = 0; i < actual_args_m.size(); i++) {
+        stream << (i > 0 ? ", " : "");
+        actual_args_m[i]->pretty_print_at(stream, NONE, caller_pos, has_paren);
+    }
     stream << ')';
 }
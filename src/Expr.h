@@ -5,13 +5,19 @@
 
 #pragma once
 
+#include <atomic>       /* std::atomic (for Call's inline cache) */
 #include <sstream>      /* std::stringstream */
 #include <utility>      /* std::move (for Var constructor) */
+#include <vector>       /* std::vector (for Fun and Call) */
 
+#include "Integer.h"    /* Integer (for Num::int_m) */
 #include "pointers.h"   /* Macros for msdscript */
 
 class Val;              /* Val class for Expr::interp() */
 class Env;              /* Env class for Expr::interp() */
+class Type;             /* Type class for Expr::typecheck() */
+class TypeEnv;          /* TypeEnv class for Expr::infer() */
+struct TypeContext;     /* TypeContext struct for Expr::infer() */
 
 /**
  * \typedef prec_t
@@ -37,6 +43,12 @@ typedef enum {
 CLASS(Expr) {
 public:
 
+    bool typed_m = false; ///< Set by typecheck() once this node's operand
+                          ///< types are proven, enabling unchecked interp()
+
+    size_t size_m = 1;    ///< Number of nodes in this subtree, for
+                          ///< parallel_interp()'s fork threshold
+
     /*
      * Non-virtual methods
      */
@@ -67,12 +79,29 @@ public:
      */
     std::string to_pretty_string();
 
+    /**
+     * \brief Non-virtual: Infers the static type of an Expr object
+     *
+     * \param tenv The types of any free variables (none, by default)
+     * \return The inferred Type of this Expr object (e.g. "(int -> int)")
+     *
+     * Runs Hindley-Milner type inference over the whole tree by calling the
+     * infer() method of the Expr class. If every node is well-typed, each
+     * Add, Mult, and If node's typed_m flag is set so that interp() can skip
+     * the dynamic type checks in Val::add_to(), Val::mult_with(), and
+     * Val::is_true(). Nothing is marked if any node is ill-typed.
+     *
+     * \throws std::runtime_error If the expression is ill-typed or has a
+     *                            free variable
+     */
+    PTR(Type) typecheck(PTR(TypeEnv) tenv = nullptr);
+
     /*
      * Pure virtual methods
      */
-    virtual bool equals(PTR(Expr) e) = 0;
+    virtual bool equals(const PTR(Expr) &e) = 0;
 
-    virtual PTR(Val) interp(PTR(Env) env = nullptr) = 0;
+    virtual PTR(Val) interp(const PTR(Env) &env = nullptr) = 0;
 
     virtual bool has_variable() = 0;
 
@@ -80,6 +109,8 @@ public:
 
     virtual void print(std::ostream &stream) = 0;
 
+    virtual PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) = 0;
+
     /*
      * Regular virtual methods
      */
@@ -95,6 +126,22 @@ public:
                                  bool has_paren) {
         pretty_print(stream);
     }
+
+protected:
+
+    /**
+     * \brief Drops a reference to an operand without recursing
+     *
+     * \param operand The operand, which is left null if this was its last
+     *                reference
+     *
+     * Called by the destructors of nodes with operands. Freeing the last
+     * reference to an operand would run its destructor, and so on down the
+     * tree, one stack frame per level; instead, operands freed while a
+     * release() is running are queued, and the outermost release() destroys
+     * them one at a time.
+     */
+    static void release(PTR(Expr) &operand);
 };
 
 /**
@@ -105,18 +152,20 @@ class Num : public Expr {
 
 public:
 
-    int int_m; ///< The integer value of the Num object
+    Integer int_m; ///< The integer value of the Num object
 
-    explicit Num(int val);
+    explicit Num(Integer val);
 
-    bool equals(PTR(Expr) e) override;
+    bool equals(const PTR(Expr) &e) override;
 
-    PTR(Val) interp(PTR(Env) env = nullptr) override;
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
 
     bool has_variable() override;
 
     PTR(Expr) subst(std::string str, PTR(Expr) e) override;
 
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
 private:
 
     void print(std::ostream &stream) override;
@@ -134,14 +183,16 @@ public:
 
     explicit Bool(bool val);
 
-    bool equals(PTR(Expr) e) override;
+    bool equals(const PTR(Expr) &e) override;
 
-    PTR(Val) interp(PTR(Env) env = nullptr) override;
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
 
     bool has_variable() override;
 
     PTR(Expr) subst(std::string str, PTR(Expr) e) override;
 
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
 private:
 
     void print(std::ostream &stream) override;
@@ -165,14 +216,18 @@ public:
 
     Eq(PTR(Expr) lhs, PTR(Expr) rhs);
 
-    bool equals(PTR(Expr) e) override;
+    ~Eq() override;
 
-    PTR(Val) interp(PTR(Env) env = nullptr) override;
+    bool equals(const PTR(Expr) &e) override;
+
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
 
     bool has_variable() override;
 
     PTR(Expr) subst(std::string str, PTR(Expr) e) override;
 
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
 private:
 
     void print(std::ostream &stream) override;
@@ -205,14 +260,18 @@ public:
 
     Add(PTR(Expr) lhs, PTR(Expr) rhs);
 
-    bool equals(PTR(Expr) e) override;
+    ~Add() override;
+
+    bool equals(const PTR(Expr) &e) override;
 
-    PTR(Val) interp(PTR(Env) env = nullptr) override;
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
 
     bool has_variable() override;
 
     PTR(Expr) subst(std::string str, PTR(Expr) e) override;
 
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
 private:
 
     void print(std::ostream &stream) override;
@@ -245,14 +304,18 @@ public:
 
     Mult(PTR(Expr) lhs, PTR(Expr) rhs);
 
-    bool equals(PTR(Expr) e) override;
+    ~Mult() override;
+
+    bool equals(const PTR(Expr) &e) override;
 
-    PTR(Val) interp(PTR(Env) env = nullptr) override;
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
 
     bool has_variable() override;
 
     PTR(Expr) subst(std::string str, PTR(Expr) e) override;
 
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
 private:
 
     void print(std::ostream &stream) override;
@@ -282,14 +345,16 @@ public:
 
     explicit Var(std::string str);
 
-    bool equals(PTR(Expr) e) override;
+    bool equals(const PTR(Expr) &e) override;
 
-    PTR(Val) interp(PTR(Env) env = nullptr) override;
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
 
     bool has_variable() override;
 
     PTR(Expr) subst(std::string str, PTR(Expr) e) override;
 
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
 private:
 
     void print(std::ostream &stream) override;
@@ -316,14 +381,62 @@ public:
 
     Let(std::string lhs, PTR(Expr) rhs, PTR(Expr) body);
 
-    bool equals(PTR(Expr) e) override;
+    ~Let() override;
 
-    PTR(Val) interp(PTR(Env) env = nullptr) override;
+    bool equals(const PTR(Expr) &e) override;
+
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
 
     bool has_variable() override;
 
     PTR(Expr) subst(std::string str, PTR(Expr) e) override;
 
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
+private:
+
+    void print(std::ostream &stream) override;
+
+    void pretty_print(std::ostream &stream) override;
+
+    void pretty_print_at(std::ostream &stream,
+                         prec_t caller_prec,
+                         std::streampos &caller_pos,
+                         bool has_paren) override;
+};
+
+/**
+ * \class LetRec
+ * \brief An Expr derived class supporting recursive function binding
+ *
+ * Like Let, except that the variable is also in scope in its own definition,
+ * which must be a Fun: the closure's environment is the one it is bound in.
+ * Example: _letrec f = _fun (n) _if n == 0 _then 1 _else n * f(n + -1) _in f(5)
+ */
+class LetRec : public Expr {
+
+public:
+
+    std::string lhs_m;  ///< The LetRec object's function name
+    PTR(Expr) rhs_m;    ///< The function (a Fun)
+    PTR(Expr) body_m;   ///< The expression in which the function is bound
+
+    LetRec(std::string lhs, PTR(Expr) rhs, PTR(Expr) body);
+
+    ~LetRec() override;
+
+    bool equals(const PTR(Expr) &e) override;
+
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
+
+    PTR(Env) bind(const PTR(Env) &env);
+
+    bool has_variable() override;
+
+    PTR(Expr) subst(std::string str, PTR(Expr) e) override;
+
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
 private:
 
     void print(std::ostream &stream) override;
@@ -357,14 +470,18 @@ public:
     If(PTR(Expr) condition, PTR(Expr) first_branch,
        PTR(Expr) second_branch);
 
-    bool equals(PTR(Expr) e) override;
+    ~If() override;
 
-    PTR(Val) interp(PTR(Env) env = nullptr) override;
+    bool equals(const PTR(Expr) &e) override;
+
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
 
     bool has_variable() override;
 
     PTR(Expr) subst(std::string str, PTR(Expr) e) override;
 
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
 private:
 
     void print(std::ostream &stream) override;
@@ -381,20 +498,26 @@ class Fun : public Expr {
 
 public:
 
-    std::string formal_arg_m;
+    std::vector<std::string> formal_args_m; ///< One or more, in order
 
     PTR(Expr) body_m;
 
     Fun(std::string formal_arg, PTR(Expr) body);
 
-    bool equals(PTR(Expr) e) override;
+    Fun(std::vector<std::string> formal_args, PTR(Expr) body);
+
+    ~Fun() override;
+
+    bool equals(const PTR(Expr) &e) override;
 
-    PTR(Val) interp(PTR(Env) env = nullptr) override;
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
 
     bool has_variable() override;
 
     PTR(Expr) subst(std::string str, PTR(Expr) e) override;
 
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
 private:
 
     void print(std::ostream &stream) override;
@@ -413,18 +536,38 @@ public:
 
     PTR(Expr) to_be_called_m;
 
-    PTR(Expr) actual_arg_m;
+    std::vector<PTR(Expr)> actual_args_m; ///< One or more, in order
+
+    /// Most arguments a call site's inline cache handles
+    static const size_t CACHE_MAX_ARGS = 4;
+
+    /*
+     * Inline cache: the body of the last FunVal this call site applied in
+     * full. A FunVal with that body takes exactly as many parameters as
+     * there are arguments, so its arguments are evaluated into a frame on
+     * the stack and the function entered directly, without Val::call() or
+     * apply(), their arity checks, or a std::vector of arguments. Atomic
+     * because --parallel shares the tree between threads; a stale value only
+     * costs a miss.
+     */
+    std::atomic<const Expr *> cached_body_m{nullptr};
 
     Call(PTR(Expr) to_be_called, PTR(Expr) actual_arg);
 
-    bool equals(PTR(Expr) e) override;
+    Call(PTR(Expr) to_be_called, std::vector<PTR(Expr)> actual_args);
+
+    ~Call() override;
 
-    PTR(Val) interp(PTR(Env) env = nullptr) override;
+    bool equals(const PTR(Expr) &e) override;
+
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
 
     bool has_variable() override;
 
     PTR(Expr) subst(std::string str, PTR(Expr) e) override;
 
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
 private:
 
     void print(std::ostream &stream) override;
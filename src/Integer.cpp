@@ -0,0 +1,349 @@
+/**
+ * \file Integer.cpp
+ * \brief Integer slow-path (BigNum) definitions
+ */
+
+#include <algorithm>    /* std::reverse */
+#include <functional>   /* std::hash */
+#include <stdexcept>    /* std::runtime_error */
+
+#include "Integer.h"
+
+/*
+ * Magnitude helpers; magnitudes are little-endian base 2^32 with no
+ * leading (most significant) zero limbs.
+ */
+static void trim(std::vector<uint32_t> &mag) {
+    while (!mag.empty() && mag.back() == 0) {
+        mag.pop_back();
+    }
+}
+
+static int compare_mag(const std::vector<uint32_t> &a,
+                       const std::vector<uint32_t> &b) {
+    if (a.size() != b.size()) {
+        return a.size() < b.size() ? -1 : 1;
+    }
+    for (size_t i = a.size(); i-- > 0;) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static std::vector<uint32_t> add_mag(const std::vector<uint32_t> &a,
+                                     const std::vector<uint32_t> &b) {
+    std::vector<uint32_t> res;
+    uint64_t carry = 0;
+    for (size_t i = 0; i < a.size() || i < b.size() || carry; i++) {
+        uint64_t sum = carry;
+        sum += i < a.size() ? a[i] : 0;
+        sum += i < b.size() ? b[i] : 0;
+        res.push_back(static_cast<uint32_t>(sum));
+        carry = sum >> 32;
+    }
+    return res;
+}
+
+/* Requires |a| >= |b| */
+static std::vector<uint32_t> sub_mag(const std::vector<uint32_t> &a,
+                                     const std::vector<uint32_t> &b) {
+    std::vector<uint32_t> res(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        int64_t diff = static_cast<int64_t>(a[i]) - borrow -
+                       static_cast<int64_t>(i < b.size() ? b[i] : 0);
+        borrow = diff < 0 ? 1 : 0;
+        res[i] = static_cast<uint32_t>(diff + (borrow << 32));
+    }
+    trim(res);
+    return res;
+}
+
+static std::vector<uint32_t> mult_mag(const std::vector<uint32_t> &a,
+                                      const std::vector<uint32_t> &b) {
+    std::vector<uint32_t> res(a.size() + b.size(), 0);
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < b.size() || carry; j++) {
+            uint64_t cur = res[i + j] + carry +
+                           (j < b.size() ? static_cast<uint64_t>(a[i]) * b[j] : 0);
+            res[i + j] = static_cast<uint32_t>(cur);
+            carry = cur >> 32;
+        }
+    }
+    trim(res);
+    return res;
+}
+
+/* mag = mag * mul + add, for small mul and add */
+static void mult_add_small(std::vector<uint32_t> &mag, uint32_t mul,
+                           uint32_t add) {
+    uint64_t carry = add;
+    for (uint32_t &limb: mag) {
+        uint64_t cur = static_cast<uint64_t>(limb) * mul + carry;
+        limb = static_cast<uint32_t>(cur);
+        carry = cur >> 32;
+    }
+    if (carry) {
+        mag.push_back(static_cast<uint32_t>(carry));
+    }
+}
+
+/* mag = mag / div, returning the remainder */
+static uint32_t div_small(std::vector<uint32_t> &mag, uint32_t div) {
+    uint64_t rem = 0;
+    for (size_t i = mag.size(); i-- > 0;) {
+        uint64_t cur = (rem << 32) | mag[i];
+        mag[i] = static_cast<uint32_t>(cur / div);
+        rem = cur % div;
+    }
+    trim(mag);
+    return static_cast<uint32_t>(rem);
+}
+
+/* mag = mag * 2 + bit */
+static void shift_in_bit(std::vector<uint32_t> &mag, uint32_t bit) {
+    for (uint32_t &limb: mag) {
+        uint32_t top = limb >> 31;
+        limb = (limb << 1) | bit;
+        bit = top;
+    }
+    if (bit) {
+        mag.push_back(bit);
+    }
+}
+
+/* a = a / b, returning the remainder; requires non-empty b. Shift-and-subtract,
+ * one bit of a at a time: slow, but only reached past 64 bits */
+static std::vector<uint32_t> div_mag(std::vector<uint32_t> &a,
+                                     const std::vector<uint32_t> &b) {
+    if (b.size() == 1) {
+        uint32_t rem = div_small(a, b[0]);
+        return rem != 0 ? std::vector<uint32_t>{rem} : std::vector<uint32_t>();
+    }
+
+    std::vector<uint32_t> quot(a.size(), 0);
+    std::vector<uint32_t> rem;
+    for (size_t i = a.size() * 32; i-- > 0;) {
+        shift_in_bit(rem, (a[i / 32] >> (i % 32)) & 1);
+        if (compare_mag(rem, b) >= 0) {
+            rem = sub_mag(rem, b);
+            quot[i / 32] |= uint32_t(1) << (i % 32);
+        }
+    }
+    trim(quot);
+    a = std::move(quot);
+    return rem;
+}
+
+/**
+ * \brief Constructs an Integer from a BigNum, demoting it if it fits in an
+ *        int64_t
+ *
+ * \param big The value to store
+ */
+Integer::Integer(BigNum &&big) : small_m(0), big_m(nullptr) {
+    trim(big.limbs);
+
+    if (big.limbs.size() <= 2) {
+        uint64_t mag = 0;
+        for (size_t i = big.limbs.size(); i-- > 0;) {
+            mag = (mag << 32) | big.limbs[i];
+        }
+        if (!big.negative && mag <= static_cast<uint64_t>(INT64_MAX)) {
+            small_m = static_cast<int64_t>(mag);
+            return;
+        }
+        if (big.negative && mag <= static_cast<uint64_t>(INT64_MAX) + 1) {
+            small_m = static_cast<int64_t>(0 - mag);
+            return;
+        }
+    }
+
+    big_m = new Shared();
+    big_m->num = std::move(big);
+}
+
+/**
+ * \brief Converts this Integer to sign-magnitude form
+ *
+ * \return A BigNum with the same value as this Integer
+ */
+BigNum Integer::to_big() const {
+    if (!is_small()) {
+        return big_m->num;
+    }
+
+    BigNum big;
+    big.negative = small_m < 0;
+    uint64_t mag = big.negative ? 0 - static_cast<uint64_t>(small_m)
+                                : static_cast<uint64_t>(small_m);
+    while (mag != 0) {
+        big.limbs.push_back(static_cast<uint32_t>(mag));
+        mag >>= 32;
+    }
+    return big;
+}
+
+/**
+ * \brief Builds an Integer from a string of decimal digits
+ *
+ * \param digits The digits to convert; must be non-empty and contain only
+ *               '0' through '9'
+ * \return A non-negative Integer
+ *
+ * \throws std::runtime_error On an empty string or a non-digit character
+ */
+Integer Integer::parse(const std::string &digits) {
+    if (digits.empty()) {
+        throw std::runtime_error("Integer::parse(): no digits");
+    }
+
+    std::vector<uint32_t> mag;
+    for (char c: digits) {
+        if (c < '0' || c > '9') {
+            throw std::runtime_error("Integer::parse(): invalid digit");
+        }
+        mult_add_small(mag, 10, static_cast<uint32_t>(c - '0'));
+    }
+
+    BigNum big;
+    big.limbs = std::move(mag);
+    return Integer(std::move(big));
+}
+
+/**
+ * \brief Converts this Integer to its decimal string representation
+ *
+ * \return A string such as "-123"
+ */
+std::string Integer::to_string() const {
+    if (is_small()) {
+        return std::to_string(small_m);
+    }
+
+    std::vector<uint32_t> mag = big_m->num.limbs;
+    std::string res;
+    while (!mag.empty()) {
+        uint32_t chunk = div_small(mag, 1000000000);
+        for (int i = 0; i < 9 && (chunk != 0 || !mag.empty()); i++) {
+            res += static_cast<char>('0' + chunk % 10);
+            chunk /= 10;
+        }
+    }
+    if (big_m->num.negative) {
+        res += '-';
+    }
+    std::reverse(res.begin(), res.end());
+    return res;
+}
+
+/**
+ * \brief Hashes this Integer; equal Integers have equal hashes, since each
+ *        value has only one representation
+ */
+size_t Integer::hash() const {
+    if (is_small()) {
+        return std::hash<int64_t>()(small_m);
+    }
+
+    size_t h = big_m->num.negative;
+    for (uint32_t limb: big_m->num.limbs) {
+        h = h * 31 + limb;
+    }
+    return h;
+}
+
+/**
+ * \brief Negates this Integer
+ *
+ * \return An Integer with the opposite sign
+ */
+Integer Integer::operator-() const {
+    if (is_small() && small_m != INT64_MIN) {
+        return Integer(-small_m);
+    }
+
+    BigNum big = to_big();
+    big.negative = !big.negative;
+    return Integer(std::move(big));
+}
+
+/**
+ * \brief Adds two Integers when either is a BigNum or the sum overflows
+ */
+Integer Integer::add_slow(const Integer &lhs, const Integer &rhs) {
+    BigNum a = lhs.to_big();
+    BigNum b = rhs.to_big();
+
+    BigNum res;
+    if (a.negative == b.negative) {
+        res.negative = a.negative;
+        res.limbs = add_mag(a.limbs, b.limbs);
+    } else if (compare_mag(a.limbs, b.limbs) >= 0) {
+        res.negative = a.negative;
+        res.limbs = sub_mag(a.limbs, b.limbs);
+    } else {
+        res.negative = b.negative;
+        res.limbs = sub_mag(b.limbs, a.limbs);
+    }
+    return Integer(std::move(res));
+}
+
+/**
+ * \brief Multiplies two Integers when either is a BigNum or the product
+ *        overflows
+ */
+Integer Integer::mult_slow(const Integer &lhs, const Integer &rhs) {
+    BigNum a = lhs.to_big();
+    BigNum b = rhs.to_big();
+
+    BigNum res;
+    res.negative = a.negative != b.negative;
+    res.limbs = mult_mag(a.limbs, b.limbs);
+    return Integer(std::move(res));
+}
+
+/**
+ * \brief Divides two Integers when either is a BigNum, rhs is zero, or the
+ *        quotient overflows (INT64_MIN / -1)
+ *
+ * \param remainder Whether to return the remainder instead of the quotient
+ *
+ * \throws std::runtime_error If rhs is zero
+ */
+Integer Integer::div_slow(const Integer &lhs, const Integer &rhs, bool remainder) {
+    if (rhs.is_small() && rhs.small_m == 0) {
+        throw std::runtime_error("division by zero");
+    }
+
+    BigNum a = lhs.to_big();
+    BigNum b = rhs.to_big();
+
+    BigNum res;
+    std::vector<uint32_t> rem = div_mag(a.limbs, b.limbs);
+    if (remainder) {
+        res.negative = a.negative;
+        res.limbs = std::move(rem);
+    } else {
+        res.negative = a.negative != b.negative;
+        res.limbs = std::move(a.limbs);
+    }
+    return Integer(std::move(res));
+}
+
+/**
+ * \brief Orders two Integers when either is a BigNum
+ */
+bool Integer::less_slow(const Integer &lhs, const Integer &rhs) {
+    BigNum a = lhs.to_big();
+    BigNum b = rhs.to_big();
+
+    if (a.negative != b.negative) {
+        return a.negative;
+    }
+    int cmp = compare_mag(a.limbs, b.limbs);
+    return a.negative ? cmp > 0 : cmp < 0;
+}
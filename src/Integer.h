@@ -0,0 +1,226 @@
+/**
+ * \file Integer.h
+ * \brief Declarations for Integer, msdscript's arbitrary-precision integer
+ */
+
+#pragma once
+
+#include <atomic>       /* std::atomic (for Integer::Shared::refs) */
+#include <cstddef>      /* size_t */
+#include <cstdint>      /* int64_t, uint32_t */
+#include <string>
+#include <vector>       /* std::vector (for BigNum::limbs) */
+
+/**
+ * \struct BigNum
+ * \brief Sign-magnitude storage for Integers that do not fit in 64 bits
+ */
+struct BigNum {
+    bool negative = false;          ///< Sign of the value
+    std::vector<uint32_t> limbs;    ///< Magnitude, base 2^32, least
+                                    ///< significant limb first
+};
+
+/**
+ * \class Integer
+ * \brief An integer value that is stored inline while it fits in an int64_t,
+ *        and is promoted to a heap-allocated BigNum when it does not
+ *
+ * Arithmetic on two small Integers is a single machine operation plus an
+ * overflow check (__builtin_*_overflow); only when that check fails does the
+ * slow path build a BigNum. Results are always demoted back to the inline
+ * representation when they fit, so there is exactly one representation for
+ * every value and equality can compare fields directly.
+ */
+class Integer {
+
+public:
+
+    Integer(int64_t val = 0); // NOLINT( google-explicit-constructor )
+
+    Integer(const Integer &other);
+
+    Integer(Integer &&other) noexcept;
+
+    Integer &operator=(Integer other) noexcept;
+
+    ~Integer();
+
+    static Integer parse(const std::string &digits);
+
+    bool is_small() const {
+        return big_m == nullptr;
+    }
+
+    int64_t small() const {
+        return small_m;
+    }
+
+    std::string to_string() const;
+
+    size_t hash() const;
+
+    Integer operator-() const;
+
+    friend Integer operator+(const Integer &lhs, const Integer &rhs);
+
+    friend Integer operator-(const Integer &lhs, const Integer &rhs);
+
+    friend Integer operator*(const Integer &lhs, const Integer &rhs);
+
+    friend Integer operator/(const Integer &lhs, const Integer &rhs);
+
+    friend Integer operator%(const Integer &lhs, const Integer &rhs);
+
+    friend bool operator==(const Integer &lhs, const Integer &rhs);
+
+    friend bool operator!=(const Integer &lhs, const Integer &rhs) {
+        return !(lhs == rhs);
+    }
+
+    friend bool operator<(const Integer &lhs, const Integer &rhs);
+
+    friend bool operator<=(const Integer &lhs, const Integer &rhs) {
+        return !(rhs < lhs);
+    }
+
+private:
+
+    struct Shared {
+        BigNum num;
+        std::atomic<int> refs{1};   ///< Number of Integers sharing num
+    };
+
+    int64_t small_m;    ///< The value, while is_small()
+    Shared *big_m;      ///< The value, otherwise
+
+    explicit Integer(BigNum &&big);
+
+    BigNum to_big() const;
+
+    static Integer add_slow(const Integer &lhs, const Integer &rhs);
+
+    static Integer mult_slow(const Integer &lhs, const Integer &rhs);
+
+    static Integer div_slow(const Integer &lhs, const Integer &rhs, bool remainder);
+
+    static bool less_slow(const Integer &lhs, const Integer &rhs);
+};
+
+/*
+ * Copying and destroying a small Integer only tests big_m; the refcount is
+ * touched only for BigNums, so the common path stays branch-cheap and never
+ * allocates.
+ */
+inline Integer::Integer(int64_t val) : small_m(val), big_m(nullptr) {
+}
+
+inline Integer::Integer(const Integer &other)
+        : small_m(other.small_m), big_m(other.big_m) {
+    if (big_m != nullptr) {
+        big_m->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+inline Integer::Integer(Integer &&other) noexcept
+        : small_m(other.small_m), big_m(other.big_m) {
+    other.big_m = nullptr;
+}
+
+inline Integer &Integer::operator=(Integer other) noexcept {
+    small_m = other.small_m;
+    Shared *old = big_m;
+    big_m = other.big_m;
+    other.big_m = old;
+    return *this;
+}
+
+inline Integer::~Integer() {
+    if (big_m != nullptr &&
+        big_m->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete big_m;
+    }
+}
+
+/**
+ * \brief Adds two Integers, promoting to a BigNum only on overflow
+ */
+inline Integer operator+(const Integer &lhs, const Integer &rhs) {
+    int64_t res;
+    if (__builtin_expect(lhs.is_small() && rhs.is_small() &&
+                         !__builtin_add_overflow(lhs.small_m, rhs.small_m, &res), 1)) {
+        return Integer(res);
+    }
+    return Integer::add_slow(lhs, rhs);
+}
+
+/**
+ * \brief Subtracts two Integers, promoting to a BigNum only on overflow
+ */
+inline Integer operator-(const Integer &lhs, const Integer &rhs) {
+    int64_t res;
+    if (__builtin_expect(lhs.is_small() && rhs.is_small() &&
+                         !__builtin_sub_overflow(lhs.small_m, rhs.small_m, &res), 1)) {
+        return Integer(res);
+    }
+    return Integer::add_slow(lhs, -rhs);
+}
+
+/**
+ * \brief Multiplies two Integers, promoting to a BigNum only on overflow
+ */
+inline Integer operator*(const Integer &lhs, const Integer &rhs) {
+    int64_t res;
+    if (__builtin_expect(lhs.is_small() && rhs.is_small() &&
+                         !__builtin_mul_overflow(lhs.small_m, rhs.small_m, &res), 1)) {
+        return Integer(res);
+    }
+    return Integer::mult_slow(lhs, rhs);
+}
+
+/**
+ * \brief Compares two Integers for equality
+ */
+inline bool operator==(const Integer &lhs, const Integer &rhs) {
+    if (lhs.is_small() || rhs.is_small()) {
+        return lhs.is_small() && rhs.is_small() && lhs.small_m == rhs.small_m;
+    }
+    return lhs.big_m->num.negative == rhs.big_m->num.negative &&
+           lhs.big_m->num.limbs == rhs.big_m->num.limbs;
+}
+
+/**
+ * \brief Divides two Integers, rounding toward zero (as C++ does)
+ *
+ * \throws std::runtime_error If rhs is zero
+ */
+inline Integer operator/(const Integer &lhs, const Integer &rhs) {
+    if (__builtin_expect(lhs.is_small() && rhs.is_small() && rhs.small_m != 0 &&
+                         !(lhs.small_m == INT64_MIN && rhs.small_m == -1), 1)) {
+        return Integer(lhs.small_m / rhs.small_m);
+    }
+    return Integer::div_slow(lhs, rhs, false);
+}
+
+/**
+ * \brief The remainder of lhs / rhs, which has the sign of lhs
+ *
+ * \throws std::runtime_error If rhs is zero
+ */
+inline Integer operator%(const Integer &lhs, const Integer &rhs) {
+    if (__builtin_expect(lhs.is_small() && rhs.is_small() && rhs.small_m != 0 &&
+                         !(lhs.small_m == INT64_MIN && rhs.small_m == -1), 1)) {
+        return Integer(lhs.small_m % rhs.small_m);
+    }
+    return Integer::div_slow(lhs, rhs, true);
+}
+
+/**
+ * \brief Orders two Integers
+ */
+inline bool operator<(const Integer &lhs, const Integer &rhs) {
+    if (lhs.is_small() && rhs.is_small()) {
+        return lhs.small_m < rhs.small_m;
+    }
+    return Integer::less_slow(lhs, rhs);
+}
@@ -0,0 +1,56 @@
+/**
+ * \file ThreadPool.cpp
+ * \brief ThreadPool definitions
+ */
+
+#include <algorithm>    /* std::max */
+
+#include "ThreadPool.h"
+
+/**
+ * \brief Starts the worker threads
+ *
+ * \param threads The number of workers; 0 means one per hardware thread
+ */
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        workers_m.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+/**
+ * \brief Finishes every queued task, then joins the worker threads
+ */
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_m);
+        stopping_m = true;
+    }
+    ready_m.notify_all();
+    for (std::thread &worker: workers_m) {
+        worker.join();
+    }
+}
+
+/**
+ * \brief A worker thread's loop: runs tasks until the pool is stopping and
+ *        the queue is empty
+ */
+void ThreadPool::work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_m);
+            ready_m.wait(lock, [this]() { return stopping_m || !tasks_m.empty(); });
+            if (tasks_m.empty()) {
+                return;
+            }
+            task = std::move(tasks_m.front());
+            tasks_m.pop_front();
+        }
+        task();
+    }
+}
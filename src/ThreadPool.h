@@ -0,0 +1,72 @@
+/**
+ * \file ThreadPool.h
+ * \brief Declarations for ThreadPool, a fixed set of worker threads
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * \class ThreadPool
+ * \brief Runs submitted tasks on a fixed number of worker threads, in
+ *        submission order
+ *
+ * Destroying the pool finishes every task already submitted, then joins the
+ * workers.
+ */
+class ThreadPool {
+
+public:
+
+    explicit ThreadPool(size_t threads = 0);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const {
+        return workers_m.size();
+    }
+
+    template<typename F>
+    auto submit(F task) -> std::future<decltype(task())>;
+
+private:
+
+    std::vector<std::thread> workers_m;         ///< The worker threads
+    std::deque<std::function<void()>> tasks_m;  ///< Tasks not yet started
+    std::mutex mutex_m;                         ///< Guards tasks_m, stopping_m
+    std::condition_variable ready_m;            ///< Signals a task or stop
+    bool stopping_m = false;                    ///< Set by the destructor
+
+    void work();
+};
+
+/**
+ * \brief Queues a task to be run by a worker thread
+ *
+ * \param task A callable taking no arguments
+ * \return A future for task's result; it rethrows anything task throws
+ */
+template<typename F>
+auto ThreadPool::submit(F task) -> std::future<decltype(task())> {
+    // std::function requires a copyable target, so the packaged_task is shared
+    auto packaged = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+    std::future<decltype(task())> res = packaged->get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_m);
+        tasks_m.emplace_back([packaged]() { (*packaged)(); });
+    }
+    ready_m.notify_one();
+    return res;
+}
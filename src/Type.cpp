@@ -0,0 +1,271 @@
+/**
+ * \file Type.cpp
+ * \brief Type base class and derived class definitions, plus unify()
+ */
+
+#include <sstream>      /* std::stringstream */
+
+#include "Type.h"
+#include "Val.h"          /* Prim (for EmptyTypeEnv::lookup()) */
+
+thread_local PTR(TypeEnv) TypeEnv::empty = NEW(EmptyTypeEnv)();
+
+/**
+ * \brief Types a primitive: int -> int -> int, or -> bool for comparisons
+ *
+ * \throws std::runtime_error If no primitive has this name
+ */
+PTR(Type) EmptyTypeEnv::lookup(const std::string &find_name, TypeContext &ctx) {
+    const Prim *prim = Prim::find(find_name);
+    if (prim == nullptr) {
+        throw std::runtime_error("typecheck(): unbound variable " + find_name);
+    }
+
+    PTR(Type) type = prim->predicate ? PTR(Type)(NEW(BoolType)()) : PTR(Type)(NEW(IntType)());
+    for (size_t i = 0; i < prim->arity; i++) {
+        type = NEW(FunType)(NEW(IntType)(), type);
+    }
+    return type;
+}
+
+/**
+ * \brief Non-virtual: Converts a Type object to a basic, easily-readable
+ * string
+ *
+ * \return An std::string object representing the Type (e.g. "(int -> bool)")
+ */
+std::string Type::to_string() {
+    std::stringstream stream("");
+    resolve()->print(stream);
+    return stream.str();
+}
+
+/**
+ * \brief Ints contain no type variables
+ *
+ * \return Always false, for objects of this type
+ */
+bool IntType::occurs(TypeVar *var) {
+    return false;
+}
+
+/**
+ * \brief Ints contain no type variables, so there is nothing to adjust
+ */
+void IntType::adjust_level(int level) {
+}
+
+/**
+ * \brief Ints are never generic
+ *
+ * \return This object
+ */
+PTR(Type) IntType::instantiate(int level, TypeContext &ctx,
+                               std::map<TypeVar *, PTR(Type)> &fresh) {
+    return THIS;
+}
+
+void IntType::print(std::ostream &stream) {
+    stream << "int";
+}
+
+/**
+ * \brief Bools contain no type variables
+ *
+ * \return Always false, for objects of this type
+ */
+bool BoolType::occurs(TypeVar *var) {
+    return false;
+}
+
+/**
+ * \brief Bools contain no type variables, so there is nothing to adjust
+ */
+void BoolType::adjust_level(int level) {
+}
+
+/**
+ * \brief Bools are never generic
+ *
+ * \return This object
+ */
+PTR(Type) BoolType::instantiate(int level, TypeContext &ctx,
+                                std::map<TypeVar *, PTR(Type)> &fresh) {
+    return THIS;
+}
+
+void BoolType::print(std::ostream &stream) {
+    stream << "bool";
+}
+
+/**
+ * \brief Constructs a FunType object representing "arg -> result"
+ *
+ * \param arg The type of the formal argument
+ * \param result The type of the function body
+ */
+FunType::FunType(PTR(Type) arg, PTR(Type) result) {
+    arg_m = arg;
+    result_m = result;
+}
+
+/**
+ * \brief Checks whether a type variable appears in either half of this type
+ *
+ * \param var The (resolved) type variable to look for
+ * \return True if var appears in the argument or result type
+ */
+bool FunType::occurs(TypeVar *var) {
+    return arg_m->resolve()->occurs(var) || result_m->resolve()->occurs(var);
+}
+
+/**
+ * \brief Lowers the level of every type variable in this type
+ *
+ * \param level The level of the type variable this type is being bound to
+ */
+void FunType::adjust_level(int level) {
+    arg_m->resolve()->adjust_level(level);
+    result_m->resolve()->adjust_level(level);
+}
+
+/**
+ * \brief Copies this type, replacing generic type variables with fresh ones
+ *
+ * \param level Type variables deeper than this level are generic
+ * \param ctx The current typecheck() pass
+ * \param fresh Generic variables already replaced during this copy
+ * \return A new FunType
+ */
+PTR(Type) FunType::instantiate(int level, TypeContext &ctx,
+                               std::map<TypeVar *, PTR(Type)> &fresh) {
+    return NEW(FunType)(arg_m->resolve()->instantiate(level, ctx, fresh),
+                        result_m->resolve()->instantiate(level, ctx, fresh));
+}
+
+void FunType::print(std::ostream &stream) {
+    stream << "(";
+    arg_m->resolve()->print(stream);
+    stream << " -> ";
+    result_m->resolve()->print(stream);
+    stream << ")";
+}
+
+/**
+ * \brief Constructs an unbound TypeVar object
+ *
+ * \param id Number used when printing
+ * \param level Let-nesting depth the variable is created at
+ */
+TypeVar::TypeVar(int id, int level) {
+    id_m = id;
+    level_m = level;
+}
+
+/**
+ * \brief Follows link_m to the type this variable stands for
+ *
+ * \return The type this variable was unified with, or this object if unbound
+ */
+PTR(Type) TypeVar::resolve() {
+    if (link_m == nullptr) {
+        return THIS;
+    }
+    link_m = link_m->resolve(); // path compression
+    return link_m;
+}
+
+bool TypeVar::occurs(TypeVar *var) {
+    return this == var;
+}
+
+void TypeVar::adjust_level(int level) {
+    if (level < level_m) {
+        level_m = level;
+    }
+}
+
+PTR(Type) TypeVar::instantiate(int level, TypeContext &ctx,
+                               std::map<TypeVar *, PTR(Type)> &fresh) {
+    if (level_m <= level) {
+        return THIS;
+    }
+
+    auto it = fresh.find(this);
+    if (it != fresh.end()) {
+        return it->second;
+    }
+
+    PTR(Type) var = ctx.fresh();
+    fresh[this] = var;
+    return var;
+}
+
+/**
+ * \brief Writes this type variable as a letter (e.g. 'a, 'b, ..., 'a1)
+ */
+void TypeVar::print(std::ostream &stream) {
+    stream << '\'' << static_cast<char>('a' + id_m % 26);
+    if (id_m >= 26) {
+        stream << id_m / 26;
+    }
+}
+
+/**
+ * \brief Creates a new, unbound type variable at the current level
+ *
+ * \return A new TypeVar object
+ */
+PTR(Type) TypeContext::fresh() {
+    return NEW(TypeVar)(next_id++, level);
+}
+
+/**
+ * \brief Makes two types equal by binding type variables in either one
+ *
+ * \param t1 The first type
+ * \param t2 The second type
+ *
+ * \throws std::runtime_error If the types cannot be made equal, or if doing
+ *                            so would create an infinite type
+ */
+void unify(PTR(Type) t1, PTR(Type) t2) {
+    t1 = t1->resolve();
+    t2 = t2->resolve();
+
+    if (t1 == t2) {
+        return;
+    }
+
+    PTR(TypeVar) var = CAST(TypeVar)(t1);
+    PTR(Type) other = t2;
+    if (var == nullptr) {
+        var = CAST(TypeVar)(t2);
+        other = t1;
+    }
+
+    if (var != nullptr) {
+        if (other->occurs(&*var)) {
+            throw std::runtime_error("typecheck(): infinite type");
+        }
+        other->adjust_level(var->level_m);
+        var->link_m = other;
+        return;
+    }
+
+    PTR(FunType) fun1 = CAST(FunType)(t1);
+    PTR(FunType) fun2 = CAST(FunType)(t2);
+    if (fun1 != nullptr && fun2 != nullptr) {
+        unify(fun1->arg_m, fun2->arg_m);
+        unify(fun1->result_m, fun2->result_m);
+        return;
+    }
+
+    if ((CAST(IntType)(t1) != nullptr && CAST(IntType)(t2) != nullptr) ||
+        (CAST(BoolType)(t1) != nullptr && CAST(BoolType)(t2) != nullptr)) {
+        return;
+    }
+
+    throw std::runtime_error("typecheck(): type mismatch between " +
+                             t1->to_string() + " and " + t2->to_string());
+}
@@ -0,0 +1,211 @@
+/**
+ * \file Type.h
+ * \brief Type base class, derived class, and TypeEnv declarations
+ */
+
+#pragma once
+
+#include <map>          /* std::map (for Type::instantiate()) */
+#include <stdexcept>    /* std::runtime_error */
+#include <string>
+#include <utility>      /* std::move (for ExtendedTypeEnv constructor) */
+#include <vector>       /* std::vector (for TypeContext) */
+
+#include "pointers.h"
+
+class Expr;             /* Expr class for TypeContext */
+class TypeVar;          /* TypeVar class for Type::occurs() */
+struct TypeContext;     /* TypeContext struct for Type::instantiate() */
+
+/**
+ * \class Type
+ * \brief An abstract, base class representing the static type of an Expr
+ *
+ * Types are inferred Hindley-Milner style by Expr::typecheck(): every
+ * expression is either an int, a bool, a function from one type to another,
+ * or a type variable standing in for a type that is not yet known. Type
+ * variables are bound destructively by unify().
+ */
+CLASS(Type) {
+
+public:
+
+    /*
+     * Non-virtual methods
+     */
+    std::string to_string();
+
+    /*
+     * Pure virtual methods
+     */
+    virtual bool occurs(TypeVar *var) = 0;
+
+    virtual void adjust_level(int level) = 0;
+
+    virtual PTR(Type) instantiate(int level, TypeContext &ctx,
+                                  std::map<TypeVar *, PTR(Type)> &fresh) = 0;
+
+    virtual void print(std::ostream &stream) = 0;
+
+    /*
+     * Regular virtual methods
+     */
+    virtual ~Type() = default;
+
+    virtual PTR(Type) resolve() {
+        return THIS;
+    }
+};
+
+/**
+ * \class IntType
+ * \brief A Type derived class representing the type of NumVal results
+ */
+class IntType : public Type {
+
+public:
+
+    bool occurs(TypeVar *var) override;
+
+    void adjust_level(int level) override;
+
+    PTR(Type) instantiate(int level, TypeContext &ctx,
+                          std::map<TypeVar *, PTR(Type)> &fresh) override;
+
+    void print(std::ostream &stream) override;
+};
+
+/**
+ * \class BoolType
+ * \brief A Type derived class representing the type of BoolVal results
+ */
+class BoolType : public Type {
+
+public:
+
+    bool occurs(TypeVar *var) override;
+
+    void adjust_level(int level) override;
+
+    PTR(Type) instantiate(int level, TypeContext &ctx,
+                          std::map<TypeVar *, PTR(Type)> &fresh) override;
+
+    void print(std::ostream &stream) override;
+};
+
+/**
+ * \class FunType
+ * \brief A Type derived class representing the type of FunVal results
+ */
+class FunType : public Type {
+
+public:
+
+    PTR(Type) arg_m;    ///< The type of the function's formal argument
+    PTR(Type) result_m; ///< The type of the function's body
+
+    FunType(PTR(Type) arg, PTR(Type) result);
+
+    bool occurs(TypeVar *var) override;
+
+    void adjust_level(int level) override;
+
+    PTR(Type) instantiate(int level, TypeContext &ctx,
+                          std::map<TypeVar *, PTR(Type)> &fresh) override;
+
+    void print(std::ostream &stream) override;
+};
+
+/**
+ * \class TypeVar
+ * \brief A Type derived class representing a not-yet-known type
+ *
+ * Once unified with another type, a TypeVar forwards to it through link_m.
+ * level_m is the let-nesting depth at which the variable was created; a
+ * variable whose level is deeper than the enclosing Let is generalized.
+ */
+class TypeVar : public Type {
+
+public:
+
+    int id_m;           ///< Number used when printing (e.g. 'a, 'b)
+    int level_m;        ///< Let-nesting depth this variable belongs to
+    PTR(Type) link_m;   ///< The type this variable was unified with, if any
+
+    TypeVar(int id, int level);
+
+    PTR(Type) resolve() override;
+
+    bool occurs(TypeVar *var) override;
+
+    void adjust_level(int level) override;
+
+    PTR(Type) instantiate(int level, TypeContext &ctx,
+                          std::map<TypeVar *, PTR(Type)> &fresh) override;
+
+    void print(std::ostream &stream) override;
+};
+
+/**
+ * \struct TypeContext
+ * \brief State threaded through a single Expr::typecheck() pass
+ */
+struct TypeContext {
+    int level = 0;                  ///< Current let-nesting depth
+    int next_id = 0;                ///< Id of the next fresh TypeVar
+    std::vector<Expr *> checked;    ///< Nodes to mark once inference succeeds
+
+    PTR(Type) fresh();
+};
+
+/**
+ * \class TypeEnv
+ * \brief A "dictionary" from variable names to their (possibly generic) types
+ */
+COUNTED(TypeEnv) {
+public:
+
+    static thread_local PTR(TypeEnv) empty; ///< One per thread, like Env::empty
+
+    virtual PTR(Type) lookup(const std::string &find_name,
+                             TypeContext &ctx) = 0;
+
+    virtual ~TypeEnv() = default;
+};
+
+class EmptyTypeEnv : public TypeEnv {
+public:
+
+    /* Below every binding are the primitives (see Prim) */
+    PTR(Type) lookup(const std::string &find_name,
+                     TypeContext &ctx) override;
+};
+
+class ExtendedTypeEnv : public TypeEnv {
+public:
+
+    std::string name;
+    PTR(Type) type;
+    int level;          ///< Type variables deeper than this are generic
+    PTR(TypeEnv) rest;
+
+    ExtendedTypeEnv(std::string name, PTR(Type) type, int level,
+                    PTR(TypeEnv) env) {
+        this->name = std::move(name);
+        this->type = type;
+        this->level = level;
+        this->rest = env;
+    }
+
+    PTR(Type) lookup(const std::string &find_name,
+                     TypeContext &ctx) override {
+        if (find_name == name) {
+            std::map<TypeVar *, PTR(Type)> fresh;
+            return type->resolve()->instantiate(level, ctx, fresh);
+        } else {
+            return rest->lookup(find_name, ctx);
+        }
+    }
+};
+
+void unify(PTR(Type) t1, PTR(Type) t2);
@@ -3,10 +3,15 @@
  * \brief Val base class and derived class definitions
  */
 
+#include <algorithm>    /* std::copy (for PrimVal) */
 #include <utility>
 
+#include "budget.h"
 #include "Env.h"
 #include "Expr.h"
+#include "memo.h"
+#include "stats.h"
+#include "trace.h"
 #include "Val.h"
 
 /**
@@ -23,9 +28,11 @@ std::string Val::to_string() {
 /**
  * \brief Constructs a NumVal object representing an integer
  *
- * \param val An int to define this NumVal object's integer value
+ * \param val An Integer to define this NumVal object's integer value
  */
-NumVal::NumVal(int val) {
+NumVal::NumVal(Integer val) {
+    budget_allocate(sizeof(NumVal));
+    eval_stats.num_vals++;
     int_m = val;
 }
 
@@ -45,8 +52,8 @@ PTR(Expr) NumVal::to_expr() {
  * \return True if the two objects are both NumVal objects and represent
  * equivalent int_m values
  */
-bool NumVal::equals(PTR(Val) v) {
-    PTR(NumVal) num_cmp = CAST(NumVal)(v);
+bool NumVal::equals(const PTR(Val) &v) {
+    NumVal *num_cmp = dynamic_cast<NumVal *>(v.get());
     return num_cmp != nullptr && int_m == num_cmp->int_m;
 }
 
@@ -56,15 +63,14 @@ bool NumVal::equals(PTR(Val) v) {
  * \throws std::runtime_error If the objects being added are not NumVals
  * \return A new NumVal object representing the sum of the NumVal objects
  */
-PTR(Val) NumVal::add_to(PTR(Val) other_val) {
-    PTR(NumVal) other_num = CAST(NumVal)(other_val);
+PTR(Val) NumVal::add_to(const PTR(Val) &other_val) {
+    NumVal *other_num = dynamic_cast<NumVal *>(other_val.get());
 
     if (other_num == nullptr) {
         throw std::runtime_error("invalid operation on non-number");
     }
 
-    return NEW(NumVal)(
-            (unsigned) int_m + (unsigned) other_num->int_m); // NOLINT( cppcoreguidelines-narrowing-conversions )
+    return NEW(NumVal)(int_m + other_num->int_m);
 }
 
 /**
@@ -73,15 +79,14 @@ PTR(Val) NumVal::add_to(PTR(Val) other_val) {
  * \throws std::runtime_error If the objects being multiplied are not NumVals
  * \return A new NumVal object representing the product of the NumVal objects
  */
-PTR(Val) NumVal::mult_with(PTR(Val) other_val) {
-    PTR(NumVal) other_num = CAST(NumVal)(other_val);
+PTR(Val) NumVal::mult_with(const PTR(Val) &other_val) {
+    NumVal *other_num = dynamic_cast<NumVal *>(other_val.get());
 
     if (other_num == nullptr) {
         throw std::runtime_error("invalid operation on non-number");
     }
 
-    return NEW(NumVal)(
-            (unsigned) int_m * (unsigned) other_num->int_m); // NOLINT( cppcoreguidelines-narrowing-conversions )
+    return NEW(NumVal)(int_m * other_num->int_m);
 }
 
 /**
@@ -113,7 +118,16 @@ void NumVal::print(std::ostream &stream) {
  *
  * \throws std::runtime_error
  */
-PTR(Val) NumVal::call(PTR(Val) actual_arg) {
+PTR(Val) NumVal::call(const PTR(Val) &actual_arg) {
+    throw std::runtime_error("cannot use call() on this type");
+}
+
+/**
+ * \brief This function will always throw an exception. See: NumVal::call()
+ *
+ * \throws std::runtime_error
+ */
+PTR(Val) NumVal::apply(const std::vector<PTR(Val)> &actual_args) {
     throw std::runtime_error("cannot use call() on this type");
 }
 
@@ -123,6 +137,8 @@ PTR(Val) NumVal::call(PTR(Val) actual_arg) {
  * \param val A bool to define this BoolVal object's boolean value
  */
 BoolVal::BoolVal(bool val) {
+    budget_allocate(sizeof(BoolVal));
+    eval_stats.bool_vals++;
     bool_m = val;
 }
 
@@ -141,8 +157,8 @@ PTR(Expr) BoolVal::to_expr() {
  * \return True if the two objects are both BoolVal objects and represent
  * equivalent bool_m values
  */
-bool BoolVal::equals(PTR(Val) v) {
-    PTR(BoolVal) bool_cmp = CAST(BoolVal)(v);
+bool BoolVal::equals(const PTR(Val) &v) {
+    BoolVal *bool_cmp = dynamic_cast<BoolVal *>(v.get());
     return bool_cmp != nullptr && bool_m == bool_cmp->bool_m;
 }
 
@@ -152,7 +168,7 @@ bool BoolVal::equals(PTR(Val) v) {
  * \throws std::runtime_error If the objects being added are not NumVals
  * \return This function will never return.
  */
-PTR(Val) BoolVal::add_to(PTR(Val) other_val) {
+PTR(Val) BoolVal::add_to(const PTR(Val) &other_val) {
     throw std::runtime_error("invalid operation on non-number");
 }
 
@@ -163,7 +179,7 @@ PTR(Val) BoolVal::add_to(PTR(Val) other_val) {
  * \throws std::runtime_error If the objects being multiplied are not NumVals
  * \return This function will never return.
  */
-PTR(Val) BoolVal::mult_with(PTR(Val) other_val) {
+PTR(Val) BoolVal::mult_with(const PTR(Val) &other_val) {
     throw std::runtime_error("invalid operation on non-number");
 }
 
@@ -195,32 +211,47 @@ void BoolVal::print(std::ostream &stream) {
  *
  * \throws std::runtime_error
  */
-PTR(Val) BoolVal::call(PTR(Val) actual_arg) {
+PTR(Val) BoolVal::call(const PTR(Val) &actual_arg) {
+    throw std::runtime_error("cannot use call() on this type");
+}
+
+/**
+ * \brief This function will always throw an exception. See: BoolVal::call()
+ *
+ * \throws std::runtime_error
+ */
+PTR(Val) BoolVal::apply(const std::vector<PTR(Val)> &actual_args) {
     throw std::runtime_error("cannot use call() on this type");
 }
 
-FunVal::FunVal(std::string arg, PTR(Expr) body, PTR(Env) env) {
-    formal_arg_m = std::move(arg);
-    body_m = body;
-    env_m = env;
+FunVal::FunVal(std::string arg, PTR(Expr) body, PTR(Env) env)
+        : FunVal(std::vector<std::string>{std::move(arg)}, std::move(body), std::move(env)) {
+}
+
+FunVal::FunVal(std::vector<std::string> args, PTR(Expr) body, PTR(Env) env) {
+    budget_allocate(sizeof(FunVal));
+    eval_stats.fun_vals++;
+    formal_args_m = std::move(args);
+    body_m = std::move(body);
+    env_m = std::move(env);
 }
 
 PTR(Expr) FunVal::to_expr() {
-    return NEW(Fun)(formal_arg_m, body_m);
+    return NEW(Fun)(formal_args_m, body_m);
 }
 
-bool FunVal::equals(PTR(Val) v) {
-    PTR(FunVal) funval_cmp = CAST(FunVal)(v);
+bool FunVal::equals(const PTR(Val) &v) {
+    FunVal *funval_cmp = dynamic_cast<FunVal *>(v.get());
     return funval_cmp != nullptr &&
-           formal_arg_m == funval_cmp->formal_arg_m &&
+           formal_args_m == funval_cmp->formal_args_m &&
            body_m->equals(funval_cmp->body_m);
 }
 
-PTR(Val) FunVal::add_to(PTR(Val) v) {
+PTR(Val) FunVal::add_to(const PTR(Val) &v) {
     throw std::runtime_error("invalid operation on non-number");
 }
 
-PTR(Val) FunVal::mult_with(PTR(Val) v) {
+PTR(Val) FunVal::mult_with(const PTR(Val) &v) {
     throw std::runtime_error("invalid operation on non-number");
 }
 
@@ -232,6 +263,314 @@ void FunVal::print(std::ostream &stream) {
     stream << to_expr()->to_string();
 }
 
-PTR(Val) FunVal::call(PTR(Val) actual_arg) {
-    return body_m->interp(NEW(ExtendedEnv)(formal_arg_m, actual_arg, env_m));
+/**
+ * \brief Supplies this function's first argument
+ *
+ * If that is the only one, simplifies the body with it bound; otherwise
+ * returns a function waiting for the rest.
+ */
+PTR(Val) FunVal::call(const PTR(Val) &actual_arg) {
+    return call(actual_arg, nullptr);
+}
+
+/**
+ * \param evaluator Evaluates the body, if non-null, instead of
+ *                  Expr::interp()
+ */
+PTR(Val) FunVal::call(const PTR(Val) &actual_arg, BodyEvaluator *evaluator) {
+    if (formal_args_m.size() == 1) {
+        return enter(&actual_arg, 1, evaluator);
+    }
+
+    return NEW(FunVal)(std::vector<std::string>(formal_args_m.begin() + 1, formal_args_m.end()),
+                       body_m, NEW(ExtendedEnv)(formal_args_m[0], actual_arg, env_m));
+}
+
+/**
+ * \brief Supplies several arguments at once
+ *
+ * \param actual_args The arguments, in order
+ * \return With exactly as many arguments as this function has parameters,
+ * the body's value, simplified with them all bound in one FrameEnv. With
+ * fewer, a function waiting for the rest (partial application); with more,
+ * the body's value applied to the ones left over.
+ */
+PTR(Val) FunVal::apply(const std::vector<PTR(Val)> &actual_args) {
+    return apply(actual_args, nullptr);
+}
+
+/**
+ * \param evaluator Evaluates the body, if non-null, instead of
+ *                  Expr::interp(); the leftovers of an over-application
+ *                  are applied as usual
+ */
+PTR(Val) FunVal::apply(const std::vector<PTR(Val)> &actual_args, BodyEvaluator *evaluator) {
+    size_t count = formal_args_m.size();
+    if (actual_args.size() < count) {
+        return NEW(FunVal)(std::vector<std::string>(formal_args_m.begin() + actual_args.size(),
+                                                    formal_args_m.end()),
+                           body_m, NEW(FrameEnv)(formal_args_m.data(), actual_args.data(),
+                                                 actual_args.size(), env_m));
+    }
+
+    PTR(Val) res = enter(actual_args.data(), count, evaluator);
+    if (actual_args.size() == count) {
+        return res;
+    }
+
+    std::vector<PTR(Val)> rest(actual_args.begin() + count, actual_args.end());
+    return rest.size() == 1 ? res->call(rest[0]) : res->apply(rest);
+}
+
+/**
+ * \brief Simplifies this function's body with all of its arguments bound:
+ *        one in an ExtendedEnv, several in a FrameEnv
+ *
+ * \param actual_args One argument per parameter
+ * \param count The number of parameters
+ * \param evaluator Evaluates the body, if non-null, instead of
+ *                  Expr::interp()
+ *
+ * Used by call() and apply(), and directly by Call::interp() on an inline
+ * cache hit. With memoization on (see memo.h), a cached result is returned
+ * without evaluating anything. While tracing, calls that take longer than
+ * the Tracer's threshold get a span of their own.
+ */
+PTR(Val) FunVal::enter(const PTR(Val) *actual_args, size_t count, BodyEvaluator *evaluator) {
+    MemoKey key;
+    if (memo_key(body_m, env_m, actual_args, count, key)) {
+        PTR(Val) res = memo_find(key);
+        if (res == nullptr) {
+            res = run(actual_args, count, evaluator);
+            memo_insert(std::move(key), res);
+        }
+        return res;
+    }
+    return run(actual_args, count, evaluator);
+}
+
+PTR(Val) FunVal::run(const PTR(Val) *actual_args, size_t count, BodyEvaluator *evaluator) {
+    PTR(Env) env = count == 1 ? PTR(Env)(NEW(ExtendedEnv)(formal_args_m[0], actual_args[0], env_m))
+                              : PTR(Env)(NEW(FrameEnv)(formal_args_m.data(), actual_args, count, env_m));
+
+    Tracer *tracer = Tracer::active.load(std::memory_order_relaxed);
+    if (tracer == nullptr) {
+        return evaluator != nullptr ? evaluator->eval(body_m, env) : body_m->interp(env);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    PTR(Val) res = evaluator != nullptr ? evaluator->eval(body_m, env) : body_m->interp(env);
+    auto end = std::chrono::steady_clock::now();
+    if (end - start >= tracer->call_threshold_m) {
+        std::string params;
+        for (const std::string &formal_arg: formal_args_m) {
+            params += (params.empty() ? "" : ", ") + formal_arg;
+        }
+        tracer->span("_fun (" + params + ")", "call", start, end);
+    }
+    return res;
+}
+
+/**
+ * \brief Checks that a primitive's argument is a number
+ *
+ * \throws std::runtime_error If it is not
+ */
+static const Integer &prim_arg(const PTR(Val) &v) {
+    if (auto *thunk = dynamic_cast<ThunkVal *>(v.get())) {
+        return prim_arg(thunk->force());
+    }
+    NumVal *num = dynamic_cast<NumVal *>(v.get());
+    if (num == nullptr) {
+        throw std::runtime_error("invalid operation on non-number");
+    }
+    return num->int_m;
+}
+
+static const Prim prims[] = {
+        {"sub", 2, false, [](const Integer *a) -> PTR(Val) { return NEW(NumVal)(a[0] - a[1]); }},
+        {"lt",  2, true,  [](const Integer *a) -> PTR(Val) { return NEW(BoolVal)(a[0] < a[1]); }},
+        {"le",  2, true,  [](const Integer *a) -> PTR(Val) { return NEW(BoolVal)(a[0] <= a[1]); }},
+        {"div", 2, false, [](const Integer *a) -> PTR(Val) { return NEW(NumVal)(a[0] / a[1]); }},
+        {"mod", 2, false, [](const Integer *a) -> PTR(Val) { return NEW(NumVal)(a[0] % a[1]); }},
+        {"min", 2, false, [](const Integer *a) -> PTR(Val) { return NEW(NumVal)(a[1] < a[0] ? a[1] : a[0]); }},
+        {"max", 2, false, [](const Integer *a) -> PTR(Val) { return NEW(NumVal)(a[0] < a[1] ? a[1] : a[0]); }},
+        {"abs", 1, false, [](const Integer *a) -> PTR(Val) { return NEW(NumVal)(a[0] < 0 ? -a[0] : a[0]); }},
+};
+
+/**
+ * \brief Finds a primitive by name
+ *
+ * \return The primitive, or nullptr if there is none by that name
+ */
+const Prim *Prim::find(const std::string &name) {
+    for (const Prim &prim: prims) {
+        if (name == prim.name) {
+            return &prim;
+        }
+    }
+    return nullptr;
+}
+
+PrimVal::PrimVal(const Prim *prim, std::vector<Integer> args) {
+    budget_allocate(sizeof(PrimVal));
+    prim_m = prim;
+    args_m = std::move(args);
+}
+
+/**
+ * \brief The value a primitive's name is bound to
+ *
+ * One per primitive per thread, made on first use (a PTR's count must not be
+ * shared between threads with USE_REF_POINTERS).
+ *
+ * \return That value, or nullptr if no primitive has this name
+ */
+PTR(Val) PrimVal::bound(const std::string &name) {
+    static thread_local PTR(Val) vals[sizeof(prims) / sizeof(prims[0])];
+
+    const Prim *prim = Prim::find(name);
+    if (prim == nullptr) {
+        return nullptr;
+    }
+
+    PTR(Val) &val = vals[prim - prims];
+    if (val == nullptr) {
+        val = NEW(PrimVal)(prim);
+    }
+    return val;
+}
+
+PTR(Expr) PrimVal::to_expr() {
+    PTR(Expr) name = NEW(Var)(prim_m->name);
+    if (args_m.empty()) {
+        return name;
+    }
+
+    std::vector<PTR(Expr)> args;
+    for (const Integer &arg: args_m) {
+        args.push_back(NEW(Num)(arg));
+    }
+    return NEW(Call)(name, args);
+}
+
+bool PrimVal::equals(const PTR(Val) &v) {
+    PrimVal *prim_cmp = dynamic_cast<PrimVal *>(v.get());
+    return prim_cmp != nullptr && prim_m == prim_cmp->prim_m && args_m == prim_cmp->args_m;
+}
+
+PTR(Val) PrimVal::add_to(const PTR(Val) &v) {
+    throw std::runtime_error("invalid operation on non-number");
+}
+
+PTR(Val) PrimVal::mult_with(const PTR(Val) &v) {
+    throw std::runtime_error("invalid operation on non-number");
+}
+
+bool PrimVal::is_true() {
+    throw std::runtime_error("invalid operation on non-number");
+}
+
+void PrimVal::print(std::ostream &stream) {
+    stream << to_expr()->to_string();
+}
+
+PTR(Val) PrimVal::call(const PTR(Val) &actual_arg) {
+    if (args_m.size() + 1 < prim_m->arity) {
+        std::vector<Integer> args = args_m;
+        args.push_back(prim_arg(actual_arg));
+        return NEW(PrimVal)(prim_m, std::move(args));
+    }
+
+    Integer args[Prim::max_arity];
+    std::copy(args_m.begin(), args_m.end(), args);
+    args[args_m.size()] = prim_arg(actual_arg);
+    return prim_m->run(args);
+}
+
+/**
+ * \brief Supplies several arguments at once, as FunVal::apply() does
+ *
+ * \throws std::runtime_error If an argument is not a number
+ */
+PTR(Val) PrimVal::apply(const std::vector<PTR(Val)> &actual_args) {
+    Integer args[Prim::max_arity];
+    std::copy(args_m.begin(), args_m.end(), args);
+
+    size_t count = args_m.size();
+    size_t used = 0;
+    while (count < prim_m->arity && used < actual_args.size()) {
+        args[count++] = prim_arg(actual_args[used++]);
+    }
+    if (count < prim_m->arity) {
+        return NEW(PrimVal)(prim_m, std::vector<Integer>(args, args + count));
+    }
+
+    PTR(Val) res = prim_m->run(args);
+    if (used == actual_args.size()) {
+        return res;
+    }
+
+    std::vector<PTR(Val)> rest(actual_args.begin() + used, actual_args.end());
+    return rest.size() == 1 ? res->call(rest[0]) : res->apply(rest);
+}
+
+thread_local bool ThunkVal::enabled = false;
+
+ThunkVal::ThunkVal(PTR(Expr) expr, PTR(Env) env) {
+    budget_allocate(sizeof(ThunkVal));
+    eval_stats.thunks++;
+    expr_m = std::move(expr);
+    env_m = std::move(env);
+}
+
+/**
+ * \brief Evaluates the expression the first time; afterwards, returns the
+ *        same value
+ *
+ * \return The expression's value
+ *
+ * \throws std::runtime_error Whatever the evaluation throws; the thunk can
+ *                            then be forced again
+ */
+const PTR(Val) &ThunkVal::force() {
+    if (val_m == nullptr) {
+        eval_stats.thunks_forced++;
+        val_m = expr_m->interp(env_m);
+        expr_m = nullptr;
+        env_m = nullptr;
+    }
+    return val_m;
+}
+
+PTR(Expr) ThunkVal::to_expr() {
+    return force()->to_expr();
+}
+
+bool ThunkVal::equals(const PTR(Val) &v) {
+    return force()->equals(v);
+}
+
+PTR(Val) ThunkVal::add_to(const PTR(Val) &v) {
+    return force()->add_to(v);
+}
+
+PTR(Val) ThunkVal::mult_with(const PTR(Val) &v) {
+    return force()->mult_with(v);
+}
+
+bool ThunkVal::is_true() {
+    return force()->is_true();
+}
+
+void ThunkVal::print(std::ostream &stream) {
+    force()->print(stream);
+}
+
+PTR(Val) ThunkVal::call(const PTR(Val) &actual_arg) {
+    return force()->call(actual_arg);
+}
+
+PTR(Val) ThunkVal::apply(const std::vector<PTR(Val)> &actual_args) {
+    return force()->apply(actual_args);
 }
@@ -5,9 +5,11 @@
 
 #pragma once
 
+#include "Integer.h"
 #include "pointers.h"
 
 #include <string>
+#include <vector>
 
 class Expr; /* Expr class for Val::to_expr() */
 class Env;
@@ -40,17 +42,19 @@ public:
      */
     virtual PTR(Expr) to_expr() = 0;
 
-    virtual bool equals(PTR(Val) v) = 0;
+    virtual bool equals(const PTR(Val) &v) = 0;
 
-    virtual PTR(Val) add_to(PTR(Val) v) = 0;
+    virtual PTR(Val) add_to(const PTR(Val) &v) = 0;
 
-    virtual PTR(Val) mult_with(PTR(Val) v) = 0;
+    virtual PTR(Val) mult_with(const PTR(Val) &v) = 0;
 
     virtual bool is_true() = 0;
 
     virtual void print(std::ostream &stream) = 0;
 
-    virtual PTR(Val) call(PTR(Val) actual_arg) = 0;
+    virtual PTR(Val) call(const PTR(Val) &actual_arg) = 0;
+
+    virtual PTR(Val) apply(const std::vector<PTR(Val)> &actual_args) = 0;
 
     /*
      * Regular virtual methods
@@ -68,23 +72,25 @@ class NumVal : public Val {
 
 public:
 
-    int int_m;
+    Integer int_m;
 
-    explicit NumVal(int val);
+    explicit NumVal(Integer val);
 
     PTR(Expr) to_expr() override;
 
-    bool equals(PTR(Val) v) override;
+    bool equals(const PTR(Val) &v) override;
 
-    PTR(Val) add_to(PTR(Val) other_val) override;
+    PTR(Val) add_to(const PTR(Val) &other_val) override;
 
-    PTR(Val) mult_with(PTR(Val) other_val) override;
+    PTR(Val) mult_with(const PTR(Val) &other_val) override;
 
     bool is_true() override;
 
     void print(std::ostream &ostream) override;
 
-    PTR(Val) call(PTR(Val) actual_arg) override;
+    PTR(Val) call(const PTR(Val) &actual_arg) override;
+
+    PTR(Val) apply(const std::vector<PTR(Val)> &actual_args) override;
 };
 
 /**
@@ -103,40 +109,189 @@ public:
 
     PTR(Expr) to_expr() override;
 
-    bool equals(PTR(Val) v) override;
+    bool equals(const PTR(Val) &v) override;
 
-    PTR(Val) add_to(PTR(Val) other_val) override;
+    PTR(Val) add_to(const PTR(Val) &other_val) override;
 
-    PTR(Val) mult_with(PTR(Val) other_val) override;
+    PTR(Val) mult_with(const PTR(Val) &other_val) override;
 
     bool is_true() override;
 
     void print(std::ostream &ostream) override;
 
-    PTR(Val) call(PTR(Val) actual_arg) override;
+    PTR(Val) call(const PTR(Val) &actual_arg) override;
+
+    PTR(Val) apply(const std::vector<PTR(Val)> &actual_args) override;
+};
+
+/**
+ * \class BodyEvaluator
+ * \brief Evaluates a function's body in place of Expr::interp(), for an
+ *        interpreter that evaluates differently (see parallel_interp())
+ */
+class BodyEvaluator {
+
+public:
+
+    virtual ~BodyEvaluator() = default;
+
+    virtual PTR(Val) eval(PTR(Expr) e, PTR(Env) env) = 0;
 };
 
 class FunVal : public Val {
 
 public:
 
-    std::string formal_arg_m;
+    std::vector<std::string> formal_args_m; ///< Still to be supplied
     PTR(Expr) body_m;
     PTR(Env) env_m;
 
     FunVal(std::string arg, PTR(Expr) body, PTR(Env) env = nullptr);
 
+    FunVal(std::vector<std::string> args, PTR(Expr) body, PTR(Env) env = nullptr);
+
     PTR(Expr) to_expr() override;
 
-    bool equals(PTR(Val) v) override;
+    bool equals(const PTR(Val) &v) override;
 
-    PTR(Val) add_to(PTR(Val) v) override;
+    PTR(Val) add_to(const PTR(Val) &v) override;
 
-    PTR(Val) mult_with(PTR(Val) v) override;
+    PTR(Val) mult_with(const PTR(Val) &v) override;
 
     bool is_true() override;
 
     void print(std::ostream &stream) override;
 
-    PTR(Val) call(PTR(Val) actual_arg) override;
+    PTR(Val) call(const PTR(Val) &actual_arg) override;
+
+    PTR(Val) call(const PTR(Val) &actual_arg, BodyEvaluator *evaluator);
+
+    PTR(Val) apply(const std::vector<PTR(Val)> &actual_args) override;
+
+    PTR(Val) apply(const std::vector<PTR(Val)> &actual_args, BodyEvaluator *evaluator);
+
+    PTR(Val) enter(const PTR(Val) *actual_args, size_t count, BodyEvaluator *evaluator = nullptr);
+
+private:
+
+    PTR(Val) run(const PTR(Val) *actual_args, size_t count, BodyEvaluator *evaluator);
+};
+
+/**
+ * \struct Prim
+ * \brief A built-in operation on integers, bound under its name in every
+ *        environment (below any user binding, so it can be shadowed)
+ *
+ * The table is in Val.cpp: sub, lt, le, div, mod, min, max, and abs.
+ */
+struct Prim {
+    static constexpr size_t max_arity = 2;
+
+    const char *name;
+    size_t arity;
+    bool predicate;                         ///< Returns a BoolVal, not a NumVal
+    PTR(Val) (*run)(const Integer *args);   ///< One native operation
+
+    static const Prim *find(const std::string &name);
+};
+
+/**
+ * \class PrimVal
+ * \brief The value of a Prim's name: a function that runs it natively once
+ *        it has all its arguments, without an environment or a body
+ */
+class PrimVal : public Val {
+
+public:
+
+    const Prim *prim_m;
+    std::vector<Integer> args_m;    ///< Supplied so far (partial application)
+
+    explicit PrimVal(const Prim *prim, std::vector<Integer> args = {});
+
+    static PTR(Val) bound(const std::string &name);
+
+    PTR(Expr) to_expr() override;
+
+    bool equals(const PTR(Val) &v) override;
+
+    PTR(Val) add_to(const PTR(Val) &v) override;
+
+    PTR(Val) mult_with(const PTR(Val) &v) override;
+
+    bool is_true() override;
+
+    void print(std::ostream &stream) override;
+
+    PTR(Val) call(const PTR(Val) &actual_arg) override;
+
+    PTR(Val) apply(const std::vector<PTR(Val)> &actual_args) override;
+};
+
+/**
+ * \class ThunkVal
+ * \brief A _let rhs or function argument that has not been evaluated yet
+ *        (see LazyEval)
+ *
+ * Var::interp() forces a thunk it looks up, so thunks only live in
+ * environments; the first force evaluates the expression and keeps the value
+ * for every later one (call-by-need). The other methods force too, in case
+ * one is passed on as it is.
+ */
+class ThunkVal : public Val {
+
+public:
+
+    static thread_local bool enabled;   ///< Set by LazyEval
+
+    PTR(Expr) expr_m;   ///< Until forced
+    PTR(Env) env_m;     ///< Until forced
+    PTR(Val) val_m;     ///< Once forced
+
+    ThunkVal(PTR(Expr) expr, PTR(Env) env);
+
+    const PTR(Val) &force();
+
+    PTR(Expr) to_expr() override;
+
+    bool equals(const PTR(Val) &v) override;
+
+    PTR(Val) add_to(const PTR(Val) &v) override;
+
+    PTR(Val) mult_with(const PTR(Val) &v) override;
+
+    bool is_true() override;
+
+    void print(std::ostream &stream) override;
+
+    PTR(Val) call(const PTR(Val) &actual_arg) override;
+
+    PTR(Val) apply(const std::vector<PTR(Val)> &actual_args) override;
+};
+
+/**
+ * \class LazyEval
+ * \brief While in scope, _let rhs's and the arguments of calls to _funs are
+ *        bound as ThunkVals on this thread instead of being evaluated first
+ *
+ * Primitives still get evaluated arguments.
+ */
+class LazyEval {
+public:
+
+    LazyEval() : saved_m(ThunkVal::enabled) {
+        ThunkVal::enabled = true;
+    }
+
+    ~LazyEval() {
+        ThunkVal::enabled = saved_m;
+    }
+
+    LazyEval(const LazyEval &) = delete;
+
+    LazyEval &operator=(const LazyEval &) = delete;
+
+private:
+
+    bool saved_m;
 };
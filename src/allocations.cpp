@@ -0,0 +1,165 @@
+/**
+ * \file allocations.cpp
+ * \brief AllocationRegistry definitions
+ */
+
+#include <algorithm>    /* std::max, std::min, std::sort */
+#include <cxxabi.h>     /* abi::__cxa_demangle */
+#include <cstdlib>      /* std::free */
+#include <iomanip>      /* std::setw */
+
+#include "allocations.h"
+
+static const size_t HISTOGRAM_ROWS = 20;   ///< Samples shown by write()
+static const size_t HISTOGRAM_WIDTH = 50;  ///< Characters in the longest bar
+
+/**
+ * \brief The registry; deliberately leaked (see AllocationRegistry)
+ */
+AllocationRegistry &AllocationRegistry::instance() {
+    static AllocationRegistry *registry = new AllocationRegistry();
+    return *registry;
+}
+
+AllocationRegistry::AllocationRegistry() : start_m(std::chrono::steady_clock::now()) {
+}
+
+/**
+ * \brief Registers a type
+ *
+ * \param type The type, by typeid
+ * \return Its counters, which stay at the same address
+ */
+AllocationCounters &AllocationRegistry::counters(const std::type_info &type) {
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : type.name();
+    std::free(demangled);
+
+    std::lock_guard<std::mutex> lock(mutex_m);
+    counters_m.emplace_back(name);
+    return counters_m.back();
+}
+
+/**
+ * \brief Counts one allocation of bytes bytes for a type
+ */
+void AllocationRegistry::allocated(AllocationCounters &counters, size_t bytes) {
+    counters.constructed++;
+    counters.bytes += bytes;
+    uint64_t live = ++counters.live;
+    uint64_t peak = counters.peak_live.load(std::memory_order_relaxed);
+    while (live > peak && !counters.peak_live.compare_exchange_weak(peak, live)) {
+    }
+
+    live_objects_m++;
+    live_bytes_m += bytes;
+    if (++events_m % ALLOCATION_SAMPLE_INTERVAL == 0) {
+        sample();
+    }
+}
+
+/**
+ * \brief Counts one deallocation of bytes bytes for a type
+ */
+void AllocationRegistry::deallocated(AllocationCounters &counters, size_t bytes) {
+    counters.destroyed++;
+    counters.live--;
+
+    live_objects_m--;
+    live_bytes_m -= bytes;
+    if (++events_m % ALLOCATION_SAMPLE_INTERVAL == 0) {
+        sample();
+    }
+}
+
+/**
+ * \return The number of counted objects not yet deallocated
+ */
+uint64_t AllocationRegistry::live_objects() const {
+    return live_objects_m;
+}
+
+/**
+ * \brief Records the live totals now
+ */
+void AllocationRegistry::sample() {
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                          start_m).count();
+    std::lock_guard<std::mutex> lock(mutex_m);
+    samples_m.push_back({ms, live_objects_m, live_bytes_m});
+}
+
+/**
+ * \brief Zeroes every type's totals (but not its live count) and the
+ *        history, and restarts the clock
+ */
+void AllocationRegistry::reset() {
+    std::lock_guard<std::mutex> lock(mutex_m);
+    for (AllocationCounters &counters: counters_m) {
+        counters.constructed = counters.destroyed = counters.bytes = 0;
+        counters.peak_live = counters.live.load();
+    }
+    samples_m.clear();
+    start_m = std::chrono::steady_clock::now();
+}
+
+/**
+ * \brief Writes a table of every type's totals, most bytes first, and a
+ *        histogram of live objects over time
+ *
+ * \param stream A reference to an output stream to write to
+ *
+ * A type with objects still live at the end is marked: it leaked, or is
+ * still referenced (e.g. by a static).
+ */
+void AllocationRegistry::write(std::ostream &stream) const {
+    std::lock_guard<std::mutex> lock(mutex_m);
+
+    std::vector<const AllocationCounters *> sorted;
+    for (const AllocationCounters &counters: counters_m) {
+        if (counters.constructed != 0 || counters.live != 0) {
+            sorted.push_back(&counters);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const AllocationCounters *a, const AllocationCounters *b) {
+                  return a->bytes > b->bytes;
+              });
+
+    stream << std::left << std::setw(16) << "type" << std::right
+           << std::setw(14) << "constructed" << std::setw(14) << "destroyed"
+           << std::setw(14) << "bytes" << std::setw(12) << "peak live"
+           << std::setw(10) << "live" << "\n";
+    for (const AllocationCounters *counters: sorted) {
+        stream << std::left << std::setw(16) << counters->type << std::right
+               << std::setw(14) << counters->constructed
+               << std::setw(14) << counters->destroyed
+               << std::setw(14) << counters->bytes
+               << std::setw(12) << counters->peak_live
+               << std::setw(10) << counters->live
+               << (counters->live != 0 ? "  <- still live" : "") << "\n";
+    }
+
+    std::vector<Sample> samples = samples_m;
+    samples.push_back({std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start_m).count(),
+                       live_objects_m, live_bytes_m});
+
+    uint64_t peak = 1;
+    for (const Sample &sample: samples) {
+        peak = std::max(peak, sample.live_objects);
+    }
+    size_t rows = std::min(samples.size(), HISTOGRAM_ROWS);
+
+    stream << "\nlive objects over time (every " << ALLOCATION_SAMPLE_INTERVAL
+           << " allocations/deallocations):\n";
+    for (size_t row = 0; row < rows; row++) {
+        const Sample &sample = samples[rows == 1 ? 0 : row * (samples.size() - 1) / (rows - 1)];
+        size_t bar = sample.live_objects * HISTOGRAM_WIDTH / peak;
+        stream << std::setw(10) << std::fixed << std::setprecision(1) << sample.ms << " ms |"
+               << std::string(bar, '#') << std::string(HISTOGRAM_WIDTH - bar, ' ') << "| "
+               << sample.live_objects << " objects, " << sample.live_bytes << " bytes\n";
+    }
+    stream << std::defaultfloat;
+}
@@ -0,0 +1,156 @@
+/**
+ * \file allocations.h
+ * \brief Allocation accounting by concrete type: counts, bytes, peak live
+ *        objects, and live objects over time
+ *
+ * Built with TRACK_ALLOCATIONS set to 1 (see pointers.h), NEW(T) allocates
+ * through a TrackingAllocator, so every object created with NEW is counted.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>      /* size_t */
+#include <cstdint>      /* uint64_t */
+#include <deque>
+#include <memory>       /* std::allocator, std::allocate_shared */
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <utility>      /* std::forward */
+#include <vector>
+
+/// Live totals are sampled once per this many allocations and deallocations
+static const uint64_t ALLOCATION_SAMPLE_INTERVAL = 1024;
+
+/**
+ * \struct AllocationCounters
+ * \brief Totals for one concrete type
+ *
+ * Bytes include the shared_ptr control block allocated alongside each
+ * object.
+ */
+struct AllocationCounters {
+    std::string type;
+    std::atomic<uint64_t> constructed{0};
+    std::atomic<uint64_t> destroyed{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> live{0};
+    std::atomic<uint64_t> peak_live{0};
+
+    explicit AllocationCounters(std::string type) : type(std::move(type)) {
+    }
+};
+
+/**
+ * \class AllocationRegistry
+ * \brief The AllocationCounters of every type allocated so far, and a
+ *        history of total live objects and bytes
+ *
+ * There is one, and it is never destroyed, so objects freed during static
+ * destruction can still be counted.
+ */
+class AllocationRegistry {
+
+public:
+
+    /// Totals at one point in time
+    struct Sample {
+        double ms;              ///< Since the registry was created or reset
+        uint64_t live_objects;
+        uint64_t live_bytes;
+    };
+
+    static AllocationRegistry &instance();
+
+    AllocationCounters &counters(const std::type_info &type);
+
+    void allocated(AllocationCounters &counters, size_t bytes);
+
+    void deallocated(AllocationCounters &counters, size_t bytes);
+
+    uint64_t live_objects() const;
+
+    void reset();
+
+    void write(std::ostream &stream) const;
+
+private:
+
+    AllocationRegistry();
+
+    std::chrono::steady_clock::time_point start_m;
+    mutable std::mutex mutex_m;
+    std::deque<AllocationCounters> counters_m;  ///< Stable addresses
+    std::vector<Sample> samples_m;
+    std::atomic<uint64_t> live_objects_m{0};
+    std::atomic<uint64_t> live_bytes_m{0};
+    std::atomic<uint64_t> events_m{0};
+
+    void sample();
+};
+
+/**
+ * \brief The counters for T, registered on first use
+ */
+template<typename T>
+AllocationCounters &allocation_counters() {
+    static AllocationCounters &counters = AllocationRegistry::instance().counters(typeid(T));
+    return counters;
+}
+
+/**
+ * \class TrackingAllocator
+ * \brief A std::allocator that reports to the AllocationRegistry, on
+ *        behalf of Tracked (which is kept when std::allocate_shared rebinds
+ *        it to its control block type)
+ */
+template<typename U, typename Tracked = U>
+class TrackingAllocator {
+
+public:
+
+    typedef U value_type;
+
+    template<typename V>
+    struct rebind {
+        typedef TrackingAllocator<V, Tracked> other;
+    };
+
+    TrackingAllocator() = default;
+
+    template<typename V>
+    TrackingAllocator(const TrackingAllocator<V, Tracked> &) { // NOLINT( google-explicit-constructor )
+    }
+
+    U *allocate(size_t n) {
+        U *res = std::allocator<U>().allocate(n);
+        AllocationRegistry::instance().allocated(allocation_counters<Tracked>(), n * sizeof(U));
+        return res;
+    }
+
+    void deallocate(U *p, size_t n) {
+        AllocationRegistry::instance().deallocated(allocation_counters<Tracked>(), n * sizeof(U));
+        std::allocator<U>().deallocate(p, n);
+    }
+
+    template<typename V>
+    bool operator==(const TrackingAllocator<V, Tracked> &) const {
+        return true;
+    }
+
+    template<typename V>
+    bool operator!=(const TrackingAllocator<V, Tracked> &) const {
+        return false;
+    }
+};
+
+/**
+ * \brief std::make_shared<T>, counted; what NEW(T) is with TRACK_ALLOCATIONS
+ */
+template<typename T, typename... Args>
+std::shared_ptr<T> make_tracked(Args &&... args) {
+    return std::allocate_shared<T>(TrackingAllocator<T>(), std::forward<Args>(args)...);
+}
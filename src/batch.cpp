@@ -0,0 +1,125 @@
+/**
+ * \file batch.cpp
+ * \brief Batch-mode definitions: splitting input into records and evaluating
+ *        them on a ThreadPool
+ */
+
+#include <future>       /* std::future */
+#include <sstream>      /* std::stringstream */
+#include <stdexcept>    /* std::runtime_error */
+
+#include "batch.h"
+#include "Expr.h"
+#include "gc.h"
+#include "parse.h"
+#include "trace.h"
+#include "Val.h"
+
+/**
+ * \brief Parses one program and simplifies or prints it
+ *
+ * \param src The program's source text
+ * \param mode What to do with the parsed program
+ * \param budget Limits for parsing and evaluating it
+ * \return The string form of the program's value (MODE_INTERP) or of the
+ *         program itself (MODE_PRINT, MODE_PRETTY_PRINT)
+ *
+ * \throws std::runtime_error On a parse or evaluation error, or an unknown
+ *                            mode
+ * \throws budget_exceeded If the budget runs out
+ */
+std::string run_program(const std::string &src, program_mode_t mode,
+                        const Budget &budget) {
+    BudgetScope scope(budget);
+    PTR(Expr) e;
+    {
+        TraceSpan span("parse_expr");
+        e = parse_expr(src);
+    }
+    switch (mode) {
+        case MODE_INTERP: {
+            PTR(Val) res;
+            {
+                TraceSpan span("interp");
+                res = e->interp();
+            }
+            TraceSpan span("print");
+            return res->to_string();
+        }
+        case MODE_PRINT: {
+            TraceSpan span("print");
+            return e->to_string();
+        }
+        case MODE_PRETTY_PRINT: {
+            TraceSpan span("pretty_print");
+            return e->to_pretty_string();
+        }
+    }
+    throw std::runtime_error("run_program(): unknown mode");
+}
+
+/**
+ * \brief Splits input into the source text of independent programs
+ *
+ * \param stream A reference to an input stream to read from
+ * \return One string per program, in input order
+ *
+ * If the input contains a ';', programs are separated by ';' and may span
+ * several lines; otherwise every line is a program. Blank records are
+ * skipped.
+ */
+std::vector<std::string> split_records(std::istream &stream) {
+    std::stringstream buffer;
+    buffer << stream.rdbuf();
+    std::string input = buffer.str();
+
+    char delimiter = input.find(';') != std::string::npos ? ';' : '\n';
+
+    std::vector<std::string> res;
+    std::stringstream records(input);
+    std::string record;
+    while (std::getline(records, record, delimiter)) {
+        if (record.find_first_not_of(" \t\r\n") != std::string::npos) {
+            res.push_back(record);
+        }
+    }
+    return res;
+}
+
+/**
+ * \brief Evaluates every record on a ThreadPool
+ *
+ * \param records Programs' source text, as from split_records()
+ * \param pool The threads to evaluate on
+ * \param budget Limits for each record
+ * \return Each record's value (or "ERROR: " and the error message), in the
+ *         same order as records
+ *
+ * Records share nothing (each has its own Expr tree and Envs), so they can
+ * be evaluated concurrently; one record's error does not affect the rest.
+ */
+std::vector<std::string> run_batch(const std::vector<std::string> &records,
+                                   ThreadPool &pool, const Budget &budget) {
+    std::vector<std::future<std::string>> futures;
+    futures.reserve(records.size());
+    for (const std::string &record: records) {
+        futures.push_back(pool.submit([&record, &budget]() {
+            std::string res;
+            try {
+                TraceSpan span("record");
+                res = run_program(record, MODE_INTERP, budget);
+            } catch (const std::runtime_error &exception) {
+                res = std::string("ERROR: ") + exception.what();
+            }
+            gc_collect();
+            return res;
+        }));
+    }
+
+    std::vector<std::string> res;
+    res.reserve(futures.size());
+    for (std::future<std::string> &future: futures) {
+        res.push_back(future.get());
+    }
+    return res;
+}
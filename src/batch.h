@@ -0,0 +1,34 @@
+/**
+ * \file batch.h
+ * \brief Evaluating many independent programs in one run
+ */
+
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "budget.h"
+#include "ThreadPool.h"
+
+/**
+ * \typedef program_mode_t
+ * \brief What run_program() does with a parsed program; the values are the
+ *        mode bytes of "--serve" requests
+ */
+typedef enum {
+    MODE_INTERP = 0,        ///< Simplify it, like "--interp"
+    MODE_PRINT = 1,         ///< Print it, like "--print"
+    MODE_PRETTY_PRINT = 2,  ///< Pretty-print it, like "--pretty-print"
+} program_mode_t;
+
+std::string run_program(const std::string &src,
+                        program_mode_t mode = MODE_INTERP,
+                        const Budget &budget = Budget());
+
+std::vector<std::string> split_records(std::istream &stream);
+
+std::vector<std::string> run_batch(const std::vector<std::string> &records,
+                                   ThreadPool &pool,
+                                   const Budget &budget = Budget());
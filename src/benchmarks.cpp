@@ -0,0 +1,487 @@
+/**
+ * \file benchmarks.cpp
+ * \brief Catch2 benchmarks, run with "--bench" (hidden from "--test")
+ */
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING /* Must match cmdline.cpp */
+#include "catch.h" /* Catch2 testing framework */
+
+#include <functional>   /* std::function */
+#include <random>       /* std::mt19937 */
+#include <stdexcept>    /* std::runtime_error */
+#include <string>
+#include <vector>
+
+#include "columnar.h"
+#include "Env.h"
+#include "flat.h"
+#include "Integer.h"
+#include "parallel.h"
+#include "parse.h"
+#include "pointers.h"
+#include "serialize.h"
+#include "Val.h"
+
+/**
+ * \brief Operands for the arithmetic benchmarks: small values, so that the
+ *        Integer benchmarks measure the inline (non-promoting) path
+ */
+static std::vector<int> small_operands(size_t count) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(-1000, 1000);
+
+    std::vector<int> res(count);
+    for (int &x: res) {
+        x = dist(gen);
+    }
+    return res;
+}
+
+/**
+ * \brief NumVal as it was before Integer: a 32-bit int with (unsigned)
+ *        wraparound arithmetic, kept here as a baseline
+ */
+CLASS(LegacyVal) {
+public:
+    virtual ~LegacyVal() = default;
+
+    virtual PTR(LegacyVal) add_to(const PTR(LegacyVal) &other_val) = 0;
+};
+
+class LegacyNumVal : public LegacyVal {
+public:
+    int int_m;
+
+    explicit LegacyNumVal(int val) : int_m(val) {
+    }
+
+    PTR(LegacyVal) add_to(const PTR(LegacyVal) &other_val) override {
+        PTR(LegacyNumVal) other_num = CAST(LegacyNumVal)(other_val);
+        if (other_num == nullptr) {
+            throw std::runtime_error("invalid operation on non-number");
+        }
+        return NEW(LegacyNumVal)(
+                (unsigned) int_m + (unsigned) other_num->int_m); // NOLINT( cppcoreguidelines-narrowing-conversions )
+    }
+};
+
+TEST_CASE("Integer arithmetic", "[!benchmark][integer]")
+{
+    const std::vector<int> ints = small_operands(4096);
+    const std::vector<Integer> integers(ints.begin(), ints.end());
+
+    // The 32-bit wraparound arithmetic NumVal used before Integer
+    BENCHMARK("int add, (unsigned) wraparound")
+    {
+        int acc = 0;
+        for (int x: ints) {
+            acc = (int) ((unsigned) acc + (unsigned) x);
+        }
+        return acc;
+    };
+
+    BENCHMARK("Integer add, small")
+    {
+        Integer acc = 0;
+        for (const Integer &x: integers) {
+            acc = acc + x;
+        }
+        return acc;
+    };
+
+    BENCHMARK("int mult, (unsigned) wraparound")
+    {
+        int acc = 0;
+        for (size_t i = 1; i < ints.size(); i++) {
+            acc = (int) ((unsigned) acc + (unsigned) ints[i - 1] * (unsigned) ints[i]);
+        }
+        return acc;
+    };
+
+    BENCHMARK("Integer mult, small")
+    {
+        Integer acc = 0;
+        for (size_t i = 1; i < integers.size(); i++) {
+            acc = acc + integers[i - 1] * integers[i];
+        }
+        return acc;
+    };
+
+    BENCHMARK("Integer mult, promoting to BigNum")
+    {
+        Integer acc = 1;
+        for (int i = 0; i < 64; i++) {
+            acc = acc * Integer(INT64_MAX);
+        }
+        return acc;
+    };
+
+    // The interpreter-level comparison: the two should be indistinguishable
+    BENCHMARK("int NumVal::add_to(), (unsigned) wraparound")
+    {
+        PTR(LegacyVal) acc = NEW(LegacyNumVal)(0);
+        for (size_t i = 0; i < 256; i++) {
+            acc = acc->add_to(NEW(LegacyNumVal)(ints[i]));
+        }
+        return acc;
+    };
+
+    BENCHMARK("Integer NumVal::add_to(), small")
+    {
+        PTR(Val) acc = NEW(NumVal)(0);
+        for (size_t i = 0; i < 256; i++) {
+            acc = acc->add_to(NEW(NumVal)(integers[i]));
+        }
+        return acc;
+    };
+}
+
+TEST_CASE("Columnar evaluation", "[!benchmark][columnar]")
+{
+    const std::vector<int> xs = small_operands(8192);
+    ColumnTable table;
+    table.names = {"x", "y"};
+    table.columns = {std::vector<int64_t>(xs.begin(), xs.end()),
+                     std::vector<int64_t>(xs.rbegin(), xs.rend())};
+
+    PTR(Expr) e = parse_expr("_if x == y _then 0 _else x * y + x * 3");
+
+    BENCHMARK("interp(), once per row")
+    {
+        size_t acc = 0;
+        for (size_t r = 0; r < table.rows(); r++) {
+            PTR(Env) env = NEW(ExtendedEnv)("y", NEW(NumVal)(table.columns[1][r]),
+                                            NEW(ExtendedEnv)("x", NEW(NumVal)(table.columns[0][r]),
+                                                             Env::empty));
+            acc += e->interp(env)->to_string().size();
+        }
+        return acc;
+    };
+
+    BENCHMARK("interp_columns()")
+    {
+        return interp_columns(e, table).size();
+    };
+}
+
+TEST_CASE("Parallel evaluation", "[!benchmark][parallel]")
+{
+    // A balanced tree of Adds and Mults, about 65,000 nodes
+    std::function<PTR(Expr)(int, int &)> tree = [&tree](int depth, int &n) -> PTR(Expr) {
+        if (depth == 0) {
+            return NEW(Num)(++n % 7 - 3);
+        }
+        PTR(Expr) lhs = tree(depth - 1, n);
+        PTR(Expr) rhs = tree(depth - 1, n);
+        return depth % 2 ? (PTR(Expr)) NEW(Add)(lhs, rhs) : (PTR(Expr)) NEW(Mult)(lhs, rhs);
+    };
+    int n = 0;
+    PTR(Expr) e = tree(15, n);
+
+    BENCHMARK("interp()")
+    {
+        return e->interp();
+    };
+
+    BENCHMARK("parallel_interp(), 1 thread")
+    {
+        return parallel_interp(e, 1);
+    };
+
+    BENCHMARK("parallel_interp(), all threads")
+    {
+        return parallel_interp(e);
+    };
+}
+
+/*
+ * Micro-benchmarks: synthetic inputs at controlled sizes. Run with
+ * "--bench [micro] -r xml" for machine-readable results.
+ */
+
+static const size_t CHAIN_LENGTH = 1024; ///< Nodes per interp() benchmark
+
+/**
+ * \brief A balanced tree of Adds and Mults over x and small numbers, with
+ *        2^depth leaves
+ */
+static PTR(Expr) arith_tree(int depth, int &n) {
+    if (depth == 0) {
+        return ++n % 4 == 0 ? (PTR(Expr)) NEW(Var)("x") : (PTR(Expr)) NEW(Num)(n % 7 - 3);
+    }
+    PTR(Expr) lhs = arith_tree(depth - 1, n);
+    PTR(Expr) rhs = arith_tree(depth - 1, n);
+    return depth % 2 ? (PTR(Expr)) NEW(Add)(lhs, rhs) : (PTR(Expr)) NEW(Mult)(lhs, rhs);
+}
+
+/**
+ * \brief Nested _lets of _funs with _if bodies, depth deep: the shape that
+ *        makes pretty-printing work hardest
+ */
+static PTR(Expr) nested_program(int depth) {
+    PTR(Expr) res = NEW(Num)(0);
+    for (int d = 0; d < depth; d++) {
+        std::string f = "f" + std::to_string(d);
+        PTR(Expr) body = NEW(If)(NEW(Eq)(NEW(Var)("y"), NEW(Num)(d)),
+                                 NEW(Var)("y"),
+                                 NEW(Add)(NEW(Var)("y"), NEW(Num)(1)));
+        res = NEW(Let)(f, NEW(Fun)("y", body), NEW(Call)(NEW(Var)(f), res));
+    }
+    return res;
+}
+
+TEST_CASE("Parsing and printing", "[!benchmark][micro]")
+{
+    for (int depth: {4, 8, 12}) {
+        int n = 0;
+        PTR(Expr) tree = arith_tree(depth, n);
+        std::string src = tree->to_string();
+        std::string nodes = std::to_string(tree->size_m);
+
+        BENCHMARK("parse_expr(), " + nodes + " nodes")
+        {
+            return parse_expr(src);
+        };
+
+        BENCHMARK("to_string(), " + nodes + " nodes")
+        {
+            return tree->to_string();
+        };
+
+        BENCHMARK("to_pretty_string(), " + nodes + " nodes")
+        {
+            return tree->to_pretty_string();
+        };
+    }
+
+    for (int depth: {4, 16, 64}) {
+        PTR(Expr) program = nested_program(depth);
+        std::string nodes = std::to_string(program->size_m);
+
+        BENCHMARK("to_string(), nested _let/_fun/_if, " + nodes + " nodes")
+        {
+            return program->to_string();
+        };
+
+        BENCHMARK("to_pretty_string(), nested _let/_fun/_if, " + nodes + " nodes")
+        {
+            return program->to_pretty_string();
+        };
+    }
+}
+
+TEST_CASE("Tree operations", "[!benchmark][micro]")
+{
+    for (int depth: {4, 8, 12}) {
+        int n = 0, m = 0;
+        PTR(Expr) tree = arith_tree(depth, n);
+        PTR(Expr) copy = arith_tree(depth, m);
+        PTR(Expr) value = NEW(Num)(5);
+        std::string nodes = std::to_string(tree->size_m);
+
+        BENCHMARK("subst(), " + nodes + " nodes")
+        {
+            return tree->subst("x", value);
+        };
+
+        BENCHMARK("equals(), " + nodes + " nodes")
+        {
+            return tree->equals(copy);
+        };
+    }
+}
+
+TEST_CASE("Flat AST operations", "[!benchmark][flat]")
+{
+    // A balanced tree of Adds over x and small numbers, about 2,000,000 nodes
+    std::function<PTR(Expr)(int, int &)> tree = [&tree](int depth, int &n) -> PTR(Expr) {
+        if (depth == 0) {
+            return ++n % 4 == 0 ? (PTR(Expr)) NEW(Var)("x") : (PTR(Expr)) NEW(Num)(n % 7 - 3);
+        }
+        PTR(Expr) lhs = tree(depth - 1, n);
+        return NEW(Add)(lhs, tree(depth - 1, n));
+    };
+    int n = 0, m = 0;
+    PTR(Expr) e = tree(20, n);
+    PTR(Expr) copy = tree(20, m);
+    PTR(FlatExpr) flat = FlatExpr::flatten(e);
+    PTR(FlatExpr) flat_copy = FlatExpr::flatten(copy);
+    PTR(Env) env = NEW(ExtendedEnv)("x", NEW(NumVal)(1), Env::empty);
+
+    BENCHMARK("Expr::interp()")
+    {
+        return e->interp(env);
+    };
+
+    BENCHMARK("FlatExpr::interp()")
+    {
+        return flat->interp(env);
+    };
+
+    BENCHMARK("Expr::to_string()")
+    {
+        return e->to_string();
+    };
+
+    BENCHMARK("FlatExpr::to_string()")
+    {
+        return flat->to_string();
+    };
+
+    BENCHMARK("Expr::equals()")
+    {
+        return e->equals(copy);
+    };
+
+    BENCHMARK("FlatExpr::equals()")
+    {
+        return flat->equals(*flat_copy);
+    };
+
+    BENCHMARK("FlatExpr::flatten()")
+    {
+        return FlatExpr::flatten(e);
+    };
+}
+
+TEST_CASE("Serialized AST loading", "[!benchmark][serialize]")
+{
+    // A chain of 200 _lets, each using the one before: _let va = ... _in
+    auto name = [](int i) {
+        std::string str = "v";
+        do {
+            str += (char) ('a' + i % 26);
+            i /= 26;
+        } while (i != 0);
+        return str;
+    };
+    std::string src;
+    for (int i = 0; i < 200; i++) {
+        src += "_let " + name(i) + " = " + std::to_string(i) + " * 3 + (_if " +
+               (i > 0 ? name(i - 1) : "1") + " == 2 _then 1 _else 2) _in ";
+    }
+    src += name(199);
+    PTR(Expr) e = parse_expr(src);
+    std::string bytes = serialize(e);
+
+    BENCHMARK("parse_expr()")
+    {
+        return parse_expr(src);
+    };
+
+    BENCHMARK("deserialize()")
+    {
+        return deserialize(bytes);
+    };
+
+    BENCHMARK("serialize()")
+    {
+        return serialize(e);
+    };
+}
+
+TEST_CASE("interp() per node type", "[!benchmark][micro]")
+{
+    const std::string count = std::to_string(CHAIN_LENGTH);
+
+    std::vector<PTR(Expr)> nums, bools;
+    for (size_t i = 0; i < CHAIN_LENGTH; i++) {
+        nums.push_back(NEW(Num)((int) i));
+        bools.push_back(NEW(Bool)(i % 2));
+    }
+    PTR(Expr) adds = NEW(Num)(1), mults = NEW(Num)(1), eqs = NEW(Bool)(true),
+            ifs = NEW(Num)(1), lets = NEW(Num)(1), funs = NEW(Num)(1), calls = NEW(Num)(1);
+    for (size_t i = 0; i < CHAIN_LENGTH; i++) {
+        adds = NEW(Add)(adds, NEW(Num)(1));
+        mults = NEW(Mult)(mults, NEW(Num)(1));
+        eqs = NEW(Eq)(eqs, NEW(Bool)(true));
+        ifs = NEW(If)(NEW(Bool)(true), ifs, NEW(Num)(0));
+        lets = NEW(Let)("x", NEW(Num)((int) i), lets);
+        funs = NEW(Fun)("x", funs);
+        calls = NEW(Call)(NEW(Fun)("x", NEW(Var)("x")), calls);
+    }
+    PTR(Env) env = NEW(ExtendedEnv)("x", NEW(NumVal)(1), Env::empty);
+    PTR(Expr) var = NEW(Var)("x");
+
+    BENCHMARK("Num::interp(), x" + count)
+    {
+        size_t acc = 0;
+        for (PTR(Expr) &num: nums) {
+            acc += num->interp() != nullptr;
+        }
+        return acc;
+    };
+
+    BENCHMARK("Bool::interp(), x" + count)
+    {
+        size_t acc = 0;
+        for (PTR(Expr) &b: bools) {
+            acc += b->interp() != nullptr;
+        }
+        return acc;
+    };
+
+    BENCHMARK("Var::interp(), x" + count)
+    {
+        size_t acc = 0;
+        for (size_t i = 0; i < CHAIN_LENGTH; i++) {
+            acc += var->interp(env) != nullptr;
+        }
+        return acc;
+    };
+
+    BENCHMARK("Add::interp(), x" + count)
+    {
+        return adds->interp();
+    };
+
+    BENCHMARK("Mult::interp(), x" + count)
+    {
+        return mults->interp();
+    };
+
+    BENCHMARK("Eq::interp(), x" + count)
+    {
+        return eqs->interp();
+    };
+
+    BENCHMARK("If::interp(), x" + count)
+    {
+        return ifs->interp();
+    };
+
+    BENCHMARK("Let::interp(), x" + count)
+    {
+        return lets->interp();
+    };
+
+    BENCHMARK("Fun::interp(), x" + count)
+    {
+        // Only the outermost Fun is evaluated; the rest are its body
+        size_t acc = 0;
+        for (size_t i = 0; i < CHAIN_LENGTH; i++) {
+            acc += funs->interp() != nullptr;
+        }
+        return acc;
+    };
+
+    BENCHMARK("Call::interp(), x" + count)
+    {
+        return calls->interp();
+    };
+}
+
+TEST_CASE("ExtendedEnv::lookup()", "[!benchmark][micro]")
+{
+    for (int depth: {1, 8, 64, 512}) {
+        PTR(Env) env = Env::empty;
+        for (int i = 0; i < depth; i++) {
+            env = NEW(ExtendedEnv)("x" + std::to_string(i), NEW(NumVal)(i), env);
+        }
+
+        BENCHMARK("lookup(), depth " + std::to_string(depth))
+        {
+            return env->lookup("x0"); // the innermost binding: the whole chain
+        };
+    }
+}
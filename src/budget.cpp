@@ -0,0 +1,252 @@
+/**
+ * \file budget.cpp
+ * \brief Budget checkpoint and BudgetScope definitions
+ */
+
+#include <algorithm>    /* std::min, std::max */
+#include <utility>      /* std::move */
+
+#include "budget.h"
+
+thread_local int64_t budget_fuel = INT64_MAX;
+thread_local int64_t budget_allocations = INT64_MAX;
+thread_local int64_t budget_bytes = INT64_MAX;
+
+static thread_local BudgetScope *current_scope = nullptr;
+
+/**
+ * \brief Called when budget_fuel runs out: enforces the step limit, the
+ *        deadline, and cancellation, then hands out more fuel
+ *
+ * \throws budget_exceeded If any of them is exceeded
+ */
+void budget_checkpoint() {
+    if (current_scope == nullptr) {
+        budget_fuel = INT64_MAX;
+        return;
+    }
+    current_scope->check();
+}
+
+/**
+ * \brief Called when either allocation counter goes negative
+ *
+ * \throws budget_exceeded If a Budget is active and has nothing left
+ */
+void budget_overdrawn() {
+    if (current_scope == nullptr) {
+        budget_allocations = budget_bytes = INT64_MAX;
+        return;
+    }
+    current_scope->overdrawn();
+}
+
+/**
+ * \brief Takes up to want from pool
+ *
+ * \return What was taken; 0 once pool is empty
+ */
+static int64_t draw(std::atomic<int64_t> &pool, int64_t want) {
+    int64_t left = pool.load(std::memory_order_relaxed);
+    int64_t grant;
+    do {
+        grant = std::min(want, left);
+        if (grant <= 0) {
+            return 0;
+        }
+    } while (!pool.compare_exchange_weak(left, left - grant, std::memory_order_relaxed));
+    return grant;
+}
+
+/**
+ * \brief timeout from now, or the end of time if that is later than the
+ *        clock can count to
+ */
+static std::chrono::steady_clock::time_point deadline_after(std::chrono::milliseconds timeout) {
+    auto now = std::chrono::steady_clock::now();
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::time_point::max() - now);
+    return timeout < left ? now + timeout : std::chrono::steady_clock::time_point::max();
+}
+
+/**
+ * \brief Installs budget for this thread
+ *
+ * \param budget The limits; the deadline is timeout from now
+ */
+BudgetScope::BudgetScope(const Budget &budget)
+        : budget_m(budget),
+          deadline_m(deadline_after(budget.timeout)),
+          previous_m(current_scope),
+          previous_fuel_m(budget_fuel),
+          previous_allocations_m(budget_allocations),
+          previous_bytes_m(budget_bytes) {
+    current_scope = this;
+    budget_allocations = budget.max_allocations ? static_cast<int64_t>(budget.max_allocations)
+                                                : INT64_MAX;
+    budget_bytes = budget.max_bytes ? static_cast<int64_t>(budget.max_bytes) : INT64_MAX;
+    refuel(0);
+}
+
+/**
+ * \brief Installs a share of a Budget for this thread
+ *
+ * \param shared The pool, from share() on the thread that owns the Budget
+ *
+ * Nothing is drawn until the first step or allocation needs it. Within a
+ * scope that draws on the same pool, such as when a thread waiting on a
+ * task runs another, this thread's draws so far are simply carried on with.
+ */
+BudgetScope::BudgetScope(std::shared_ptr<SharedBudget> shared)
+        : budget_m(shared->budget),
+          deadline_m(shared->deadline),
+          shared_m(std::move(shared)),
+          previous_m(current_scope),
+          previous_fuel_m(budget_fuel),
+          previous_allocations_m(budget_allocations),
+          previous_bytes_m(budget_bytes) {
+    current_scope = this;
+    if (previous_m != nullptr && previous_m->shared_m == shared_m) {
+        return; // carry on with what this thread already drew
+    }
+    budget_fuel = 0;
+    budget_allocations = budget_m.max_allocations ? 0 : INT64_MAX;
+    budget_bytes = budget_m.max_bytes ? 0 : INT64_MAX;
+}
+
+/**
+ * \brief Gives back to the pool, if any, what this scope drew but didn't
+ *        use, and restores the enclosing Budget, if any
+ */
+BudgetScope::~BudgetScope() {
+    if (shared_m != nullptr && previous_m != nullptr && previous_m->shared_m == shared_m) {
+        current_scope = previous_m; // and it carries on with what's left
+        return;
+    }
+    if (shared_m != nullptr) {
+        if (budget_m.max_steps != 0 && budget_fuel > 0) {
+            shared_m->steps.fetch_add(budget_fuel, std::memory_order_relaxed);
+        }
+        if (budget_m.max_allocations != 0 && budget_allocations > 0) {
+            shared_m->allocations.fetch_add(budget_allocations, std::memory_order_relaxed);
+        }
+        if (budget_m.max_bytes != 0 && budget_bytes > 0) {
+            shared_m->bytes.fetch_add(budget_bytes, std::memory_order_relaxed);
+        }
+    }
+    current_scope = previous_m;
+    budget_fuel = previous_fuel_m;
+    budget_allocations = previous_allocations_m;
+    budget_bytes = previous_bytes_m;
+}
+
+/**
+ * \brief Hands out fuel up to the next checkpoint or the step limit,
+ *        whichever comes first
+ *
+ * \param taking Steps already being taken (1 at a checkpoint, which
+ *               budget_step() calls on behalf of a step)
+ * \return Whether there was any fuel left to hand out
+ */
+bool BudgetScope::refuel(int64_t taking) {
+    if (budget_m.unlimited()) {
+        budget_fuel = INT64_MAX;
+        return true;
+    }
+
+    int64_t grant = BUDGET_CHECK_INTERVAL;
+    if (budget_m.max_steps != 0 && shared_m != nullptr) {
+        grant = draw(shared_m->steps, grant);
+    } else if (budget_m.max_steps != 0) {
+        grant = static_cast<int64_t>(std::min(static_cast<uint64_t>(grant),
+                                              budget_m.max_steps - steps_granted_m));
+        steps_granted_m += grant;
+    }
+    if (grant == 0) {
+        return false;
+    }
+    budget_fuel = grant - taking;
+    return true;
+}
+
+/**
+ * \brief The checkpoint itself
+ *
+ * \throws budget_exceeded If a limit is exceeded
+ */
+void BudgetScope::check() {
+    if (!refuel(1)) {
+        budget_fuel = -1; // stays exhausted until the scope ends
+        throw budget_exceeded("interp(): step limit exceeded");
+    }
+    if (budget_m.cancel != nullptr && budget_m.cancel->load(std::memory_order_relaxed)) {
+        budget_fuel = -1;
+        throw budget_exceeded("interp(): cancelled");
+    }
+    if (budget_m.timeout.count() != 0 && std::chrono::steady_clock::now() >= deadline_m) {
+        budget_fuel = -1;
+        throw budget_exceeded("interp(): deadline exceeded");
+    }
+}
+
+/**
+ * \brief Called when either allocation counter goes negative: draws more
+ *        from the pool, if any
+ *
+ * \throws budget_exceeded If there is nothing left to draw
+ */
+void BudgetScope::overdrawn() {
+    if (shared_m != nullptr) {
+        if (budget_allocations < 0) {
+            budget_allocations += draw(shared_m->allocations, BUDGET_ALLOCATION_GRANT - budget_allocations);
+        }
+        if (budget_bytes < 0) {
+            budget_bytes += draw(shared_m->bytes, BUDGET_BYTES_GRANT - budget_bytes);
+        }
+        if ((budget_allocations | budget_bytes) >= 0) {
+            return;
+        }
+    }
+    // Keep failing until the scope ends: the next allocation throws too
+    budget_allocations = budget_bytes = -1;
+    throw budget_exceeded("interp(): allocation limit exceeded");
+}
+
+/**
+ * \brief Moves what this thread's Budget has left into a pool that other
+ *        threads can draw on with BudgetScopes of their own
+ *
+ * This thread's scope draws on the same pool from then on, so the limits
+ * hold across all of them together. The deadline and the cancel flag are
+ * the same for all of them.
+ *
+ * \return The pool, or nullptr if no Budget is active on this thread
+ */
+std::shared_ptr<SharedBudget> BudgetScope::share() {
+    BudgetScope *scope = current_scope;
+    if (scope == nullptr || scope->budget_m.unlimited()) {
+        return nullptr;
+    }
+    if (scope->shared_m != nullptr) {
+        return scope->shared_m;
+    }
+
+    std::shared_ptr<SharedBudget> shared = std::make_shared<SharedBudget>();
+    shared->budget = scope->budget_m;
+    shared->deadline = scope->deadline_m;
+    if (scope->budget_m.max_steps != 0) {
+        shared->steps = static_cast<int64_t>(scope->budget_m.max_steps - scope->steps_granted_m) +
+                        std::max<int64_t>(budget_fuel, 0);
+        budget_fuel = 0;
+    }
+    if (scope->budget_m.max_allocations != 0) {
+        shared->allocations = std::max<int64_t>(budget_allocations, 0);
+        budget_allocations = 0;
+    }
+    if (scope->budget_m.max_bytes != 0) {
+        shared->bytes = std::max<int64_t>(budget_bytes, 0);
+        budget_bytes = 0;
+    }
+    scope->shared_m = shared;
+    return shared;
+}
@@ -0,0 +1,141 @@
+/**
+ * \file budget.h
+ * \brief Per-evaluation resource limits: steps, allocations, a deadline, and
+ *        cooperative cancellation
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>      /* size_t */
+#include <cstdint>      /* int64_t, uint64_t */
+#include <memory>       /* std::shared_ptr */
+#include <stdexcept>
+
+/**
+ * \class budget_exceeded
+ * \brief Thrown when an evaluation runs out of any part of its Budget
+ *
+ * Derives from std::runtime_error so that existing handlers still report it,
+ * but can be caught separately to tell "too expensive" apart from "wrong".
+ */
+class budget_exceeded : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * \struct Budget
+ * \brief Limits for one evaluation; a zero (or null) field means unlimited
+ */
+struct Budget {
+    uint64_t max_steps = 0;                 ///< Expr::interp() calls
+    uint64_t max_allocations = 0;           ///< Vals and Envs created
+    uint64_t max_bytes = 0;                 ///< Total size of those objects
+    std::chrono::milliseconds timeout{0};   ///< Wall-clock time
+    const std::atomic<bool> *cancel = nullptr; ///< Abort once this is true
+
+    bool unlimited() const {
+        return max_steps == 0 && max_allocations == 0 && max_bytes == 0 &&
+               timeout.count() == 0 && cancel == nullptr;
+    }
+};
+
+/**
+ * \struct SharedBudget
+ * \brief What is left of one Budget, for several threads to draw on at once
+ *
+ * Each thread draws steps BUDGET_CHECK_INTERVAL at a time, and allocations
+ * and bytes BUDGET_ALLOCATION_GRANT and BUDGET_BYTES_GRANT at a time, and
+ * gives back what it didn't use when its scope ends. A limit is exceeded
+ * when a thread needs more and the pool is empty, so it can trip early by
+ * what the other threads are holding, but is never overrun.
+ */
+struct SharedBudget {
+    Budget budget;                                  ///< The limits being shared
+    std::chrono::steady_clock::time_point deadline; ///< Common to every thread
+    std::atomic<int64_t> steps{0};                  ///< Not yet handed out
+    std::atomic<int64_t> allocations{0};
+    std::atomic<int64_t> bytes{0};
+};
+
+/*
+ * The hot-path counters count down, and are huge while no Budget is active,
+ * so the checks below are a decrement and one never-taken branch. The
+ * clock and the cancel flag are only read at checkpoints, every
+ * BUDGET_CHECK_INTERVAL steps.
+ */
+static const int64_t BUDGET_CHECK_INTERVAL = 4096;
+static const int64_t BUDGET_ALLOCATION_GRANT = 1024;
+static const int64_t BUDGET_BYTES_GRANT = 64 * 1024;
+
+extern thread_local int64_t budget_fuel;        ///< Steps to next checkpoint
+extern thread_local int64_t budget_allocations; ///< Allocations left
+extern thread_local int64_t budget_bytes;       ///< Bytes left
+
+void budget_checkpoint();
+
+void budget_overdrawn();
+
+/**
+ * \brief Counts one evaluation step; called at the start of every interp()
+ */
+inline void budget_step() {
+    if (__builtin_expect(--budget_fuel < 0, 0)) {
+        budget_checkpoint();
+    }
+}
+
+/**
+ * \brief Counts one allocation of bytes bytes; called by Val and Env
+ *        constructors
+ */
+inline void budget_allocate(size_t bytes) {
+    budget_allocations--;
+    budget_bytes -= static_cast<int64_t>(bytes);
+    if (__builtin_expect((budget_allocations | budget_bytes) < 0, 0)) {
+        budget_overdrawn();
+    }
+}
+
+/**
+ * \class BudgetScope
+ * \brief Applies a Budget to every evaluation on this thread while in scope
+ *
+ * Scopes nest: an inner scope replaces the enclosing Budget, which is
+ * restored (with whatever it had left) on destruction. A scope made from a
+ * SharedBudget draws on the same pool as every other such scope, on any
+ * thread.
+ */
+class BudgetScope {
+public:
+
+    explicit BudgetScope(const Budget &budget);
+
+    explicit BudgetScope(std::shared_ptr<SharedBudget> shared);
+
+    ~BudgetScope();
+
+    BudgetScope(const BudgetScope &) = delete;
+
+    BudgetScope &operator=(const BudgetScope &) = delete;
+
+    void check();
+
+    void overdrawn();
+
+    static std::shared_ptr<SharedBudget> share();
+
+private:
+
+    Budget budget_m;
+    std::chrono::steady_clock::time_point deadline_m;
+    uint64_t steps_granted_m = 0;   ///< Fuel handed out so far
+    std::shared_ptr<SharedBudget> shared_m; ///< The pool, if drawing on one
+
+    BudgetScope *previous_m;
+    int64_t previous_fuel_m, previous_allocations_m, previous_bytes_m;
+
+    bool refuel(int64_t taking);
+};
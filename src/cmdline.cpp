@@ -3,15 +3,38 @@
  * \brief Command line argument-handling function definitions
  */
 
+#include <atomic>   /* std::atomic (for --serve) */
+#include <cerrno>   /* errno, ERANGE */
+#include <csignal>  /* std::signal */
+#include <cstdlib>  /* std::strtoull */
+#include <fstream>  /* std::ifstream */
 #include <iostream> /* Console I/O */
+#include <memory>   /* std::unique_ptr (for --trace) */
+#include <unistd.h> /* isatty */
 
-#define CATCH_CONFIG_RUNNER /* Don't move either of these */
+#define CATCH_CONFIG_RUNNER /* Don't move any of these */
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 
 #include "catch.h"          /* Catch2 testing framework */
 
+#include "allocations.h"
+#include "batch.h"
+#include "budget.h"
 #include "cmdline.h"
+#include "columnar.h"
 #include "Expr.h"
+#include "flat.h"
+#include "gc.h"
+#include "memo.h"
+#include "parallel.h"
 #include "parse.h"
+#include "profile.h"
+#include "repl.h"
+#include "serialize.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
+#include "Type.h"
 #include "Val.h"
 
 /**
@@ -21,55 +44,197 @@ void if_help();
 
 void if_test(char **argv);
 
+void if_bench(char *program, int argc, char **argv);
+
 void if_interp();
 
+void if_lazy();
+
+void if_flat();
+
 void if_print();
 
 void if_pretty_print();
 
+void if_typecheck();
+
+void if_columns(const char *path);
+
+void if_batch(const char *path, const Budget &budget);
+
+void if_parallel();
+
+void if_serve(const char *path, const Budget &budget);
+
+void if_repl(const Budget &budget);
+
+void if_profile(const char *path);
+
+void if_stats();
+
 /**
- * std::cin helper
+ * std::cin helpers
  * */
 void handle_cin(PTR(Expr) &e);
 
+std::string read_cin();
+
 /**
  * \brief Interprets command line arguments passed from a main() function
  *
  * \param argc The command line argument count
  * \param argv The command line argument vector
- * \return An int return code to return to a main() function
+ * \return An int return code to return to a main() function: 1 on an error,
+ *         2 if an evaluation exceeded its budget
  *
- * Supports handling of --help, --test, --interp, --print, and --pretty-print
- * command line arguments/flags.
+ * Supports handling of --help, --test, --bench, --interp, --lazy, --flat, --print,
+ * --pretty-print, --typecheck, --columns FILE, --batch FILE, --parallel,
+ * --serve SOCKET, --repl, --profile FILE, and --stats command line arguments/flags, and the
+ * --max-steps N, --max-allocs N, --max-bytes N, and --timeout MS options,
+ * which limit the evaluations of the flags that follow them (see Budget),
+ * the --trace FILE option, which records the flags that follow it (see
+ * Tracer) and writes FILE once they are done, the --memo N option, which
+ * caches up to N function call results for the flags that follow it (see
+ * memo.h) and reports the hit rate once they are done, the --cache-dir DIR
+ * option, which keeps the parsed trees of the flags that follow it in DIR
+ * (see parse_cached()), and the --allocs option, which reports allocations
+ * by type once they are done (see AllocationRegistry; only with
+ * TRACK_ALLOCATIONS).
  */
 int use_arguments(int argc, char **argv) {
+    Budget budget;
+    std::unique_ptr<Tracer> tracer;
+    std::string trace_path;
+    bool report_allocations = false;
+    int rc = 0;
+
     try {
         for (int i = 1; i < argc; i++) {
             std::string arg = argv[i];
 
+            if (arg == "--max-steps") {
+                budget.max_steps = option_value(argc, argv, i, INT64_MAX);
+                continue;
+            } else if (arg == "--max-allocs") {
+                budget.max_allocations = option_value(argc, argv, i, INT64_MAX);
+                continue;
+            } else if (arg == "--max-bytes") {
+                budget.max_bytes = option_value(argc, argv, i, INT64_MAX);
+                continue;
+            } else if (arg == "--timeout") {
+                budget.timeout = std::chrono::milliseconds(option_value(argc, argv, i, INT64_MAX));
+                continue;
+            } else if (arg == "--trace") {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("--trace: missing FILE");
+                }
+                trace_path = argv[++i];
+                tracer.reset(new Tracer());
+                Tracer::active = tracer.get();
+                continue;
+            } else if (arg == "--memo") {
+                memo_configure(option_value(argc, argv, i));
+                eval_stats.memo_hits = eval_stats.memo_misses = eval_stats.memo_evictions = 0;
+                continue;
+            } else if (arg == "--cache-dir") {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("--cache-dir: missing DIR");
+                }
+                parse_cache_configure(argv[++i]);
+                continue;
+            } else if (arg == "--allocs") {
+                if (!TRACK_ALLOCATIONS) {
+                    throw std::runtime_error("--allocs: rebuild with TRACK_ALLOCATIONS=1");
+                }
+                report_allocations = true;
+                AllocationRegistry::instance().reset();
+                continue;
+            }
+
+            BudgetScope scope(budget);
             if (arg == "--help") {
                 if_help();
             } else if (arg == "--test") {
                 if_test(argv);
+            } else if (arg == "--bench") {
+                if_bench(argv[0], argc - i - 1, argv + i + 1);
+                break; // The rest are Catch2's
             } else if (arg == "--interp") {
                 if_interp();
+            } else if (arg == "--lazy") {
+                if_lazy();
+            } else if (arg == "--flat") {
+                if_flat();
             } else if (arg == "--print") {
                 if_print();
             } else if (arg == "--pretty-print") {
                 if_pretty_print();
+            } else if (arg == "--typecheck") {
+                if_typecheck();
+            } else if (arg == "--columns") {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("--columns: missing FILE");
+                }
+                if_columns(argv[++i]);
+            } else if (arg == "--batch") {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("--batch: missing FILE");
+                }
+                if_batch(argv[++i], budget);
+            } else if (arg == "--parallel") {
+                if_parallel();
+            } else if (arg == "--serve") {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("--serve: missing SOCKET");
+                }
+                if_serve(argv[++i], budget);
+            } else if (arg == "--repl") {
+                if_repl(budget);
+            } else if (arg == "--profile") {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("--profile: missing FILE");
+                }
+                if_profile(argv[++i]);
+            } else if (arg == "--stats") {
+                if_stats();
             } else {
                 std::cerr << "Invalid argument: run program with "
                              "\"--help\" flag to list valid arguments"
                           << std::endl;
             }
+            memo_clear();
+            gc_collect();
         }
     }
+    catch (const budget_exceeded &exception) {
+        std::cerr << "ERROR: " << exception.what() << std::endl;
+        rc = 2;
+    }
     catch (const std::runtime_error &exception) {
         std::cerr << "ERROR: " << exception.what() << std::endl;
-        return 1;
+        rc = 1;
     }
 
-    return 0;
+    if (tracer != nullptr) {
+        Tracer::active = nullptr;
+        std::ofstream file(trace_path);
+        tracer->write(file);
+        if (!file) {
+            std::cerr << "ERROR: --trace: cannot write " << trace_path << std::endl;
+            rc = rc ? rc : 1;
+        }
+    }
+    if (memo_capacity() != 0) {
+        uint64_t calls = eval_stats.memo_hits + eval_stats.memo_misses;
+        std::cerr << "\nmemo: " << eval_stats.memo_hits << " hits, " << eval_stats.memo_misses
+                  << " misses (" << (calls ? 100 * eval_stats.memo_hits / calls : 0) << "% hit rate), "
+                  << eval_stats.memo_evictions << " evictions" << std::endl;
+    }
+    if (report_allocations) {
+        std::cerr << "\n";
+        AllocationRegistry::instance().write(std::cerr);
+    }
+    return rc;
 }
 
 /**
@@ -79,9 +244,29 @@ void if_help() {
     std::cout <<
               "--help:\t\tlists valid arguments"
               "\n--test:\t\truns tests"
+              "\n--bench [ARGS]:\truns benchmarks; ARGS go to Catch2 (e.g. \"[micro] -r xml\")"
               "\n--interp:\tsimplifies a user-inputted expression"
+              "\n--lazy:\t\tsimplifies a user-inputted expression, evaluating _let values and _fun arguments only when used"
+              "\n--flat:\t\tsimplifies a user-inputted expression from a compact array-based copy of its tree"
               "\n--print:\tprints a user-inputted expression as a basic string"
               "\n--pretty-print:\tprints a user-inputted expression as a stylized string"
+              "\n--typecheck:\tinfers a user-inputted expression's type, then simplifies it"
+              "\n--columns FILE:\tsimplifies a user-inputted expression once per row of FILE"
+              "\n--batch FILE:\tsimplifies each line (or ';'-separated record) of FILE (\"-\" for stdin) in parallel"
+              "\n--parallel:\tsimplifies a user-inputted expression, evaluating large independent subexpressions concurrently"
+              "\n--serve SOCKET:\tanswers framed interp/print/pretty-print requests on a Unix domain socket"
+              "\n\nOptions, given before the flags they apply to:"
+              "\n--max-steps N:\tstops any evaluation after N interp() steps"
+              "\n--max-allocs N:\tstops any evaluation after N value/environment allocations"
+              "\n--max-bytes N:\tstops any evaluation after allocating N bytes of values/environments"
+              "\n--timeout MS:\tstops any evaluation after MS milliseconds"
+              "\n--memo N:\tcaches up to N results of calls with number/boolean arguments, reporting hit rates on exit"
+              "\n--cache-dir DIR:\tkeeps parsed expressions in DIR, keyed by their source, and loads them instead of parsing"
+              "\n--allocs:\tcounts allocations by type, reporting them on exit (TRACK_ALLOCATIONS=1 builds only)"
+              "\n--trace FILE:\twrites Chrome trace-event JSON of the phases, and of calls over 100us, to FILE"
+              "\n--repl:\t\tsimplifies expressions line by line; \"_def name = expr\" defines name for later lines"
+              "\n--profile FILE:\tsimplifies a user-inputted expression, timing each _let, _fun, and call; writes folded stacks to FILE"
+              "\n--stats:\tsimplifies a user-inputted expression, then prints phase times, allocations, and depths"
               << std::endl;
 }
 
@@ -99,6 +284,36 @@ void if_test(char **argv) {
     }
 }
 
+/**
+ * \brief Handles "--bench" argument
+ *
+ * \param program The program's name, argv[0]
+ * \param argc The number of arguments after "--bench"
+ * \param argv The arguments after "--bench", passed on to Catch2
+ *
+ * Runs the Catch2 benchmarks, which are hidden from "--test" by their
+ * "[!benchmark]" tag. The arguments can narrow them down by tag (e.g.
+ * "[micro]") and choose a reporter (e.g. "-r xml -o FILE" for
+ * machine-readable results); without a tag, every benchmark runs.
+ */
+void if_bench(char *program, int argc, char **argv) {
+    char tag[] = "[!benchmark]";
+    std::vector<char *> bench_argv{program};
+    bool has_tag = false;
+    for (int i = 0; i < argc; i++) {
+        bench_argv.push_back(argv[i]);
+        has_tag = has_tag || argv[i][0] == '[';
+    }
+    if (!has_tag) {
+        bench_argv.push_back(tag);
+    }
+
+    int bench_session_rc = Catch::Session().run((int) bench_argv.size(), bench_argv.data());
+    if (bench_session_rc != 0) {
+        exit(1);
+    }
+}
+
 /**
  * \brief Handles the "--interp" command line argument
  *
@@ -108,10 +323,59 @@ void if_test(char **argv) {
 void if_interp() {
     PTR(Expr) e;
     handle_cin(e);
-    std::cout << "\ninterp() result:\t" << e->interp()->to_string() << std::endl;
+    PTR(Val) res;
+    {
+        TraceSpan span("interp");
+        res = e->interp();
+    }
+    TraceSpan span("print");
+    std::cout << "\ninterp() result:\t" << res->to_string() << std::endl;
     // std::cout << e->interp()->to_string() << std::endl; // this instead for debugging test_msdscript
 }
 
+/**
+ * \brief Handles the "--lazy" command line argument
+ *
+ * Parses a user-inputted expression and simplifies it like "--interp", but
+ * call-by-need: _let values and the arguments of calls to _funs are only
+ * evaluated when a variable bound to them is first used (see LazyEval).
+ */
+void if_lazy() {
+    PTR(Expr) e;
+    handle_cin(e);
+    PTR(Val) res;
+    {
+        TraceSpan span("interp");
+        LazyEval lazy;
+        res = e->interp();
+    }
+    TraceSpan span("print");
+    std::cout << "\nlazy interp() result:\t" << res->to_string() << std::endl;
+}
+
+/**
+ * \brief Handles the "--flat" command line argument
+ *
+ * Parses a user-inputted expression, stores it as a FlatExpr, releases the
+ * Expr tree, and simplifies the FlatExpr.
+ */
+void if_flat() {
+    PTR(FlatExpr) flat;
+    {
+        PTR(Expr) e;
+        handle_cin(e);
+        TraceSpan span("flatten");
+        flat = FlatExpr::flatten(e);
+    }
+    PTR(Val) res;
+    {
+        TraceSpan span("interp");
+        res = flat->interp();
+    }
+    TraceSpan span("print");
+    std::cout << "\nflat interp() result:\t" << res->to_string() << std::endl;
+}
+
 /**
  * \brief Handles the "--print" command line argument
  *
@@ -121,6 +385,7 @@ void if_interp() {
 void if_print() {
     PTR(Expr) e;
     handle_cin(e);
+    TraceSpan span("print");
     std::cout << "\nprint() result:\t" << e->to_string() << std::endl;
     // std::cout << e->to_string() << std::endl; // this instead for debugging test_msdscript
 }
@@ -134,15 +399,264 @@ void if_print() {
 void if_pretty_print() {
     PTR(Expr) e;
     handle_cin(e);
+    TraceSpan span("pretty_print");
     std::cout << "\npretty_print() result:\t" << e->to_pretty_string() << std::endl;
     // std::cout << e->to_pretty_string() << std::endl; // this instead for debugging test_msdscript
 }
 
+/**
+ * \brief Handles the "--typecheck" command line argument
+ *
+ * Parses a user-inputted expression and infers its type, rejecting
+ * ill-typed expressions before any evaluation happens. Well-typed expressions
+ * are then simplified using interp()'s unchecked fast paths, and the result
+ * is printed along with its type.
+ */
+void if_typecheck() {
+    PTR(Expr) e;
+    handle_cin(e);
+    PTR(Type) type;
+    {
+        TraceSpan span("typecheck");
+        type = e->typecheck();
+    }
+    PTR(Val) res;
+    {
+        TraceSpan span("interp");
+        res = e->interp();
+    }
+    TraceSpan span("print");
+    std::cout << "\ntypecheck() result:\t" << res->to_string()
+              << " : " << type->to_string() << std::endl;
+}
+
+/**
+ * \brief Handles the "--columns FILE" command line argument
+ *
+ * \param path A CSV file whose header names the expression's free variables
+ *             and whose rows give integer values for them
+ *
+ * Parses a user-inputted expression and simplifies it once for every row of
+ * the file, printing one result per line. Evaluation is column-at-a-time
+ * where the expression allows it (see interp_columns()).
+ */
+void if_columns(const char *path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error(std::string("--columns: cannot open ") + path);
+    }
+    ColumnTable table = read_columns(file);
+
+    PTR(Expr) e;
+    handle_cin(e);
+    std::cout << "\ninterp_columns() result:" << std::endl;
+    for (const std::string &res: interp_columns(e, table)) {
+        std::cout << res << '\n';
+    }
+    std::cout << std::flush;
+}
+
+/**
+ * \brief Handles the "--batch FILE" command line argument
+ *
+ * \param path A file of independent programs, or "-" to read them from
+ *             std::cin
+ * \param budget Limits for each record
+ *
+ * Splits the input into records (see split_records()), simplifies them on
+ * a ThreadPool with one thread per core, and prints one result per line in
+ * input order. A record that fails prints "ERROR: " and its message in its
+ * place.
+ */
+void if_batch(const char *path, const Budget &budget) {
+    std::vector<std::string> records;
+    if (std::string(path) == "-") {
+        records = split_records(std::cin);
+    } else {
+        std::ifstream file(path);
+        if (!file) {
+            throw std::runtime_error(std::string("--batch: cannot open ") + path);
+        }
+        records = split_records(file);
+    }
+
+    ThreadPool pool;
+    for (const std::string &res: run_batch(records, pool, budget)) {
+        std::cout << res << '\n';
+    }
+    std::cout << std::flush;
+}
+
+/**
+ * \brief Handles the "--parallel" command line argument
+ *
+ * Parses a user-inputted expression and simplifies it like "--interp", but
+ * on one thread per core, forking large independent subexpressions (see
+ * parallel_interp()).
+ */
+void if_parallel() {
+    PTR(Expr) e;
+    handle_cin(e);
+    PTR(Val) res;
+    {
+        TraceSpan span("parallel_interp");
+        res = parallel_interp(e);
+    }
+    TraceSpan span("print");
+    std::cout << "\nparallel_interp() result:\t" << res->to_string() << std::endl;
+}
+
+static std::atomic<bool> stop_serving(false); ///< Set by SIGINT/SIGTERM
+
+static void handle_stop_signal(int) {
+    stop_serving = true;
+}
+
+/**
+ * \brief Handles the "--serve SOCKET" command line argument
+ *
+ * \param path Where to create the Unix domain socket
+ * \param budget Limits for each request
+ *
+ * Serves requests (see serve()) with one worker per core until interrupted,
+ * then removes the socket.
+ */
+void if_serve(const char *path, const Budget &budget) {
+    std::signal(SIGINT, handle_stop_signal);
+    std::signal(SIGTERM, handle_stop_signal);
+
+    std::cerr << "Serving on " << path << std::endl;
+    serve(path, 0, &stop_serving, budget);
+}
+
+/**
+ * \brief Handles the "--repl" command line argument
+ *
+ * Reads and simplifies one entry per line until EOF, keeping "_def"
+ * definitions in a Session. Prompts only when std::cin is a terminal.
+ *
+ * \param budget Limits for each entry
+ */
+void if_repl(const Budget &budget) {
+    Session session;
+    session.budget_m = budget;
+    session.loop(std::cin, std::cout, isatty(STDIN_FILENO));
+}
+
+/**
+ * \brief Handles the "--profile FILE" command line argument
+ *
+ * \param path Where to write the folded stacks (see Profiler::write_folded())
+ *
+ * Parses a user-inputted expression and simplifies an instrumented copy of
+ * it, then prints a per-construct summary after the result.
+ */
+void if_profile(const char *path) {
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error(std::string("--profile: cannot open ") + path);
+    }
+
+    PTR(Expr) e;
+    handle_cin(e);
+    Profiler profiler;
+    PTR(Val) res = profiler.instrument(e)->interp();
+
+    std::cout << "\ninterp() result:\t" << res->to_string() << "\n\n";
+    profiler.write_summary(std::cout);
+    std::cout << std::flush;
+    profiler.write_folded(file);
+}
+
+/**
+ * \brief Handles the "--stats" command line argument
+ *
+ * Reads, parses, simplifies, and prints a user-inputted expression like
+ * "--interp", timing each phase, then prints the evaluation's counters (see
+ * EvalStats).
+ */
+void if_stats() {
+    StatsReport report;
+    auto start = std::chrono::steady_clock::now();
+    std::string src = read_cin();
+    auto read = std::chrono::steady_clock::now();
+    PTR(Expr) e = parse_cached(src);
+    auto parsed = std::chrono::steady_clock::now();
+
+    eval_stats = EvalStats();
+    PTR(Val) res = e->interp();
+    auto evaluated = std::chrono::steady_clock::now();
+
+    std::cout << "\ninterp() result:\t" << res->to_string() << std::endl;
+    auto printed = std::chrono::steady_clock::now();
+    report.nodes_parsed = e->size_m;
+    res = nullptr;
+    e = nullptr;
+    memo_clear();
+    gc_collect();
+    report.eval_counts = eval_stats;
+
+    report.read = read - start;
+    report.parse = parsed - read;
+    report.eval = evaluated - parsed;
+    report.print = printed - evaluated;
+    std::cout << "\n";
+    report.write(std::cout);
+    std::cout << std::flush;
+}
+
+/**
+ * \brief Reads the numeric argument of an option such as "--max-steps N"
+ *
+ * \param argc The command line argument count
+ * \param argv The command line argument vector
+ * \param i The option's index; advanced past its argument
+ * \param max The largest value the option takes (INT64_MAX for Budget's
+ *            limits, which count down in signed counters)
+ * \return The argument
+ *
+ * \throws std::runtime_error If the argument is missing, not a number, or
+ *         more than max
+ */
+uint64_t option_value(int argc, char **argv, int &i, uint64_t max) {
+    std::string option = argv[i];
+    if (i + 1 >= argc) {
+        throw std::runtime_error(option + ": missing value");
+    }
+
+    std::string value = argv[++i];
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos) {
+        throw std::runtime_error(option + ": invalid value");
+    }
+
+    errno = 0;
+    unsigned long long n = std::strtoull(value.c_str(), nullptr, 10);
+    if (errno == ERANGE || n > max) {
+        throw std::runtime_error(option + ": value out of range");
+    }
+    return n;
+}
+
 /**
  * \brief Helper function for argument functions that request user input.
+ *
+ * Parses the input through the parse cache, if --cache-dir set one (see
+ * parse_cached()).
  */
 void handle_cin(PTR(Expr) &e) {
+    std::string src = read_cin();
+    TraceSpan span("parse_expr");
+    e = parse_cached(src);
+}
+
+/**
+ * \brief Prompts for and reads std::cin until EOF
+ *
+ * \return The input, without its final newline
+ */
+std::string read_cin() {
     std::cout << "Enter an expression:\t"; // comment out for debugging test_msdscript
+    TraceSpan span("read");
 
     std::string user_string;
     std::string line;
@@ -155,5 +669,5 @@ void handle_cin(PTR(Expr) &e) {
         user_string.pop_back();
     } // Remove eof
 
-    e = parse_expr(user_string);
+    return user_string;
 }
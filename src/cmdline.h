@@ -5,4 +5,8 @@
 
 #pragma once
 
+#include <cstdint>  /* uint64_t, UINT64_MAX */
+
 int use_arguments(int argc, char **argv);
+
+uint64_t option_value(int argc, char **argv, int &i, uint64_t max = UINT64_MAX);
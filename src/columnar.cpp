@@ -0,0 +1,498 @@
+/**
+ * \file columnar.cpp
+ * \brief Column-at-a-time evaluation of the Add/Mult/Eq/If subset of Exprs
+ *
+ * interp_columns() compiles the arithmetic skeleton of an Expr -- Num, Bool,
+ * column Vars, Add, Mult, Eq, and If -- into a short straight-line program
+ * whose every instruction is a loop over a chunk of rows. On x86-64 CPUs
+ * that support it, those loops are AVX2 kernels (selected at runtime);
+ * elsewhere they are plain scalar loops. Any other node (Let, Fun, Call, ...)
+ * becomes a "scalar" instruction that calls Expr::interp() once per row, and
+ * so does an If with one in either branch, since a compiled If computes both
+ * branches. A chunk whose 64-bit arithmetic overflows is recomputed row by
+ * row with Expr::interp(), which promotes to BigNums as usual.
+ */
+
+#include <algorithm>    /* std::any_of, std::copy, std::fill */
+#include <cerrno>       /* errno, ERANGE */
+#include <cstdlib>      /* std::strtoll */
+#include <sstream>      /* std::stringstream */
+#include <stdexcept>    /* std::runtime_error */
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+# define COLUMNAR_AVX2 1
+# include <immintrin.h>  /* AVX2 intrinsics */
+#else
+# define COLUMNAR_AVX2 0
+#endif
+
+#include "columnar.h"
+#include "Env.h"
+#include "Type.h"
+#include "Val.h"
+
+static const size_t CHUNK = 1024; ///< Rows evaluated per kernel call
+
+/**
+ * \typedef op_t
+ * \brief The instructions of a compiled column program
+ */
+typedef enum {
+    OP_CONST,   ///< Broadcast value
+    OP_LOAD,    ///< Copy column a
+    OP_ADD,     ///< slot a + slot b
+    OP_MULT,    ///< slot a * slot b
+    OP_EQ,      ///< slot a == slot b
+    OP_IF,      ///< slot a ? slot b : slot c
+    OP_SCALAR,  ///< expr->interp() for each row
+} op_t;
+
+/**
+ * \struct Instr
+ * \brief One instruction; instruction i writes its results to slot i
+ */
+struct Instr {
+    op_t op;
+    bool is_bool;       ///< Lanes hold 0/1 booleans rather than ints
+    int a, b, c;        ///< Operand slots (or column index, for OP_LOAD)
+    int64_t value;      ///< Constant, for OP_CONST
+    PTR(Expr) expr;     ///< Expression, for OP_SCALAR
+};
+
+/*
+ * Kernels. Each returns false if any lane overflowed 64 bits, in which case
+ * the chunk's results are discarded.
+ */
+static bool add_scalar(const int64_t *a, const int64_t *b, int64_t *out,
+                       size_t n) {
+    uint64_t overflow = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t x = a[i], y = b[i];
+        uint64_t s = x + y;
+        overflow |= (x ^ s) & (y ^ s);
+        out[i] = static_cast<int64_t>(s);
+    }
+    return (overflow >> 63) == 0;
+}
+
+static bool mult_scalar(const int64_t *a, const int64_t *b, int64_t *out,
+                        size_t n) {
+    bool overflow = false;
+    for (size_t i = 0; i < n; i++) {
+        overflow |= __builtin_mul_overflow(a[i], b[i], &out[i]);
+    }
+    return !overflow;
+}
+
+static void eq_scalar(const int64_t *a, const int64_t *b, int64_t *out,
+                      size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = a[i] == b[i];
+    }
+}
+
+static void select_scalar(const int64_t *test, const int64_t *a,
+                          const int64_t *b, int64_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = test[i] ? a[i] : b[i];
+    }
+}
+
+#if COLUMNAR_AVX2
+
+static bool use_avx2() {
+    static const bool res = __builtin_cpu_supports("avx2");
+    return res;
+}
+
+__attribute__((target("avx2")))
+static bool add_avx2(const int64_t *a, const int64_t *b, int64_t *out,
+                     size_t n) {
+    __m256i overflow = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+        __m256i s = _mm256_add_epi64(x, y);
+        overflow = _mm256_or_si256(overflow, _mm256_and_si256(_mm256_xor_si256(x, s),
+                                                              _mm256_xor_si256(y, s)));
+        _mm256_storeu_si256((__m256i *) (out + i), s);
+    }
+    bool ok = _mm256_movemask_pd(_mm256_castsi256_pd(overflow)) == 0;
+    return add_scalar(a + i, b + i, out + i, n - i) && ok;
+}
+
+/*
+ * AVX2 has no 64x64-bit multiply, but _mm256_mul_epi32 is exact when both
+ * operands fit in 32 bits, which is checked lane by lane.
+ */
+__attribute__((target("avx2")))
+static bool mult_avx2(const int64_t *a, const int64_t *b, int64_t *out,
+                      size_t n) {
+    const __m256i max32 = _mm256_set1_epi64x(INT32_MAX);
+    const __m256i min32 = _mm256_set1_epi64x(INT32_MIN);
+    __m256i wide = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+        wide = _mm256_or_si256(wide, _mm256_or_si256(_mm256_cmpgt_epi64(x, max32),
+                                                     _mm256_cmpgt_epi64(min32, x)));
+        wide = _mm256_or_si256(wide, _mm256_or_si256(_mm256_cmpgt_epi64(y, max32),
+                                                     _mm256_cmpgt_epi64(min32, y)));
+        _mm256_storeu_si256((__m256i *) (out + i), _mm256_mul_epi32(x, y));
+    }
+    bool ok = _mm256_testz_si256(wide, wide);
+    return mult_scalar(a + i, b + i, out + i, n - i) && ok;
+}
+
+__attribute__((target("avx2")))
+static void eq_avx2(const int64_t *a, const int64_t *b, int64_t *out,
+                    size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+        __m256i mask = _mm256_cmpeq_epi64(x, y); // -1 or 0
+        _mm256_storeu_si256((__m256i *) (out + i), _mm256_sub_epi64(zero, mask));
+    }
+    eq_scalar(a + i, b + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void select_avx2(const int64_t *test, const int64_t *a,
+                        const int64_t *b, int64_t *out, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i t = _mm256_loadu_si256((const __m256i *) (test + i));
+        __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+        __m256i is_false = _mm256_cmpeq_epi64(t, zero);
+        _mm256_storeu_si256((__m256i *) (out + i), _mm256_blendv_epi8(x, y, is_false));
+    }
+    select_scalar(test + i, a + i, b + i, out + i, n - i);
+}
+
+#endif /* COLUMNAR_AVX2 */
+
+static bool kernel_add(const int64_t *a, const int64_t *b, int64_t *out,
+                       size_t n) {
+#if COLUMNAR_AVX2
+    if (use_avx2()) {
+        return add_avx2(a, b, out, n);
+    }
+#endif
+    return add_scalar(a, b, out, n);
+}
+
+static bool kernel_mult(const int64_t *a, const int64_t *b, int64_t *out,
+                        size_t n) {
+#if COLUMNAR_AVX2
+    if (use_avx2()) {
+        return mult_avx2(a, b, out, n);
+    }
+#endif
+    return mult_scalar(a, b, out, n);
+}
+
+static void kernel_eq(const int64_t *a, const int64_t *b, int64_t *out,
+                      size_t n) {
+#if COLUMNAR_AVX2
+    if (use_avx2()) {
+        eq_avx2(a, b, out, n);
+        return;
+    }
+#endif
+    eq_scalar(a, b, out, n);
+}
+
+static void kernel_select(const int64_t *test, const int64_t *a,
+                          const int64_t *b, int64_t *out, size_t n) {
+#if COLUMNAR_AVX2
+    if (use_avx2()) {
+        select_avx2(test, a, b, out, n);
+        return;
+    }
+#endif
+    select_scalar(test, a, b, out, n);
+}
+
+/**
+ * \brief Binds every column to its value in one row
+ *
+ * \param table The bindings
+ * \param row The row to bind
+ * \return An Env for Expr::interp()
+ */
+static PTR(Env) row_env(const ColumnTable &table, size_t row) {
+    PTR(Env) env = Env::empty;
+    for (size_t k = 0; k < table.names.size(); k++) {
+        env = NEW(ExtendedEnv)(table.names[k],
+                               NEW(NumVal)(table.columns[k][row]), env);
+    }
+    return env;
+}
+
+/**
+ * \brief Appends a scalar instruction that computes e with Expr::interp()
+ *
+ * \return Its slot, or -1 if e's value is not an int or bool
+ */
+static int compile_scalar(PTR(Expr) e, PTR(TypeEnv) tenv, std::vector<Instr> &code) {
+    PTR(Type) type = e->typecheck(tenv);
+    if (CAST(IntType)(type) == nullptr && CAST(BoolType)(type) == nullptr) {
+        return -1;
+    }
+    code.push_back({OP_SCALAR, CAST(BoolType)(type) != nullptr, -1, -1, -1, 0, e});
+    return static_cast<int>(code.size() - 1);
+}
+
+/**
+ * \brief Appends the instructions that compute e to code
+ *
+ * \param e The expression to compile
+ * \param table The bindings (for column Vars)
+ * \param tenv Every column bound to int (for scalar subexpressions)
+ * \param code The program being built
+ * \return The slot holding e's results, or -1 if e's value is not an int or
+ *         bool that fits in 64 bits
+ */
+static int compile(PTR(Expr) e, const ColumnTable &table, PTR(TypeEnv) tenv,
+                   std::vector<Instr> &code) {
+    Instr instr = {OP_SCALAR, false, -1, -1, -1, 0, nullptr};
+
+    PTR(Num) num = CAST(Num)(e);
+    PTR(Bool) boolean = CAST(Bool)(e);
+    PTR(Var) var = CAST(Var)(e);
+    PTR(Add) add = CAST(Add)(e);
+    PTR(Mult) mult = CAST(Mult)(e);
+    PTR(Eq) eq = CAST(Eq)(e);
+    PTR(If) cond = CAST(If)(e);
+
+    if (num != nullptr && num->int_m.is_small()) {
+        instr.op = OP_CONST;
+        instr.value = num->int_m.small();
+    } else if (boolean != nullptr) {
+        instr.op = OP_CONST;
+        instr.is_bool = true;
+        instr.value = boolean->bool_m;
+    } else if (var != nullptr) {
+        for (size_t k = 0; k < table.names.size(); k++) {
+            if (table.names[k] == var->str_m) {
+                instr.op = OP_LOAD;
+                instr.a = static_cast<int>(k);
+            }
+        }
+        if (instr.op != OP_LOAD) {
+            return -1;
+        }
+    } else if (add != nullptr || mult != nullptr || eq != nullptr) {
+        PTR(Expr) lhs = add ? add->lhs_m : mult ? mult->lhs_m : eq->lhs_m;
+        PTR(Expr) rhs = add ? add->rhs_m : mult ? mult->rhs_m : eq->rhs_m;
+        instr.op = add ? OP_ADD : mult ? OP_MULT : OP_EQ;
+        instr.is_bool = eq != nullptr;
+        instr.a = compile(lhs, table, tenv, code);
+        instr.b = compile(rhs, table, tenv, code);
+        if (instr.a < 0 || instr.b < 0) {
+            return -1;
+        }
+    } else if (cond != nullptr) {
+        size_t start = code.size();
+        instr.op = OP_IF;
+        instr.a = compile(cond->test_m, table, tenv, code);
+        size_t branches = code.size();
+        instr.b = compile(cond->then_m, table, tenv, code);
+        instr.c = compile(cond->else_m, table, tenv, code);
+        if (instr.a < 0 || instr.b < 0 || instr.c < 0) {
+            return -1;
+        }
+
+        /* OP_IF computes both branches for every row, which is only safe if
+         * neither can fail or fail to terminate where interp() would not
+         * have evaluated it */
+        if (std::any_of(code.begin() + (long) branches, code.end(),
+                        [](const Instr &branch) { return branch.op == OP_SCALAR; })) {
+            code.resize(start);
+            return compile_scalar(e, tenv, code);
+        }
+        instr.is_bool = code[instr.b].is_bool;
+    } else {
+        return compile_scalar(e, tenv, code);
+    }
+
+    code.push_back(instr);
+    return static_cast<int>(code.size() - 1);
+}
+
+/**
+ * \brief Runs a compiled program over rows [begin, begin + n)
+ *
+ * \return False if the chunk must be recomputed row by row
+ */
+static bool run_chunk(const std::vector<Instr> &code, const ColumnTable &table,
+                      size_t begin, size_t n, std::vector<int64_t> &slots) {
+    for (size_t i = 0; i < code.size(); i++) {
+        const Instr &instr = code[i];
+        int64_t *out = &slots[i * CHUNK];
+        const int64_t *a = instr.a >= 0 ? &slots[instr.a * CHUNK] : nullptr;
+        const int64_t *b = instr.b >= 0 ? &slots[instr.b * CHUNK] : nullptr;
+        const int64_t *c = instr.c >= 0 ? &slots[instr.c * CHUNK] : nullptr;
+
+        switch (instr.op) {
+            case OP_CONST:
+                std::fill(out, out + n, instr.value);
+                break;
+            case OP_LOAD:
+                a = table.columns[instr.a].data() + begin;
+                std::copy(a, a + n, out);
+                break;
+            case OP_ADD:
+                if (!kernel_add(a, b, out, n)) {
+                    return false;
+                }
+                break;
+            case OP_MULT:
+                if (!kernel_mult(a, b, out, n)) {
+                    return false;
+                }
+                break;
+            case OP_EQ:
+                kernel_eq(a, b, out, n);
+                break;
+            case OP_IF:
+                kernel_select(a, b, c, out, n);
+                break;
+            case OP_SCALAR:
+                for (size_t r = 0; r < n; r++) {
+                    PTR(Val) val = instr.expr->interp(row_env(table, begin + r));
+                    PTR(NumVal) num_val = CAST(NumVal)(val);
+                    PTR(BoolVal) bool_val = CAST(BoolVal)(val);
+                    if (num_val != nullptr && num_val->int_m.is_small()) {
+                        out[r] = num_val->int_m.small();
+                    } else if (bool_val != nullptr) {
+                        out[r] = bool_val->bool_m;
+                    } else {
+                        return false;
+                    }
+                }
+                break;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Reads a table of integer bindings in CSV form
+ *
+ * \param stream A reference to an input stream to read from
+ * \return The table
+ *
+ * The first line names the variables (e.g. "x,y"); every following non-empty
+ * line gives one row of 64-bit integer values for them (e.g. "3,-4").
+ *
+ * \throws std::runtime_error On malformed names, values, or rows
+ */
+ColumnTable read_columns(std::istream &stream) {
+    ColumnTable table;
+
+    std::string line;
+    bool header = true;
+    while (std::getline(stream, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+
+        std::stringstream fields(line);
+        std::vector<std::string> row;
+        std::string field;
+        while (std::getline(fields, field, ',')) {
+            size_t first = field.find_first_not_of(" \t\r");
+            size_t last = field.find_last_not_of(" \t\r");
+            row.push_back(first == std::string::npos ? ""
+                                                     : field.substr(first, last - first + 1));
+        }
+
+        if (header) {
+            for (const std::string &name: row) {
+                if (name.empty() ||
+                    !std::all_of(name.begin(), name.end(), ::isalpha)) {
+                    throw std::runtime_error("read_columns(): invalid column name");
+                }
+            }
+            table.names = row;
+            table.columns.resize(row.size());
+            header = false;
+            continue;
+        }
+
+        if (row.size() != table.names.size()) {
+            throw std::runtime_error("read_columns(): wrong number of values");
+        }
+        for (size_t k = 0; k < row.size(); k++) {
+            char *end = nullptr;
+            errno = 0;
+            long long value = std::strtoll(row[k].c_str(), &end, 10);
+            if (row[k].empty() || *end != '\0' || errno == ERANGE) {
+                throw std::runtime_error("read_columns(): invalid value");
+            }
+            table.columns[k].push_back(value);
+        }
+    }
+
+    return table;
+}
+
+/**
+ * \brief Evaluates an Expr once for every row of a ColumnTable
+ *
+ * \param e The expression; its free variables must be columns of table
+ * \param table The bindings
+ * \return The result for each row, as Val::to_string() would print it
+ *
+ * If e is not well-typed with every column bound to int, or its result is
+ * not an int or bool, every row is evaluated with Expr::interp().
+ *
+ * \throws std::runtime_error If evaluating any row throws
+ */
+std::vector<std::string> interp_columns(PTR(Expr) e, const ColumnTable &table) {
+    PTR(TypeEnv) tenv = TypeEnv::empty;
+    for (const std::string &name: table.names) {
+        tenv = NEW(ExtendedTypeEnv)(name, NEW(IntType)(), 0, tenv);
+    }
+
+    std::vector<Instr> code;
+    int result = -1;
+    try {
+        e->typecheck(tenv);
+        result = compile(e, table, tenv, code);
+    } catch (const std::runtime_error &) {
+        result = -1; // ill-typed: leave it to interp() to report
+    }
+
+    std::vector<std::string> res;
+    res.reserve(table.rows());
+
+    std::vector<int64_t> slots(code.size() * CHUNK);
+    for (size_t begin = 0; begin < table.rows(); begin += CHUNK) {
+        size_t n = std::min(CHUNK, table.rows() - begin);
+
+        if (result >= 0 && run_chunk(code, table, begin, n, slots)) {
+            const int64_t *lanes = &slots[result * CHUNK];
+            for (size_t r = 0; r < n; r++) {
+                if (code[result].is_bool) {
+                    res.emplace_back(lanes[r] ? "_true" : "_false");
+                } else {
+                    res.push_back(std::to_string(lanes[r]));
+                }
+            }
+        } else {
+            for (size_t r = 0; r < n; r++) {
+                res.push_back(e->interp(row_env(table, begin + r))->to_string());
+            }
+        }
+    }
+
+    return res;
+}
@@ -0,0 +1,33 @@
+/**
+ * \file columnar.h
+ * \brief Evaluating one Expr over a table of bindings for its free variables
+ */
+
+#pragma once
+
+#include <cstdint>      /* int64_t */
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "Expr.h"
+#include "pointers.h"
+
+/**
+ * \struct ColumnTable
+ * \brief Integer bindings for free variables, stored one column per variable
+ *
+ * Row i binds names[k] to columns[k][i] for every k.
+ */
+struct ColumnTable {
+    std::vector<std::string> names;             ///< One variable per column
+    std::vector<std::vector<int64_t>> columns;  ///< Same length as names
+
+    size_t rows() const {
+        return columns.empty() ? 0 : columns[0].size();
+    }
+};
+
+ColumnTable read_columns(std::istream &stream);
+
+std::vector<std::string> interp_columns(PTR(Expr) e, const ColumnTable &table);
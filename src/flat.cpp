@@ -0,0 +1,753 @@
+/**
+ * \file flat.cpp
+ * \brief FlatExpr and FlatRef definitions
+ *
+ * Building, comparing, converting, and printing a FlatExpr are loops over
+ * its arrays with explicit stacks, so they don't recurse however deep the
+ * tree is. interp_at() recurses once per node evaluated, like Expr::interp().
+ */
+
+#include <limits>       /* std::numeric_limits */
+#include <sstream>      /* std::stringstream */
+#include <stdexcept>    /* std::runtime_error */
+#include <typeinfo>     /* typeid (for thunks, as in Var::interp()) */
+#include <unordered_map>
+
+#include "budget.h"
+#include "Env.h"
+#include "flat.h"
+#include "gc.h"
+#include "stats.h"
+#include "Val.h"
+
+/**
+ * \brief Finds an Expr's kind and its operand Exprs, in order
+ *
+ * \throws std::runtime_error If e is not one of the Expr classes flat_kind_t
+ *         covers
+ */
+static flat_kind_t kind_of(Expr *e, std::vector<Expr *> &operands) {
+    const std::type_info &type = typeid(*e);
+    operands.clear();
+    if (type == typeid(Num)) {
+        return FLAT_NUM;
+    } else if (type == typeid(Bool)) {
+        return FLAT_BOOL;
+    } else if (type == typeid(Var)) {
+        return FLAT_VAR;
+    } else if (type == typeid(Add)) {
+        auto *add = static_cast<Add *>(e);
+        operands = {add->lhs_m.get(), add->rhs_m.get()};
+        return FLAT_ADD;
+    } else if (type == typeid(Mult)) {
+        auto *mult = static_cast<Mult *>(e);
+        operands = {mult->lhs_m.get(), mult->rhs_m.get()};
+        return FLAT_MULT;
+    } else if (type == typeid(Eq)) {
+        auto *eq = static_cast<Eq *>(e);
+        operands = {eq->lhs_m.get(), eq->rhs_m.get()};
+        return FLAT_EQ;
+    } else if (type == typeid(Let)) {
+        auto *let = static_cast<Let *>(e);
+        operands = {let->rhs_m.get(), let->body_m.get()};
+        return FLAT_LET;
+    } else if (type == typeid(LetRec)) {
+        auto *letrec = static_cast<LetRec *>(e);
+        operands = {letrec->rhs_m.get(), letrec->body_m.get()};
+        return FLAT_LETREC;
+    } else if (type == typeid(If)) {
+        auto *if_expr = static_cast<If *>(e);
+        operands = {if_expr->test_m.get(), if_expr->then_m.get(), if_expr->else_m.get()};
+        return FLAT_IF;
+    } else if (type == typeid(Fun)) {
+        operands = {static_cast<Fun *>(e)->body_m.get()};
+        return FLAT_FUN;
+    } else if (type == typeid(Call)) {
+        auto *call = static_cast<Call *>(e);
+        operands.push_back(call->to_be_called_m.get());
+        for (const PTR(Expr) &actual_arg: call->actual_args_m) {
+            operands.push_back(actual_arg.get());
+        }
+        return FLAT_CALL;
+    }
+    throw std::runtime_error("flatten(): unknown Expr");
+}
+
+/**
+ * \brief Stores an Expr tree as a FlatExpr
+ *
+ * \param e The root of the tree; FlatRefs in it are converted back first
+ * \return A new FlatExpr, which doesn't refer to e
+ *
+ * \throws std::runtime_error If the tree has more nodes than a node_t can
+ *         number
+ */
+PTR(FlatExpr) FlatExpr::flatten(const PTR(Expr) &e) {
+    PTR(FlatExpr) flat = NEW(FlatExpr)();
+    FlatExpr &f = *flat;
+    f.kinds_m.reserve(e->size_m);
+    f.a_m.reserve(e->size_m);
+    f.b_m.reserve(e->size_m);
+    f.c_m.reserve(e->size_m);
+
+    std::unordered_map<std::string, node_t> name_ids;
+    auto name = [&f, &name_ids](const std::string &str) {
+        auto inserted = name_ids.emplace(str, (node_t) f.names_m.size());
+        if (inserted.second) {
+            f.names_m.push_back(str);
+        }
+        return inserted.first->second;
+    };
+
+    /* Each Expr is visited twice: to queue its operands, then, once they
+     * have all been stored, to store it */
+    struct Visit {
+        Expr *expr;
+        bool store;
+        flat_kind_t kind;       ///< Once store is set
+        size_t operands;        ///< Once store is set
+    };
+    std::vector<Visit> stack{{e.get(), false, FLAT_NUM, 0}};
+    std::vector<node_t> stored;         ///< Nodes whose parents aren't yet
+    std::vector<PTR(Expr)> converted;   ///< FlatRefs' subtrees, kept alive
+    std::vector<Expr *> operands;
+    std::vector<node_t> entries;
+
+    while (!stack.empty()) {
+        Visit visit = stack.back();
+        stack.pop_back();
+
+        if (!visit.store) {
+            if (auto *ref = dynamic_cast<FlatRef *>(visit.expr)) {
+                converted.push_back(ref->to_expr());
+                visit.expr = converted.back().get();
+            }
+            flat_kind_t kind = kind_of(visit.expr, operands);
+            stack.push_back({visit.expr, true, kind, operands.size()});
+            for (auto it = operands.rbegin(); it != operands.rend(); ++it) {
+                stack.push_back({*it, false, FLAT_NUM, 0});
+            }
+            continue;
+        }
+
+        if (f.kinds_m.size() >= std::numeric_limits<node_t>::max()) {
+            throw std::runtime_error("flatten(): too many nodes");
+        }
+
+        const node_t *ops = stored.data() + stored.size() - visit.operands;
+        node_t a = 0;
+        node_t b = 0;
+        node_t c = 0;
+        switch (visit.kind) {
+            case FLAT_NUM:
+                a = (node_t) f.nums_m.size();
+                f.nums_m.push_back(static_cast<Num *>(visit.expr)->int_m);
+                break;
+            case FLAT_BOOL:
+                a = static_cast<Bool *>(visit.expr)->bool_m;
+                break;
+            case FLAT_VAR:
+                a = name(static_cast<Var *>(visit.expr)->str_m);
+                break;
+            case FLAT_ADD:
+            case FLAT_MULT:
+            case FLAT_EQ:
+                a = ops[0];
+                b = ops[1];
+                break;
+            case FLAT_LET:
+                a = name(static_cast<Let *>(visit.expr)->lhs_m);
+                b = ops[0];
+                c = ops[1];
+                break;
+            case FLAT_LETREC:
+                a = name(static_cast<LetRec *>(visit.expr)->lhs_m);
+                b = ops[0];
+                c = ops[1];
+                break;
+            case FLAT_IF:
+                a = ops[0];
+                b = ops[1];
+                c = ops[2];
+                break;
+            case FLAT_FUN:
+                entries.clear();
+                for (const std::string &formal_arg: static_cast<Fun *>(visit.expr)->formal_args_m) {
+                    entries.push_back(name(formal_arg));
+                }
+                a = f.list(entries);
+                b = (node_t) f.bodies_m.size();
+                c = ops[0];
+                f.bodies_m.emplace_back();
+                break;
+            case FLAT_CALL:
+                a = ops[0];
+                entries.assign(ops + 1, ops + visit.operands);
+                b = f.list(entries);
+                break;
+        }
+
+        stored.resize(stored.size() - visit.operands);
+        stored.push_back((node_t) f.kinds_m.size());
+        f.kinds_m.push_back(visit.kind);
+        f.a_m.push_back(a);
+        f.b_m.push_back(b);
+        f.c_m.push_back(c);
+    }
+
+    f.lists_m.shrink_to_fit();
+    f.nums_m.shrink_to_fit();
+    f.names_m.shrink_to_fit();
+    f.bodies_m.shrink_to_fit();
+    return flat;
+}
+
+/**
+ * \brief Appends a list
+ *
+ * \return Where it starts in lists_m
+ */
+FlatExpr::node_t FlatExpr::list(const std::vector<node_t> &entries) {
+    if (lists_m.size() + entries.size() >= std::numeric_limits<node_t>::max()) {
+        throw std::runtime_error("flatten(): too many nodes");
+    }
+    auto start = (node_t) lists_m.size();
+    lists_m.push_back((node_t) entries.size());
+    lists_m.insert(lists_m.end(), entries.begin(), entries.end());
+    return start;
+}
+
+/**
+ * \return The memory held by this FlatExpr's arrays, not counting BigNum
+ *         digits or names too long to be stored inline
+ */
+size_t FlatExpr::bytes() const {
+    return sizeof(FlatExpr) +
+           kinds_m.capacity() * sizeof(uint8_t) +
+           (a_m.capacity() + b_m.capacity() + c_m.capacity() + lists_m.capacity()) * sizeof(node_t) +
+           nums_m.capacity() * sizeof(Integer) +
+           names_m.capacity() * sizeof(std::string) +
+           bodies_m.capacity() * sizeof(WEAK(Expr));
+}
+
+/**
+ * \brief Finds the first node of a subtree, which is its leftmost leaf
+ *
+ * \return The start of the range of nodes ending at node
+ */
+FlatExpr::node_t FlatExpr::start(node_t node) const {
+    for (;;) {
+        switch (kinds_m[node]) {
+            case FLAT_NUM:
+            case FLAT_BOOL:
+            case FLAT_VAR:
+                return node;
+            case FLAT_LET:
+            case FLAT_LETREC:
+                node = b_m[node];
+                break;
+            case FLAT_FUN:
+                node = c_m[node];
+                break;
+            default:
+                node = a_m[node];
+                break;
+        }
+    }
+}
+
+/**
+ * \brief Compares two FlatExprs; true if they store equal Expr trees
+ */
+bool FlatExpr::equals(const FlatExpr &other) const {
+    return !kinds_m.empty() && !other.kinds_m.empty() &&
+           equals_at(root(), other, other.root());
+}
+
+/**
+ * \brief Compares a subtree with a subtree of another FlatExpr
+ *
+ * \return True if they store equal Expr trees (as Expr::equals())
+ *
+ * Equal trees are laid out alike, so the two ranges are compared node by
+ * node, with operands compared by their offset into the range.
+ */
+bool FlatExpr::equals_at(node_t node, const FlatExpr &other, node_t other_node) const {
+    node_t s = start(node);
+    node_t other_s = other.start(other_node);
+    if (node - s != other_node - other_s) {
+        return false;
+    }
+
+    auto same_node = [s, other_s](node_t x, node_t y) {
+        return x - s == y - other_s;
+    };
+
+    for (node_t x = s, y = other_s; x <= node; x++, y++) {
+        if (kinds_m[x] != other.kinds_m[y]) {
+            return false;
+        }
+
+        bool same = true;
+        switch (kinds_m[x]) {
+            case FLAT_NUM:
+                same = nums_m[a_m[x]] == other.nums_m[other.a_m[y]];
+                break;
+            case FLAT_BOOL:
+                same = a_m[x] == other.a_m[y];
+                break;
+            case FLAT_VAR:
+                same = names_m[a_m[x]] == other.names_m[other.a_m[y]];
+                break;
+            case FLAT_ADD:
+            case FLAT_MULT:
+            case FLAT_EQ:
+                same = same_node(a_m[x], other.a_m[y]) && same_node(b_m[x], other.b_m[y]);
+                break;
+            case FLAT_LET:
+            case FLAT_LETREC:
+                same = names_m[a_m[x]] == other.names_m[other.a_m[y]] &&
+                       same_node(b_m[x], other.b_m[y]) && same_node(c_m[x], other.c_m[y]);
+                break;
+            case FLAT_IF:
+                same = same_node(a_m[x], other.a_m[y]) && same_node(b_m[x], other.b_m[y]) &&
+                       same_node(c_m[x], other.c_m[y]);
+                break;
+            case FLAT_FUN: {
+                const node_t *params = &lists_m[a_m[x]];
+                const node_t *other_params = &other.lists_m[other.a_m[y]];
+                same = params[0] == other_params[0] && same_node(c_m[x], other.c_m[y]);
+                for (node_t i = 1; same && i <= params[0]; i++) {
+                    same = names_m[params[i]] == other.names_m[other_params[i]];
+                }
+                break;
+            }
+            case FLAT_CALL: {
+                const node_t *args = &lists_m[b_m[x]];
+                const node_t *other_args = &other.lists_m[other.b_m[y]];
+                same = args[0] == other_args[0] && same_node(a_m[x], other.a_m[y]);
+                for (node_t i = 1; same && i <= args[0]; i++) {
+                    same = same_node(args[i], other_args[i]);
+                }
+                break;
+            }
+        }
+        if (!same) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Evaluates the whole tree
+ *
+ * \param env The environment to evaluate it in; the empty one by default
+ * \return The tree's value, as Expr::interp() would give it
+ */
+PTR(Val) FlatExpr::interp(const PTR(Env) &env) {
+    return interp_at(root(), env != nullptr ? env : Env::empty);
+}
+
+/**
+ * \brief Evaluates a subtree
+ *
+ * \param node The subtree's root
+ * \param env The environment to evaluate it in; not null
+ * \return Its value, as Expr::interp() would give it
+ *
+ * Counts steps and stats per node like Expr::interp(), so budgets and
+ * --stats see a flat evaluation the same way.
+ */
+PTR(Val) FlatExpr::interp_at(node_t node, const PTR(Env) &env) {
+    if (kinds_m[node] == FLAT_ADD || kinds_m[node] == FLAT_MULT) {
+        Integer num;
+        PTR(Val) val;
+        return num_at(node, env, num, val) ? NEW(NumVal)(std::move(num)) : val;
+    }
+
+    budget_step();
+    StatsFrame frame;
+
+    switch (kinds_m[node]) {
+        case FLAT_NUM:
+            return NEW(NumVal)(nums_m[a_m[node]]);
+        case FLAT_BOOL:
+            return NEW(BoolVal)(a_m[node] != 0);
+        case FLAT_VAR: {
+            PTR(Val) val = env->lookup(names_m[a_m[node]]);
+            if (typeid(*val) == typeid(ThunkVal)) {
+                return static_cast<ThunkVal *>(val.get())->force();
+            }
+            return val;
+        }
+        case FLAT_EQ: {
+            Integer lhs, rhs;
+            PTR(Val) lhs_val, rhs_val;
+            bool lhs_num = num_at(a_m[node], env, lhs, lhs_val);
+            bool rhs_num = num_at(b_m[node], env, rhs, rhs_val);
+            if (lhs_num && rhs_num) {
+                return NEW(BoolVal)(lhs == rhs);
+            }
+            return NEW(BoolVal)(value(lhs_num, lhs, lhs_val)->equals(value(rhs_num, rhs, rhs_val)));
+        }
+        case FLAT_LET: {
+            PTR(Val) rhs_val = interp_at(b_m[node], env);
+            return interp_at(c_m[node], NEW(ExtendedEnv)(names_m[a_m[node]], std::move(rhs_val), env));
+        }
+        case FLAT_LETREC: {
+            /* As LetRec::bind() */
+            PTR(ExtendedEnv) rec_env = NEW(ExtendedEnv)(names_m[a_m[node]], nullptr, env);
+            rec_env->val = interp_at(b_m[node], rec_env);
+            gc_candidate(rec_env);
+            return interp_at(c_m[node], rec_env);
+        }
+        case FLAT_IF:
+            return interp_at(a_m[node], env)->is_true() ? interp_at(b_m[node], env)
+                                                        : interp_at(c_m[node], env);
+        case FLAT_FUN: {
+            const node_t *params = &lists_m[a_m[node]];
+            std::vector<std::string> formal_args;
+            formal_args.reserve(params[0]);
+            for (node_t i = 1; i <= params[0]; i++) {
+                formal_args.push_back(names_m[params[i]]);
+            }
+            return NEW(FunVal)(std::move(formal_args), body(node), env);
+        }
+        case FLAT_CALL: {
+            PTR(Val) fun_val = interp_at(a_m[node], env);
+            const node_t *args = &lists_m[b_m[node]];
+            if (args[0] == 1) {
+                return fun_val->call(interp_at(args[1], env));
+            }
+
+            std::vector<PTR(Val)> arg_vals;
+            arg_vals.reserve(args[0]);
+            for (node_t i = 1; i <= args[0]; i++) {
+                arg_vals.push_back(interp_at(args[i], env));
+            }
+            return fun_val->apply(arg_vals);
+        }
+    }
+    throw std::runtime_error("FlatExpr::interp(): corrupt node");
+}
+
+/**
+ * \brief Evaluates a subtree whose value may be a number, without making a
+ *        NumVal for it
+ *
+ * \param node The subtree's root
+ * \param env The environment to evaluate it in; not null
+ * \param num Set to the value, if it is a number
+ * \param val Set to the value, if it isn't
+ * \return True if the value is a number
+ *
+ * Nested + and * pass Integers to each other; only the outermost result
+ * becomes a NumVal. Anything but a number fails as Val::add_to() and
+ * Val::mult_with() would, once both operands are evaluated.
+ */
+bool FlatExpr::num_at(node_t node, const PTR(Env) &env, Integer &num, PTR(Val) &val) {
+    switch (kinds_m[node]) {
+        case FLAT_NUM: {
+            budget_step();
+            StatsFrame frame;
+            num = nums_m[a_m[node]];
+            return true;
+        }
+        case FLAT_ADD:
+        case FLAT_MULT: {
+            budget_step();
+            StatsFrame frame;
+
+            Integer lhs, rhs;
+            PTR(Val) lhs_val, rhs_val;
+            bool lhs_num = num_at(a_m[node], env, lhs, lhs_val);
+            bool rhs_num = num_at(b_m[node], env, rhs, rhs_val);
+            if (lhs_num && rhs_num) {
+                num = kinds_m[node] == FLAT_ADD ? lhs + rhs : lhs * rhs;
+                return true;
+            }
+
+            lhs_val = value(lhs_num, lhs, lhs_val);
+            rhs_val = value(rhs_num, rhs, rhs_val);
+            val = kinds_m[node] == FLAT_ADD ? lhs_val->add_to(rhs_val) : lhs_val->mult_with(rhs_val);
+            return false;
+        }
+        default:
+            val = interp_at(node, env);
+            if (typeid(*val) == typeid(NumVal)) {
+                num = static_cast<NumVal *>(val.get())->int_m;
+                return true;
+            }
+            return false;
+    }
+}
+
+/**
+ * \return A result of num_at() as a Val
+ */
+PTR(Val) FlatExpr::value(bool is_num, const Integer &num, const PTR(Val) &val) {
+    return is_num ? NEW(NumVal)(num) : val;
+}
+
+/**
+ * \brief The body of a Fun's FunVals
+ *
+ * \return A FlatRef to the Fun's body, the same one for as long as any
+ *         FunVal uses it (so inline caches and memo keys see one body)
+ */
+PTR(Expr) FlatExpr::body(node_t fun) {
+    WEAK(Expr) &cached = bodies_m[b_m[fun]];
+    PTR(Expr) ref = cached.lock();
+    if (ref == nullptr) {
+        ref = NEW(FlatRef)(THIS, c_m[fun]);
+        cached = ref;
+    }
+    return ref;
+}
+
+/**
+ * \return The tree's string representation, as Expr::to_string()
+ */
+std::string FlatExpr::to_string() const {
+    std::stringstream st("");
+    if (!kinds_m.empty()) {
+        print_at(root(), st);
+    }
+    return st.str();
+}
+
+/**
+ * \brief Writes a subtree as Expr::print() would
+ *
+ * \param node The subtree's root
+ * \param stream The stream to write to
+ */
+void FlatExpr::print_at(node_t node, std::ostream &stream) const {
+    /* Either a node still to print, or text to write between nodes */
+    struct Item {
+        node_t node;
+        const char *text;
+    };
+    std::vector<Item> stack{{node, nullptr}};
+
+    while (!stack.empty()) {
+        Item item = stack.back();
+        stack.pop_back();
+        if (item.text != nullptr) {
+            stream << item.text;
+            continue;
+        }
+
+        node_t n = item.node;
+        switch (kinds_m[n]) {
+            case FLAT_NUM: {
+                const Integer &num = nums_m[a_m[n]];
+                if (num.is_small()) {
+                    stream << num.small(); // without a string
+                } else {
+                    stream << num.to_string();
+                }
+                break;
+            }
+            case FLAT_BOOL:
+                stream << (a_m[n] ? "_true" : "_false");
+                break;
+            case FLAT_VAR:
+                stream << names_m[a_m[n]];
+                break;
+            case FLAT_ADD:
+            case FLAT_MULT:
+            case FLAT_EQ:
+                stream << "(";
+                stack.push_back({0, ")"});
+                stack.push_back({b_m[n], nullptr});
+                stack.push_back({0, kinds_m[n] == FLAT_ADD ? "+" : kinds_m[n] == FLAT_MULT ? "*" : "=="});
+                stack.push_back({a_m[n], nullptr});
+                break;
+            case FLAT_LET:
+            case FLAT_LETREC:
+                stream << (kinds_m[n] == FLAT_LET ? "(_let " : "(_letrec ") << names_m[a_m[n]] << "=";
+                stack.push_back({0, ")"});
+                stack.push_back({c_m[n], nullptr});
+                stack.push_back({0, " _in "});
+                stack.push_back({b_m[n], nullptr});
+                break;
+            case FLAT_IF:
+                stream << "(_if ";
+                stack.push_back({0, ")"});
+                stack.push_back({c_m[n], nullptr});
+                stack.push_back({0, " _else "});
+                stack.push_back({b_m[n], nullptr});
+                stack.push_back({0, " _then "});
+                stack.push_back({a_m[n], nullptr});
+                break;
+            case FLAT_FUN: {
+                const node_t *params = &lists_m[a_m[n]];
+                stream << "(_fun (";
+                for (node_t i = 1; i <= params[0]; i++) {
+                    stream << (i > 1 ? ", " : "") << names_m[params[i]];
+                }
+                stream << ") ";
+                stack.push_back({0, ")"});
+                stack.push_back({c_m[n], nullptr});
+                break;
+            }
+            case FLAT_CALL: {
+                const node_t *args = &lists_m[b_m[n]];
+                if (args[0] == 1) {
+                    stack.push_back({args[1], nullptr});
+                } else {
+                    stack.push_back({0, ")"});
+                    for (node_t i = args[0]; i >= 1; i--) {
+                        stack.push_back({args[i], nullptr});
+                        stack.push_back({0, i > 1 ? ", " : "("});
+                    }
+                }
+                stack.push_back({0, " "});
+                stack.push_back({a_m[n], nullptr});
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * \return The whole tree as Exprs
+ */
+PTR(Expr) FlatExpr::to_expr() const {
+    return to_expr_at(root());
+}
+
+/**
+ * \brief Converts a subtree back to Exprs
+ *
+ * \param node The subtree's root
+ * \return An Expr tree equal to it
+ *
+ * Operands come before the nodes using them, so one pass over the subtree's
+ * range builds it bottom-up.
+ */
+PTR(Expr) FlatExpr::to_expr_at(node_t node) const {
+    node_t s = start(node);
+    std::vector<PTR(Expr)> built;
+    built.reserve(node - s + 1);
+    auto at = [&built, s](node_t n) -> const PTR(Expr) & {
+        return built[n - s];
+    };
+
+    for (node_t n = s; n <= node; n++) {
+        switch (kinds_m[n]) {
+            case FLAT_NUM:
+                built.push_back(NEW(Num)(nums_m[a_m[n]]));
+                break;
+            case FLAT_BOOL:
+                built.push_back(NEW(Bool)(a_m[n] != 0));
+                break;
+            case FLAT_VAR:
+                built.push_back(NEW(Var)(names_m[a_m[n]]));
+                break;
+            case FLAT_ADD:
+                built.push_back(NEW(Add)(at(a_m[n]), at(b_m[n])));
+                break;
+            case FLAT_MULT:
+                built.push_back(NEW(Mult)(at(a_m[n]), at(b_m[n])));
+                break;
+            case FLAT_EQ:
+                built.push_back(NEW(Eq)(at(a_m[n]), at(b_m[n])));
+                break;
+            case FLAT_LET:
+                built.push_back(NEW(Let)(names_m[a_m[n]], at(b_m[n]), at(c_m[n])));
+                break;
+            case FLAT_LETREC:
+                built.push_back(NEW(LetRec)(names_m[a_m[n]], at(b_m[n]), at(c_m[n])));
+                break;
+            case FLAT_IF:
+                built.push_back(NEW(If)(at(a_m[n]), at(b_m[n]), at(c_m[n])));
+                break;
+            case FLAT_FUN: {
+                const node_t *params = &lists_m[a_m[n]];
+                std::vector<std::string> formal_args;
+                for (node_t i = 1; i <= params[0]; i++) {
+                    formal_args.push_back(names_m[params[i]]);
+                }
+                built.push_back(NEW(Fun)(formal_args, at(c_m[n])));
+                break;
+            }
+            case FLAT_CALL: {
+                const node_t *args = &lists_m[b_m[n]];
+                std::vector<PTR(Expr)> actual_args;
+                for (node_t i = 1; i <= args[0]; i++) {
+                    actual_args.push_back(at(args[i]));
+                }
+                built.push_back(NEW(Call)(at(a_m[n]), actual_args));
+                break;
+            }
+        }
+    }
+    return built.back();
+}
+
+/**
+ * \brief Constructs a FlatRef to a subtree
+ *
+ * \param flat The FlatExpr
+ * \param node The subtree's root
+ */
+FlatRef::FlatRef(PTR(FlatExpr) flat, FlatExpr::node_t node) {
+    flat_m = std::move(flat);
+    node_m = node;
+    size_m = node - flat_m->start(node) + 1;
+}
+
+/**
+ * \return The subtree as Exprs
+ */
+PTR(Expr) FlatRef::to_expr() {
+    return flat_m->to_expr_at(node_m);
+}
+
+/**
+ * \brief Compares a FlatRef to an Expr; flat if e is a FlatRef too
+ */
+bool FlatRef::equals(const PTR(Expr) &e) {
+    if (auto *ref = dynamic_cast<FlatRef *>(e.get())) {
+        return flat_m->equals_at(node_m, *ref->flat_m, ref->node_m);
+    }
+    return to_expr()->equals(e);
+}
+
+PTR(Val) FlatRef::interp(const PTR(Env) &env) {
+    return flat_m->interp_at(node_m, env != nullptr ? env : Env::empty);
+}
+
+bool FlatRef::has_variable() {
+    return to_expr()->has_variable();
+}
+
+PTR(Expr) FlatRef::subst(std::string str, PTR(Expr) e) {
+    return to_expr()->subst(std::move(str), std::move(e));
+}
+
+/**
+ * \brief Always throws: typecheck() marks the nodes it proves, and a
+ *        converted subtree would not outlive the check
+ *
+ * \throws std::runtime_error
+ */
+PTR(Type) FlatRef::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    throw std::runtime_error("FlatRef cannot be typechecked");
+}
+
+void FlatRef::print(std::ostream &stream) {
+    flat_m->print_at(node_m, stream);
+}
+
+void FlatRef::pretty_print(std::ostream &stream) {
+    to_expr()->pretty_print(stream);
+}
+
+void FlatRef::pretty_print_at(std::ostream &stream, prec_t caller_prec,
+                              std::streampos &caller_pos, bool has_paren) {
+    to_expr()->pretty_print_at(stream, caller_prec, caller_pos, has_paren);
+}
@@ -0,0 +1,171 @@
+/**
+ * \file flat.h
+ * \brief A compact, array-based form of an Expr tree
+ *
+ * An Expr node is a separate heap object: a vtable pointer, the
+ * enable_shared_from_this weak reference, typed_m and size_m, and a 16-byte
+ * PTR per operand, plus its control block. A FlatExpr stores the same tree as
+ * a handful of parallel arrays indexed by 32-bit node numbers: one kind byte
+ * and three operands per node (13 bytes), with numbers, names, and the
+ * operand lists of Funs and Calls in side tables.
+ *
+ * Nodes are stored in post-order, so every subtree occupies a contiguous
+ * range of node numbers ending at its root, and the same tree always gets
+ * the same layout. equals() is then a linear scan over two ranges, and
+ * to_expr() builds a subtree in one pass over its range.
+ */
+
+#pragma once
+
+#include <cstdint>      /* uint8_t, uint32_t */
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Expr.h"
+#include "Integer.h"
+#include "pointers.h"
+
+/**
+ * \typedef flat_kind_t
+ * \brief The node kinds of a FlatExpr, one per Expr class
+ *
+ * What each node's operands a, b, and c hold:
+ * - FLAT_NUM: a indexes the numbers
+ * - FLAT_BOOL: a is 0 or 1
+ * - FLAT_VAR: a indexes the names
+ * - FLAT_ADD, FLAT_MULT, FLAT_EQ: a and b are the operand nodes
+ * - FLAT_LET, FLAT_LETREC: a indexes the names; b is the rhs, c the body
+ * - FLAT_IF: a, b, and c are the test, then, and else nodes
+ * - FLAT_FUN: a starts a list of parameter names; b numbers the Fun among
+ *   the tree's Funs; c is the body
+ * - FLAT_CALL: a is the function node; b starts a list of argument nodes
+ *
+ * A list is a count followed by that many entries.
+ */
+typedef enum {
+    FLAT_NUM,
+    FLAT_BOOL,
+    FLAT_VAR,
+    FLAT_ADD,
+    FLAT_MULT,
+    FLAT_EQ,
+    FLAT_LET,
+    FLAT_LETREC,
+    FLAT_IF,
+    FLAT_FUN,
+    FLAT_CALL,
+} flat_kind_t;
+
+/**
+ * \class FlatExpr
+ * \brief An Expr tree stored as arrays of nodes (see flat.h)
+ *
+ * Built only by flatten(), which fixes the layout equals() relies on.
+ * interp() evaluates the arrays directly, with the same Vals and Envs as
+ * Expr::interp(), except that nested + and * pass Integers rather than
+ * NumVals; a _fun's value is a FunVal whose body is a FlatRef into this
+ * tree. Not safe to interp() on several threads at once.
+ */
+CLASS(FlatExpr) {
+public:
+
+    typedef uint32_t node_t;
+
+    static PTR(FlatExpr) flatten(const PTR(Expr) &e);
+
+    /**
+     * \return The number of nodes
+     */
+    size_t size() const {
+        return kinds_m.size();
+    }
+
+    /**
+     * \return The root node (the last)
+     */
+    node_t root() const {
+        return (node_t) (kinds_m.size() - 1);
+    }
+
+    size_t bytes() const;
+
+    bool equals(const FlatExpr &other) const;
+
+    bool equals_at(node_t node, const FlatExpr &other, node_t other_node) const;
+
+    PTR(Val) interp(const PTR(Env) &env = nullptr);
+
+    PTR(Val) interp_at(node_t node, const PTR(Env) &env);
+
+    std::string to_string() const;
+
+    void print_at(node_t node, std::ostream &stream) const;
+
+    PTR(Expr) to_expr() const;
+
+    PTR(Expr) to_expr_at(node_t node) const;
+
+    node_t start(node_t node) const;
+
+private:
+
+    std::vector<uint8_t> kinds_m;   ///< flat_kind_t per node
+    std::vector<node_t> a_m;        ///< Operands per node (see flat_kind_t)
+    std::vector<node_t> b_m;
+    std::vector<node_t> c_m;
+    std::vector<node_t> lists_m;    ///< Fun parameters and Call arguments
+    std::vector<Integer> nums_m;
+    std::vector<std::string> names_m;
+    std::vector<WEAK(Expr)> bodies_m; ///< Each Fun's FlatRef body, while used
+
+    node_t list(const std::vector<node_t> &entries);
+
+    bool num_at(node_t node, const PTR(Env) &env, Integer &num, PTR(Val) &val);
+
+    static PTR(Val) value(bool is_num, const Integer &num, const PTR(Val) &val);
+
+    PTR(Expr) body(node_t fun);
+};
+
+/**
+ * \class FlatRef
+ * \brief An Expr standing for a subtree of a FlatExpr
+ *
+ * The body of every FunVal made by FlatExpr::interp(), so calls to it
+ * evaluate the flat arrays; it keeps its FlatExpr alive. Printing and
+ * comparing with another FlatRef stay flat; anything else works on the
+ * subtree converted back with to_expr().
+ */
+class FlatRef : public Expr {
+
+public:
+
+    PTR(FlatExpr) flat_m;
+    FlatExpr::node_t node_m;
+
+    FlatRef(PTR(FlatExpr) flat, FlatExpr::node_t node);
+
+    PTR(Expr) to_expr();
+
+    bool equals(const PTR(Expr) &e) override;
+
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
+
+    bool has_variable() override;
+
+    PTR(Expr) subst(std::string str, PTR(Expr) e) override;
+
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
+private:
+
+    void print(std::ostream &stream) override;
+
+    void pretty_print(std::ostream &stream) override;
+
+    void pretty_print_at(std::ostream &stream,
+                         prec_t caller_prec,
+                         std::streampos &caller_pos,
+                         bool has_paren) override;
+};
@@ -0,0 +1,211 @@
+/**
+ * \file gc.cpp
+ * \brief Cycle collector definitions
+ */
+
+#include <chrono>
+#include <unordered_map>
+#include <utility>      /* std::move */
+#include <vector>
+
+#include "Env.h"
+#include "gc.h"
+#include "stats.h"
+#include "trace.h"
+#include "Val.h"
+
+/// A registered environment, held weakly so it doesn't keep itself alive
+struct Candidate {
+    WEAK(Env) weak;
+    Env *env;   ///< Valid while weak hasn't expired
+};
+
+static thread_local std::vector<Candidate> candidates;
+
+/// A Val or Env reachable from a candidate; exactly one of env and val is set
+struct GcNode {
+    Env *env = nullptr;
+    Val *val = nullptr;
+    long refs = 0;      ///< Its use_count()
+    long internal = 0;  ///< References to it from other GcNodes
+    bool live = false;
+};
+
+/**
+ * \brief The references a node holds to other Vals and Envs: ExtendedEnv's
+ *        val and rest, FrameEnv's vals and rest, FunVal's env_m, and
+ *        ThunkVal's env_m and val_m
+ *
+ * \param node The node
+ * \param out Gets one GcNode per reference, with env or val and refs set
+ */
+static void references(const GcNode &node, std::vector<GcNode> &out) {
+    out.clear();
+    if (node.env != nullptr) {
+        if (auto *extended = dynamic_cast<ExtendedEnv *>(node.env)) {
+            if (extended->val != nullptr) {
+                out.push_back({nullptr, extended->val.get(), extended->val.use_count()});
+            }
+            if (extended->rest != nullptr) {
+                out.push_back({extended->rest.get(), nullptr, extended->rest.use_count()});
+            }
+        } else if (auto *frame = dynamic_cast<FrameEnv *>(node.env)) {
+            for (const auto &binding: frame->bindings) {
+                if (binding.second != nullptr) {
+                    out.push_back({nullptr, binding.second.get(), binding.second.use_count()});
+                }
+            }
+            if (frame->rest != nullptr) {
+                out.push_back({frame->rest.get(), nullptr, frame->rest.use_count()});
+            }
+        }
+    } else if (auto *fun = dynamic_cast<FunVal *>(node.val)) {
+        if (fun->env_m != nullptr) {
+            out.push_back({fun->env_m.get(), nullptr, fun->env_m.use_count()});
+        }
+    } else if (auto *thunk = dynamic_cast<ThunkVal *>(node.val)) {
+        if (thunk->env_m != nullptr) {
+            out.push_back({thunk->env_m.get(), nullptr, thunk->env_m.use_count()});
+        }
+        if (thunk->val_m != nullptr) {
+            out.push_back({nullptr, thunk->val_m.get(), thunk->val_m.use_count()});
+        }
+    }
+}
+
+static const void *key(const GcNode &node) {
+    return node.env != nullptr ? (const void *) node.env : (const void *) node.val;
+}
+
+/**
+ * \brief Registers an environment that may be part of a cycle
+ *
+ * \param env The environment, e.g. one a FunVal in it captures
+ *
+ * Collects first if GC_CANDIDATE_LIMIT candidates are already waiting.
+ */
+void gc_candidate(const PTR(Env) &env) {
+    if (candidates.size() >= GC_CANDIDATE_LIMIT) {
+        gc_collect();
+    }
+    candidates.push_back({env, env.get()});
+}
+
+/**
+ * \return The number of candidates waiting on this thread
+ */
+size_t gc_candidates() {
+    return candidates.size();
+}
+
+/**
+ * \brief Frees every cycle among this thread's candidates that is no longer
+ *        referenced from outside
+ *
+ * \return The number of Vals and Envs freed
+ *
+ * Builds the graph of Vals and Envs reachable from the candidates, counting
+ * the references each gets from inside it. An object with more references
+ * than that is referenced from outside, so it and everything it reaches
+ * stays; the rest is garbage, and its references are cleared so that it is
+ * freed. Candidates that stay are kept for the next collection. The pause
+ * is counted in eval_stats.
+ */
+size_t gc_collect() {
+    if (candidates.empty()) {
+        return 0;
+    }
+    TraceSpan span("gc_collect");
+    auto start = std::chrono::steady_clock::now();
+
+    // Build the graph
+    std::unordered_map<const void *, GcNode> nodes;
+    std::vector<const void *> stack;
+    std::vector<GcNode> refs;
+    for (const Candidate &candidate: candidates) {
+        if (candidate.weak.expired() || nodes.count(candidate.env)) {
+            continue;
+        }
+        nodes[candidate.env] = {candidate.env, nullptr, candidate.weak.use_count()};
+        stack.push_back(candidate.env);
+
+        while (!stack.empty()) {
+            GcNode node = nodes.at(stack.back());
+            stack.pop_back();
+            references(node, refs);
+            for (const GcNode &ref: refs) {
+                auto inserted = nodes.emplace(key(ref), ref);
+                inserted.first->second.internal++;
+                if (inserted.second) {
+                    stack.push_back(key(ref));
+                }
+            }
+        }
+    }
+
+    // Mark what's referenced from outside, and everything it reaches
+    for (auto &entry: nodes) {
+        if (entry.second.refs > entry.second.internal) {
+            entry.second.live = true;
+            stack.push_back(entry.first);
+        }
+    }
+    while (!stack.empty()) {
+        references(nodes.at(stack.back()), refs);
+        stack.pop_back();
+        for (const GcNode &ref: refs) {
+            GcNode &next = nodes.at(key(ref));
+            if (!next.live) {
+                next.live = true;
+                stack.push_back(key(ref));
+            }
+        }
+    }
+
+    // Break the garbage's references; nothing is freed until doomed is
+    std::vector<PTR(Val)> doomed_vals;
+    std::vector<PTR(Env)> doomed_envs;
+    size_t freed = 0;
+    for (auto &entry: nodes) {
+        GcNode &node = entry.second;
+        if (node.live) {
+            continue;
+        }
+        freed++;
+        if (auto *extended = dynamic_cast<ExtendedEnv *>(node.env)) {
+            doomed_vals.push_back(std::move(extended->val));
+            doomed_envs.push_back(std::move(extended->rest));
+        } else if (auto *frame = dynamic_cast<FrameEnv *>(node.env)) {
+            for (auto &binding: frame->bindings) {
+                doomed_vals.push_back(std::move(binding.second));
+            }
+            doomed_envs.push_back(std::move(frame->rest));
+        } else if (auto *fun = dynamic_cast<FunVal *>(node.val)) {
+            doomed_envs.push_back(std::move(fun->env_m));
+        } else if (auto *thunk = dynamic_cast<ThunkVal *>(node.val)) {
+            doomed_envs.push_back(std::move(thunk->env_m));
+            doomed_vals.push_back(std::move(thunk->val_m));
+        }
+    }
+
+    std::vector<Candidate> kept;
+    for (const Candidate &candidate: candidates) {
+        if (!candidate.weak.expired() && nodes.at(candidate.env).live) {
+            kept.push_back(candidate);
+        }
+    }
+    candidates.swap(kept);
+
+    doomed_vals.clear();
+    doomed_envs.clear();
+
+    uint64_t pause = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    eval_stats.gc_collections++;
+    eval_stats.gc_freed += freed;
+    eval_stats.gc_pause_ns += pause;
+    if (pause > eval_stats.gc_max_pause_ns) {
+        eval_stats.gc_max_pause_ns = pause;
+    }
+    return freed;
+}
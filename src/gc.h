@@ -0,0 +1,32 @@
+/**
+ * \file gc.h
+ * \brief A cycle collector for closures and environments
+ *
+ * Vals and Envs are reference counted (PTR), which can't free a cycle: a
+ * FunVal whose env_m is an ExtendedEnv that binds that FunVal, as when a
+ * recursive binding is backpatched. Code that creates such a cycle
+ * registers the environment with gc_candidate(); gc_collect() then finds
+ * the candidates' cycles that nothing outside them still references (by
+ * trial deletion: subtracting references from inside the cycle from each
+ * object's reference count) and breaks them, so the reference counts free
+ * them.
+ *
+ * Candidates are per thread, and are only examined by their own thread.
+ */
+
+#pragma once
+
+#include <cstddef>      /* size_t */
+
+#include "pointers.h"
+
+class Env;
+
+/// Candidates that trigger a collection when registered
+static const size_t GC_CANDIDATE_LIMIT = 1024;
+
+void gc_candidate(const PTR(Env) &env);
+
+size_t gc_candidates();
+
+size_t gc_collect();
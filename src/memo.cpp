@@ -0,0 +1,196 @@
+/**
+ * \file memo.cpp
+ * \brief Memoization cache definitions
+ */
+
+#include <functional>   /* std::hash */
+#include <unordered_map>
+
+#include "Env.h"
+#include "Expr.h"
+#include "memo.h"
+#include "stats.h"
+#include "Val.h"
+
+bool MemoKey::operator==(const MemoKey &other) const {
+    return body == other.body && captured == other.captured &&
+           (!captured.empty() || env == other.env) && args == other.args;
+}
+
+struct MemoKeyHash {
+    size_t operator()(const MemoKey &key) const {
+        size_t h = std::hash<const void *>()(key.body.get());
+        if (key.captured.empty()) {
+            h = h * 31 + std::hash<const void *>()(key.env.get());
+        }
+        for (const Val *val: key.captured) {
+            h = h * 31 + std::hash<const void *>()(val);
+        }
+        for (const auto &arg: key.args) {
+            h = h * 31 + arg.second.hash() * 2 + arg.first;
+        }
+        return h;
+    }
+};
+
+/// One cached call; ref is set by a hit and cleared by the clock hand
+struct MemoEntry {
+    MemoKey key;
+    PTR(Val) val;
+    bool ref;
+};
+
+/**
+ * \struct MemoCache
+ * \brief The entries, in clock order, and an index into them by key
+ */
+struct MemoCache {
+    size_t capacity = 0;
+    std::vector<MemoEntry> entries;
+    std::unordered_map<MemoKey, size_t, MemoKeyHash> index;
+    size_t hand = 0;
+};
+
+static thread_local MemoCache cache;
+
+/**
+ * \brief Sets how many results this thread's cache holds, and empties it
+ *
+ * \param capacity The number of entries; 0 turns memoization off
+ */
+void memo_configure(size_t capacity) {
+    memo_clear();
+    cache.capacity = capacity;
+}
+
+/**
+ * \return The number of entries this thread's cache holds; 0 if off
+ */
+size_t memo_capacity() {
+    return cache.capacity;
+}
+
+/**
+ * \return The number of entries in this thread's cache
+ */
+size_t memo_size() {
+    return cache.entries.size();
+}
+
+/**
+ * \brief Empties this thread's cache, releasing the environments its keys
+ *        hold (its capacity stays)
+ */
+void memo_clear() {
+    cache.index.clear();
+    cache.entries.clear();
+    cache.hand = 0;
+}
+
+/**
+ * \brief Builds the key for a call, if it can be memoized
+ *
+ * \param body The called FunVal's body
+ * \param env The environment it captured
+ * \param actual_args Its arguments, one per parameter
+ * \param count The number of arguments
+ * \param key Set to the key, if there is one
+ * \return False if memoization is off on this thread or an argument is not
+ *         a number or a boolean (functions have no equality to key on)
+ *
+ * Under --lazy, a forced thunk is keyed on its value. An unforced one makes
+ * the call uncacheable: evaluating it just for the key could diverge or fail
+ * where call-by-need would not, so with both flags only calls whose
+ * arguments are literals or already-used variables are cached.
+ */
+bool memo_key(const PTR(Expr) &body, const PTR(Env) &env,
+              const PTR(Val) *actual_args, size_t count, MemoKey &key) {
+    if (cache.capacity == 0) {
+        return false;
+    }
+
+    key.args.clear();
+    key.args.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        Val *arg = actual_args[i].get();
+        if (auto *thunk = dynamic_cast<ThunkVal *>(arg)) {
+            arg = thunk->val_m.get();
+        }
+        if (auto *num = dynamic_cast<NumVal *>(arg)) {
+            key.args.emplace_back(false, num->int_m);
+        } else if (auto *boolean = dynamic_cast<BoolVal *>(arg)) {
+            key.args.emplace_back(true, Integer(boolean->bool_m));
+        } else {
+            return false;
+        }
+    }
+    key.body = body;
+    key.env = env;
+
+    key.captured.clear();
+    Env *scope = env.get();
+    while (scope != nullptr && key.captured.size() <= MEMO_MAX_CAPTURED) {
+        if (auto *extended = dynamic_cast<ExtendedEnv *>(scope)) {
+            key.captured.push_back(extended->val.get());
+            scope = extended->rest.get();
+        } else if (auto *frame = dynamic_cast<FrameEnv *>(scope)) {
+            for (auto it = frame->bindings.rbegin(); it != frame->bindings.rend(); ++it) {
+                key.captured.push_back(it->second.get());
+            }
+            scope = frame->rest.get();
+        } else {
+            scope = nullptr; // EmptyEnv
+        }
+    }
+    if (key.captured.size() > MEMO_MAX_CAPTURED) {
+        key.captured.clear();
+    }
+    return true;
+}
+
+/**
+ * \brief Looks up a call's result, counting a hit or a miss
+ *
+ * \return The result, or nullptr if it isn't cached
+ */
+PTR(Val) memo_find(const MemoKey &key) {
+    auto found = cache.index.find(key);
+    if (found == cache.index.end()) {
+        eval_stats.memo_misses++;
+        return nullptr;
+    }
+    eval_stats.memo_hits++;
+    MemoEntry &entry = cache.entries[found->second];
+    entry.ref = true;
+    return entry.val;
+}
+
+/**
+ * \brief Caches a call's result, evicting another if the cache is full
+ *
+ * \param key The call, from memo_key()
+ * \param val Its result
+ */
+void memo_insert(MemoKey &&key, const PTR(Val) &val) {
+    if (cache.capacity == 0 || cache.index.count(key)) {
+        return; // e.g. turned off, or cached by a recursive call meanwhile
+    }
+
+    if (cache.entries.size() < cache.capacity) {
+        cache.index.emplace(key, cache.entries.size());
+        cache.entries.push_back({std::move(key), val, false});
+        return;
+    }
+
+    while (cache.entries[cache.hand].ref) {
+        cache.entries[cache.hand].ref = false;
+        cache.hand = (cache.hand + 1) % cache.capacity;
+    }
+    MemoEntry &victim = cache.entries[cache.hand];
+    cache.index.erase(victim.key);
+    eval_stats.memo_evictions++;
+
+    cache.index.emplace(key, cache.hand);
+    victim = {std::move(key), val, false};
+    cache.hand = (cache.hand + 1) % cache.capacity;
+}
@@ -0,0 +1,65 @@
+/**
+ * \file memo.h
+ * \brief An opt-in memoization cache for function calls
+ *
+ * msdscript functions are pure, so a call of the same closure with equal
+ * arguments always gives the same result. With a capacity set (--memo N),
+ * FunVal remembers the results of calls whose arguments are all numbers or
+ * booleans, keyed on the closure and the argument values. A closure is
+ * identified by its body and the values its environment binds, so closures
+ * made again from the same _fun over the same values (as self-application
+ * does on every call) share results. The cache is bounded: when it is full,
+ * a clock sweep evicts an entry that has not been hit since the hand last
+ * passed it.
+ *
+ * Under --lazy, arguments still bound as unforced thunks aren't keyed (see
+ * memo_key()), so recursive calls on computed arguments are not cached.
+ *
+ * Like the cycle collector's candidates, the cache is per thread. Its keys
+ * hold their environments, so it is cleared after every program.
+ */
+
+#pragma once
+
+#include <cstddef>      /* size_t */
+#include <utility>      /* std::pair */
+#include <vector>
+
+#include "Integer.h"
+#include "pointers.h"
+
+class Env;
+class Expr;
+class Val;
+
+/// Environments binding more values than this are identified by address
+static const size_t MEMO_MAX_CAPTURED = 16;
+
+/**
+ * \struct MemoKey
+ * \brief A closure and the values it was called with
+ */
+struct MemoKey {
+    PTR(Expr) body;
+    PTR(Env) env;                       ///< Keeps captured's values alive
+    std::vector<const Val *> captured;  ///< env's values, innermost first;
+                                        ///< empty if env is too long
+    std::vector<std::pair<bool, Integer>> args; ///< (is a boolean, value)
+
+    bool operator==(const MemoKey &other) const;
+};
+
+void memo_configure(size_t capacity);
+
+size_t memo_capacity();
+
+size_t memo_size();
+
+void memo_clear();
+
+bool memo_key(const PTR(Expr) &body, const PTR(Env) &env,
+              const PTR(Val) *actual_args, size_t count, MemoKey &key);
+
+PTR(Val) memo_find(const MemoKey &key);
+
+void memo_insert(MemoKey &&key, const PTR(Val) &val);
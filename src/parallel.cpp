@@ -0,0 +1,447 @@
+/**
+ * \file parallel.cpp
+ * \brief A fork/join interpreter on a work-stealing scheduler
+ *
+ * parallel_interp() evaluates the same way Expr::interp() does, except that
+ * where two subexpressions are independent -- both operands of an Add, Mult,
+ * or Eq, the callee and arguments of a Call, and the rhs's of a chain of Lets
+ * that do not refer to each other's variables -- and large enough, one of
+ * them is forked as a task while the current thread evaluates the other.
+ *
+ * Each thread owns a deque of tasks: it pushes and pops its own forks at the
+ * back (so the most recent, smallest, cache-warm work stays local) and, when
+ * out of work, steals the oldest (largest) task from the front of another
+ * thread's deque. A thread waiting on a fork runs other tasks until the fork
+ * finishes, so no thread ever blocks while work is available.
+ *
+ * Every task draws on the Budget of the thread that called parallel_interp(),
+ * through a SharedBudget, so --max-steps, --max-allocs, --timeout, and
+ * cancellation hold for the evaluation as a whole.
+ */
+
+#include <algorithm>    /* std::any_of, std::max */
+#include <atomic>
+#include <chrono>       /* std::chrono::microseconds */
+#include <deque>
+#include <exception>    /* std::exception_ptr */
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>      /* std::move */
+#include <vector>
+
+#include "budget.h"
+#include "Env.h"
+#include "parallel.h"
+
+/**
+ * \struct Task
+ * \brief A forked evaluation and, once done, its result or error
+ */
+struct Task {
+    std::function<PTR(Val)()> fn;
+    PTR(Val) result;
+    std::exception_ptr error;
+    std::atomic<bool> done{false};
+
+    void run() {
+        try {
+            result = fn();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        done.store(true, std::memory_order_release);
+    }
+};
+
+/**
+ * \class WorkStealingScheduler
+ * \brief One task deque per thread; the thread that constructs it is worker 0
+ */
+class WorkStealingScheduler {
+
+public:
+
+    explicit WorkStealingScheduler(size_t threads);
+
+    ~WorkStealingScheduler();
+
+    void push(std::shared_ptr<Task> task);
+
+    void wait(Task &task);
+
+private:
+
+    struct Deque {
+        std::mutex mutex;
+        std::deque<std::shared_ptr<Task>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Deque>> deques_m;   ///< One per worker
+    std::vector<std::thread> threads_m;             ///< Workers 1 and up
+    std::atomic<bool> stopping_m{false};
+
+    static thread_local const WorkStealingScheduler *current_m;
+    static thread_local size_t index_m;
+
+    size_t self() const {
+        return current_m == this ? index_m : 0;
+    }
+
+    std::shared_ptr<Task> find_task(size_t self);
+
+    void work(size_t self);
+};
+
+thread_local const WorkStealingScheduler *WorkStealingScheduler::current_m = nullptr;
+thread_local size_t WorkStealingScheduler::index_m = 0;
+
+/**
+ * \brief Starts threads - 1 workers; the calling thread is the last one
+ *
+ * \param threads The total number of threads, at least 1
+ */
+WorkStealingScheduler::WorkStealingScheduler(size_t threads) {
+    for (size_t i = 0; i < threads; i++) {
+        deques_m.emplace_back(new Deque());
+    }
+    for (size_t i = 1; i < threads; i++) {
+        threads_m.emplace_back(&WorkStealingScheduler::work, this, i);
+    }
+}
+
+WorkStealingScheduler::~WorkStealingScheduler() {
+    stopping_m.store(true);
+    for (std::thread &thread: threads_m) {
+        thread.join();
+    }
+}
+
+/**
+ * \brief Forks a task onto the back of the calling thread's deque
+ */
+void WorkStealingScheduler::push(std::shared_ptr<Task> task) {
+    Deque &own = *deques_m[self()];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    own.tasks.push_back(std::move(task));
+}
+
+/**
+ * \brief Runs other tasks until task is done
+ */
+void WorkStealingScheduler::wait(Task &task) {
+    size_t me = self();
+    while (!task.done.load(std::memory_order_acquire)) {
+        std::shared_ptr<Task> next = find_task(me);
+        if (next != nullptr) {
+            next->run();
+        } else {
+            std::this_thread::yield(); // task was stolen and is still running
+        }
+    }
+}
+
+/**
+ * \brief Pops the newest task of this thread's deque, or else steals the
+ *        oldest task of another's
+ */
+std::shared_ptr<Task> WorkStealingScheduler::find_task(size_t me) {
+    std::shared_ptr<Task> res;
+    {
+        Deque &own = *deques_m[me];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            res = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return res;
+        }
+    }
+
+    for (size_t i = 1; i < deques_m.size(); i++) {
+        Deque &victim = *deques_m[(me + i) % deques_m.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            res = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return res;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * \brief A worker thread's loop: steal and run tasks until stopping
+ */
+void WorkStealingScheduler::work(size_t me) {
+    current_m = this;
+    index_m = me;
+
+    int idle = 0;
+    while (!stopping_m.load(std::memory_order_relaxed)) {
+        std::shared_ptr<Task> task = find_task(me);
+        if (task != nullptr) {
+            task->run();
+            idle = 0;
+        } else if (++idle < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+}
+
+/**
+ * \class ParallelInterp
+ * \brief Expr::interp() with forks
+ */
+class ParallelInterp : public BodyEvaluator {
+
+public:
+
+    ParallelInterp(WorkStealingScheduler &scheduler, size_t threshold,
+                   std::shared_ptr<SharedBudget> budget)
+            : scheduler_m(scheduler), threshold_m(threshold), budget_m(std::move(budget)) {
+    }
+
+    PTR(Val) eval(PTR(Expr) e, PTR(Env) env) override;
+
+private:
+
+    WorkStealingScheduler &scheduler_m;
+    size_t threshold_m;
+    std::shared_ptr<SharedBudget> budget_m; ///< What tasks draw on, if limited
+
+    bool is_big(PTR(Expr) e) const {
+        return e->size_m >= threshold_m;
+    }
+
+    std::shared_ptr<Task> fork(PTR(Expr) e, PTR(Env) env);
+
+    PTR(Val) join(Task &task);
+
+    void eval_both(PTR(Expr) first, PTR(Expr) second, PTR(Env) env,
+                   PTR(Val) &first_val, PTR(Val) &second_val);
+
+    PTR(Val) eval_lets(PTR(Let) head, PTR(Env) env);
+
+    PTR(Val) eval_call(PTR(Call) call, PTR(Env) env, std::vector<PTR(Val)> &arg_vals);
+};
+
+/**
+ * \brief Whether e refers to a variable named name anywhere (ignoring
+ *        shadowing, which only makes the answer conservative)
+ */
+static bool mentions(PTR(Expr) e, const std::string &name) {
+    if (PTR(Var) var = CAST(Var)(e)) {
+        return var->str_m == name;
+    } else if (PTR(Add) add = CAST(Add)(e)) {
+        return mentions(add->lhs_m, name) || mentions(add->rhs_m, name);
+    } else if (PTR(Mult) mult = CAST(Mult)(e)) {
+        return mentions(mult->lhs_m, name) || mentions(mult->rhs_m, name);
+    } else if (PTR(Eq) eq = CAST(Eq)(e)) {
+        return mentions(eq->lhs_m, name) || mentions(eq->rhs_m, name);
+    } else if (PTR(Let) let = CAST(Let)(e)) {
+        return mentions(let->rhs_m, name) || mentions(let->body_m, name);
+    } else if (PTR(LetRec) letrec = CAST(LetRec)(e)) {
+        return mentions(letrec->rhs_m, name) || mentions(letrec->body_m, name);
+    } else if (PTR(If) cond = CAST(If)(e)) {
+        return mentions(cond->test_m, name) || mentions(cond->then_m, name) ||
+               mentions(cond->else_m, name);
+    } else if (PTR(Fun) fun = CAST(Fun)(e)) {
+        return mentions(fun->body_m, name);
+    } else if (PTR(Call) call = CAST(Call)(e)) {
+        return mentions(call->to_be_called_m, name) ||
+               std::any_of(call->actual_args_m.begin(), call->actual_args_m.end(),
+                           [&name](const PTR(Expr) &arg) { return mentions(arg, name); });
+    }
+    return false; // Num, Bool
+}
+
+std::shared_ptr<Task> ParallelInterp::fork(PTR(Expr) e, PTR(Env) env) {
+    std::shared_ptr<Task> task = std::make_shared<Task>();
+    task->fn = [this, e, env]() {
+        if (budget_m == nullptr) {
+            return eval(e, env);
+        }
+        BudgetScope scope(budget_m);
+        return eval(e, env);
+    };
+    scheduler_m.push(task);
+    return task;
+}
+
+PTR(Val) ParallelInterp::join(Task &task) {
+    scheduler_m.wait(task);
+    if (task.error) {
+        std::rethrow_exception(task.error);
+    }
+    return task.result;
+}
+
+/**
+ * \brief Evaluates two independent subexpressions, concurrently if both are
+ *        big
+ *
+ * Errors are reported as sequential evaluation (first, then second) would
+ * report them.
+ */
+void ParallelInterp::eval_both(PTR(Expr) first, PTR(Expr) second, PTR(Env) env,
+                               PTR(Val) &first_val, PTR(Val) &second_val) {
+    if (!is_big(first) || !is_big(second)) {
+        first_val = eval(first, env);
+        second_val = eval(second, env);
+        return;
+    }
+
+    std::shared_ptr<Task> task = fork(first, env);
+    try {
+        second_val = eval(second, env);
+    } catch (...) {
+        std::exception_ptr second_error = std::current_exception();
+        scheduler_m.wait(*task);
+        std::rethrow_exception(task->error ? task->error : second_error);
+    }
+    first_val = join(*task);
+}
+
+/**
+ * \brief Evaluates a chain of Lets, forking every big rhs that does not
+ *        depend on the chain's earlier variables
+ */
+PTR(Val) ParallelInterp::eval_lets(PTR(Let) head, PTR(Env) env) {
+    std::vector<PTR(Let)> chain;
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (PTR(Let) link = head; link != nullptr; link = CAST(Let)(link->body_m)) {
+        // Scanning a big rhs costs no more than evaluating it will
+        bool forked = is_big(link->rhs_m);
+        for (size_t i = 0; forked && i < chain.size(); i++) {
+            forked = !mentions(link->rhs_m, chain[i]->lhs_m);
+        }
+        tasks.push_back(forked ? fork(link->rhs_m, env) : nullptr);
+        chain.push_back(link);
+    }
+
+    PTR(Env) new_env = env;
+    try {
+        for (size_t i = 0; i < chain.size(); i++) {
+            PTR(Val) rhs_val = tasks[i] ? join(*tasks[i])
+                                        : eval(chain[i]->rhs_m, new_env);
+            new_env = NEW(ExtendedEnv)(chain[i]->lhs_m, rhs_val, new_env);
+            tasks[i] = nullptr;
+        }
+    } catch (...) {
+        for (const std::shared_ptr<Task> &task: tasks) {
+            if (task != nullptr) {
+                scheduler_m.wait(*task); // they refer to this and env
+            }
+        }
+        throw;
+    }
+    return eval(chain.back()->body_m, new_env);
+}
+
+/**
+ * \brief Evaluates a multi-argument Call's function and arguments, forking
+ *        every big argument
+ *
+ * \return The function's value; arg_vals gets the arguments', in order
+ */
+PTR(Val) ParallelInterp::eval_call(PTR(Call) call, PTR(Env) env,
+                                   std::vector<PTR(Val)> &arg_vals) {
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (const PTR(Expr) &arg: call->actual_args_m) {
+        tasks.push_back(is_big(arg) ? fork(arg, env) : nullptr);
+    }
+
+    PTR(Val) fun_val;
+    try {
+        fun_val = eval(call->to_be_called_m, env);
+        for (size_t i = 0; i < tasks.size(); i++) {
+            arg_vals.push_back(tasks[i] ? join(*tasks[i]) : eval(call->actual_args_m[i], env));
+            tasks[i] = nullptr;
+        }
+    } catch (...) {
+        for (const std::shared_ptr<Task> &task: tasks) {
+            if (task != nullptr) {
+                scheduler_m.wait(*task); // they refer to this and env
+            }
+        }
+        throw;
+    }
+    return fun_val;
+}
+
+/**
+ * \brief Evaluates e as e->interp(env) would
+ */
+PTR(Val) ParallelInterp::eval(PTR(Expr) e, PTR(Env) env) {
+    if (!is_big(e)) {
+        return e->interp(env);
+    }
+
+    budget_step(); // for e itself, as e->interp() would
+    PTR(Val) lhs_val, rhs_val;
+    if (PTR(Add) add = CAST(Add)(e)) {
+        eval_both(add->lhs_m, add->rhs_m, env, lhs_val, rhs_val);
+        return lhs_val->add_to(rhs_val);
+    } else if (PTR(Mult) mult = CAST(Mult)(e)) {
+        eval_both(mult->lhs_m, mult->rhs_m, env, lhs_val, rhs_val);
+        return lhs_val->mult_with(rhs_val);
+    } else if (PTR(Eq) eq = CAST(Eq)(e)) {
+        eval_both(eq->lhs_m, eq->rhs_m, env, lhs_val, rhs_val);
+        return NEW(BoolVal)(lhs_val->equals(rhs_val));
+    } else if (PTR(Let) let = CAST(Let)(e)) {
+        return eval_lets(let, env);
+    } else if (PTR(LetRec) letrec = CAST(LetRec)(e)) {
+        return eval(letrec->body_m, letrec->bind(env));
+    } else if (PTR(If) cond = CAST(If)(e)) {
+        return eval(cond->test_m, env)->is_true() ? eval(cond->then_m, env)
+                                                  : eval(cond->else_m, env);
+    } else if (PTR(Call) call = CAST(Call)(e)) {
+        // Entered as by Call::interp(), for --memo and --trace, but with forks
+        if (call->actual_args_m.size() == 1) {
+            eval_both(call->to_be_called_m, call->actual_args_m[0], env, lhs_val, rhs_val);
+            PTR(FunVal) fun_val = CAST(FunVal)(lhs_val);
+            return fun_val != nullptr ? fun_val->call(rhs_val, this) : lhs_val->call(rhs_val);
+        }
+
+        std::vector<PTR(Val)> arg_vals;
+        lhs_val = eval_call(call, env, arg_vals);
+        PTR(FunVal) fun_val = CAST(FunVal)(lhs_val);
+        return fun_val != nullptr ? fun_val->apply(arg_vals, this) : lhs_val->apply(arg_vals);
+    }
+    budget_fuel++; // e->interp() counts e itself again
+    return e->interp(env); // Fun
+}
+
+/**
+ * \brief Evaluates an Expr, running independent subexpressions concurrently
+ *
+ * \param e The expression to evaluate
+ * \param threads How many threads to use; 0 means one per hardware thread
+ * \param threshold Subtrees with fewer nodes than this are not forked
+ * \return The same Val as e->interp()
+ *
+ * \throws std::runtime_error The same error e->interp() would throw
+ * \throws budget_exceeded If this thread's Budget runs out, counting the
+ *         work of every thread
+ *
+ * With USE_REF_POINTERS, reference counts aren't atomic, so nothing is
+ * forked: e is simply interpreted on this thread.
+ */
+PTR(Val) parallel_interp(PTR(Expr) e, size_t threads, size_t threshold) {
+    if (USE_REF_POINTERS) {
+        return e->interp();
+    }
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::shared_ptr<SharedBudget> budget = BudgetScope::share();
+    WorkStealingScheduler scheduler(threads);
+    ParallelInterp interp(scheduler, threshold, budget);
+    return interp.eval(e, Env::empty);
+}
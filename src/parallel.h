@@ -0,0 +1,18 @@
+/**
+ * \file parallel.h
+ * \brief Evaluating independent subexpressions concurrently
+ */
+
+#pragma once
+
+#include <cstddef>      /* size_t */
+
+#include "Expr.h"
+#include "pointers.h"
+#include "Val.h"
+
+/// Subtrees with fewer nodes than this are evaluated sequentially
+static const size_t PARALLEL_THRESHOLD = 512;
+
+PTR(Val) parallel_interp(PTR(Expr) e, size_t threads = 0,
+                         size_t threshold = PARALLEL_THRESHOLD);
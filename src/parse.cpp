@@ -27,13 +27,17 @@ PTR(Expr) parse_var(std::istream &stream);
 
 PTR(Expr) parse_let(std::istream &stream);
 
+PTR(Expr) parse_letrec(std::istream &stream);
+
 PTR(Expr) parse_if(std::istream &stream);
 
 PTR(Expr) parse_fun(std::istream &stream);
 
+PTR(Expr) parse_def(std::istream &stream, std::string &name);
+
 PTR(Expr) parse_paren(std::istream &stream);
 
-int build_number(std::istream &stream);
+Integer build_number(std::istream &stream);
 
 std::string peek_keyword(std::istream &stream);
 
@@ -83,6 +87,36 @@ PTR(Expr) parse_expr(const std::string &str) {
     return e;
 }
 
+/**
+ * \brief Parses one REPL entry: an expression, or a top-level definition
+ *        ("_def name = expr")
+ *
+ * \param str The string to parse
+ * \param name Set to the defined name, or cleared if str is an expression
+ * \return The expression, or the definition's rhs
+ *
+ * \throws std::runtime_error On invalid input, as parse_expr() does
+ */
+PTR(Expr) parse_entry(const std::string &str, std::string &name) {
+    std::stringstream stream(str);
+    consume_whitespace(stream);
+
+    name.clear();
+    PTR(Expr) e;
+    if (stream.peek() == '_' && peek_keyword(stream) == "DEF") {
+        e = parse_def(stream, name);
+    } else {
+        e = parse_eqs(stream);
+    }
+
+    consume_whitespace(stream);
+    if (!stream.eof()) {
+        throw std::runtime_error("parse_expr(): invalid input");
+    }
+
+    return e;
+}
+
 /**
  * \brief An alias function for maintainability
  *
@@ -157,12 +191,17 @@ PTR(Expr) parse_mults(std::istream &stream) {
 PTR(Expr) parse_calls(std::istream &stream) {
     PTR(Expr) e = parse_bases(stream);
 
-    PTR(Expr) actual_arg;
     while (stream.peek() == '(') {
         consume(stream, '(');
-        actual_arg = parse_expr(stream);
+        std::vector<PTR(Expr)> actual_args = {parse_expr(stream)};
+        consume_whitespace(stream);
+        while (stream.peek() == ',') {
+            consume(stream, ',');
+            actual_args.push_back(parse_expr(stream));
+            consume_whitespace(stream);
+        }
         consume(stream, ')');
-        e = NEW(Call)(e, actual_arg);
+        e = NEW(Call)(e, actual_args);
     }
 
     return e;
@@ -174,7 +213,8 @@ PTR(Expr) parse_calls(std::istream &stream) {
  * \param stream A reference to an input stream to read from
  * \return A pointer to an Expr object
  *
- * Calls base-case helper functions: parse_num(), parse_var(), or parse_let().
+ * Calls base-case helper functions: parse_num(), parse_var(), parse_let(),
+ * or parse_letrec().
  * Returns to parse_mults().
  *
  * \throws std::runtime_error On encountering characters not valid in any
@@ -194,10 +234,15 @@ PTR(Expr) parse_bases(std::istream &stream) {
         std::string kw = peek_keyword(stream);
         if (kw == "LET") {
             return parse_let(stream);
+        } else if (kw == "LETREC") {
+            return parse_letrec(stream);
         } else if (kw == "IF") {
             return parse_if(stream);
         } else if (kw == "FUN") {
             return parse_fun(stream);
+        } else if (kw == "DEF") {
+            throw std::runtime_error("parse_bases(): "
+                                     "_def is only allowed at the top level");
         } else {
             return parse_bool(stream);
         }
@@ -221,11 +266,29 @@ std::string peek_keyword(std::istream &stream) {
 
     const int first_char = stream.peek();
     if (first_char == 'l') {
-        res = "LET";
+        consume(stream, "let");
+        res = stream.peek() == 'r' ? "LETREC" : "LET";
+
+        stream.putback('t');
+        stream.putback('e');
+        stream.putback('l');
     } else if (first_char == 'i') {
         res = "IF";
     } else if (first_char == 't') {
         res = "TRUE";
+    } else if (first_char == 'd') {
+        std::string word;
+        while (isalpha(stream.peek())) {
+            word += static_cast<char>(stream.get());
+        }
+        for (auto it = word.rbegin(); it != word.rend(); ++it) {
+            stream.putback(*it);
+        }
+        if (word != "def") {
+            throw std::runtime_error("peek_keyword(): "
+                                     "invalid keyword");
+        }
+        res = "DEF";
     } else if (first_char == 'f') {
         consume(stream, first_char);
 
@@ -284,9 +347,9 @@ PTR(Expr) parse_num(std::istream &stream) {
         }
     }
 
-    int number = build_number(stream);
+    Integer number = build_number(stream);
     if (negative) {
-        number *= -1;
+        number = -number;
     }
 
     return NEW(Num)(number);
@@ -297,23 +360,27 @@ PTR(Expr) parse_num(std::istream &stream) {
  *        chars
  *
  * \param stream A reference to an input stream to read from
- * \return A pointer to a Var object
+ * \return The (non-negative) Integer value of the digits read
+ *
+ * Numbers of any length are accepted; those that do not fit in 64 bits become
+ * BigNum-backed Integers.
  *
  * \throws std::runtime_error On detecting malformed numbers
  */
-int build_number(std::istream &stream) {
-    int number = 0;
+Integer build_number(std::istream &stream) {
+    std::string digits;
     while (true) {
         const int c = stream.peek();
         if (isdigit(c)) {
             consume(stream, c);
-            number = number * 10 + (c - '0');
+            digits += static_cast<char>( c );
         } else {
             if (!isspace(c) &&
                 c != ')' &&
                 c != '*' &&
                 c != '+' &&
                 c != '=' &&
+                c != ',' &&
                 !stream.eof()) {
                 throw std::runtime_error("build_number(): malformed number");
             } else {
@@ -321,7 +388,7 @@ int build_number(std::istream &stream) {
             }
         }
     }
-    return number;
+    return Integer::parse(digits);
 }
 
 /**
@@ -340,8 +407,8 @@ PTR(Expr) parse_var(std::istream &stream) {
             consume(stream, c);
             str += std::string(1, static_cast<char> ( c ));
         } else {
-            if (!isspace(c) && c != ')' && c != '*'
-                && c != '+' && c != '=' && !stream.eof()) {
+            if (!isspace(c) && c != '(' && c != ')' && c != '*'
+                && c != '+' && c != '=' && c != ',' && !stream.eof()) {
                 throw std::runtime_error("build_variable(): malformed variable");
             } else {
                 break;
@@ -381,6 +448,41 @@ PTR(Expr) parse_let(std::istream &stream) {
     return NEW(Let)(lhs->str_m, rhs, body);
 }
 
+/**
+ * \brief Constructs LetRec objects from parsed recursive bindings
+ *        (e.g. "_letrec f = _fun (n) ... _in f(5)")
+ *
+ * \param stream A reference to an input stream to read from
+ * \return A pointer to a LetRec object
+ *
+ * \throws std::runtime_error On invalid bindings, including ones whose rhs is
+ *                            not a _fun
+ */
+PTR(Expr) parse_letrec(std::istream &stream) {
+    consume(stream, "_letrec");
+
+    PTR(Var) lhs = CAST(Var)(parse_expr(stream));
+    if (lhs == nullptr) {
+        throw std::runtime_error("parse_letrec(): invalid letrec");
+    }
+
+    consume(stream, '=');
+
+    PTR(Expr) rhs = parse_expr(stream);
+    if (CAST(Fun)(rhs) == nullptr) {
+        throw std::runtime_error("parse_letrec(): _letrec must bind a _fun");
+    }
+
+    consume(stream, "_in");
+
+    PTR(Expr) body = parse_expr(stream);
+    if (body->subst(lhs->str_m, rhs)->equals(body)) {
+        throw std::runtime_error("parse_letrec(): invalid letrec");
+    }
+
+    return NEW(LetRec)(lhs->str_m, rhs, body);
+}
+
 /**
  * \brief Constructs If objects from parsed condition expressions
  *        (e.g. "_if ... _then ... _else ...")
@@ -401,20 +503,68 @@ PTR(Expr) parse_if(std::istream &stream) {
     return NEW(If)(test, then, el);
 }
 
+/**
+ * \brief Constructs Fun objects from parsed function expressions
+ *        (e.g. "_fun (x) x * x" or "_fun (x, y) x * y")
+ *
+ * \param stream A reference to an input stream to read from
+ * \return A pointer to a Fun object
+ *
+ * \throws std::runtime_error On a malformed parameter list, or a parameter
+ *                            the body does not use
+ */
 PTR(Expr) parse_fun(std::istream &stream) {
     consume(stream, "_fun");
+    consume_whitespace(stream);
 
-    PTR(Var) formal_arg = CAST(Var)(parse_expr(stream));
-    if (formal_arg == nullptr) {
+    std::vector<std::string> formal_args;
+    bool list = stream.peek() == '(';
+    if (list) {
+        consume(stream, '(');
+    }
+    do {
+        consume_whitespace(stream);
+        if (!isalpha(stream.peek())) {
+            throw std::runtime_error("parse_let(): invalid fun");
+        }
+        formal_args.push_back(CAST(Var)(parse_var(stream))->str_m);
+        consume_whitespace(stream);
+    } while (list && stream.peek() == ',' && stream.get() == ',');
+    if (list && stream.get() != ')') {
         throw std::runtime_error("parse_let(): invalid fun");
     }
 
     PTR(Expr) body = parse_expr(stream);
-    if (body->subst(formal_arg->str_m, body)->equals(body)) {
-        throw std::runtime_error("parse_let(): invalid fun");
+    for (const std::string &formal_arg: formal_args) {
+        if (body->subst(formal_arg, body)->equals(body)) {
+            throw std::runtime_error("parse_let(): invalid fun");
+        }
     }
 
-    return NEW(Fun)(formal_arg->str_m, body);
+    return NEW(Fun)(formal_args, body);
+}
+
+/**
+ * \brief Parses a top-level definition (e.g. "_def f = _fun (x) x * x")
+ *
+ * \param stream A reference to an input stream to read from
+ * \param name Set to the defined variable's name
+ * \return The definition's rhs
+ *
+ * \throws std::runtime_error On invalid definitions
+ */
+PTR(Expr) parse_def(std::istream &stream, std::string &name) {
+    consume(stream, "_def");
+
+    PTR(Var) lhs = CAST(Var)(parse_expr(stream));
+    if (lhs == nullptr) {
+        throw std::runtime_error("parse_def(): invalid def");
+    }
+
+    consume(stream, '=');
+
+    name = lhs->str_m;
+    return parse_expr(stream);
 }
 
 /**
@@ -9,3 +9,5 @@
 #include "pointers.h"
 
 PTR(Expr) parse_expr(const std::string &str);
+
+PTR(Expr) parse_entry(const std::string &str, std::string &name);
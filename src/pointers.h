@@ -1,6 +1,6 @@
 /**
  * \file pointers.h
- * \brief Macros for pointers (two different modes)
+ * \brief Macros for pointers (three different modes)
  */
 
 #ifndef MSDSCRIPT_POINTERS_H
@@ -10,20 +10,69 @@
 
 #define USE_PLAIN_POINTERS 0
 
+/*
+ * Set to 1 (e.g. -DUSE_REF_POINTERS=1) for intrusive, non-atomic reference
+ * counts (see ref_ptr.h). Faster, but no object may be shared between
+ * threads, so --parallel evaluates sequentially.
+ */
+#ifndef USE_REF_POINTERS
+# define USE_REF_POINTERS 0
+#endif
+
+/*
+ * Set to 1 (e.g. -DTRACK_ALLOCATIONS=1) to count every NEW by type; see
+ * allocations.h and "--allocs". Shared pointers only.
+ */
+#ifndef TRACK_ALLOCATIONS
+# define TRACK_ALLOCATIONS 0
+#endif
+
+#if TRACK_ALLOCATIONS && USE_REF_POINTERS
+# error "TRACK_ALLOCATIONS needs shared pointers (USE_REF_POINTERS 0)"
+#endif
+
+/*
+ * CLASS(T) declares a base class whose methods can use THIS; COUNTED(T)
+ * declares one PTR(T) can point to that doesn't need THIS.
+ */
+
 #if USE_PLAIN_POINTERS
 
 # define NEW(T)     new T
 # define PTR(T)     T*
 # define CAST(T)    dynamic_cast<T*>
+# define UNCHECKED_CAST(T) static_cast<T*>
+# define WEAK(T)    T*
 # define CLASS(T)   class T
+# define COUNTED(T) class T
 # define THIS       this
 
+#elif USE_REF_POINTERS
+
+# include "ref_ptr.h"
+# define NEW(T)     make_ref<T>
+# define PTR(T)     ref_ptr<T>
+# define WEAK(T)    ref_weak<T>
+# define CAST(T)    ref_dynamic_cast<T>
+# define UNCHECKED_CAST(T) ref_static_cast<T>
+# define CLASS(T)   class T : public RefCounted
+# define COUNTED(T) class T : public RefCounted
+# define THIS       ref_from_this(this)
+
 #else
 
-# define NEW(T)     std::make_shared<T>
+# if TRACK_ALLOCATIONS
+#  include "allocations.h"
+#  define NEW(T)    make_tracked<T>
+# else
+#  define NEW(T)    std::make_shared<T>
+# endif
 # define PTR(T)     std::shared_ptr<T>
+# define WEAK(T)    std::weak_ptr<T>
 # define CAST(T)    std::dynamic_pointer_cast<T>
+# define UNCHECKED_CAST(T) std::static_pointer_cast<T>
 # define CLASS(T)   class T : public std::enable_shared_from_this<T>
+# define COUNTED(T) class T
 # define THIS       shared_from_this()
 
 #endif /* USE_PLAIN_POINTERS */
@@ -0,0 +1,256 @@
+/**
+ * \file profile.cpp
+ * \brief Profiler and Probe definitions
+ */
+
+#include <algorithm>    /* std::sort, std::reverse */
+#include <iomanip>      /* std::setw */
+#include <stdexcept>    /* std::runtime_error */
+
+#include "profile.h"
+#include "Val.h"
+
+static const size_t MAX_CALL_LABEL = 40; ///< Longest callee text in a label
+
+/**
+ * \brief Registers a site, making its label unique
+ *
+ * The second and later sites with the same label are numbered: "call f",
+ * "call f #2", and so on. Source text never contains '#', so the numbered
+ * labels can't collide with another site's own.
+ *
+ * \param label The construct's description, e.g. "_let x"
+ * \return The site's index
+ */
+size_t Profiler::add_site(const std::string &label) {
+    size_t n = ++seen_m[label];
+
+    sites_m.emplace_back();
+    sites_m.back().label = n == 1 ? label : label + " #" + std::to_string(n);
+    return sites_m.size() - 1;
+}
+
+/**
+ * \brief Copies an Expr, wrapping the whole program, every Let rhs, every Fun
+ *        body, and every Call in a Probe
+ *
+ * \param e The expression to profile
+ * \return The instrumented copy, which evaluates exactly as e does
+ */
+PTR(Expr) Profiler::instrument(PTR(Expr) e) {
+    return NEW(Probe)(instrument(e, ""), add_site("program"), this);
+}
+
+/**
+ * \param name The variable e is bound to, if e is the rhs of a Let or
+ *             LetRec; named functions are labelled with their names
+ */
+PTR(Expr) Profiler::instrument(PTR(Expr) e, const std::string &name) {
+    if (PTR(Add) add = CAST(Add)(e)) {
+        return NEW(Add)(instrument(add->lhs_m, ""), instrument(add->rhs_m, ""));
+    } else if (PTR(Mult) mult = CAST(Mult)(e)) {
+        return NEW(Mult)(instrument(mult->lhs_m, ""), instrument(mult->rhs_m, ""));
+    } else if (PTR(Eq) eq = CAST(Eq)(e)) {
+        return NEW(Eq)(instrument(eq->lhs_m, ""), instrument(eq->rhs_m, ""));
+    } else if (PTR(If) cond = CAST(If)(e)) {
+        return NEW(If)(instrument(cond->test_m, ""), instrument(cond->then_m, ""),
+                       instrument(cond->else_m, ""));
+    } else if (PTR(Let) let = CAST(Let)(e)) {
+        size_t site = add_site("_let " + let->lhs_m);
+        return NEW(Let)(let->lhs_m,
+                        NEW(Probe)(instrument(let->rhs_m, let->lhs_m), site, this),
+                        instrument(let->body_m, ""));
+    } else if (PTR(LetRec) letrec = CAST(LetRec)(e)) {
+        return NEW(LetRec)(letrec->lhs_m, instrument(letrec->rhs_m, letrec->lhs_m),
+                           instrument(letrec->body_m, ""));
+    } else if (PTR(Fun) fun = CAST(Fun)(e)) {
+        std::string params;
+        for (const std::string &formal_arg: fun->formal_args_m) {
+            params += (params.empty() ? "" : ", ") + formal_arg;
+        }
+        size_t site = add_site(name.empty() ? "_fun (" + params + ")" : "_fun " + name);
+        return NEW(Fun)(fun->formal_args_m,
+                        NEW(Probe)(instrument(fun->body_m, ""), site, this));
+    } else if (PTR(Call) call = CAST(Call)(e)) {
+        std::string callee = call->to_be_called_m->to_string();
+        if (callee.size() > MAX_CALL_LABEL) {
+            callee = callee.substr(0, MAX_CALL_LABEL) + "...";
+        }
+        size_t site = add_site("call " + callee);
+        std::vector<PTR(Expr)> args;
+        for (const PTR(Expr) &arg: call->actual_args_m) {
+            args.push_back(instrument(arg, ""));
+        }
+        return NEW(Probe)(NEW(Call)(instrument(call->to_be_called_m, ""), args), site, this);
+    }
+    return e; // Num, Bool, Var
+}
+
+/**
+ * \brief Starts timing an evaluation of a site
+ */
+void Profiler::enter(size_t site) {
+    size_t parent = stack_m.empty() ? 0 : stack_m.back().node;
+    auto found = children_m.find({parent, site});
+    size_t node;
+    if (found != children_m.end()) {
+        node = found->second;
+    } else {
+        node = nodes_m.size();
+        nodes_m.push_back({parent, site});
+        children_m[{parent, site}] = node;
+    }
+
+    sites_m[site].count++;
+    sites_m[site].active++;
+    stack_m.push_back({node, std::chrono::steady_clock::now(), 0});
+}
+
+/**
+ * \brief Stops timing the innermost evaluation in progress
+ */
+void Profiler::leave() {
+    Frame frame = stack_m.back();
+    stack_m.pop_back();
+
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - frame.start).count();
+    uint64_t exclusive = elapsed > frame.children_ns ? elapsed - frame.children_ns : 0;
+
+    Node &node = nodes_m[frame.node];
+    Site &site = sites_m[node.site];
+    node.exclusive_ns += exclusive;
+    site.exclusive_ns += exclusive;
+    if (--site.active == 0) {
+        site.inclusive_ns += elapsed;
+    }
+    if (!stack_m.empty()) {
+        stack_m.back().children_ns += elapsed;
+    }
+}
+
+/**
+ * \brief Writes the call tree in folded-stack form, one line per node:
+ *        "program;_let f;call f;_fun f 12345", where the count is the
+ *        node's exclusive time in nanoseconds
+ *
+ * \param stream A reference to an output stream to write to
+ *
+ * The output can be read by flamegraph.pl and compatible tools.
+ */
+void Profiler::write_folded(std::ostream &stream) const {
+    for (size_t i = 1; i < nodes_m.size(); i++) {
+        std::vector<const std::string *> path;
+        for (size_t node = i; node != 0; node = nodes_m[node].parent) {
+            path.push_back(&sites_m[nodes_m[node].site].label);
+        }
+        std::reverse(path.begin(), path.end());
+
+        for (size_t j = 0; j < path.size(); j++) {
+            stream << (j ? ";" : "") << *path[j];
+        }
+        stream << " " << nodes_m[i].exclusive_ns << "\n";
+    }
+}
+
+/**
+ * \brief Writes a table of every site's evaluation count and inclusive and
+ *        exclusive time, most exclusive time first
+ *
+ * \param stream A reference to an output stream to write to
+ */
+void Profiler::write_summary(std::ostream &stream) const {
+    std::vector<const Site *> sorted;
+    for (const Site &site: sites_m) {
+        sorted.push_back(&site);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Site *a, const Site *b) {
+        return a->exclusive_ns > b->exclusive_ns;
+    });
+
+    stream << std::setw(12) << "count" << std::setw(16) << "inclusive (us)"
+           << std::setw(16) << "exclusive (us)" << "  site\n";
+    for (const Site *site: sorted) {
+        stream << std::setw(12) << site->count
+               << std::setw(16) << site->inclusive_ns / 1000
+               << std::setw(16) << site->exclusive_ns / 1000
+               << "  " << site->label << "\n";
+    }
+}
+
+/**
+ * \brief Looks up a site by its label
+ *
+ * \throws std::runtime_error If no site has the label
+ */
+const Profiler::Site &Profiler::site(const std::string &label) const {
+    for (const Site &site: sites_m) {
+        if (site.label == label) {
+            return site;
+        }
+    }
+    throw std::runtime_error("site(): no site labelled " + label);
+}
+
+/**
+ * \brief Constructs a Probe
+ *
+ * \param inner The Expr to evaluate
+ * \param site The site to report evaluations to
+ * \param profiler The Profiler to report to
+ */
+Probe::Probe(PTR(Expr) inner, size_t site, Profiler *profiler) {
+    inner_m = inner;
+    site_m = site;
+    profiler_m = profiler;
+    size_m = 1 + inner->size_m;
+}
+
+/**
+ * \brief Compares the inner Expr, ignoring any Probe around e
+ */
+bool Probe::equals(const PTR(Expr) &e) {
+    PTR(Probe) probe_cmp = CAST(Probe)(e);
+    return inner_m->equals(probe_cmp != nullptr ? probe_cmp->inner_m : e);
+}
+
+/**
+ * \brief Evaluates the inner Expr, timing it
+ */
+PTR(Val) Probe::interp(const PTR(Env) &env) {
+    profiler_m->enter(site_m);
+    PTR(Val) res;
+    try {
+        res = inner_m->interp(env);
+    } catch (...) {
+        profiler_m->leave();
+        throw;
+    }
+    profiler_m->leave();
+    return res;
+}
+
+bool Probe::has_variable() {
+    return inner_m->has_variable();
+}
+
+PTR(Expr) Probe::subst(std::string str, PTR(Expr) e) {
+    return NEW(Probe)(inner_m->subst(str, e), site_m, profiler_m);
+}
+
+PTR(Type) Probe::infer(PTR(TypeEnv) tenv, TypeContext &ctx) {
+    return inner_m->infer(tenv, ctx);
+}
+
+void Probe::print(std::ostream &stream) {
+    inner_m->print(stream);
+}
+
+void Probe::pretty_print(std::ostream &stream) {
+    inner_m->pretty_print(stream);
+}
+
+void Probe::pretty_print_at(std::ostream &stream, prec_t caller_prec,
+                            std::streampos &caller_pos, bool has_paren) {
+    inner_m->pretty_print_at(stream, caller_prec, caller_pos, has_paren);
+}
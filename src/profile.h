@@ -0,0 +1,118 @@
+/**
+ * \file profile.h
+ * \brief Declarations for Profiler and Probe, which attribute evaluation time
+ *        to Let bindings, functions, and call sites ("--profile")
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>      /* uint64_t */
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>      /* std::pair */
+#include <vector>
+
+#include "Expr.h"
+#include "pointers.h"
+
+/**
+ * \class Profiler
+ * \brief Counts and times the evaluations of labelled sites, building a call
+ *        tree of them
+ *
+ * Profiling costs nothing when it is off because the probes are not in the
+ * tree at all: instrument() returns a copy of an Expr with a Probe around
+ * every Let rhs, Fun body, and Call, and only that copy is profiled. A
+ * Profiler is not thread-safe.
+ */
+class Profiler {
+
+public:
+
+    /// A labelled construct, with totals over all of its evaluations
+    struct Site {
+        std::string label;
+        uint64_t count = 0;
+        uint64_t inclusive_ns = 0;  ///< Not counting recursive re-entries twice
+        uint64_t exclusive_ns = 0;
+        int active = 0;             ///< Evaluations of this site in progress
+    };
+
+    PTR(Expr) instrument(PTR(Expr) e);
+
+    void enter(size_t site);
+
+    void leave();
+
+    void write_folded(std::ostream &stream) const;
+
+    void write_summary(std::ostream &stream) const;
+
+    const Site &site(const std::string &label) const;
+
+private:
+
+    /// A node in the call tree: a site, reached from its parent node
+    struct Node {
+        size_t parent;
+        size_t site;
+        uint64_t exclusive_ns = 0;
+    };
+
+    /// An evaluation in progress
+    struct Frame {
+        size_t node;
+        std::chrono::steady_clock::time_point start;
+        uint64_t children_ns;
+    };
+
+    std::vector<Site> sites_m;
+    std::unordered_map<std::string, size_t> seen_m;     ///< Label -> sites given it
+    std::vector<Node> nodes_m{{0, 0}};  ///< nodes_m[0] is the root
+    std::map<std::pair<size_t, size_t>, size_t> children_m; ///< (parent, site) -> node
+    std::vector<Frame> stack_m;
+
+    size_t add_site(const std::string &label);
+
+    PTR(Expr) instrument(PTR(Expr) e, const std::string &name);
+};
+
+/**
+ * \class Probe
+ * \brief A transparent Expr that reports its inner Expr's evaluations to a
+ *        Profiler
+ */
+class Probe : public Expr {
+
+public:
+
+    PTR(Expr) inner_m;
+    size_t site_m;
+    Profiler *profiler_m;
+
+    Probe(PTR(Expr) inner, size_t site, Profiler *profiler);
+
+    bool equals(const PTR(Expr) &e) override;
+
+    PTR(Val) interp(const PTR(Env) &env = nullptr) override;
+
+    bool has_variable() override;
+
+    PTR(Expr) subst(std::string str, PTR(Expr) e) override;
+
+    PTR(Type) infer(PTR(TypeEnv) tenv, TypeContext &ctx) override;
+
+private:
+
+    void print(std::ostream &stream) override;
+
+    void pretty_print(std::ostream &stream) override;
+
+    void pretty_print_at(std::ostream &stream,
+                         prec_t caller_prec,
+                         std::streampos &caller_pos,
+                         bool has_paren) override;
+};
@@ -0,0 +1,305 @@
+/**
+ * \file ref_ptr.h
+ * \brief An intrusive, non-atomic reference-counted pointer: what PTR(T) is
+ *        with USE_REF_POINTERS
+ *
+ * The count lives in the object (RefCounted) instead of a separate control
+ * block, and is a plain integer instead of an atomic, so copying a ref_ptr is
+ * an ordinary increment. The price is that an object must never be shared
+ * between threads: each thread has to build and evaluate its own trees, as
+ * --batch, --serve, and --repl already do (--parallel runs sequentially).
+ */
+
+#pragma once
+
+#include <cstddef>      /* std::nullptr_t */
+#include <cstdint>      /* uint32_t */
+#include <type_traits>  /* std::enable_if, std::is_convertible */
+#include <utility>      /* std::forward, std::swap */
+
+/**
+ * \struct WeakFlag
+ * \brief Outlives a RefCounted object for as long as a ref_weak observes it
+ *
+ * Only allocated for objects that a ref_weak has been made from.
+ */
+struct WeakFlag {
+    uint32_t refs = 1;  ///< The object (while alive) plus each ref_weak
+    bool alive = true;
+};
+
+/**
+ * \class RefCounted
+ * \brief Base class of everything a ref_ptr can point to
+ */
+class RefCounted {
+public:
+
+    uint32_t strong_m = 0;          ///< ref_ptrs to this object
+    WeakFlag *weak_m = nullptr;     ///< Set by the first ref_weak
+
+    RefCounted() = default;
+
+    /* A copy is a new object: it starts out unowned and unobserved */
+    RefCounted(const RefCounted &) {}
+
+    RefCounted &operator=(const RefCounted &) {
+        return *this;
+    }
+
+    virtual ~RefCounted() {
+        if (weak_m != nullptr) {
+            weak_m->alive = false;
+            if (--weak_m->refs == 0) {
+                delete weak_m;
+            }
+        }
+    }
+};
+
+/**
+ * \class ref_ptr
+ * \brief The subset of std::shared_ptr's interface this project uses
+ *
+ * Like std::shared_ptr, a ref_ptr can be copied and destroyed where T is
+ * incomplete (e.g. a defaulted PTR(Env) argument), so it keeps the object as
+ * a RefCounted too, converted where T was complete.
+ */
+template<typename T>
+class ref_ptr {
+
+    template<typename U> friend class ref_ptr;
+    template<typename U> friend class ref_weak;
+
+    /// Only ref_ptrs to derived classes convert, as with std::shared_ptr
+    template<typename U>
+    using if_convertible = typename std::enable_if<std::is_convertible<U *, T *>::value>::type;
+
+    T *ptr_m = nullptr;
+    RefCounted *counted_m = nullptr;
+
+    ref_ptr(T *ptr, RefCounted *counted) : ptr_m(ptr), counted_m(counted) {
+        retain();
+    }
+
+    void retain() const {
+        if (counted_m != nullptr) {
+            counted_m->strong_m++;
+        }
+    }
+
+    void release() {
+        if (counted_m != nullptr && --counted_m->strong_m == 0) {
+            delete counted_m;
+        }
+    }
+
+public:
+
+    ref_ptr() = default;
+
+    ref_ptr(std::nullptr_t) {} // NOLINT( google-explicit-constructor )
+
+    /// Takes ownership of a new object, or shares an owned one (e.g. this)
+    explicit ref_ptr(T *ptr) : ref_ptr(ptr, ptr) {
+    }
+
+    ref_ptr(const ref_ptr &other) : ref_ptr(other.ptr_m, other.counted_m) {
+    }
+
+    ref_ptr(ref_ptr &&other) noexcept : ptr_m(other.ptr_m), counted_m(other.counted_m) {
+        other.ptr_m = nullptr;
+        other.counted_m = nullptr;
+    }
+
+    template<typename U, typename = if_convertible<U>>
+    ref_ptr(const ref_ptr<U> &other) : ref_ptr(other.ptr_m, other.counted_m) { // NOLINT( google-explicit-constructor )
+    }
+
+    template<typename U, typename = if_convertible<U>>
+    ref_ptr(ref_ptr<U> &&other) noexcept : ptr_m(other.ptr_m), counted_m(other.counted_m) { // NOLINT( google-explicit-constructor )
+        other.ptr_m = nullptr;
+        other.counted_m = nullptr;
+    }
+
+    ~ref_ptr() {
+        release();
+    }
+
+    ref_ptr &operator=(const ref_ptr &other) {
+        ref_ptr(other).swap(*this);
+        return *this;
+    }
+
+    ref_ptr &operator=(ref_ptr &&other) noexcept {
+        ref_ptr(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    template<typename U, typename = if_convertible<U>>
+    ref_ptr &operator=(const ref_ptr<U> &other) {
+        ref_ptr(other).swap(*this);
+        return *this;
+    }
+
+    template<typename U, typename = if_convertible<U>>
+    ref_ptr &operator=(ref_ptr<U> &&other) {
+        ref_ptr(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ref_ptr &operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    void reset() {
+        ref_ptr().swap(*this);
+    }
+
+    void swap(ref_ptr &other) noexcept {
+        std::swap(ptr_m, other.ptr_m);
+        std::swap(counted_m, other.counted_m);
+    }
+
+    T *get() const {
+        return ptr_m;
+    }
+
+    T &operator*() const {
+        return *ptr_m;
+    }
+
+    T *operator->() const {
+        return ptr_m;
+    }
+
+    explicit operator bool() const {
+        return ptr_m != nullptr;
+    }
+
+    long use_count() const {
+        return counted_m != nullptr ? (long) counted_m->strong_m : 0;
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const ref_ptr<T> &a, const ref_ptr<U> &b) {
+    return a.get() == b.get();
+}
+
+template<typename T, typename U>
+bool operator!=(const ref_ptr<T> &a, const ref_ptr<U> &b) {
+    return a.get() != b.get();
+}
+
+template<typename T>
+bool operator==(const ref_ptr<T> &a, std::nullptr_t) {
+    return a.get() == nullptr;
+}
+
+template<typename T>
+bool operator!=(const ref_ptr<T> &a, std::nullptr_t) {
+    return a.get() != nullptr;
+}
+
+template<typename T>
+bool operator==(std::nullptr_t, const ref_ptr<T> &a) {
+    return a.get() == nullptr;
+}
+
+template<typename T>
+bool operator!=(std::nullptr_t, const ref_ptr<T> &a) {
+    return a.get() != nullptr;
+}
+
+/**
+ * \class ref_weak
+ * \brief The subset of std::weak_ptr's interface this project uses
+ */
+template<typename T>
+class ref_weak {
+
+    T *ptr_m = nullptr;
+    RefCounted *counted_m = nullptr;    ///< Valid while flag_m->alive
+    WeakFlag *flag_m = nullptr;
+
+public:
+
+    ref_weak() = default;
+
+    template<typename U>
+    ref_weak(const ref_ptr<U> &ptr) : ptr_m(ptr.ptr_m), counted_m(ptr.counted_m) { // NOLINT( google-explicit-constructor )
+        if (counted_m != nullptr) {
+            if (counted_m->weak_m == nullptr) {
+                counted_m->weak_m = new WeakFlag();
+            }
+            flag_m = counted_m->weak_m;
+            flag_m->refs++;
+        }
+    }
+
+    ref_weak(const ref_weak &other)
+            : ptr_m(other.ptr_m), counted_m(other.counted_m), flag_m(other.flag_m) {
+        if (flag_m != nullptr) {
+            flag_m->refs++;
+        }
+    }
+
+    ref_weak &operator=(ref_weak other) {
+        std::swap(ptr_m, other.ptr_m);
+        std::swap(counted_m, other.counted_m);
+        std::swap(flag_m, other.flag_m);
+        return *this;
+    }
+
+    ~ref_weak() {
+        if (flag_m != nullptr && --flag_m->refs == 0) {
+            delete flag_m;
+        }
+    }
+
+    bool expired() const {
+        return flag_m == nullptr || !flag_m->alive;
+    }
+
+    long use_count() const {
+        return expired() ? 0 : (long) counted_m->strong_m;
+    }
+
+    ref_ptr<T> lock() const {
+        return expired() ? ref_ptr<T>() : ref_ptr<T>(ptr_m, counted_m);
+    }
+};
+
+/**
+ * \brief std::make_shared<T> for ref_ptr
+ */
+template<typename T, typename... Args>
+ref_ptr<T> make_ref(Args &&... args) {
+    return ref_ptr<T>(new T(std::forward<Args>(args)...));
+}
+
+/**
+ * \brief std::dynamic_pointer_cast<T> for ref_ptr
+ */
+template<typename T, typename U>
+ref_ptr<T> ref_dynamic_cast(const ref_ptr<U> &ptr) {
+    return ref_ptr<T>(dynamic_cast<T *>(ptr.get()));
+}
+
+/**
+ * \brief std::static_pointer_cast<T> for ref_ptr
+ */
+template<typename T, typename U>
+ref_ptr<T> ref_static_cast(const ref_ptr<U> &ptr) {
+    return ref_ptr<T>(static_cast<T *>(ptr.get()));
+}
+
+/**
+ * \brief shared_from_this() for ref_ptr: what THIS is with USE_REF_POINTERS
+ */
+template<typename T>
+ref_ptr<T> ref_from_this(T *self) {
+    return ref_ptr<T>(self);
+}
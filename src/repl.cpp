@@ -0,0 +1,68 @@
+/**
+ * \file repl.cpp
+ * \brief Session definitions
+ */
+
+#include <stdexcept>    /* std::runtime_error */
+
+#include "Expr.h"
+#include "gc.h"
+#include "parse.h"
+#include "repl.h"
+#include "Val.h"
+
+/**
+ * \brief Parses and evaluates one entry against the session's Env
+ *
+ * \param entry An expression, or a definition ("_def name = expr")
+ * \return The expression's value, or "name = value" for a definition
+ *
+ * \throws std::runtime_error On a parse or evaluation error (including
+ *                            budget_exceeded), in which case the session is
+ *                            unchanged
+ */
+std::string Session::run(const std::string &entry) {
+    BudgetScope scope(budget_m);
+    std::string name;
+    PTR(Expr) e = parse_entry(entry, name);
+    PTR(Val) val = e->interp(env_m);
+
+    if (name.empty()) {
+        return val->to_string();
+    }
+    env_m = NEW(ExtendedEnv)(name, val, env_m);
+    return name + " = " + val->to_string();
+}
+
+/**
+ * \brief Runs entries, one per line, until EOF
+ *
+ * \param in Where to read entries from
+ * \param out Where to write results and errors
+ * \param prompt Whether to write a prompt before each entry
+ *
+ * Blank lines are skipped; an error is reported and the loop continues.
+ */
+void Session::loop(std::istream &in, std::ostream &out, bool prompt) {
+    std::string line;
+    while (true) {
+        if (prompt) {
+            out << "msd> " << std::flush;
+        }
+        if (!std::getline(in, line)) {
+            break;
+        }
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        try {
+            out << run(line) << std::endl;
+        } catch (const std::runtime_error &exception) {
+            out << "ERROR: " << exception.what() << std::endl;
+        }
+        gc_collect();
+    }
+    if (prompt) {
+        out << std::endl;
+    }
+}
@@ -0,0 +1,33 @@
+/**
+ * \file repl.h
+ * \brief Declarations for Session, the state of an interactive "--repl"
+ */
+
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+#include "budget.h"
+#include "Env.h"
+#include "pointers.h"
+
+/**
+ * \class Session
+ * \brief A top-level environment that persists across REPL entries
+ *
+ * Each "_def name = expr" entry evaluates expr in the session's Env and
+ * extends it with the result, so later entries are parsed and evaluated on
+ * their own, against everything defined so far.
+ */
+class Session {
+public:
+
+    PTR(Env) env_m = Env::empty; ///< Every definition so far, newest first
+    Budget budget_m;             ///< Limits for each entry
+
+    std::string run(const std::string &entry);
+
+    void loop(std::istream &in, std::ostream &out, bool prompt);
+};
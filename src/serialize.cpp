@@ -0,0 +1,517 @@
+/**
+ * \file serialize.cpp
+ * \brief Binary serialization and parse cache definitions
+ */
+
+#include <cstdio>       /* std::rename, std::remove, std::snprintf */
+#include <exception>    /* std::exception */
+#include <fstream>      /* std::ifstream, std::ofstream */
+#include <iterator>     /* std::istreambuf_iterator */
+#include <stdexcept>    /* std::runtime_error */
+#include <typeinfo>     /* typeid */
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>   /* mkdir */
+#include <unistd.h>     /* getpid */
+
+#include "parse.h"
+#include "serialize.h"
+
+/// Starts every serialized tree; the last byte is the format version
+static const char TREE_MAGIC[] = {'M', 'S', 'D', 'T', 1};
+
+/// Starts every cache file
+static const char CACHE_MAGIC[] = {'M', 'S', 'D', 'C'};
+
+/**
+ * \typedef serial_tag_t
+ * \brief The tag byte of a serialized node, and what follows it
+ *
+ * - SERIAL_NUM: the value as a zigzag varint
+ * - SERIAL_BIG, SERIAL_NEG_BIG: the magnitude's decimal digits (a varint
+ *   count, then the digits)
+ * - SERIAL_VAR, SERIAL_LET, SERIAL_LETREC: a name index
+ * - SERIAL_FUN: a parameter count, then that many name indices
+ * - SERIAL_CALL: an argument count
+ * - all others: nothing
+ *
+ * The values are part of the format: add tags at the end.
+ */
+typedef enum {
+    SERIAL_NUM = 0,
+    SERIAL_BIG = 1,
+    SERIAL_NEG_BIG = 2,
+    SERIAL_FALSE = 3,
+    SERIAL_TRUE = 4,
+    SERIAL_VAR = 5,
+    SERIAL_ADD = 6,
+    SERIAL_MULT = 7,
+    SERIAL_EQ = 8,
+    SERIAL_LET = 9,
+    SERIAL_LETREC = 10,
+    SERIAL_IF = 11,
+    SERIAL_FUN = 12,
+    SERIAL_CALL = 13,
+} serial_tag_t;
+
+/**
+ * \brief Appends n as a varint: seven bits per byte, low bits first, the high
+ *        bit set on every byte but the last
+ */
+static void put_varint(std::string &out, uint64_t n) {
+    while (n >= 0x80) {
+        out.push_back(static_cast<char>(n | 0x80));
+        n >>= 7;
+    }
+    out.push_back(static_cast<char>(n));
+}
+
+/**
+ * \brief Appends str's length as a varint, then str
+ */
+static void put_string(std::string &out, const std::string &str) {
+    put_varint(out, str.size());
+    out += str;
+}
+
+/**
+ * \class Reader
+ * \brief Reads the parts serialize() writes, checking each against the end
+ *        of the input
+ */
+class Reader {
+public:
+
+    Reader(const std::string &bytes, size_t pos) : bytes_m(bytes), pos_m(pos) {}
+
+    bool at_end() const {
+        return pos_m == bytes_m.size();
+    }
+
+    uint8_t byte() {
+        need(1);
+        return static_cast<uint8_t>(bytes_m[pos_m++]);
+    }
+
+    uint64_t varint() {
+        uint64_t n = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte();
+            n |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if ((b & 0x80) == 0) {
+                return n;
+            }
+        }
+        throw std::runtime_error("deserialize(): invalid varint");
+    }
+
+    std::string string() {
+        uint64_t length = varint();
+        need(length);
+        std::string str = bytes_m.substr(pos_m, length);
+        pos_m += length;
+        return str;
+    }
+
+    /**
+     * \return True, consuming them, if the next bytes are magic's
+     */
+    bool skip(const char *magic, size_t length) {
+        if (bytes_m.size() - pos_m < length || bytes_m.compare(pos_m, length, magic, length) != 0) {
+            return false;
+        }
+        pos_m += length;
+        return true;
+    }
+
+private:
+
+    const std::string &bytes_m;
+    size_t pos_m;
+
+    void need(uint64_t count) const {
+        if (count > bytes_m.size() - pos_m) {
+            throw std::runtime_error("deserialize(): truncated input");
+        }
+    }
+};
+
+/**
+ * \brief Finds an Expr's tag and its operand Exprs, in order
+ *
+ * \throws std::runtime_error If e is not one of the Expr classes the parser
+ *         builds
+ */
+static serial_tag_t tag_of(Expr *e, std::vector<Expr *> &operands) {
+    const std::type_info &type = typeid(*e);
+    operands.clear();
+    if (type == typeid(Num)) {
+        const Integer &num = static_cast<Num *>(e)->int_m;
+        if (num.is_small()) {
+            return SERIAL_NUM;
+        }
+        return num < Integer(0) ? SERIAL_NEG_BIG : SERIAL_BIG;
+    } else if (type == typeid(Bool)) {
+        return static_cast<Bool *>(e)->bool_m ? SERIAL_TRUE : SERIAL_FALSE;
+    } else if (type == typeid(Var)) {
+        return SERIAL_VAR;
+    } else if (type == typeid(Add)) {
+        auto *add = static_cast<Add *>(e);
+        operands = {add->lhs_m.get(), add->rhs_m.get()};
+        return SERIAL_ADD;
+    } else if (type == typeid(Mult)) {
+        auto *mult = static_cast<Mult *>(e);
+        operands = {mult->lhs_m.get(), mult->rhs_m.get()};
+        return SERIAL_MULT;
+    } else if (type == typeid(Eq)) {
+        auto *eq = static_cast<Eq *>(e);
+        operands = {eq->lhs_m.get(), eq->rhs_m.get()};
+        return SERIAL_EQ;
+    } else if (type == typeid(Let)) {
+        auto *let = static_cast<Let *>(e);
+        operands = {let->rhs_m.get(), let->body_m.get()};
+        return SERIAL_LET;
+    } else if (type == typeid(LetRec)) {
+        auto *letrec = static_cast<LetRec *>(e);
+        operands = {letrec->rhs_m.get(), letrec->body_m.get()};
+        return SERIAL_LETREC;
+    } else if (type == typeid(If)) {
+        auto *if_expr = static_cast<If *>(e);
+        operands = {if_expr->test_m.get(), if_expr->then_m.get(), if_expr->else_m.get()};
+        return SERIAL_IF;
+    } else if (type == typeid(Fun)) {
+        operands = {static_cast<Fun *>(e)->body_m.get()};
+        return SERIAL_FUN;
+    } else if (type == typeid(Call)) {
+        auto *call = static_cast<Call *>(e);
+        operands.push_back(call->to_be_called_m.get());
+        for (const PTR(Expr) &actual_arg: call->actual_args_m) {
+            operands.push_back(actual_arg.get());
+        }
+        return SERIAL_CALL;
+    }
+    throw std::runtime_error("serialize(): unknown Expr");
+}
+
+/**
+ * \brief Writes an Expr tree in the binary form described in serialize.h
+ *
+ * \param e The root of the tree
+ * \return The serialized tree
+ *
+ * \throws std::runtime_error If the tree holds an Expr the parser doesn't
+ *         build (such as a FlatRef)
+ */
+std::string serialize(const PTR(Expr) &e) {
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint64_t> name_ids;
+    auto name = [&names, &name_ids](const std::string &str) {
+        auto inserted = name_ids.emplace(str, names.size());
+        if (inserted.second) {
+            names.push_back(str);
+        }
+        return inserted.first->second;
+    };
+
+    /* Each Expr is visited twice: to queue its operands, then, once they
+     * have all been written, to write it */
+    struct Visit {
+        Expr *expr;
+        bool write;
+    };
+    std::vector<Visit> stack{{e.get(), false}};
+    std::vector<Expr *> operands;
+    std::string nodes;
+    uint64_t count = 0;
+
+    while (!stack.empty()) {
+        Visit visit = stack.back();
+        stack.pop_back();
+
+        serial_tag_t tag = tag_of(visit.expr, operands);
+        if (!visit.write) {
+            stack.push_back({visit.expr, true});
+            for (auto it = operands.rbegin(); it != operands.rend(); ++it) {
+                stack.push_back({*it, false});
+            }
+            continue;
+        }
+
+        nodes.push_back(static_cast<char>(tag));
+        count++;
+        switch (tag) {
+            case SERIAL_NUM: {
+                int64_t n = static_cast<Num *>(visit.expr)->int_m.small();
+                put_varint(nodes, (static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63));
+                break;
+            }
+            case SERIAL_BIG:
+                put_string(nodes, static_cast<Num *>(visit.expr)->int_m.to_string());
+                break;
+            case SERIAL_NEG_BIG:
+                put_string(nodes, (-static_cast<Num *>(visit.expr)->int_m).to_string());
+                break;
+            case SERIAL_VAR:
+                put_varint(nodes, name(static_cast<Var *>(visit.expr)->str_m));
+                break;
+            case SERIAL_LET:
+                put_varint(nodes, name(static_cast<Let *>(visit.expr)->lhs_m));
+                break;
+            case SERIAL_LETREC:
+                put_varint(nodes, name(static_cast<LetRec *>(visit.expr)->lhs_m));
+                break;
+            case SERIAL_FUN: {
+                const std::vector<std::string> &formal_args = static_cast<Fun *>(visit.expr)->formal_args_m;
+                put_varint(nodes, formal_args.size());
+                for (const std::string &formal_arg: formal_args) {
+                    put_varint(nodes, name(formal_arg));
+                }
+                break;
+            }
+            case SERIAL_CALL:
+                put_varint(nodes, operands.size() - 1);
+                break;
+            default:
+                break;
+        }
+    }
+
+    std::string out(TREE_MAGIC, sizeof(TREE_MAGIC));
+    put_varint(out, names.size());
+    for (const std::string &str: names) {
+        put_string(out, str);
+    }
+    put_varint(out, count);
+    out += nodes;
+    return out;
+}
+
+/**
+ * \brief Rebuilds the serialized tree at a Reader's position
+ *
+ * \throws std::runtime_error If there is no whole serialized tree of this
+ *         format version there
+ */
+static PTR(Expr) read_tree(Reader &in) {
+    if (!in.skip(TREE_MAGIC, sizeof(TREE_MAGIC))) {
+        throw std::runtime_error("deserialize(): not a serialized tree of this version");
+    }
+
+    std::vector<std::string> names;
+    for (uint64_t count = in.varint(); names.size() < count;) {
+        names.push_back(in.string());
+    }
+    auto name = [&in, &names]() -> const std::string & {
+        uint64_t id = in.varint();
+        if (id >= names.size()) {
+            throw std::runtime_error("deserialize(): invalid name");
+        }
+        return names[id];
+    };
+
+    std::vector<PTR(Expr)> stack;   ///< Nodes whose parents aren't yet built
+    auto pop = [&stack]() {
+        PTR(Expr) e = std::move(stack.back());
+        stack.pop_back();
+        return e;
+    };
+
+    for (uint64_t count = in.varint(), i = 0; i < count; i++) {
+        auto tag = static_cast<serial_tag_t>(in.byte());
+
+        static const size_t OPERANDS[] = {0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 3, 1, 1};
+        if (tag > SERIAL_CALL) {
+            throw std::runtime_error("deserialize(): invalid tag");
+        }
+        if (stack.size() < OPERANDS[tag]) {
+            throw std::runtime_error("deserialize(): missing operand");
+        }
+
+        PTR(Expr) e;
+        switch (tag) {
+            case SERIAL_NUM: {
+                uint64_t n = in.varint();
+                e = NEW(Num)(static_cast<int64_t>(n >> 1) ^ -static_cast<int64_t>(n & 1));
+                break;
+            }
+            case SERIAL_BIG:
+                e = NEW(Num)(Integer::parse(in.string()));
+                break;
+            case SERIAL_NEG_BIG:
+                e = NEW(Num)(-Integer::parse(in.string()));
+                break;
+            case SERIAL_FALSE:
+            case SERIAL_TRUE:
+                e = NEW(Bool)(tag == SERIAL_TRUE);
+                break;
+            case SERIAL_VAR:
+                e = NEW(Var)(name());
+                break;
+            case SERIAL_ADD: {
+                PTR(Expr) rhs = pop();
+                e = NEW(Add)(pop(), rhs);
+                break;
+            }
+            case SERIAL_MULT: {
+                PTR(Expr) rhs = pop();
+                e = NEW(Mult)(pop(), rhs);
+                break;
+            }
+            case SERIAL_EQ: {
+                PTR(Expr) rhs = pop();
+                e = NEW(Eq)(pop(), rhs);
+                break;
+            }
+            case SERIAL_LET: {
+                PTR(Expr) body = pop();
+                e = NEW(Let)(name(), pop(), body);
+                break;
+            }
+            case SERIAL_LETREC: {
+                PTR(Expr) body = pop();
+                e = NEW(LetRec)(name(), pop(), body);
+                break;
+            }
+            case SERIAL_IF: {
+                PTR(Expr) else_branch = pop();
+                PTR(Expr) then_branch = pop();
+                e = NEW(If)(pop(), then_branch, else_branch);
+                break;
+            }
+            case SERIAL_FUN: {
+                std::vector<std::string> formal_args;
+                for (uint64_t params = in.varint(); formal_args.size() < params;) {
+                    formal_args.push_back(name());
+                }
+                e = NEW(Fun)(std::move(formal_args), pop());
+                break;
+            }
+            case SERIAL_CALL: {
+                uint64_t args = in.varint();
+                if (args > stack.size() - 1) {
+                    throw std::runtime_error("deserialize(): missing operand");
+                }
+                std::vector<PTR(Expr)> actual_args(std::make_move_iterator(stack.end() - args),
+                                                   std::make_move_iterator(stack.end()));
+                stack.resize(stack.size() - args);
+                e = NEW(Call)(pop(), std::move(actual_args));
+                break;
+            }
+        }
+        stack.push_back(std::move(e));
+    }
+
+    if (stack.size() != 1) {
+        throw std::runtime_error("deserialize(): not one tree");
+    }
+    return pop();
+}
+
+/**
+ * \brief Rebuilds an Expr tree written by serialize()
+ *
+ * \param bytes The serialized tree
+ * \return A new tree, equal to the one serialized
+ *
+ * \throws std::runtime_error If bytes is not a whole serialized tree of this
+ *         format version
+ */
+PTR(Expr) deserialize(const std::string &bytes) {
+    Reader in(bytes, 0);
+    PTR(Expr) e = read_tree(in);
+    if (!in.at_end()) {
+        throw std::runtime_error("deserialize(): trailing bytes");
+    }
+    return e;
+}
+
+/*
+ * Parse cache
+ */
+
+/// The cache directory; empty while caching is off
+static std::string cache_dir;
+
+/**
+ * \brief Sets the directory parse_cached() keeps its files in
+ *
+ * \param dir The directory, created on the first store if missing; empty
+ *            turns caching off
+ */
+void parse_cache_configure(const std::string &dir) {
+    cache_dir = dir;
+}
+
+/**
+ * \brief Names the cache file for a source text
+ *
+ * \param src The source
+ * \return The path of its file in the cache directory: the 64-bit FNV-1a
+ *         hash of src, in hex, with a ".msdc" extension
+ */
+std::string parse_cache_path(const std::string &src) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c: src) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.msdc", static_cast<unsigned long long>(hash));
+    return cache_dir + "/" + name;
+}
+
+/**
+ * \brief Parses a source text, or loads its tree from the cache directory
+ *
+ * \param src The source
+ * \return Its Expr tree, as parse_expr() would build it
+ *
+ * \throws std::runtime_error On invalid input, as parse_expr() does
+ *
+ * A cache file holds the source it was made from, which must match src,
+ * then the serialized tree. A missing, stale, or unreadable file means the
+ * source is parsed and its file (re)written. Invalid input is never cached,
+ * and a file that can't be written is skipped: the cache never changes a
+ * result.
+ */
+PTR(Expr) parse_cached(const std::string &src) {
+    if (cache_dir.empty()) {
+        return parse_expr(src);
+    }
+
+    std::string path = parse_cache_path(src);
+    std::ifstream file(path, std::ios::binary);
+    if (file) {
+        std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        try {
+            Reader in(bytes, 0);
+            if (in.skip(CACHE_MAGIC, sizeof(CACHE_MAGIC)) && in.string() == src) {
+                PTR(Expr) e = read_tree(in);
+                if (in.at_end()) {
+                    return e;
+                }
+            }
+        } catch (std::exception &) {
+            // Stale or damaged; rewritten below
+        }
+    }
+
+    PTR(Expr) e = parse_expr(src);
+
+    std::string bytes(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    put_string(bytes, src);
+    bytes += serialize(e);
+
+    /* Written under a temporary name and renamed, so a reader never sees half
+     * a file */
+    mkdir(cache_dir.c_str(), 0777);
+    std::string tmp = path + ".tmp" + std::to_string(getpid());
+    std::ofstream out(tmp, std::ios::binary);
+    out.write(bytes.data(), (std::streamsize) bytes.size());
+    out.close();
+    if (out.fail() || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+    }
+    return e;
+}
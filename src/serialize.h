@@ -0,0 +1,34 @@
+/**
+ * \file serialize.h
+ * \brief A binary form of an Expr tree, and an on-disk cache of parses
+ *
+ * serialize() writes a tree as a table of the distinct names in it (each a
+ * varint length and its bytes), then the nodes in post-order: a tag byte per
+ * node, followed by what the node holds besides its operands. Numbers that
+ * fit in 64 bits are zigzag varints, larger ones decimal digits; names are
+ * varint indices into the table. Operands are never written: in post-order
+ * they are the nodes just before their parent, so deserialize() rebuilds the
+ * tree with one stack and no recursion, and without parse_expr()'s per-_let
+ * checks.
+ *
+ * With a cache directory set (--cache-dir DIR), parse_cached() looks for a
+ * file named after a 64-bit FNV-1a hash of the source, holding the source
+ * and its serialized tree, and parses only when it is missing or stale.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "Expr.h"
+#include "pointers.h"
+
+std::string serialize(const PTR(Expr) &e);
+
+PTR(Expr) deserialize(const std::string &bytes);
+
+void parse_cache_configure(const std::string &dir);
+
+std::string parse_cache_path(const std::string &src);
+
+PTR(Expr) parse_cached(const std::string &src);
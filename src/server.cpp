@@ -0,0 +1,349 @@
+/**
+ * \file server.cpp
+ * \brief An epoll-driven server that evaluates framed requests on a
+ *        ThreadPool
+ *
+ * Every message, in either direction, is a frame: a 4-byte big-endian length
+ * n, then n bytes, the first of which is a tag. In a request the tag is a
+ * program_mode_t and the rest is the program's source text; in a reply the
+ * tag is STATUS_OK or STATUS_ERROR and the rest is the result of
+ * run_program() or the error message. A client may pipeline any number of
+ * requests on one connection; replies come back in request order.
+ *
+ * One thread runs the event loop (accepting, reading, framing, and writing,
+ * all non-blocking); the pool's workers parse and evaluate, then hand their
+ * replies back to the loop through a queue and an eventfd.
+ */
+
+#include <stdexcept>    /* std::runtime_error */
+
+#include "server.h"
+
+/**
+ * \brief Builds one frame
+ *
+ * \param tag The mode (requests) or status (replies) byte
+ * \param body The source text, result, or error message
+ * \return The length prefix, tag, and body
+ */
+std::string encode_frame(uint8_t tag, const std::string &body) {
+    uint32_t length = static_cast<uint32_t>(body.size() + 1);
+    std::string res;
+    res.reserve(4 + length);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        res += static_cast<char>((length >> shift) & 0xff);
+    }
+    res += static_cast<char>(tag);
+    res += body;
+    return res;
+}
+
+#ifdef __linux__
+
+#include <cerrno>       /* errno */
+#include <cstring>      /* std::strerror */
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "gc.h"
+#include "ThreadPool.h"
+#include "trace.h"
+
+static const uint64_t LISTENER_ID = 0;  ///< epoll data for the listening socket
+static const uint64_t WAKE_ID = 1;      ///< epoll data for the eventfd
+
+/**
+ * \struct Fd
+ * \brief Closes a file descriptor when it goes out of scope
+ */
+struct Fd {
+    int fd = -1;
+
+    ~Fd() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+};
+
+/**
+ * \struct Connection
+ * \brief The event loop's state for one client
+ */
+struct Connection {
+    Fd socket;
+    std::string in;                         ///< Bytes not yet framed
+    std::string out;                        ///< Bytes not yet written
+    uint64_t next_request = 0;              ///< Sequence number to assign next
+    uint64_t next_reply = 0;                ///< Sequence number to write next
+    std::map<uint64_t, std::string> ready;  ///< Replies finished out of order
+    bool reading = true;                    ///< False after EOF or a bad frame
+    bool broken = false;                    ///< True after a bad frame
+    uint32_t watching = EPOLLIN;            ///< The events registered for socket
+};
+
+/**
+ * \struct Completion
+ * \brief A reply from a worker, on its way back to the event loop
+ */
+struct Completion {
+    uint64_t connection;
+    uint64_t request;
+    std::string frame;
+};
+
+static std::runtime_error system_error(const std::string &what) {
+    return std::runtime_error("serve(): " + what + ": " + std::strerror(errno));
+}
+
+static void watch(int epoll, int fd, uint64_t id, uint32_t events, int op) {
+    epoll_event event = {};
+    event.events = events;
+    event.data.u64 = id;
+    if (epoll_ctl(epoll, op, fd, &event) < 0) {
+        throw system_error("epoll_ctl");
+    }
+}
+
+/**
+ * \brief Serves requests on a Unix domain socket until stop is set
+ *
+ * \param path Where to create the socket; an existing file there is replaced
+ * \param threads The number of evaluation workers; 0 means one per hardware
+ *                thread
+ * \param stop If non-null, checked at least every 100 ms; serve() returns
+ *             (removing the socket) once it is true
+ * \param budget Limits for each request; unless it has its own cancel flag,
+ *               stop also cancels requests still being evaluated
+ *
+ * \throws std::runtime_error If the socket cannot be created
+ */
+void serve(const std::string &path, size_t threads,
+           const std::atomic<bool> *stop, const Budget &budget) {
+    Budget request_budget = budget;
+    if (request_budget.cancel == nullptr) {
+        request_budget.cancel = stop;
+    }
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("serve(): socket path too long");
+    }
+    path.copy(address.sun_path, path.size());
+
+    Fd listener, epoll, wake;
+    listener.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener.fd < 0) {
+        throw system_error("socket");
+    }
+    unlink(path.c_str());
+    if (bind(listener.fd, (sockaddr *) &address, sizeof(address)) < 0 ||
+        listen(listener.fd, SOMAXCONN) < 0) {
+        throw system_error("bind " + path);
+    }
+
+    epoll.fd = epoll_create1(EPOLL_CLOEXEC);
+    wake.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll.fd < 0 || wake.fd < 0) {
+        throw system_error("epoll");
+    }
+    watch(epoll.fd, listener.fd, LISTENER_ID, EPOLLIN, EPOLL_CTL_ADD);
+    watch(epoll.fd, wake.fd, WAKE_ID, EPOLLIN, EPOLL_CTL_ADD);
+
+    std::mutex done_mutex;
+    std::vector<Completion> done;       // Guarded by done_mutex
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections;
+    uint64_t next_id = WAKE_ID + 1;
+
+    // Declared last so that its workers finish before anything above goes
+    ThreadPool pool(threads);
+
+    // Moves finished replies into conn.out, in order, and writes what it can
+    auto flush = [&](uint64_t id, Connection &conn) {
+        for (auto found = conn.ready.find(conn.next_reply); found != conn.ready.end();
+             found = conn.ready.find(conn.next_reply)) {
+            conn.out += found->second;
+            conn.ready.erase(found);
+            conn.next_reply++;
+        }
+
+        while (!conn.out.empty()) {
+            ssize_t written = send(conn.socket.fd, conn.out.data(), conn.out.size(), MSG_NOSIGNAL);
+            if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else if (written < 0) {
+                connections.erase(id); // peer is gone
+                return;
+            }
+            conn.out.erase(0, written);
+        }
+
+        if (!conn.reading && conn.out.empty() && conn.next_reply == conn.next_request) {
+            connections.erase(id);
+            return;
+        }
+
+        // After EOF the socket stays readable (or hung up), so it is watched
+        // only while there is something to write
+        uint32_t wanted = (conn.reading ? uint32_t(EPOLLIN) : 0u) | (conn.out.empty() ? 0u : uint32_t(EPOLLOUT));
+        if (wanted != conn.watching) {
+            if (wanted == 0) {
+                epoll_ctl(epoll.fd, EPOLL_CTL_DEL, conn.socket.fd, nullptr);
+            } else {
+                watch(epoll.fd, conn.socket.fd, id, wanted,
+                      conn.watching == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD);
+            }
+            conn.watching = wanted;
+        }
+    };
+
+    // Splits conn.in into requests and hands them to the pool
+    auto dispatch = [&](uint64_t id, Connection &conn) {
+        size_t offset = 0;
+        while (!conn.broken && conn.in.size() - offset >= 4) {
+            uint32_t length = 0;
+            for (size_t i = 0; i < 4; i++) {
+                length = (length << 8) | static_cast<unsigned char>(conn.in[offset + i]);
+            }
+
+            uint64_t request = conn.next_request;
+            if (length == 0 || length > MAX_FRAME) {
+                conn.next_request++;
+                conn.ready[request] = encode_frame(STATUS_ERROR, "serve: invalid frame length");
+                conn.reading = false; // the stream can't be re-synchronized
+                conn.broken = true;
+                offset = conn.in.size();
+                break;
+            }
+            if (conn.in.size() - offset - 4 < length) {
+                break;
+            }
+
+            uint8_t mode = static_cast<uint8_t>(conn.in[offset + 4]);
+            std::string src = conn.in.substr(offset + 5, length - 1);
+            offset += 4 + length;
+            conn.next_request++;
+
+            if (mode > MODE_PRETTY_PRINT) {
+                conn.ready[request] = encode_frame(STATUS_ERROR, "serve: unknown mode");
+                continue;
+            }
+            pool.submit([&, id, request, mode, src]() {
+                std::string reply;
+                try {
+                    TraceSpan span("request");
+                    reply = encode_frame(STATUS_OK, run_program(src, (program_mode_t) mode,
+                                                                request_budget));
+                } catch (const std::exception &exception) {
+                    reply = encode_frame(STATUS_ERROR, exception.what());
+                }
+                gc_collect();
+                {
+                    std::lock_guard<std::mutex> lock(done_mutex);
+                    done.push_back({id, request, std::move(reply)});
+                }
+                uint64_t one = 1;
+                (void) !write(wake.fd, &one, sizeof(one));
+            });
+        }
+        conn.in.erase(0, offset);
+    };
+
+    std::vector<epoll_event> events(64);
+    while (stop == nullptr || !stop->load()) {
+        int count = epoll_wait(epoll.fd, events.data(), static_cast<int>(events.size()),
+                               stop == nullptr ? -1 : 100);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count < 0) {
+            throw system_error("epoll_wait");
+        }
+
+        for (int i = 0; i < count; i++) {
+            uint64_t id = events[i].data.u64;
+
+            if (id == LISTENER_ID) {
+                int fd;
+                while ((fd = accept4(listener.fd, nullptr, nullptr,
+                                     SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    std::unique_ptr<Connection> conn(new Connection());
+                    conn->socket.fd = fd;
+                    watch(epoll.fd, fd, next_id, EPOLLIN, EPOLL_CTL_ADD);
+                    connections[next_id++] = std::move(conn);
+                }
+                continue;
+            }
+
+            if (id == WAKE_ID) {
+                uint64_t ignored;
+                (void) !read(wake.fd, &ignored, sizeof(ignored));
+                std::vector<Completion> finished;
+                {
+                    std::lock_guard<std::mutex> lock(done_mutex);
+                    finished.swap(done);
+                }
+                for (Completion &completion: finished) {
+                    auto found = connections.find(completion.connection);
+                    if (found != connections.end()) {
+                        found->second->ready[completion.request] = std::move(completion.frame);
+                        flush(completion.connection, *found->second);
+                    }
+                }
+                continue;
+            }
+
+            auto found = connections.find(id);
+            if (found == connections.end()) {
+                continue; // closed earlier in this batch of events
+            }
+            Connection &conn = *found->second;
+
+            if (events[i].events & EPOLLERR) {
+                connections.erase(id);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP)) {
+                char buffer[65536];
+                while (conn.reading) {
+                    ssize_t got = recv(conn.socket.fd, buffer, sizeof(buffer), 0);
+                    if (got > 0) {
+                        conn.in.append(buffer, got);
+                    } else if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        break;
+                    } else {
+                        conn.reading = false; // EOF: reply to what was sent, then close
+                    }
+                }
+                dispatch(id, conn);
+            }
+            flush(id, conn);
+        }
+    }
+
+    unlink(path.c_str());
+}
+
+#else
+
+/**
+ * \brief Stands in for serve() where epoll is unavailable
+ *
+ * \throws std::runtime_error Always
+ */
+void serve(const std::string &path, size_t threads,
+           const std::atomic<bool> *stop, const Budget &budget) {
+    throw std::runtime_error("serve(): requires Linux (epoll)");
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,24 @@
+/**
+ * \file server.h
+ * \brief "--serve": a long-lived evaluation daemon on a Unix domain socket
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>      /* size_t */
+#include <cstdint>      /* uint8_t, uint32_t */
+#include <string>
+
+#include "budget.h"
+
+static const uint8_t STATUS_OK = 0;     ///< Reply status: the result follows
+static const uint8_t STATUS_ERROR = 1;  ///< Reply status: the error follows
+
+static const uint32_t MAX_FRAME = 16 << 20; ///< Largest request accepted
+
+std::string encode_frame(uint8_t tag, const std::string &body);
+
+void serve(const std::string &path, size_t threads = 0,
+           const std::atomic<bool> *stop = nullptr,
+           const Budget &budget = Budget());
@@ -0,0 +1,46 @@
+/**
+ * \file stats.cpp
+ * \brief EvalStats counters and StatsReport definitions
+ */
+
+#include <iomanip>      /* std::setw */
+
+#include "stats.h"
+
+thread_local EvalStats eval_stats;
+
+/**
+ * \brief Writes one "name: value" line per phase time and counter
+ *
+ * \param stream A reference to an output stream to write to
+ */
+void StatsReport::write(std::ostream &stream) const {
+    auto us = [](std::chrono::nanoseconds ns) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(ns).count();
+    };
+    auto line = [&stream](const char *name) -> std::ostream & {
+        return stream << std::left << std::setw(26) << name << std::right;
+    };
+
+    line("read (us):") << us(read) << "\n";
+    line("parse (us):") << us(parse) << "\n";
+    line("eval (us):") << us(eval) << "\n";
+    line("print (us):") << us(print) << "\n";
+    line("nodes parsed:") << nodes_parsed << "\n";
+    line("nodes evaluated:") << eval_counts.nodes_evaluated << "\n";
+    line("NumVal allocations:") << eval_counts.num_vals << "\n";
+    line("BoolVal allocations:") << eval_counts.bool_vals << "\n";
+    line("FunVal allocations:") << eval_counts.fun_vals << "\n";
+    line("ExtendedEnv allocations:") << eval_counts.envs << "\n";
+    line("max env chain length:") << eval_counts.max_env_length << "\n";
+    line("max recursion depth:") << eval_counts.max_depth << "\n";
+    line("gc collections:") << eval_counts.gc_collections << "\n";
+    line("gc objects freed:") << eval_counts.gc_freed << "\n";
+    line("gc pause total (us):") << eval_counts.gc_pause_ns / 1000 << "\n";
+    line("gc pause max (us):") << eval_counts.gc_max_pause_ns / 1000 << "\n";
+    line("memo hits:") << eval_counts.memo_hits << "\n";
+    line("memo misses:") << eval_counts.memo_misses << "\n";
+    line("memo evictions:") << eval_counts.memo_evictions << "\n";
+    line("call cache hits:") << eval_counts.call_cache_hits << "\n";
+    line("call cache misses:") << eval_counts.call_cache_misses << "\n";
+}
@@ -0,0 +1,97 @@
+/**
+ * \file stats.h
+ * \brief Runtime counters for "--stats": evaluation steps, allocations by
+ *        type, the deepest environment chain and interp() recursion, cycle
+ *        collections, memo cache hits, and call-site inline cache hits
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>      /* size_t */
+#include <cstdint>      /* uint64_t */
+#include <ostream>
+
+/**
+ * \struct EvalStats
+ * \brief Counters updated by every evaluation on this thread
+ *
+ * The counters are always on: each is a thread-local increment next to an
+ * interp() call or an allocation, which cost far more. Reset them before
+ * the evaluation to be measured.
+ */
+struct EvalStats {
+    uint64_t nodes_evaluated = 0;   ///< Expr::interp() calls
+    uint64_t num_vals = 0;          ///< NumVals created
+    uint64_t bool_vals = 0;         ///< BoolVals created
+    uint64_t fun_vals = 0;          ///< FunVals created
+    uint64_t envs = 0;              ///< ExtendedEnvs created
+    uint64_t max_env_length = 0;    ///< Longest ExtendedEnv chain created
+    uint64_t max_depth = 0;         ///< Deepest nesting of interp() calls
+    uint64_t depth = 0;             ///< Current nesting of interp() calls
+    uint64_t gc_collections = 0;    ///< gc_collect() runs with candidates
+    uint64_t gc_freed = 0;          ///< Vals and Envs freed by them
+    uint64_t gc_pause_ns = 0;       ///< Total time spent in them
+    uint64_t gc_max_pause_ns = 0;   ///< Longest of them
+    uint64_t thunks = 0;            ///< ThunkVals created (see LazyEval)
+    uint64_t thunks_forced = 0;     ///< ThunkVals evaluated
+    uint64_t memo_hits = 0;         ///< Calls answered by the memo cache
+    uint64_t memo_misses = 0;       ///< Memoizable calls it didn't have
+    uint64_t memo_evictions = 0;    ///< Results it dropped to make room
+    uint64_t call_cache_hits = 0;   ///< Calls entered through Call's inline cache
+    uint64_t call_cache_misses = 0; ///< Calls dispatched through Val::call()/apply()
+};
+
+extern thread_local EvalStats eval_stats;
+
+/**
+ * \class StatsFrame
+ * \brief Counts one interp() call and tracks the recursion depth while it
+ *        is in progress; one is declared at the start of every interp()
+ */
+class StatsFrame {
+public:
+
+    StatsFrame() {
+        eval_stats.nodes_evaluated++;
+        if (++eval_stats.depth > eval_stats.max_depth) {
+            eval_stats.max_depth = eval_stats.depth;
+        }
+    }
+
+    ~StatsFrame() {
+        eval_stats.depth--;
+    }
+
+    StatsFrame(const StatsFrame &) = delete;
+
+    StatsFrame &operator=(const StatsFrame &) = delete;
+};
+
+/**
+ * \brief Counts one ExtendedEnv; called by its constructor
+ *
+ * \param length The length of the new environment's chain
+ */
+inline void stats_env(size_t length) {
+    eval_stats.envs++;
+    if (length > eval_stats.max_env_length) {
+        eval_stats.max_env_length = length;
+    }
+}
+
+/**
+ * \struct StatsReport
+ * \brief Everything "--stats" prints: phase times, the size of the parsed
+ *        Expr, and the evaluation's counters
+ */
+struct StatsReport {
+    std::chrono::nanoseconds read{0};
+    std::chrono::nanoseconds parse{0};
+    std::chrono::nanoseconds eval{0};
+    std::chrono::nanoseconds print{0};
+    uint64_t nodes_parsed = 0;
+    EvalStats eval_counts;
+
+    void write(std::ostream &stream) const;
+};
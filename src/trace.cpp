@@ -0,0 +1,118 @@
+/**
+ * \file trace.cpp
+ * \brief Tracer definitions
+ */
+
+#include <algorithm>    /* std::find */
+#include <iomanip>      /* std::setw, std::setfill */
+
+#include "trace.h"
+
+std::atomic<Tracer *> Tracer::active(nullptr);
+
+/**
+ * \brief A small, stable number for the calling thread, used as its track
+ */
+static uint64_t thread_number() {
+    static std::atomic<uint64_t> next(1);
+    static thread_local uint64_t number = next++;
+    return number;
+}
+
+/**
+ * \brief Writes str as a JSON string literal
+ */
+static void write_json_string(std::ostream &stream, const std::string &str) {
+    static const char *hex = "0123456789abcdef";
+
+    stream << '"';
+    for (char c: str) {
+        if (c == '"' || c == '\\') {
+            stream << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            stream << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+        } else {
+            stream << c;
+        }
+    }
+    stream << '"';
+}
+
+/**
+ * \brief Constructs a Tracer; the calling thread's track is named "main"
+ *
+ * \param call_threshold How long a function call must take to get a span
+ */
+Tracer::Tracer(std::chrono::nanoseconds call_threshold)
+        : call_threshold_m(call_threshold),
+          start_m(std::chrono::steady_clock::now()),
+          main_thread_m(thread_number()) {
+}
+
+/**
+ * \brief Records a span on the calling thread's track
+ *
+ * \param name What the span measures
+ * \param category The span's category: "phase" or "call"
+ * \param start When the span started
+ * \param end When the span ended
+ */
+void Tracer::span(const std::string &name, const char *category,
+                  std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::time_point end) {
+    Event event{name, category,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(start - start_m).count(),
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(),
+                thread_number()};
+
+    std::lock_guard<std::mutex> lock(mutex_m);
+    events_m.push_back(std::move(event));
+}
+
+/**
+ * \return The number of spans recorded
+ */
+size_t Tracer::size() const {
+    std::lock_guard<std::mutex> lock(mutex_m);
+    return events_m.size();
+}
+
+/**
+ * \brief Writes every span, plus a name for every track, as a JSON object
+ *        that chrome://tracing and Perfetto can load
+ *
+ * \param stream A reference to an output stream to write to
+ */
+void Tracer::write(std::ostream &stream) const {
+    std::lock_guard<std::mutex> lock(mutex_m);
+
+    std::vector<uint64_t> threads;
+    for (const Event &event: events_m) {
+        if (std::find(threads.begin(), threads.end(), event.thread) == threads.end()) {
+            threads.push_back(event.thread);
+        }
+    }
+
+    stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    const char *separator = "\n";
+    for (uint64_t thread: threads) {
+        stream << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+               << thread << ",\"args\":{\"name\":\""
+               << (thread == main_thread_m ? "main" : "worker " + std::to_string(thread))
+               << "\"}}";
+        separator = ",\n";
+    }
+    for (const Event &event: events_m) {
+        stream << separator << "{\"name\":";
+        write_json_string(stream, event.name);
+        // Timestamps are in microseconds; keep nanosecond precision
+        stream << ",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+               << event.thread
+               << ",\"ts\":" << event.start_ns / 1000 << "." << std::setfill('0') << std::setw(3)
+               << event.start_ns % 1000
+               << ",\"dur\":" << event.duration_ns / 1000 << "." << std::setw(3)
+               << event.duration_ns % 1000 << std::setfill(' ') << "}";
+        separator = ",\n";
+    }
+    stream << "\n]}\n";
+}
@@ -0,0 +1,98 @@
+/**
+ * \file trace.h
+ * \brief Chrome trace-event recording ("--trace FILE"): spans for reading,
+ *        parsing, evaluating, and printing, and for slow function calls
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>      /* uint64_t */
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// Calls to user-defined functions shorter than this get no span of their own
+static const std::chrono::microseconds TRACE_CALL_THRESHOLD(100);
+
+/**
+ * \class Tracer
+ * \brief Collects complete ("X") trace events from any thread, and writes
+ *        them as Chrome/Perfetto trace-event JSON
+ *
+ * Each thread that records a span gets its own track. Recording takes a
+ * lock, so spans should be coarse: phases, records, and calls that already
+ * took longer than call_threshold_m.
+ */
+class Tracer {
+
+public:
+
+    /// The Tracer that TraceSpans record to, or null while tracing is off
+    static std::atomic<Tracer *> active;
+
+    std::chrono::nanoseconds call_threshold_m;
+
+    explicit Tracer(std::chrono::nanoseconds call_threshold = TRACE_CALL_THRESHOLD);
+
+    void span(const std::string &name, const char *category,
+              std::chrono::steady_clock::time_point start,
+              std::chrono::steady_clock::time_point end);
+
+    void write(std::ostream &stream) const;
+
+    size_t size() const;
+
+private:
+
+    struct Event {
+        std::string name;
+        const char *category;
+        int64_t start_ns;   ///< Since start_m
+        int64_t duration_ns;
+        uint64_t thread;    ///< Track
+    };
+
+    std::chrono::steady_clock::time_point start_m;
+    mutable std::mutex mutex_m;
+    std::vector<Event> events_m;
+    uint64_t main_thread_m;
+};
+
+/**
+ * \class TraceSpan
+ * \brief Records a span from its construction to its destruction, if
+ *        tracing was on when it was constructed
+ */
+class TraceSpan {
+
+public:
+
+    explicit TraceSpan(const char *name, const char *category = "phase")
+            : tracer_m(Tracer::active.load(std::memory_order_relaxed)),
+              name_m(name),
+              category_m(category) {
+        if (tracer_m != nullptr) {
+            start_m = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TraceSpan() {
+        if (tracer_m != nullptr) {
+            tracer_m->span(name_m, category_m, start_m, std::chrono::steady_clock::now());
+        }
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+
+    Tracer *tracer_m;
+    const char *name_m;
+    const char *category_m;
+    std::chrono::steady_clock::time_point start_m;
+};
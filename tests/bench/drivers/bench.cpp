@@ -0,0 +1,296 @@
+/**
+ * \file bench.cpp
+ * \brief Macro-benchmark runner ("make bench"): times msd-script on a corpus
+ *        of programs and compares the results against a saved baseline
+ *
+ * Every program in CORPUS_DIR is run through "--interp", "--print", and
+ * "--pretty-print", RUNS times each, as a separate process. The median wall
+ * time and the peak resident set size of each (program, mode) pair are
+ * written to RESULTS_FILE as JSON, then compared against BASELINE_FILE: a
+ * pair regresses when it is more than THRESHOLD slower (or bigger) than its
+ * baseline, and by more than the noise floor.
+ */
+
+#include <algorithm>    /* std::sort, std::max */
+#include <cerrno>       /* errno */
+#include <chrono>
+#include <cstdlib>      /* std::atof, std::atoi */
+#include <filesystem>
+#include <fstream>
+#include <iomanip>      /* std::setw, std::setprecision */
+#include <iostream>
+#include <map>
+#include <stdexcept>    /* std::runtime_error */
+#include <string>
+#include <utility>      /* std::pair */
+#include <vector>
+
+#include <fcntl.h>      /* open */
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char *EXECUTABLE = "bin/msd-script";
+static const char *CORPUS_DIR = "tests/bench/corpus";
+static const char *BASELINE_FILE = "tests/bench/baseline.json";
+static const char *RESULTS_FILE = "bin/bench.json";
+
+static const char *MODES[] = {"--interp", "--print", "--pretty-print"};
+
+static const int RUNS = 7;                 ///< Runs per (program, mode) pair
+static const double THRESHOLD = 0.25;      ///< Allowed slowdown/growth: 25%
+static const double NOISE_MS = 5.0;        ///< Smaller slowdowns are ignored
+static const long NOISE_KB = 1024;         ///< Smaller growth is ignored
+
+/**
+ * \struct Measurement
+ * \brief The results for one (program, mode) pair
+ */
+struct Measurement {
+    std::string program;
+    std::string mode;
+    double median_ms = 0;
+    long peak_rss_kb = 0;
+};
+
+/**
+ * \brief Runs EXECUTABLE once with the program as stdin, discarding output
+ *
+ * \param path The program's file
+ * \param mode The flag to run it with
+ * \param rss_kb Set to the process's peak resident set size
+ * \return The wall time in milliseconds
+ *
+ * \throws std::runtime_error If the process can't be started or fails
+ */
+static double run_once(const std::string &path, const char *mode, long &rss_kb) {
+    auto start = std::chrono::steady_clock::now();
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        throw std::runtime_error("run_once(): fork failed");
+    }
+    if (pid == 0) {
+        int in = open(path.c_str(), O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if (in == -1 || out == -1) {
+            _exit(127);
+        }
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        dup2(out, STDERR_FILENO);
+        execl(EXECUTABLE, EXECUTABLE, mode, (char *) nullptr);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage{};
+    while (wait4(pid, &status, 0, &usage) == -1) {
+        if (errno != EINTR) {
+            throw std::runtime_error("run_once(): wait4 failed");
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error("run_once(): " + std::string(EXECUTABLE) + " " + mode +
+                                 " failed on " + path);
+    }
+
+#ifdef __APPLE__
+    rss_kb = usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    rss_kb = usage.ru_maxrss;        // kilobytes on Linux
+#endif
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/**
+ * \brief Runs one (program, mode) pair runs times
+ *
+ * \return The median time and the largest peak RSS
+ */
+static Measurement measure(const std::filesystem::path &path, const char *mode, int runs) {
+    Measurement res;
+    res.program = path.filename().string();
+    res.mode = mode;
+
+    std::vector<double> times;
+    for (int i = 0; i < runs; i++) {
+        long rss_kb;
+        times.push_back(run_once(path.string(), mode, rss_kb));
+        res.peak_rss_kb = std::max(res.peak_rss_kb, rss_kb);
+    }
+    std::sort(times.begin(), times.end());
+    res.median_ms = runs % 2 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+    return res;
+}
+
+/**
+ * \brief Writes measurements as a JSON array, one object per line
+ */
+static void write_json(std::ostream &stream, const std::vector<Measurement> &measurements) {
+    stream << "[\n";
+    for (size_t i = 0; i < measurements.size(); i++) {
+        const Measurement &m = measurements[i];
+        stream << "  {\"program\": \"" << m.program << "\", \"mode\": \"" << m.mode
+               << "\", \"median_ms\": " << std::fixed << std::setprecision(3) << m.median_ms
+               << ", \"peak_rss_kb\": " << m.peak_rss_kb << "}"
+               << (i + 1 < measurements.size() ? "," : "") << "\n";
+    }
+    stream << "]\n";
+}
+
+/**
+ * \brief Finds the value of "key" in one line of write_json()'s output
+ *
+ * \return The value, without quotes; empty if the key is missing
+ */
+static std::string json_field(const std::string &line, const std::string &key) {
+    size_t pos = line.find("\"" + key + "\":");
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos = line.find_first_not_of(' ', pos + key.size() + 3);
+    if (pos == std::string::npos) {
+        return "";
+    }
+    if (line[pos] == '"') {
+        return line.substr(pos + 1, line.find('"', pos + 1) - pos - 1);
+    }
+    return line.substr(pos, line.find_first_of(",}", pos) - pos);
+}
+
+/**
+ * \brief Reads measurements written by write_json()
+ *
+ * \return The measurements, by (program, mode)
+ */
+static std::map<std::pair<std::string, std::string>, Measurement> read_json(std::istream &stream) {
+    std::map<std::pair<std::string, std::string>, Measurement> res;
+    std::string line;
+    while (std::getline(stream, line)) {
+        Measurement m;
+        m.program = json_field(line, "program");
+        m.mode = json_field(line, "mode");
+        if (m.program.empty() || m.mode.empty()) {
+            continue;
+        }
+        m.median_ms = std::atof(json_field(line, "median_ms").c_str());
+        m.peak_rss_kb = std::atol(json_field(line, "peak_rss_kb").c_str());
+        res[{m.program, m.mode}] = m;
+    }
+    return res;
+}
+
+/**
+ * \brief Prints each measurement next to its baseline
+ *
+ * \return The number of regressions
+ */
+static int compare(const std::vector<Measurement> &measurements,
+                   const std::map<std::pair<std::string, std::string>, Measurement> &baseline,
+                   double threshold) {
+    int regressions = 0;
+
+    std::cout << std::left << std::setw(20) << "program" << std::setw(16) << "mode"
+              << std::right << std::setw(12) << "median ms" << std::setw(12) << "baseline"
+              << std::setw(12) << "peak KB" << std::setw(12) << "baseline" << "\n";
+    for (const Measurement &m: measurements) {
+        std::cout << std::left << std::setw(20) << m.program << std::setw(16) << m.mode
+                  << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << m.median_ms;
+
+        auto found = baseline.find({m.program, m.mode});
+        if (found == baseline.end()) {
+            std::cout << std::setw(12) << "-" << std::setw(12) << m.peak_rss_kb
+                      << std::setw(12) << "-" << "  (new)\n";
+            continue;
+        }
+
+        const Measurement &base = found->second;
+        bool slower = m.median_ms > base.median_ms * (1 + threshold) &&
+                      m.median_ms - base.median_ms > NOISE_MS;
+        bool bigger = m.peak_rss_kb > base.peak_rss_kb * (1 + threshold) &&
+                      m.peak_rss_kb - base.peak_rss_kb > NOISE_KB;
+        std::cout << std::setw(12) << base.median_ms << std::setw(12) << m.peak_rss_kb
+                  << std::setw(12) << base.peak_rss_kb
+                  << (slower ? "  SLOWER" : "") << (bigger ? "  BIGGER" : "") << "\n";
+        regressions += slower || bigger;
+    }
+    return regressions;
+}
+
+/**
+ * \brief Runs the corpus, then saves the results as the new baseline
+ *        ("--save") or compares them against the saved one
+ *
+ * Options: "--runs N" (default RUNS) and "--threshold PERCENT" (default
+ * THRESHOLD). Exits with 1 if anything regressed or failed.
+ */
+int main(int argc, char **argv) {
+    bool save = false;
+    int runs = RUNS;
+    double threshold = THRESHOLD;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--save") {
+                save = true;
+            } else if (arg == "--runs" && i + 1 < argc) {
+                runs = std::max(1, std::atoi(argv[++i]));
+            } else if (arg == "--threshold" && i + 1 < argc) {
+                threshold = std::atof(argv[++i]) / 100;
+            } else {
+                throw std::runtime_error("invalid argument: " + arg);
+            }
+        }
+
+        std::vector<std::filesystem::path> programs;
+        for (const auto &entry: std::filesystem::directory_iterator(CORPUS_DIR)) {
+            if (entry.path().extension() == ".msd") {
+                programs.push_back(entry.path());
+            }
+        }
+        std::sort(programs.begin(), programs.end());
+        if (programs.empty()) {
+            throw std::runtime_error(std::string("no programs in ") + CORPUS_DIR);
+        }
+
+        std::vector<Measurement> measurements;
+        for (const std::filesystem::path &program: programs) {
+            for (const char *mode: MODES) {
+                measurements.push_back(measure(program, mode, runs));
+            }
+        }
+
+        std::ofstream results(RESULTS_FILE);
+        write_json(results, measurements);
+        if (!results) {
+            throw std::runtime_error(std::string("cannot write ") + RESULTS_FILE);
+        }
+
+        if (save) {
+            std::ofstream baseline(BASELINE_FILE);
+            write_json(baseline, measurements);
+            if (!baseline) {
+                throw std::runtime_error(std::string("cannot write ") + BASELINE_FILE);
+            }
+            std::cout << "Saved " << measurements.size() << " measurements to "
+                      << BASELINE_FILE << std::endl;
+            return 0;
+        }
+
+        std::ifstream baseline_file(BASELINE_FILE);
+        int regressions = compare(measurements, read_json(baseline_file), threshold);
+        std::cout << "\nResults written to " << RESULTS_FILE << "; " << regressions
+                  << " regression(s) beyond " << std::defaultfloat << threshold * 100 << "%"
+                  << std::endl;
+        return regressions ? 1 : 0;
+    }
+    catch (const std::exception &exception) {
+        std::cerr << "ERROR: " << exception.what() << std::endl;
+        return 1;
+    }
+}
@@ -4,14 +4,47 @@
  * \file tests.cpp
  */
 
+#include <algorithm> /* std::sort */
+#include <atomic>  /* std::atomic */
+#include <chrono>  /* std::chrono::milliseconds */
+#include <climits> /* INT_MAX, INT_MIN */
+#include <cstdio>  /* std::remove */
+#include <fstream> /* std::ifstream, std::ofstream */
+#include <functional> /* std::function */
+#include <sstream> /* std::stringstream */
+#include <thread>  /* std::thread */
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING /* Must match cmdline.cpp */
 #include "../../src/catch.h" /* Catch2 testing framework */
 
+#include "../../src/allocations.h"
+#include "../../src/batch.h"
+#include "../../src/budget.h"
+#include "../../src/columnar.h"
 #include "../../src/Env.h"
 #include "../../src/Expr.h"
+#include "../../src/flat.h"
+#include "../../src/gc.h"
+#include "../../src/memo.h"
+#include "../../src/parallel.h"
 #include "../../src/parse.h"
+#include "../../src/profile.h"
 #include "../../src/pointers.h"
+#include "../../src/repl.h"
+#include "../../src/serialize.h"
+#include "../../src/server.h"
+#include "../../src/stats.h"
+#include "../../src/trace.h"
+#include "../../src/Type.h"
 #include "../../src/Val.h"
 
+#include <unistd.h> /* getpid, rmdir */
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
 TEST_CASE("Properties of Addition/Multiplication")
 {
     SECTION("Addition")
@@ -2014,4 +2047,1897 @@ TEST_CASE("Fun/FunVal/Call")
             }
         }
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Typecheck")
+{
+    SECTION("Expr::typecheck()")
+    {
+        CHECK(parse_expr("42")->typecheck()->to_string() == "int");
+        CHECK(parse_expr("_true")->typecheck()->to_string() == "bool");
+        CHECK(parse_expr("1 + 2 * 3")->typecheck()->to_string() == "int");
+        CHECK(parse_expr("1 == 2")->typecheck()->to_string() == "bool");
+        CHECK(parse_expr("_fun (x) x + 1")->typecheck()->to_string() == "(int -> int)");
+        CHECK((NEW(Fun)("x", NEW(Var)("x")))->typecheck()->to_string() == "('a -> 'a)");
+        CHECK(parse_expr("_if _true _then 1 _else 2")->typecheck()->to_string() == "int");
+        CHECK(parse_expr("_let f = _fun (x) x * 2\n_in  f(21)")->typecheck()->to_string() == "int");
+
+        // Let-bound functions are polymorphic
+        CHECK((NEW(Let)("id", NEW(Fun)("x", NEW(Var)("x")),
+                        NEW(If)(NEW(Call)(NEW(Var)("id"), NEW(Bool)(true)),
+                                NEW(Call)(NEW(Var)("id"), NEW(Num)(1)),
+                                NEW(Num)(2))))->typecheck()->to_string() == "int");
+        // ...but function arguments are not
+        CHECK_THROWS_WITH(parse_expr("_fun (id) _if id(_true) _then id(1) _else 2")->typecheck(),
+                          "typecheck(): type mismatch between bool and int");
+    }
+
+    SECTION("Ill-typed expressions")
+    {
+        CHECK_THROWS_WITH(parse_expr("1 + _true")->typecheck(),
+                          "typecheck(): type mismatch between bool and int");
+        CHECK_THROWS_WITH(parse_expr("_if 1 _then 2 _else 3")->typecheck(),
+                          "typecheck(): type mismatch between int and bool");
+        CHECK_THROWS_WITH(parse_expr("_if _true _then 2 _else _false")->typecheck(),
+                          "typecheck(): type mismatch between int and bool");
+        CHECK_THROWS_WITH(parse_expr("1 == _true")->typecheck(),
+                          "typecheck(): type mismatch between int and bool");
+        CHECK_THROWS_WITH(parse_expr("(1)(2)")->typecheck(),
+                          "typecheck(): type mismatch between int and (int -> 'a)");
+        CHECK_THROWS_WITH(parse_expr("x + 1")->typecheck(), "typecheck(): unbound variable x");
+        CHECK_THROWS_WITH(parse_expr("_fun (x) x(x)")->typecheck(), "typecheck(): infinite type");
+    }
+
+    SECTION("Unchecked interp()")
+    {
+        PTR(Expr) e = parse_expr("_let f = _fun (x) _if x == 0 _then 1 _else x * 2\n_in  f(21) + f(0)");
+        CHECK_FALSE(e->typed_m);
+        CHECK(e->typecheck()->to_string() == "int");
+        CHECK(CAST(Let)(e)->body_m->typed_m);
+        CHECK_FALSE(CAST(Add)(CAST(Let)(e)->body_m)->lhs_m->typed_m); // Calls have no unchecked path
+        CHECK(e->interp()->equals(NEW(NumVal)(43)));
+
+        // Nothing is marked when any part of the expression is ill-typed
+        PTR(Add) add = NEW(Add)(NEW(Num)(1), NEW(Num)(2));
+        PTR(Expr) bad = NEW(Eq)(add, NEW(Bool)(true));
+        CHECK_THROWS(bad->typecheck());
+        CHECK_FALSE(add->typed_m);
+        CHECK_THROWS_WITH(NEW(Add)(add, NEW(Bool)(true))->interp(), "invalid operation on non-number");
+    }
+
+    SECTION("interp() environments")
+    {
+        CHECK(parse_expr("_let x = 1\n_in  _if x == 1 _then x + 1 _else x")->interp()->equals(NEW(NumVal)(2)));
+        CHECK(parse_expr("_let y = 2\n_in  (_fun (x) x + y)(3)")->interp()->equals(NEW(NumVal)(5)));
+        CHECK(parse_expr("_let f = _fun (x) x + 1\n_in  f(2)")->interp()->equals(NEW(NumVal)(3)));
+    }
+}
+
+TEST_CASE("Integer")
+{
+    SECTION("Small values")
+    {
+        CHECK((Integer(2) + Integer(3)) == Integer(5));
+        CHECK((Integer(-4) * Integer(3)) == Integer(-12));
+        CHECK((Integer(INT_MAX) + Integer(1)).to_string() == "2147483648");
+        CHECK((Integer(INT_MAX) + Integer(1)).is_small());
+        CHECK((-Integer(7)).to_string() == "-7");
+    }
+
+    SECTION("Promotion to BigNum on overflow")
+    {
+        Integer max = INT64_MAX;
+        Integer min = INT64_MIN;
+
+        CHECK((max + Integer(1)).to_string() == "9223372036854775808");
+        CHECK_FALSE((max + Integer(1)).is_small());
+        CHECK((min + Integer(-1)).to_string() == "-9223372036854775809");
+        CHECK((-min).to_string() == "9223372036854775808");
+        CHECK((max * max).to_string() == "85070591730234615847396907784232501249");
+        CHECK((min * min).to_string() == "85070591730234615865843651857942052864");
+        CHECK((max * Integer(-2)).to_string() == "-18446744073709551614");
+    }
+
+    SECTION("Demotion when the result fits again")
+    {
+        Integer max = INT64_MAX;
+        Integer big = max + Integer(1);
+
+        CHECK((big + Integer(-1)).is_small());
+        CHECK((big + Integer(-1)) == max);
+        CHECK((big + -big) == Integer(0));
+        CHECK((big + -big).is_small());
+        CHECK(big == Integer::parse("9223372036854775808"));
+        CHECK(big != max);
+    }
+
+    SECTION("Subtraction, division, and ordering")
+    {
+        Integer max = INT64_MAX;
+        Integer min = INT64_MIN;
+        Integer big = Integer::parse("1267650600228229401496703205376"); // 2^100
+
+        CHECK((Integer(3) - Integer(5)) == Integer(-2));
+        CHECK((min - Integer(1)).to_string() == "-9223372036854775809");
+        CHECK((big - big) == Integer(0));
+
+        CHECK((Integer(-7) / Integer(2)) == Integer(-3)); // toward zero
+        CHECK((Integer(-7) % Integer(2)) == Integer(-1)); // sign of the dividend
+        CHECK((min / Integer(-1)).to_string() == "9223372036854775808");
+        CHECK((min % Integer(-1)) == Integer(0));
+        CHECK((big / Integer::parse("1099511627776")) == Integer(1) * Integer(1152921504606846976)); // 2^60
+        CHECK((big / -max).to_string() == "-137438953472");
+        CHECK((-big % max).to_string() == "-137438953472");
+        CHECK((big % Integer(7)).to_string() == "2");
+        CHECK_THROWS_WITH(Integer(1) / Integer(0), "division by zero");
+        CHECK_THROWS_WITH(big % Integer(0), "division by zero");
+
+        CHECK(Integer(-1) < Integer(0));
+        CHECK_FALSE(Integer(0) < Integer(0));
+        CHECK(Integer(0) <= Integer(0));
+        CHECK(max < big);
+        CHECK(-big < min);
+        CHECK_FALSE(big < -big);
+        CHECK(-big < -max);
+    }
+
+    SECTION("Integer::parse()")
+    {
+        CHECK(Integer::parse("0") == Integer(0));
+        CHECK(Integer::parse("000123") == Integer(123));
+        CHECK(Integer::parse("9223372036854775807") == Integer(INT64_MAX));
+        CHECK(Integer::parse("123456789012345678901234567890").to_string() == "123456789012345678901234567890");
+        CHECK(Integer::parse("1000000000000000000000").to_string() == "1000000000000000000000");
+        CHECK_THROWS_WITH(Integer::parse(""), "Integer::parse(): no digits");
+    }
+
+    SECTION("Large numbers in expressions")
+    {
+        CHECK(parse_expr("2147483647 + 1")->interp()->to_string() == "2147483648");
+        CHECK(parse_expr("9223372036854775807 + 1")->interp()->to_string() == "9223372036854775808");
+        CHECK(parse_expr("-9223372036854775808 * -1")->interp()->to_string() == "9223372036854775808");
+        CHECK(parse_expr("100000000000000000000 * 100000000000000000000")->interp()->to_string() ==
+              "10000000000000000000000000000000000000000");
+        CHECK(parse_expr("123456789012345678901234567890")->to_string() == "123456789012345678901234567890");
+        CHECK(parse_expr("(9223372036854775807 + 1) + -1 == 9223372036854775807")->interp()->equals(NEW(BoolVal)(true)));
+    }
+}
+
+TEST_CASE("Columnar")
+{
+    // The reference: interp() once per row, with every column bound
+    auto interp_rows = [](PTR(Expr) e, const ColumnTable &table) {
+        std::vector<std::string> res;
+        for (size_t r = 0; r < table.rows(); r++) {
+            PTR(Env) env = Env::empty;
+            for (size_t k = 0; k < table.names.size(); k++) {
+                env = NEW(ExtendedEnv)(table.names[k], NEW(NumVal)(table.columns[k][r]), env);
+            }
+            res.push_back(e->interp(env)->to_string());
+        }
+        return res;
+    };
+
+    ColumnTable table;
+    table.names = {"x", "y"};
+    table.columns.resize(2);
+    for (int64_t r = 0; r < 2500; r++) { // Several chunks, plus a partial one
+        table.columns[0].push_back(r * 7919 % 2001 - 1000);
+        table.columns[1].push_back(r % 13 - 6);
+    }
+
+    SECTION("read_columns()")
+    {
+        std::stringstream good("x, y\n1, -2\n\n30,40\n");
+        ColumnTable read = read_columns(good);
+        CHECK(read.names == std::vector<std::string>{"x", "y"});
+        CHECK(read.rows() == 2);
+        CHECK(read.columns[0] == std::vector<int64_t>{1, 30});
+        CHECK(read.columns[1] == std::vector<int64_t>{-2, 40});
+
+        std::stringstream bad_name("x,y1\n1,2\n");
+        CHECK_THROWS_WITH(read_columns(bad_name), "read_columns(): invalid column name");
+        std::stringstream bad_row("x,y\n1\n");
+        CHECK_THROWS_WITH(read_columns(bad_row), "read_columns(): wrong number of values");
+        std::stringstream bad_value("x,y\n1,two\n");
+        CHECK_THROWS_WITH(read_columns(bad_value), "read_columns(): invalid value");
+    }
+
+    SECTION("Arithmetic, Eq, and If match interp()")
+    {
+        const char *exprs[] = {
+                "x + y",
+                "x * y + 3",
+                "x * x * y",
+                "x == y",
+                "x + y == 0",
+                "_if x == 0 _then 1 _else x * y",
+                "_if y == 0 _then _true _else _false",
+                "_true",
+                "42",
+        };
+        for (const char *src: exprs) {
+            PTR(Expr) e = parse_expr(src);
+            CHECK(interp_columns(e, table) == interp_rows(e, table));
+        }
+    }
+
+    SECTION("Overflowing chunks fall back to interp()")
+    {
+        ColumnTable big;
+        big.names = {"x"};
+        big.columns = {{INT64_MAX, 1, -1, INT64_MIN, 3037000500, -3037000500, 0}};
+
+        PTR(Expr) sum = parse_expr("x + x");
+        PTR(Expr) square = parse_expr("x * x");
+        CHECK(interp_columns(sum, big) == interp_rows(sum, big));
+        CHECK(interp_columns(square, big) == interp_rows(square, big));
+        CHECK(interp_columns(sum, big)[0] == "18446744073709551614");
+        CHECK(interp_columns(square, big)[4] == "9223372037000250000");
+    }
+
+    SECTION("Other expressions evaluate per row")
+    {
+        const char *exprs[] = {
+                "_let z = x * 2 _in z + y",
+                "(_fun (a) a * a)(x) + y",
+                "_let f = _fun (a) a + y _in f(x) == x",
+                "x + 100000000000000000000",
+        };
+        for (const char *src: exprs) {
+            PTR(Expr) e = parse_expr(src);
+            CHECK(interp_columns(e, table) == interp_rows(e, table));
+        }
+        CHECK_THROWS_WITH(interp_columns(parse_expr("x + _true"), table), "invalid operation on non-number");
+        CHECK_THROWS_WITH(interp_columns(parse_expr("x + z"), table), "Var cannot call interp()");
+    }
+
+    SECTION("Untaken _if branches are not evaluated")
+    {
+        ColumnTable rows;
+        rows.names = {"x"};
+        rows.columns = {{0, 5, 2}};
+
+        PTR(Expr) guarded = parse_expr("_if x == 0 _then 0 _else div(10, x)");
+        CHECK(interp_columns(guarded, rows) == std::vector<std::string>{"0", "2", "5"});
+
+        // f(-1) would never return
+        PTR(Expr) recursive = parse_expr("_if x == 0 _then 1 _else _letrec f = _fun (n) _if n == 0 _then 1 "
+                                         "_else n * f(n + -1) _in f(x + -1)");
+        CHECK(interp_columns(recursive, rows) == std::vector<std::string>{"1", "24", "1"});
+
+        // Nested, and with the scalar in the test, which is always evaluated
+        PTR(Expr) nested = parse_expr("_if x == 5 _then x + 1 _else _if x == 0 _then x _else div(10, x)");
+        CHECK(interp_columns(nested, rows) == std::vector<std::string>{"0", "6", "5"});
+        PTR(Expr) test = parse_expr("_if div(10, x + 1) == 10 _then x * 2 _else x + 1");
+        CHECK(interp_columns(test, rows) == interp_rows(test, rows));
+    }
+}
+
+TEST_CASE("Batch")
+{
+    SECTION("split_records()")
+    {
+        std::stringstream lines("1 + 2\n\n_let x = 3 _in x * x\n  \n_true\n");
+        CHECK(split_records(lines) == std::vector<std::string>{"1 + 2", "_let x = 3 _in x * x", "_true"});
+
+        std::stringstream delimited("_let x = 3\n_in x * x;\n1 + 2;\n");
+        CHECK(split_records(delimited) == std::vector<std::string>{"_let x = 3\n_in x * x", "\n1 + 2"});
+    }
+
+    SECTION("run_batch() keeps input order and isolates errors")
+    {
+        ThreadPool pool(4);
+        std::vector<std::string> records = {"1 + 2", "_true + 1", "(_fun (x) x * 2)(21)", "y", "1 == 1"};
+        CHECK(run_batch(records, pool) == std::vector<std::string>{
+                "3", "ERROR: invalid operation on non-number", "42", "ERROR: Var cannot call interp()", "_true"});
+    }
+
+    SECTION("run_batch() matches run_program()")
+    {
+        std::vector<std::string> records;
+        for (int i = 0; i < 500; i++) {
+            records.push_back("_let f = _fun (n) n * " + std::to_string(i) +
+                              " _in f(" + std::to_string(i) + ") + f(-1)");
+        }
+
+        std::vector<std::string> expected;
+        for (const std::string &record: records) {
+            expected.push_back(run_program(record));
+        }
+
+        ThreadPool pool;
+        CHECK(pool.size() >= 1);
+        CHECK(run_batch(records, pool) == expected);
+    }
+
+    SECTION("Env::empty is per thread")
+    {
+        Env *main_empty = Env::empty.get();
+        Env *worker_empty = nullptr;
+        std::thread worker([&worker_empty]() { worker_empty = Env::empty.get(); });
+        worker.join();
+        CHECK(worker_empty != nullptr);
+        CHECK(worker_empty != main_empty);
+    }
+}
+
+TEST_CASE("Parallel")
+{
+    // A balanced tree of Adds and Mults (alternating by depth) over small Nums
+    // and leaf, which must be at least depth 1
+    std::function<PTR(Expr)(int, int &, PTR(Expr))> tree = [&tree](int depth, int &n, PTR(Expr) leaf) -> PTR(Expr) {
+        if (depth == 0) {
+            n++;
+            return n % 97 == 0 && leaf ? leaf : NEW(Num)(n % 7 - 3);
+        }
+        PTR(Expr) lhs = tree(depth - 1, n, leaf);
+        PTR(Expr) rhs = tree(depth - 1, n, leaf);
+        return depth % 2 ? (PTR(Expr)) NEW(Add)(lhs, rhs) : (PTR(Expr)) NEW(Mult)(lhs, rhs);
+    };
+
+    SECTION("Wide arithmetic matches interp()")
+    {
+        int n = 0;
+        PTR(Expr) e = tree(13, n, nullptr);
+        for (size_t threads: {1, 2, 4}) {
+            CHECK(parallel_interp(e, threads, 16)->equals(e->interp()));
+        }
+        CHECK(parallel_interp(NEW(Eq)(e, e), 4, 16)->equals(NEW(BoolVal)(true)));
+    }
+
+    SECTION("Lets, Ifs, and Calls match interp()")
+    {
+        int n = 0;
+        PTR(Expr) a = tree(8, n, NEW(Var)("x"));
+        PTR(Expr) b = tree(8, n, nullptr);
+        PTR(Expr) c = tree(8, n, NEW(Var)("a"));
+
+        // a and b are independent; c depends on a
+        PTR(Expr) lets = NEW(Let)("x", NEW(Num)(2),
+                                  NEW(Let)("a", a,
+                                           NEW(Let)("b", b,
+                                                    NEW(Let)("c", c,
+                                                             NEW(Add)(NEW(Mult)(NEW(Var)("a"), NEW(Var)("b")),
+                                                                      NEW(Var)("c"))))));
+        CHECK(parallel_interp(lets, 4, 16)->equals(lets->interp()));
+
+        PTR(Expr) call = NEW(Call)(NEW(Fun)("x", NEW(If)(NEW(Eq)(a, b), a, NEW(Add)(a, b))), b);
+        CHECK(parallel_interp(call, 4, 16)->equals(call->interp()));
+    }
+
+    SECTION("Errors match interp()")
+    {
+        int n = 0;
+        PTR(Expr) bad_type = tree(10, n, NEW(Bool)(true));
+        PTR(Expr) unbound = tree(10, n, NEW(Var)("y"));
+        CHECK_THROWS_WITH(parallel_interp(bad_type, 4, 16), "invalid operation on non-number");
+        CHECK_THROWS_WITH(parallel_interp(unbound, 4, 16), "Var cannot call interp()");
+
+        // The lhs's error wins, as it does sequentially
+        CHECK_THROWS_WITH(parallel_interp(NEW(Add)(bad_type, unbound), 4, 16), "invalid operation on non-number");
+        CHECK_THROWS_WITH(parallel_interp(NEW(Add)(unbound, bad_type), 4, 16), "Var cannot call interp()");
+        CHECK_THROWS_WITH(parallel_interp(NEW(Call)(unbound, bad_type), 4, 16), "Var cannot call interp()");
+    }
+
+    SECTION("Calls are entered as interp() enters them, for --memo and --trace")
+    {
+        PTR(Expr) fib = parse_expr("_letrec fib = _fun (n) _if le(n, 1) _then n _else fib(n + -1) + fib(n + -2) "
+                                   "_in fib(25)");
+        memo_configure(100); // per thread, so on one thread to count it
+        eval_stats = EvalStats();
+        CHECK(parallel_interp(fib, 1, 3)->to_string() == "75025");
+        CHECK(eval_stats.memo_misses == 26); // fib(0) through fib(25), once each
+        memo_configure(0);
+        gc_collect();
+
+        PTR(Expr) small_fib = parse_expr("_letrec fib = _fun (n) _if le(n, 1) _then n _else fib(n + -1) + fib(n + -2) "
+                                         "_in fib(12)");
+        Tracer sequential(std::chrono::nanoseconds(0));
+        Tracer::active = &sequential;
+        PTR(Val) expected = small_fib->interp();
+        Tracer parallel(std::chrono::nanoseconds(0));
+        Tracer::active = &parallel;
+        CHECK(parallel_interp(small_fib, 4, 3)->equals(expected));
+        Tracer::active = nullptr;
+        CHECK(parallel.size() == sequential.size()); // a span per call
+        gc_collect();
+    }
+
+    SECTION("Budgets hold across threads")
+    {
+        int n = 0;
+        PTR(Expr) e = tree(15, n, nullptr); // 65535 nodes
+        PTR(Val) expected = e->interp();
+        Budget budget;
+
+        budget.max_steps = 20000;
+        for (int i = 0; i < 5; i++) {
+            BudgetScope scope(budget);
+            CHECK_THROWS_WITH(parallel_interp(e, 4, 64), "interp(): step limit exceeded");
+        }
+        // Other threads may be holding up to a checkpoint's worth each
+        budget.max_steps = 65535 + 4 * BUDGET_CHECK_INTERVAL;
+        {
+            BudgetScope scope(budget);
+            CHECK(parallel_interp(e, 4, 64)->equals(expected));
+        }
+        budget.max_steps = 0;
+
+        budget.max_allocations = 20000;
+        {
+            BudgetScope scope(budget);
+            CHECK_THROWS_WITH(parallel_interp(e, 4, 64), "interp(): allocation limit exceeded");
+        }
+        budget.max_allocations = 0;
+
+        std::atomic<bool> cancel{true};
+        budget.cancel = &cancel;
+        {
+            BudgetScope scope(budget);
+            CHECK_THROWS_WITH(parallel_interp(e, 4, 64), "interp(): cancelled");
+        }
+
+        // What the threads drew but didn't use goes back to the caller's scope
+        cancel = false;
+        budget.max_steps = 2 * 65535 + 4 * BUDGET_CHECK_INTERVAL;
+        {
+            BudgetScope scope(budget);
+            CHECK(parallel_interp(e, 4, 64)->equals(expected));
+            CHECK(e->interp()->equals(expected));
+            CHECK_THROWS_WITH(e->interp(), "interp(): step limit exceeded");
+        }
+    }
+}
+
+TEST_CASE("Repl")
+{
+    SECTION("parse_entry()")
+    {
+        std::string name = "stale";
+        CHECK(parse_entry("1 + 2", name)->equals(NEW(Add)(NEW(Num)(1), NEW(Num)(2))));
+        CHECK(name.empty());
+
+        CHECK(parse_entry("  _def  f = _fun (x) x * x ", name)->equals(
+                NEW(Fun)("x", NEW(Mult)(NEW(Var)("x"), NEW(Var)("x")))));
+        CHECK(name == "f");
+
+        CHECK(parse_entry("_def y = y == 1", name)->equals(NEW(Eq)(NEW(Var)("y"), NEW(Num)(1))));
+        CHECK(name == "y");
+
+        CHECK_THROWS_WITH(parse_entry("_def 1 = 2", name), "parse_def(): invalid def");
+        CHECK_THROWS_WITH(parse_entry("_def x 2", name), "consume(): mismatch");
+        CHECK_THROWS_WITH(parse_entry("1 + _def x = 2", name), "parse_bases(): _def is only allowed at the top level");
+        CHECK_THROWS_WITH(parse_expr("_def x = 2"), "parse_bases(): _def is only allowed at the top level");
+        CHECK_THROWS_WITH(parse_entry("_def x = 2 3", name), "parse_expr(): invalid input");
+        CHECK_THROWS_WITH(parse_entry("_dfe x = 2", name), "peek_keyword(): invalid keyword");
+        CHECK_THROWS_WITH(parse_entry("_define x = 2", name), "peek_keyword(): invalid keyword");
+        CHECK_THROWS_WITH(parse_expr("_d"), "peek_keyword(): invalid keyword");
+    }
+
+    SECTION("Session::run()")
+    {
+        Session session;
+        CHECK(session.run("_def sq = _fun (x) x * x") == "sq = (_fun (x) (x*x))");
+        CHECK(session.run("sq(7)") == "49");
+        CHECK(session.run("_def y = sq(3) + 1") == "y = 10");
+        CHECK(session.run("y + sq(y)") == "110");
+        CHECK(session.run("_def y = y * 2") == "y = 20"); // Shadows the old y
+        CHECK(session.run("y") == "20");
+
+        // A failed entry leaves the session as it was
+        CHECK_THROWS_WITH(session.run("_def z = y + _true"), "invalid operation on non-number");
+        CHECK_THROWS_WITH(session.run("z"), "Var cannot call interp()");
+        CHECK(session.run("y") == "20");
+    }
+
+    SECTION("Session::loop()")
+    {
+        Session session;
+        std::stringstream in("_def x = 4\n\nx * x\nx + _false\n_def f = _fun (n) n + x\nf(1)\n");
+        std::stringstream out;
+        session.loop(in, out, false);
+        CHECK(out.str() == "x = 4\n16\nERROR: invalid operation on non-number\n"
+                           "f = (_fun (n) (n+x))\n5\n");
+
+        std::stringstream prompted_in("1 + 1\n");
+        std::stringstream prompted_out;
+        Session().loop(prompted_in, prompted_out, true);
+        CHECK(prompted_out.str() == "msd> 2\nmsd> \n");
+    }
+}
+
+TEST_CASE("Budget")
+{
+    const std::string forever = "_let f = _fun (f) _fun (n) f(f)(n + 1) _in f(f)(0)";
+    const std::string fib = "_let fib = _fun (fib) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1 "
+                            "_else fib(fib)(n + -1) + fib(fib)(n + -2) _in fib(fib)(40)";
+
+    SECTION("Step limits are exact")
+    {
+        Budget budget;
+        budget.max_steps = 3; // Add, Num, Num
+        CHECK(run_program("1 + 2", MODE_INTERP, budget) == "3");
+        budget.max_steps = 2;
+        CHECK_THROWS_AS(run_program("1 + 2", MODE_INTERP, budget), budget_exceeded);
+        CHECK_THROWS_WITH(run_program("1 + 2", MODE_INTERP, budget), "interp(): step limit exceeded");
+
+        budget.max_steps = 10000;
+        CHECK_THROWS_WITH(run_program(forever, MODE_INTERP, budget), "interp(): step limit exceeded");
+
+        // Printing doesn't evaluate, so it doesn't spend steps
+        budget.max_steps = 1;
+        CHECK(run_program(forever, MODE_PRINT, budget) == parse_expr(forever)->to_string());
+    }
+
+    SECTION("Allocation limits")
+    {
+        Budget budget;
+        budget.max_allocations = 3; // NumVal, NumVal, NumVal
+        CHECK(run_program("1 + 2", MODE_INTERP, budget) == "3");
+        budget.max_allocations = 2;
+        CHECK_THROWS_WITH(run_program("1 + 2", MODE_INTERP, budget), "interp(): allocation limit exceeded");
+
+        budget.max_allocations = 0;
+        budget.max_bytes = 3 * sizeof(NumVal);
+        CHECK(run_program("1 + 2", MODE_INTERP, budget) == "3");
+        budget.max_bytes = 3 * sizeof(NumVal) - 1;
+        CHECK_THROWS_WITH(run_program("1 + 2", MODE_INTERP, budget), "interp(): allocation limit exceeded");
+    }
+
+    SECTION("Deadlines and cancellation")
+    {
+        Budget budget;
+        budget.timeout = std::chrono::milliseconds(20);
+        auto start = std::chrono::steady_clock::now();
+        CHECK_THROWS_WITH(run_program(fib, MODE_INTERP, budget), "interp(): deadline exceeded");
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+        std::atomic<bool> cancel(false);
+        Budget cancellable;
+        cancellable.cancel = &cancel;
+        std::thread canceller([&cancel]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            cancel = true;
+        });
+        CHECK_THROWS_WITH(run_program(fib, MODE_INTERP, cancellable), "interp(): cancelled");
+        canceller.join();
+    }
+
+    SECTION("Scopes nest and restore")
+    {
+        Budget outer;
+        outer.max_steps = 100;
+        BudgetScope outer_scope(outer);
+        CHECK(parse_expr("1 + 2")->interp()->to_string() == "3"); // 3 of 100
+
+        {
+            Budget inner;
+            inner.max_steps = 1;
+            BudgetScope inner_scope(inner);
+            CHECK_THROWS_AS(parse_expr("1 + 2")->interp(), budget_exceeded);
+        }
+
+        CHECK(parse_expr("1 + 2")->interp()->to_string() == "3"); // 6 of 100
+        CHECK_THROWS_WITH(parse_expr(forever)->interp(), "interp(): step limit exceeded");
+    }
+
+    SECTION("Batches and sessions limit each record or entry")
+    {
+        Budget budget;
+        budget.max_steps = 10000;
+        ThreadPool pool(2);
+        CHECK(run_batch({"1 + 2", forever, "2 * 3"}, pool, budget) ==
+              std::vector<std::string>{"3", "ERROR: interp(): step limit exceeded", "6"});
+
+        Session session;
+        session.budget_m = budget;
+        CHECK(session.run("_def x = 5") == "x = 5");
+        CHECK_THROWS_AS(session.run("_def y = " + forever), budget_exceeded);
+        CHECK(session.run("x * x") == "25");
+    }
+    SECTION("Option values")
+    {
+        std::vector<std::string> args = {"msdscript", "--max-steps", "99999999999999999999999",
+                                         "--max-steps", "9223372036854775808",
+                                         "--max-steps", "9223372036854775807",
+                                         "--memo", "18446744073709551615",
+                                         "--memo", "18446744073709551616",
+                                         "--timeout", "12x", "--timeout"};
+        std::vector<char *> argv;
+        for (std::string &arg: args) {
+            argv.push_back(&arg[0]);
+        }
+        int argc = static_cast<int>(argv.size());
+
+        int i = 1;
+        CHECK_THROWS_WITH(option_value(argc, argv.data(), i, INT64_MAX), "--max-steps: value out of range");
+        i = 3;
+        CHECK_THROWS_WITH(option_value(argc, argv.data(), i, INT64_MAX), "--max-steps: value out of range");
+        i = 5;
+        CHECK(option_value(argc, argv.data(), i, INT64_MAX) == INT64_MAX);
+        CHECK(i == 6);
+        i = 7;
+        CHECK(option_value(argc, argv.data(), i) == UINT64_MAX);
+        i = 9;
+        CHECK_THROWS_WITH(option_value(argc, argv.data(), i), "--memo: value out of range");
+        i = 11;
+        CHECK_THROWS_WITH(option_value(argc, argv.data(), i), "--timeout: invalid value");
+        i = 13;
+        CHECK_THROWS_WITH(option_value(argc, argv.data(), i), "--timeout: missing value");
+
+        // The largest limits of all behave as no limit
+        Budget budget;
+        budget.max_steps = budget.max_allocations = budget.max_bytes = INT64_MAX;
+        budget.timeout = std::chrono::milliseconds(INT64_MAX);
+        CHECK(run_program("1 + 2", MODE_INTERP, budget) == "3");
+    }
+}
+
+TEST_CASE("Profile")
+{
+    SECTION("Instrumented copies print and evaluate like the original")
+    {
+        PTR(Expr) e = parse_expr("_let f = _fun (x) x * x _in f(3) + f(4)");
+        Profiler profiler;
+        PTR(Expr) instrumented = profiler.instrument(e);
+        CHECK(instrumented->to_string() == e->to_string());
+        CHECK(instrumented->to_pretty_string() == e->to_pretty_string());
+        CHECK(instrumented->equals(e));
+        CHECK(instrumented->interp()->to_string() == "25");
+        CHECK(instrumented->typecheck()->to_string() == "int");
+    }
+
+    SECTION("Sites are counted per construct")
+    {
+        Profiler profiler;
+        PTR(Expr) e = profiler.instrument(parse_expr("_let f = _fun (x) x * x _in f(3) + f(4)"));
+        CHECK(e->interp()->to_string() == "25");
+        CHECK(profiler.site("program").count == 1);
+        CHECK(profiler.site("_let f").count == 1);
+        CHECK(profiler.site("_fun f").count == 2);
+        CHECK(profiler.site("call f").count == 1);
+        CHECK(profiler.site("call f #2").count == 1);
+        CHECK_THROWS_AS(profiler.site("call g"), std::runtime_error);
+
+        std::stringstream folded;
+        profiler.write_folded(folded);
+        std::string line;
+        std::vector<std::string> stacks;
+        while (std::getline(folded, line)) {
+            size_t space = line.rfind(' ');
+            REQUIRE(space != std::string::npos);
+            CHECK(line.find_first_not_of("0123456789", space + 1) == std::string::npos);
+            stacks.push_back(line.substr(0, space));
+        }
+        std::sort(stacks.begin(), stacks.end());
+        CHECK(stacks == std::vector<std::string>{"program", "program;_let f",
+                                                 "program;call f", "program;call f #2",
+                                                 "program;call f #2;_fun f", "program;call f;_fun f"});
+    }
+
+    SECTION("Many sites can share a label")
+    {
+        // Numbering a label is constant-time, however many sites share it
+        PTR(Expr) body = NEW(Call)(NEW(Var)("f"), NEW(Num)(1));
+        for (int i = 1; i < 4000; i++) {
+            body = NEW(Add)(body, NEW(Call)(NEW(Var)("f"), NEW(Num)(1)));
+        }
+        Profiler profiler;
+        PTR(Expr) e = profiler.instrument(NEW(Let)("f", NEW(Fun)("x", NEW(Var)("x")), body));
+        CHECK(e->interp()->to_string() == "4000");
+        CHECK(profiler.site("call f").count == 1);
+        CHECK(profiler.site("call f #2").count == 1);
+        CHECK(profiler.site("call f #4000").count == 1);
+        CHECK_THROWS_AS(profiler.site("call f #4001"), std::runtime_error);
+        CHECK(profiler.site("_fun f").count == 4000);
+    }
+
+    SECTION("Recursion counts inclusive time once")
+    {
+        Profiler profiler;
+        PTR(Expr) e = profiler.instrument(parse_expr(
+                "_let fact = _fun (fact) _fun (n) _if n == 0 _then 1 _else n * fact(fact)(n + -1) "
+                "_in fact(fact)(10)"));
+        CHECK(e->interp()->to_string() == "3628800");
+        CHECK(profiler.site("_fun (n)").count == 11);
+        CHECK(profiler.site("_fun fact").count == 11);
+        CHECK(profiler.site("_fun (n)").inclusive_ns <= profiler.site("program").inclusive_ns);
+        CHECK(profiler.site("_fun (n)").exclusive_ns <= profiler.site("_fun (n)").inclusive_ns);
+
+        std::stringstream summary;
+        profiler.write_summary(summary);
+        CHECK(summary.str().find("_fun (n)\n") != std::string::npos);
+    }
+
+    SECTION("Errors unwind the profile")
+    {
+        Profiler profiler;
+        PTR(Expr) e = profiler.instrument(parse_expr("_let f = _fun (x) x + _true _in f(1)"));
+        CHECK_THROWS_WITH(e->interp(), "invalid operation on non-number");
+        CHECK_THROWS_WITH(e->interp(), "invalid operation on non-number");
+        CHECK(profiler.site("_fun f").count == 2);
+
+        std::stringstream folded;
+        profiler.write_folded(folded);
+        CHECK(folded.str().find("program;call f;_fun f ") != std::string::npos);
+    }
+}
+
+TEST_CASE("Stats")
+{
+    SECTION("Evaluations are counted")
+    {
+        PTR(Expr) e = parse_expr("_let f = _fun (x) x * x _in f(3) + f(4)");
+        CHECK(e->size_m == 12);
+
+        eval_stats = EvalStats();
+        CHECK(e->interp()->to_string() == "25");
+        CHECK(eval_stats.nodes_evaluated == 15);
+        CHECK(eval_stats.num_vals == 5);  // 3, 4, 9, 16, 25
+        CHECK(eval_stats.bool_vals == 0);
+        CHECK(eval_stats.fun_vals == 1);
+        CHECK(eval_stats.envs == 3);      // f, and x twice
+        CHECK(eval_stats.max_env_length == 1);
+        CHECK(eval_stats.max_depth == 5); // _let, +, call, *, x
+        CHECK(eval_stats.depth == 0);
+    }
+
+    SECTION("Depths")
+    {
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_let x = 1 _in _let y = 2 _in _let z = 3 _in x + y + z == 6")
+                      ->interp()->to_string() == "_true");
+        CHECK(eval_stats.bool_vals == 1);
+        CHECK(eval_stats.max_env_length == 3);
+        CHECK(eval_stats.max_depth == 7);
+
+        // Errors unwind the depth
+        eval_stats = EvalStats();
+        CHECK_THROWS(parse_expr("1 + (2 + (3 + _true))")->interp());
+        CHECK(eval_stats.max_depth == 4);
+        CHECK(eval_stats.depth == 0);
+    }
+
+    SECTION("Reports")
+    {
+        StatsReport report;
+        report.eval = std::chrono::microseconds(42);
+        report.nodes_parsed = 11;
+        report.eval_counts.fun_vals = 2;
+        std::stringstream stream;
+        report.write(stream);
+        CHECK(stream.str().find("eval (us):                42\n") != std::string::npos);
+        CHECK(stream.str().find("nodes parsed:             11\n") != std::string::npos);
+        CHECK(stream.str().find("FunVal allocations:       2\n") != std::string::npos);
+    }
+
+    SECTION("Call inline caches")
+    {
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_letrec f = _fun (n) _if n == 0 _then 0 _else 1 + f(n + -1) _in f(10)")
+                      ->interp()->to_string() == "10");
+        CHECK(eval_stats.call_cache_misses == 2); // each call site's first call
+        CHECK(eval_stats.call_cache_hits == 9);
+        gc_collect();
+
+        // Several arguments are entered with one frame, as by Val::apply()
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_letrec f = _fun (a, b) _if a == 0 _then b _else f(a + -1, b + a) _in f(4, 0)")
+                      ->interp()->to_string() == "10");
+        CHECK(eval_stats.call_cache_misses == 2);
+        CHECK(eval_stats.call_cache_hits == 3);
+        gc_collect();
+
+        // More than Call::CACHE_MAX_ARGS always go through Val::apply()
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_letrec f = _fun (a, b, c, d, e) _if a == 0 _then b + c + d + e "
+                         "_else f(a + -1, b, c, d, e) _in f(3, 1, 1, 1, 1)")->interp()->to_string() == "4");
+        CHECK(eval_stats.call_cache_misses == 4);
+        CHECK(eval_stats.call_cache_hits == 0);
+        gc_collect();
+
+        // A call site that sees two functions misses whenever it changes
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_let g = _fun (h) h(1) _in _let inc = _fun (x) x + 1 _in g(inc) + g(inc) + g(_fun (y) y * 5)")
+                      ->interp()->to_string() == "9");
+        CHECK(eval_stats.call_cache_hits == 1);   // h(1) with inc the second time
+        CHECK(eval_stats.call_cache_misses == 5); // three g(...) sites, and h(1) twice
+
+        // Partially applied, a body takes fewer arguments: never a false hit
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_let f = _fun (x, y) x * 10 + y _in _let g = _fun (h) h(1) _in g(f(2)) + g(f)(3)")
+                      ->interp()->to_string() == "34");
+        CHECK(parse_expr("_let f = _fun (x, y) x * 10 + y _in _let g = _fun (h) h(1) _in g(f)(3) + g(f(2))")
+                      ->interp()->to_string() == "34");
+
+        // Primitives always go through Val::call()
+        eval_stats = EvalStats();
+        CHECK(parse_expr("sub(3, 1) + sub(3, 1)")->interp()->to_string() == "4");
+        CHECK(eval_stats.call_cache_hits == 0);
+        CHECK(eval_stats.call_cache_misses == 2);
+
+        // A hit still enters through FunVal::enter(), so --memo answers it
+        memo_configure(100);
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_let g = _fun (h) h(3) _in _let d = _fun (n) n * 2 _in g(d) + g(d)")
+                      ->interp()->to_string() == "12");
+        CHECK(eval_stats.call_cache_hits == 1);
+        CHECK(eval_stats.memo_misses == 1);
+        CHECK(eval_stats.memo_hits == 1);
+        memo_configure(0);
+        gc_collect();
+
+        StatsReport report;
+        report.eval_counts.call_cache_hits = 5;
+        std::stringstream stream;
+        report.write(stream);
+        CHECK(stream.str().find("call cache hits:          5\n") != std::string::npos);
+    }
+}
+
+TEST_CASE("Trace")
+{
+    SECTION("Spans are recorded only while a Tracer is active")
+    {
+        CHECK(Tracer::active == nullptr);
+        Tracer tracer(std::chrono::nanoseconds(0));
+        CHECK(run_program("_let f = _fun (x) x * x _in f(3)") == "9");
+        CHECK(tracer.size() == 0);
+
+        Tracer::active = &tracer;
+        CHECK(run_program("_let f = _fun (x) x * x _in f(3)") == "9");
+        Tracer::active = nullptr;
+        CHECK(tracer.size() == 4); // parse_expr, _fun (x), interp, print
+
+        std::stringstream json;
+        tracer.write(json);
+        CHECK(json.str().rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", 0) == 0);
+        CHECK(json.str().find("\"args\":{\"name\":\"main\"}") != std::string::npos);
+        CHECK(json.str().find("{\"name\":\"parse_expr\",\"cat\":\"phase\",\"ph\":\"X\"") != std::string::npos);
+        CHECK(json.str().find("{\"name\":\"_fun (x)\",\"cat\":\"call\",\"ph\":\"X\"") != std::string::npos);
+        CHECK(json.str().find("]}\n") == json.str().size() - 3);
+    }
+
+    SECTION("Calls under the threshold get no span")
+    {
+        Tracer tracer(std::chrono::seconds(1));
+        Tracer::active = &tracer;
+        CHECK(run_program("_let f = _fun (x) x * x _in f(3)") == "9");
+        Tracer::active = nullptr;
+        CHECK(tracer.size() == 3);
+    }
+
+    SECTION("Each worker thread gets a track")
+    {
+        Tracer tracer;
+        Tracer::active = &tracer;
+        ThreadPool pool(2);
+        std::vector<std::string> records(16, "1 + 2");
+        CHECK(run_batch(records, pool, Budget()) == std::vector<std::string>(16, "3"));
+        Tracer::active = nullptr;
+        CHECK(tracer.size() == 16 * 4); // record, parse_expr, interp, print
+
+        std::stringstream json;
+        tracer.write(json);
+        CHECK(json.str().find("\"args\":{\"name\":\"worker ") != std::string::npos);
+        CHECK(json.str().find("\"args\":{\"name\":\"main\"}") == std::string::npos);
+    }
+}
+
+#if !USE_REF_POINTERS /* make_tracked() makes shared pointers */
+
+TEST_CASE("Allocations")
+{
+    AllocationRegistry &registry = AllocationRegistry::instance();
+
+    SECTION("Allocations are counted by concrete type")
+    {
+        AllocationCounters &nums = allocation_counters<NumVal>();
+        AllocationCounters &envs = allocation_counters<ExtendedEnv>();
+        CHECK(nums.type == "NumVal");
+        CHECK(&allocation_counters<NumVal>() == &nums);
+
+        uint64_t constructed = nums.constructed, destroyed = nums.destroyed;
+        uint64_t live = registry.live_objects();
+        {
+            PTR(Val) five = make_tracked<NumVal>(5);
+            PTR(Env) env = make_tracked<ExtendedEnv>("x", five, Env::empty);
+            CHECK(nums.constructed == constructed + 1);
+            CHECK(nums.live >= 1);
+            CHECK(envs.live >= 1);
+            CHECK(nums.bytes >= sizeof(NumVal));
+            CHECK(registry.live_objects() == live + 2);
+        }
+        CHECK(nums.destroyed == destroyed + 1);
+        CHECK(registry.live_objects() == live);
+    }
+
+    SECTION("Reference cycles show up as live objects")
+    {
+        AllocationCounters &funs = allocation_counters<FunVal>();
+        uint64_t live = funs.live;
+
+        // _let f = _fun (x) x _in ..., with f bound in the env f captures
+        PTR(FunVal) f = make_tracked<FunVal>("x", NEW(Var)("x"), Env::empty);
+        PTR(ExtendedEnv) env = make_tracked<ExtendedEnv>("f", f, f->env_m);
+        f->env_m = env;
+        f = nullptr;
+        env = nullptr;
+        CHECK(funs.live == live + 1); // leaked
+
+        std::stringstream report;
+        registry.write(report);
+        CHECK(report.str().find("FunVal") != std::string::npos);
+        CHECK(report.str().find("<- still live") != std::string::npos);
+        CHECK(report.str().find("live objects over time") != std::string::npos);
+    }
+}
+
+#endif
+
+TEST_CASE("Cycle collection")
+{
+    // f bound, in an env chained to rest, to a FunVal that captures that env
+    auto make_cycle = [](const PTR(Env) &rest) {
+        PTR(FunVal) f = NEW(FunVal)("x", NEW(Var)("x"), rest);
+        PTR(Env) env = NEW(ExtendedEnv)("f", f, rest);
+        f->env_m = env;
+        gc_candidate(env);
+        return env;
+    };
+
+    SECTION("Unreferenced cycles are freed")
+    {
+        WEAK(Env) weak = make_cycle(Env::empty);
+        CHECK(!weak.expired()); // the cycle keeps itself alive
+        eval_stats = EvalStats();
+        CHECK(gc_collect() == 2); // the ExtendedEnv and the FunVal
+        CHECK(weak.expired());
+        CHECK(gc_candidates() == 0);
+        CHECK(eval_stats.gc_collections == 1);
+        CHECK(eval_stats.gc_freed == 2);
+        CHECK(gc_collect() == 0);
+        CHECK(eval_stats.gc_collections == 1); // nothing to do
+    }
+
+    SECTION("Referenced cycles are kept until they aren't")
+    {
+        PTR(Env) env = make_cycle(Env::empty);
+        PTR(Val) f = env->lookup("f");
+        WEAK(Env) weak = env;
+        env = nullptr;
+
+        CHECK(gc_collect() == 0);
+        CHECK(gc_candidates() == 1);
+        CHECK(CAST(FunVal)(f)->call(NEW(NumVal)(3))->to_string() == "3");
+
+        f = nullptr;
+        CHECK(!weak.expired());
+        CHECK(gc_collect() == 2);
+        CHECK(weak.expired());
+        CHECK(gc_candidates() == 0);
+    }
+
+    SECTION("Only the cycle is freed")
+    {
+        PTR(Val) one = NEW(NumVal)(1);
+        PTR(Env) outer = NEW(ExtendedEnv)("y", one, Env::empty);
+        PTR(Env) z_env = NEW(ExtendedEnv)("z", NEW(NumVal)(2), outer);
+        WEAK(Env) z = z_env;
+        WEAK(Env) f = make_cycle(z_env);
+        z_env = nullptr;
+
+        CHECK(gc_collect() == 4); // f's ExtendedEnv, the FunVal, z's, and its NumVal
+        CHECK(f.expired());
+        CHECK(z.expired());
+        CHECK(outer.use_count() == 1);
+        CHECK(outer->lookup("y") == one);
+    }
+
+    SECTION("Expired candidates are dropped")
+    {
+        PTR(Env) env = NEW(ExtendedEnv)("x", NEW(NumVal)(1), Env::empty);
+        gc_candidate(env);
+        env = nullptr;
+        CHECK(gc_candidates() == 1);
+        CHECK(gc_collect() == 0);
+        CHECK(gc_candidates() == 0);
+    }
+}
+
+TEST_CASE("Reference counting")
+{
+    SECTION("Copies share, and the last one frees")
+    {
+        PTR(Val) five = NEW(NumVal)(5);
+        CHECK(five.use_count() == 1);
+        {
+            PTR(Val) copy = five;
+            CHECK(five.use_count() == 2);
+            CHECK(copy == five);
+        }
+        CHECK(five.use_count() == 1);
+
+        WEAK(Val) weak = five;
+        CHECK(!weak.expired());
+        CHECK(weak.use_count() == 1);
+        CHECK(weak.lock()->equals(NEW(NumVal)(5)));
+        five = nullptr;
+        CHECK(weak.expired());
+        CHECK(weak.lock() == nullptr);
+    }
+
+    SECTION("Casts share the count")
+    {
+        PTR(Val) val = NEW(FunVal)("x", NEW(Var)("x"), Env::empty);
+        PTR(FunVal) fun = CAST(FunVal)(val);
+        CHECK(fun != nullptr);
+        CHECK(val.use_count() == 2);
+        CHECK(CAST(NumVal)(val) == nullptr);
+        CHECK(UNCHECKED_CAST(FunVal)(val) == fun);
+    }
+
+    SECTION("THIS shares the count")
+    {
+        PTR(Type) type = NEW(IntType)();
+        PTR(Type) resolved = type->resolve();
+        CHECK(resolved == type);
+        CHECK(type.use_count() == 2);
+    }
+
+    SECTION("Borrowed arguments aren't copied")
+    {
+        PTR(Val) five = NEW(NumVal)(5);
+        PTR(Env) env = NEW(ExtendedEnv)("x", five, Env::empty);
+        long uses = five.use_count();
+        CHECK(five->add_to(five)->equals(NEW(NumVal)(10)));
+        CHECK(NEW(Var)("x")->interp(env)->equals(five));
+        CHECK(five.use_count() == uses);
+    }
+}
+
+TEST_CASE("LetRec")
+{
+    const std::string fact = "_letrec f = _fun (n) _if n == 0 _then 1 _else n * f(n + -1) _in f(10)";
+
+    SECTION("Parsing and printing")
+    {
+        PTR(Expr) e = parse_expr(fact);
+        PTR(LetRec) letrec = CAST(LetRec)(e);
+        REQUIRE(letrec != nullptr);
+        CHECK(letrec->lhs_m == "f");
+        CHECK(CAST(Fun)(letrec->rhs_m) != nullptr);
+        CHECK(e->to_string() ==
+              "(_letrec f=(_fun (n) (_if (n==0) _then 1 _else (n*f (n+-1)))) _in f 10)");
+        CHECK(e->to_pretty_string() ==
+              "_letrec f = _fun (n)\n"
+              "              _if   n == 0\n"
+              "              _then 1\n"
+              "              _else n * f(n + -1)\n"
+              "_in     f(10)");
+        CHECK(parse_expr(e->to_pretty_string())->equals(e));
+        CHECK_FALSE(e->equals(parse_expr("_let f = _fun (n) n * 2 _in f(10)")));
+
+        // _let and variables starting with "rec" are unaffected
+        CHECK(parse_expr("_let rec = 2 _in rec * 3")->interp()->to_string() == "6");
+
+        CHECK_THROWS_WITH(parse_expr("_letrec f = 3 _in f"),
+                          "parse_letrec(): _letrec must bind a _fun");
+        CHECK_THROWS_WITH(parse_expr("_letrec f = _fun (n) n * 2 _in 3"),
+                          "parse_letrec(): invalid letrec");
+    }
+
+    SECTION("Substitution")
+    {
+        PTR(Expr) e = parse_expr("_letrec f = _fun (n) _if n == 0 _then x _else f(n + -1) _in f(y)");
+        CHECK(e->subst("x", NEW(Num)(1))->equals(
+                parse_expr("_letrec f = _fun (n) _if n == 0 _then 1 _else f(n + -1) _in f(y)")));
+        CHECK(e->subst("f", NEW(Num)(1))->equals(e)); // bound in both rhs and body
+    }
+
+    SECTION("One call per level")
+    {
+        eval_stats = EvalStats();
+        CHECK(parse_expr(fact)->interp()->to_string() == "3628800");
+        CHECK(eval_stats.fun_vals == 1);
+        CHECK(eval_stats.envs == 12);   // f, and n for each of 11 calls
+        CHECK(eval_stats.max_env_length == 2);
+
+        CHECK(parse_expr("_let x = 2 _in _letrec f = _fun (n) _if n == 0 _then x _else f(n + -1) _in f(5)")
+                      ->interp()->to_string() == "2");
+        CHECK(parallel_interp(parse_expr(fact), 2, 1)->to_string() == "3628800");
+    }
+
+    SECTION("Types")
+    {
+        CHECK(parse_expr(fact)->typecheck()->to_string() == "int");
+        CHECK(parse_expr("_letrec f = _fun (n) _if n == 0 _then _true _else f(n + -1) _in f")
+                      ->typecheck()->to_string() == "(int -> bool)");
+        // Polymorphic in the body...
+        CHECK(parse_expr("_letrec f = _fun (x) _if _true _then x _else f(x) _in _if f(_true) _then f(1) _else 2")
+                      ->typecheck()->to_string() == "int");
+        // ...but not in its own definition
+        CHECK_THROWS_WITH(parse_expr("_letrec f = _fun (x) _if f(_true) _then x _else f(1) _in f(1)")
+                                  ->typecheck(),
+                          "typecheck(): type mismatch between bool and int");
+    }
+
+    SECTION("The closure's cycle is collected")
+    {
+        gc_collect();
+        PTR(Expr) e = parse_expr(fact);
+        CHECK(e->interp()->to_string() == "3628800");
+        CHECK(gc_candidates() == 1);
+        CHECK(gc_collect() == 2); // the environment and the FunVal
+        CHECK(gc_candidates() == 0);
+    }
+}
+
+TEST_CASE("Multi-argument functions")
+{
+    const std::string add3 = "_let f = _fun (x, y, z) x * y + z _in ";
+
+    SECTION("Parsing and printing")
+    {
+        PTR(Expr) e = parse_expr("_fun (x, y) x * y");
+        PTR(Fun) fun = CAST(Fun)(e);
+        REQUIRE(fun != nullptr);
+        CHECK(fun->formal_args_m == std::vector<std::string>{"x", "y"});
+        CHECK(e->to_string() == "(_fun (x, y) (x*y))");
+        CHECK(e->equals(parse_expr("_fun ( x ,y ) x * y")));
+        CHECK_FALSE(e->equals(parse_expr("_fun (y, x) x * y")));
+        CHECK_FALSE(e->equals(parse_expr("_fun (x) _fun (y) x * y")));
+
+        PTR(Expr) call = parse_expr("f(1, y + 2)");
+        REQUIRE(CAST(Call)(call) != nullptr);
+        CHECK(CAST(Call)(call)->actual_args_m.size() == 2);
+        CHECK(call->to_string() == "f (1, (y+2))");
+        CHECK(call->to_pretty_string() == "f(1, y + 2)");
+        CHECK(call->equals(parse_expr("f( 1 ,y+2 )")));
+        CHECK_FALSE(call->equals(parse_expr("f(1)(y + 2)")));
+
+        PTR(Expr) prog = parse_expr(add3 + "f(2, 3, 4)");
+        CHECK(parse_expr(prog->to_pretty_string())->equals(prog));
+
+        // One parameter, with or without parentheses, is unchanged
+        CHECK(parse_expr("_fun x x + 1")->equals(parse_expr("_fun (x) x + 1")));
+        CHECK(parse_expr("f(1)")->equals(NEW(Call)(NEW(Var)("f"), NEW(Num)(1))));
+
+        CHECK_THROWS_WITH(parse_expr("_fun (x, ) x"), "parse_let(): invalid fun");
+        CHECK_THROWS_WITH(parse_expr("_fun (x, y x"), "parse_let(): invalid fun");
+        CHECK_THROWS_WITH(parse_expr("_fun (x, y) x"), "parse_let(): invalid fun");
+        CHECK_THROWS(parse_expr("f(1, )"));
+        CHECK_THROWS(parse_expr("f(1, 2"));
+    }
+
+    SECTION("Substitution")
+    {
+        CHECK(parse_expr("_fun (x, y) x + y + z")->subst("z", NEW(Num)(1))
+                      ->equals(parse_expr("_fun (x, y) x + y + 1")));
+        CHECK(parse_expr("_fun (x, y) x + y")->subst("y", NEW(Num)(1))
+                      ->equals(parse_expr("_fun (x, y) x + y")));
+        CHECK(parse_expr("f(x, y)")->subst("y", NEW(Num)(1))->equals(parse_expr("f(x, 1)")));
+    }
+
+    SECTION("One frame per call")
+    {
+        eval_stats = EvalStats();
+        CHECK(parse_expr(add3 + "f(2, 3, 4)")->interp()->to_string() == "10");
+        CHECK(eval_stats.fun_vals == 1);
+        CHECK(eval_stats.envs == 2);    // f, and x, y, and z together
+        CHECK(eval_stats.max_env_length == 3);  // one frame, not three links
+
+        CHECK(parallel_interp(parse_expr(add3 + "f(2, 3, 4)"), 2, 1)->to_string() == "10");
+    }
+
+    SECTION("Partial and over-application")
+    {
+        CHECK(parse_expr(add3 + "f(2)(3)(4)")->interp()->to_string() == "10");
+        CHECK(parse_expr(add3 + "f(2, 3)(4)")->interp()->to_string() == "10");
+        CHECK(parse_expr(add3 + "f(2)(3, 4)")->interp()->to_string() == "10");
+        CHECK(parse_expr(add3 + "_let g = f(2, 3) _in g(4) + g(5)")->interp()->to_string() == "21");
+        CHECK(parse_expr("_let f = _fun (x) _fun (y) x * y _in f(6, 7)")->interp()->to_string() == "42");
+        CHECK(parse_expr("(_fun (x, y) x + y)(1)")->interp()->to_string() == "(_fun (y) (x+y))");
+        CHECK(parallel_interp(parse_expr(add3 + "f(2)(3, 4)"), 2, 1)->to_string() == "10");
+
+        CHECK_THROWS_WITH(parse_expr("_let f = _fun (x, y) x * y _in f(1, 2, 3)")->interp(),
+                          "cannot use call() on this type");
+        CHECK_THROWS_WITH(parse_expr("_let n = 3 _in n(1, 2)")->interp(), "cannot use call() on this type");
+    }
+
+    SECTION("Types are curried")
+    {
+        CHECK(parse_expr("_fun (x, y) x + y")->typecheck()->to_string() == "(int -> (int -> int))");
+        CHECK(parse_expr(add3 + "f(2, 3)")->typecheck()->to_string() == "(int -> int)");
+        CHECK(parse_expr(add3 + "f(2)(3, 4)")->typecheck()->to_string() == "int");
+
+        PTR(Expr) typed = parse_expr(add3 + "f(2, 3)(4) + f(1)(1, 1)");
+        CHECK(typed->typecheck()->to_string() == "int");
+        CHECK(typed->interp()->to_string() == "12"); // without runtime checks
+
+        CHECK_THROWS_WITH(parse_expr(add3 + "f(2, _true)")->typecheck(),
+                          "typecheck(): type mismatch between int and bool");
+    }
+
+    SECTION("Cycles through a frame are collected")
+    {
+        gc_collect();
+        PTR(Expr) e = parse_expr("_let g = _fun (a, b) "
+                                 "_letrec f = _fun (n) _if n == 0 _then a _else f(n + -1) _in f(b) "
+                                 "_in g(7, 3)");
+        CHECK(e->interp()->to_string() == "7");
+        CHECK(gc_candidates() == 1);
+        CHECK(gc_collect() == 5); // f's environment and f, then the frame, g's _let, and g
+    }
+}
+
+TEST_CASE("Primitives")
+{
+    SECTION("Each one")
+    {
+        CHECK(parse_expr("sub(10, 3)")->interp()->to_string() == "7");
+        CHECK(parse_expr("lt(2, 3)")->interp()->to_string() == "_true");
+        CHECK(parse_expr("lt(3, 3)")->interp()->to_string() == "_false");
+        CHECK(parse_expr("le(3, 3)")->interp()->to_string() == "_true");
+        CHECK(parse_expr("div(-7, 2)")->interp()->to_string() == "-3");
+        CHECK(parse_expr("mod(-7, 2)")->interp()->to_string() == "-1");
+        CHECK(parse_expr("min(4, -2)")->interp()->to_string() == "-2");
+        CHECK(parse_expr("max(4, -2)")->interp()->to_string() == "4");
+        CHECK(parse_expr("abs(-5)")->interp()->to_string() == "5");
+        CHECK(parse_expr("sub(9223372036854775807, -1)")->interp()->to_string() == "9223372036854775808");
+
+        CHECK_THROWS_WITH(parse_expr("div(1, 0)")->interp(), "division by zero");
+        CHECK_THROWS_WITH(parse_expr("sub(_true, 1)")->interp(), "invalid operation on non-number");
+        CHECK_THROWS_WITH(parse_expr("abs(1, 2)")->interp(), "cannot use call() on this type");
+        CHECK_THROWS_WITH(parse_expr("abs + 1")->interp(), "invalid operation on non-number");
+        CHECK_THROWS_WITH(parse_expr("nope(1)")->interp(), "Var cannot call interp()");
+    }
+
+    SECTION("Values")
+    {
+        PTR(Val) sub = parse_expr("sub")->interp();
+        REQUIRE(CAST(PrimVal)(sub) != nullptr);
+        CHECK(sub == parse_expr("sub")->interp()); // one per thread
+        CHECK(sub->to_string() == "sub");
+        CHECK(sub->equals(parse_expr("_let f = sub _in f")->interp()));
+        CHECK_FALSE(sub->equals(parse_expr("div")->interp()));
+
+        PTR(Val) partial = parse_expr("sub(10)")->interp();
+        CHECK(partial->to_string() == "sub 10");
+        CHECK(partial->call(NEW(NumVal)(3))->to_string() == "7");
+        CHECK(partial->equals(parse_expr("_let x = 10 _in sub(x)")->interp()));
+        CHECK(parse_expr("_let g = min _in g(3)(1)")->interp()->to_string() == "1");
+        CHECK(parse_expr("_let apply = _fun (f) f(2, 5) _in apply(max) * apply(sub)")->interp()->to_string() == "-15");
+    }
+
+    SECTION("Shadowed by any binding")
+    {
+        CHECK(parse_expr("_let sub = _fun (x, y) x + y _in sub(1, 2)")->interp()->to_string() == "3");
+        CHECK(parse_expr("_let min = 5 _in min + 1")->interp()->to_string() == "6");
+        CHECK(parse_expr("(_fun (abs) abs * 2)(4)")->interp()->to_string() == "8");
+    }
+
+    SECTION("No closure calls")
+    {
+        const std::string gcd = "_letrec gcd = _fun (a, b) _if b == 0 _then a _else gcd(b, mod(a, b)) _in gcd(1071, 462)";
+
+        eval_stats = EvalStats();
+        CHECK(parse_expr(gcd)->interp()->to_string() == "21");
+        CHECK(eval_stats.fun_vals == 1);
+        CHECK(eval_stats.envs == 5);    // gcd, and one frame for each of 4 calls
+
+        CHECK(parallel_interp(parse_expr(gcd), 2, 1)->to_string() == "21");
+        CHECK(parse_expr("_letrec f = _fun (n) _if le(n, 1) _then n _else f(sub(n, 1)) + f(sub(n, 2)) _in f(15)")
+                      ->interp()->to_string() == "610");
+    }
+
+    SECTION("Types")
+    {
+        CHECK(parse_expr("sub")->typecheck()->to_string() == "(int -> (int -> int))");
+        CHECK(parse_expr("lt")->typecheck()->to_string() == "(int -> (int -> bool))");
+        CHECK(parse_expr("abs")->typecheck()->to_string() == "(int -> int)");
+        CHECK(parse_expr("_let sub = _true _in sub")->typecheck()->to_string() == "bool");
+        CHECK_THROWS_WITH(parse_expr("lt(1, 2) + 1")->typecheck(),
+                          "typecheck(): type mismatch between bool and int");
+
+        // Typed calls still work when the callee turns out to be a primitive
+        PTR(Expr) e = parse_expr("_let apply = _fun (f) f(7)(2) _in apply(div) + apply(_fun (x, y) x * y)");
+        CHECK(e->typecheck()->to_string() == "int");
+        CHECK(e->interp()->to_string() == "17");
+    }
+}
+
+TEST_CASE("Lazy evaluation")
+{
+    // Only one of a and b is used on each path
+    const std::string tree = "_let a = 2 * 21 _in _let b = _true + 1 _in _let c = 1 + 1 _in "
+                             "_if c == 2 _then a _else b";
+
+    SECTION("Values are only evaluated when used")
+    {
+        CHECK_THROWS_WITH(parse_expr(tree)->interp(), "invalid operation on non-number");
+
+        LazyEval lazy;
+        eval_stats = EvalStats();
+        CHECK(parse_expr(tree)->interp()->to_string() == "42");
+        CHECK(eval_stats.thunks == 3);
+        CHECK(eval_stats.thunks_forced == 2); // c, then a
+
+        CHECK(parse_expr("_let f = _fun (x, y) _if x == 0 _then 1 _else y _in f(0, _true + 1)")
+                      ->interp()->to_string() == "1");
+        CHECK_THROWS_WITH(parse_expr("_let f = _fun (x, y) _if x == 0 _then 1 _else y _in f(1, _true + 1)")
+                                  ->interp(),
+                          "invalid operation on non-number");
+    }
+
+    SECTION("Each value is evaluated at most once")
+    {
+        LazyEval lazy;
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_let x = 3 * 4 _in _let y = x _in _let f = _fun (z) z + z _in f(x) + y")
+                      ->interp()->to_string() == "36");
+        CHECK(eval_stats.thunks == 1);          // numbers, _funs, and variables are bound as they are
+        CHECK(eval_stats.thunks_forced == 1);   // x, shared by y and z
+        CHECK(eval_stats.num_vals == 5);        // 3, 4, 12, 24, and 36
+    }
+
+    SECTION("Same results as interp()")
+    {
+        const std::vector<std::string> programs = {
+                "_letrec f = _fun (n) _if n == 0 _then 1 _else n * f(n + -1) _in f(10)",
+                "_let f = _fun (x, y, z) x * y + z _in f(2)(3, 4) + f(2, 3)(4)",
+                "_let x = 1 + 2 _in _fun (y) x + y",
+                "sub(2 * 3, abs(-1)) + max(1 + 1, 3)",
+                "_let f = _fun (g) g(1 + 1) _in f(sub(10))",
+        };
+        for (const std::string &program: programs) {
+            std::string eager = parse_expr(program)->interp()->to_string();
+            LazyEval lazy;
+            CHECK(parse_expr(program)->interp()->to_string() == eager);
+        }
+
+        // A function result keeps its unforced thunks, and forces them later
+        PTR(Val) f;
+        {
+            LazyEval lazy;
+            f = parse_expr("_let x = 5 * 5 _in _fun (y) x + y")->interp();
+        }
+        CHECK_FALSE(ThunkVal::enabled);
+        CHECK(f->call(NEW(NumVal)(1))->to_string() == "26");
+    }
+
+    SECTION("Thunks")
+    {
+        PTR(ThunkVal) thunk = NEW(ThunkVal)(parse_expr("x * 2"), NEW(ExtendedEnv)("x", NEW(NumVal)(21), Env::empty));
+        CHECK(thunk->val_m == nullptr);
+        CHECK(thunk->equals(NEW(NumVal)(42)));
+        CHECK(thunk->val_m != nullptr);
+        CHECK(thunk->expr_m == nullptr); // released once forced
+        CHECK(thunk->env_m == nullptr);
+        CHECK(thunk->to_string() == "42");
+        CHECK(parse_expr("sub(x, 2)")->interp(NEW(ExtendedEnv)("x", thunk, Env::empty))->to_string() == "40");
+
+        PTR(ThunkVal) bad = NEW(ThunkVal)(parse_expr("1 + _true"), Env::empty);
+        CHECK_THROWS_WITH(bad->force(), "invalid operation on non-number");
+        CHECK(bad->expr_m != nullptr);
+    }
+}
+
+TEST_CASE("Memoization")
+{
+    const std::string fib = "_letrec fib = _fun (n) _if le(n, 1) _then n _else fib(n + -1) + fib(n + -2) _in fib(";
+
+    SECTION("Off unless configured")
+    {
+        CHECK(memo_capacity() == 0);
+        eval_stats = EvalStats();
+        CHECK(parse_expr(fib + "15)")->interp()->to_string() == "610");
+        CHECK(eval_stats.memo_misses == 0);
+        CHECK(memo_size() == 0);
+    }
+
+    SECTION("Recursive calls become linear")
+    {
+        memo_configure(100);
+        eval_stats = EvalStats();
+        CHECK(parse_expr(fib + "90)")->interp()->to_string() == "2880067194370816120");
+        CHECK(eval_stats.memo_misses == 91);    // fib(0) through fib(90), once each
+        CHECK(eval_stats.memo_hits == 88);
+        CHECK(memo_size() == 91);
+
+        // Self-application makes a new closure per call, over the same values
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_let fib = _fun (f) _fun (n) _if le(n, 1) _then n _else f(f)(n + -1) + f(f)(n + -2) "
+                         "_in fib(fib)(60)")->interp()->to_string() == "1548008755920");
+        CHECK(eval_stats.memo_misses == 61);
+
+        memo_configure(0);
+        CHECK(memo_size() == 0);
+        gc_collect();
+    }
+
+    SECTION("Keys")
+    {
+        memo_configure(100);
+        eval_stats = EvalStats();
+
+        // Same body over different values: different closures
+        CHECK(parse_expr("_let add = _fun (x) _fun (y) x + y _in add(1)(10) + add(2)(10)")
+                      ->interp()->to_string() == "23");
+        CHECK(eval_stats.memo_hits == 0);
+
+        // Numbers and booleans with the same Integer are different arguments
+        CHECK(parse_expr("_let f = _fun (x) x == 1 _in _if f(1) _then f(_true) _else _true")
+                      ->interp()->to_string() == "_false");
+
+        // Functions can't be compared, so calls with them aren't cached
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_let f = _fun (g) g(1) _in f(_fun (x) x + 1) + f(abs)")->interp()->to_string() == "3");
+        CHECK(eval_stats.memo_hits + eval_stats.memo_misses == 1); // only x + 1, with 1
+
+        // Multi-argument calls are keyed on all of their arguments
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_let f = _fun (x, y) x * y _in f(2, 3) + f(3, 2) + f(2, 3)")->interp()->to_string() == "18");
+        CHECK(eval_stats.memo_hits == 1);
+        CHECK(eval_stats.memo_misses == 2);
+
+        memo_configure(0);
+    }
+
+    SECTION("Lazy arguments")
+    {
+        memo_configure(100);
+        LazyEval lazy;
+
+        // n is still a thunk at the first call, and forced by the time of the
+        // second; only calls with forced arguments are keyed
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_let f = _fun (x) x * x _in _let n = 2 + 3 _in f(n) + f(n) + f(n)")
+                      ->interp()->to_string() == "75");
+        CHECK(eval_stats.memo_misses == 1);
+        CHECK(eval_stats.memo_hits == 1);
+
+        // An unused argument is never evaluated for a key
+        CHECK(parse_expr("_let f = _fun (x, y) _if x == 1 _then x _else y _in f(1, div(1, 0)) + f(1, div(1, 0))")
+                      ->interp()->to_string() == "2");
+
+        memo_configure(0);
+        gc_collect();
+    }
+
+    SECTION("Bounded by a clock sweep")
+    {
+        memo_configure(4);
+        eval_stats = EvalStats();
+        CHECK(parse_expr("_let f = _fun (x) x * x _in f(1) + f(2) + f(3) + f(4) + f(1) + f(5) + f(1) + f(2)")
+                      ->interp()->to_string() == "61");
+        CHECK(memo_size() == 4);
+        CHECK(eval_stats.memo_hits == 2);       // f(1) twice: it was hit, so f(2) was evicted for f(5)
+        CHECK(eval_stats.memo_misses == 6);
+        CHECK(eval_stats.memo_evictions == 2);  // f(2), then f(3) for f(2)
+
+        memo_clear();
+        CHECK(memo_size() == 0);
+        CHECK(memo_capacity() == 4);
+        memo_configure(0);
+    }
+}
+
+TEST_CASE("Flat AST")
+{
+    const std::vector<std::string> programs = {
+            "1 + 2 * 3",
+            "-7 * (3 + x)",
+            "_true == (1 == 2)",
+            "_let x = 5 _in _let y = x * x _in y + x",
+            "_if 3 == 3 _then _false _else _true",
+            "_letrec f = _fun (n) _if n == 0 _then 1 _else n * f(n + -1) _in f(10)",
+            "_let f = _fun (x, y, z) x * y + z _in f(2)(3, 4) + f(2, 3)(4)",
+            "_let f = _fun (x) _fun (y) x + y _in f(1)",
+            "sub(2 * 3, abs(-1)) + max(1 + 1, 3)",
+            "99999999999999999999 * 99999999999999999999",
+    };
+
+    SECTION("Same tree as the Expr")
+    {
+        for (const std::string &program: programs) {
+            PTR(Expr) e = parse_expr(program);
+            PTR(FlatExpr) flat = FlatExpr::flatten(e);
+            CHECK(flat->size() == e->size_m);
+            CHECK(flat->to_string() == e->to_string());
+            CHECK(flat->to_expr()->equals(e));
+            CHECK(flat->equals(*FlatExpr::flatten(parse_expr(program))));
+        }
+    }
+
+    SECTION("Same results as interp()")
+    {
+        for (const std::string &program: programs) {
+            if (program == programs[1]) {
+                continue; // it has a free variable
+            }
+            std::string tree = parse_expr(program)->interp()->to_string();
+            CHECK(FlatExpr::flatten(parse_expr(program))->interp()->to_string() == tree);
+        }
+        gc_collect();
+
+        CHECK_THROWS_WITH(FlatExpr::flatten(parse_expr("-7 * (3 + x)"))->interp(), "Var cannot call interp()");
+        CHECK_THROWS_WITH(FlatExpr::flatten(parse_expr("_true + 1"))->interp(), "invalid operation on non-number");
+        CHECK(FlatExpr::flatten(parse_expr("-7 * (3 + x)"))->interp(
+                NEW(ExtendedEnv)("x", NEW(NumVal)(1), Env::empty))->to_string() == "-28");
+
+        // Same steps, too
+        const std::string program = "_let f = _fun (x, y) _if x == 0 _then y _else x * y _in f(2, 3) + f(0, 1)";
+        eval_stats = EvalStats();
+        parse_expr(program)->interp();
+        uint64_t nodes = eval_stats.nodes_evaluated;
+        eval_stats = EvalStats();
+        FlatExpr::flatten(parse_expr(program))->interp();
+        CHECK(eval_stats.nodes_evaluated == nodes);
+    }
+
+    SECTION("Unequal trees")
+    {
+        const std::vector<std::pair<std::string, std::string>> pairs = {
+                {"1 + 2",                             "1 + 3"},
+                {"1 + 2",                             "1 * 2"},
+                {"x + y",                             "x + z"},
+                {"(1 + 2) + 3",                       "1 + (2 + 3)"},
+                {"_let x = 1 _in x",                  "_let y = 1 _in y"},
+                {"_let f = _fun (x) x + 0 _in f(1)",  "_letrec f = _fun (x) x + 0 _in f(1)"},
+                {"_fun (x, y) x + y",                 "_fun (y, x) x + y"},
+                {"f(1, 2)",                           "f(1)(2)"},
+                {"_true",                             "_false"},
+        };
+        for (const auto &pair: pairs) {
+            PTR(FlatExpr) lhs = FlatExpr::flatten(parse_expr(pair.first));
+            PTR(FlatExpr) rhs = FlatExpr::flatten(parse_expr(pair.second));
+            CHECK_FALSE(lhs->equals(*rhs));
+            CHECK_FALSE(rhs->equals(*lhs));
+        }
+    }
+
+    SECTION("Functions")
+    {
+        PTR(FlatExpr) flat = FlatExpr::flatten(parse_expr("_let f = _fun (x) _fun (y) x + y _in f(1)"));
+        PTR(Val) g = flat->interp();
+        CHECK(g->to_string() == "(_fun (y) (x+y))");
+        CHECK(g->call(NEW(NumVal)(2))->to_string() == "3");
+
+        // Closures from the same _fun share one body, which keeps the tree alive
+        PTR(Val) h = flat->interp();
+        FunVal *g_fun = CAST(FunVal)(g).get();
+        CHECK(g_fun->body_m == CAST(FunVal)(h)->body_m);
+        CHECK(g->equals(h));
+        CHECK(g->equals(parse_expr("_fun (y) x + y")->interp()));
+        flat = nullptr;
+        CHECK(g->call(NEW(NumVal)(4))->to_string() == "5");
+
+        // A body converts back for anything that isn't flat
+        CHECK(g_fun->body_m->subst("x", NEW(Num)(7))->equals(parse_expr("7 + y")));
+        CHECK(g_fun->body_m->to_pretty_string() == "x + y");
+        CHECK(FlatExpr::flatten(g_fun->to_expr())->to_string() == "(_fun (y) (x+y))");
+    }
+
+    SECTION("Deep and large trees")
+    {
+        PTR(Expr) e = NEW(Num)(0);
+        for (int i = 1; i <= 10000; i++) {
+            e = NEW(Add)(e, NEW(Num)(i));
+        }
+        PTR(FlatExpr) flat = FlatExpr::flatten(e);
+        CHECK(flat->size() == 20001);
+        CHECK(flat->interp()->to_string() == "50005000");
+        CHECK(flat->to_string() == e->to_string());
+        CHECK(flat->equals(*FlatExpr::flatten(e)));
+
+        // One byte of kind and three 4-byte operands per node, plus the numbers
+        CHECK(flat->bytes() < flat->size() * (13 + sizeof(Integer)) + 1024);
+        CHECK(flat->bytes() * 3 < flat->size() * sizeof(Add));
+    }
+}
+
+TEST_CASE("Deep trees")
+{
+    const int depth = 200000;
+
+    /* x + (1 + (2 + ... + (depth - 1))), built bottom-up as the parser would */
+    auto add_chain = [depth](const PTR(Expr) &first) {
+        PTR(Expr) e = NEW(Num)(depth);
+        for (int i = depth - 1; i > 0; i--) {
+            e = NEW(Add)(NEW(Num)(i), e);
+        }
+        return NEW(Add)(first, e);
+    };
+
+    /* _let x0 = 0 _in _let x1 = 1 _in ... _in body */
+    auto let_chain = [depth](const PTR(Expr) &body) {
+        PTR(Expr) e = body;
+        for (int i = depth - 1; i >= 0; i--) {
+            e = NEW(Let)("x" + std::to_string(i), NEW(Num)(i), e);
+        }
+        return e;
+    };
+
+    SECTION("equals")
+    {
+        CHECK(add_chain(NEW(Var)("x"))->equals(add_chain(NEW(Var)("x"))));
+        CHECK_FALSE(add_chain(NEW(Var)("x"))->equals(add_chain(NEW(Var)("y"))));
+        CHECK(let_chain(NEW(Var)("x"))->equals(let_chain(NEW(Var)("x"))));
+        CHECK_FALSE(let_chain(NEW(Var)("x"))->equals(let_chain(NEW(Num)(1))));
+
+        PTR(Expr) e = add_chain(NEW(Num)(0));
+        CHECK(e->equals(e));
+        CHECK_FALSE(e->equals(NEW(Mult)(NEW(Num)(0), NEW(Num)(1))));
+    }
+
+    SECTION("has_variable")
+    {
+        CHECK(add_chain(NEW(Var)("x"))->has_variable());
+        CHECK_FALSE(add_chain(NEW(Num)(0))->has_variable());
+        CHECK(let_chain(NEW(Var)("x"))->has_variable());
+        CHECK_FALSE(let_chain(NEW(Num)(0))->has_variable());
+    }
+
+    SECTION("subst")
+    {
+        PTR(Expr) e = add_chain(NEW(Var)("x"));
+        CHECK(e->subst("x", NEW(Num)(0))->equals(add_chain(NEW(Num)(0))));
+        CHECK(e->subst("y", NEW(Num)(0))->equals(e));
+
+        /* A binder of the same name stops the substitution */
+        PTR(Expr) free = let_chain(NEW(Var)("y"));
+        CHECK(free->subst("y", NEW(Num)(0))->equals(let_chain(NEW(Num)(0))));
+        PTR(Expr) bound = let_chain(NEW(Var)("x7"));
+        CHECK(bound->subst("x7", NEW(Num)(0))->equals(bound));
+    }
+
+    SECTION("Destruction")
+    {
+        PTR(Expr) e = NEW(Var)("x");
+        for (int i = 0; i < depth; i++) {
+            switch (i % 6) {
+                case 0: e = NEW(Mult)(e, NEW(Num)(i)); break;
+                case 1: e = NEW(Eq)(NEW(Num)(i), e); break;
+                case 2: e = NEW(If)(NEW(Bool)(true), e, NEW(Num)(i)); break;
+                case 3: e = NEW(Fun)("x", e); break;
+                case 4: e = NEW(Call)(e, std::vector<PTR(Expr)>{NEW(Num)(i)}); break;
+                default: e = NEW(LetRec)("f", NEW(Fun)("n", NEW(Var)("n")), e); break;
+            }
+        }
+        CHECK(e->equals(e));
+        e = nullptr;
+
+        /* A subtree shared with a live tree survives */
+        PTR(Expr) shared = add_chain(NEW(Var)("x"));
+        PTR(Expr) other = NEW(Add)(NEW(Num)(1), shared);
+        other = nullptr;
+        CHECK(shared->equals(add_chain(NEW(Var)("x"))));
+    }
+
+    SECTION("Parsed trees")
+    {
+        std::string program = "1";
+        for (int i = 0; i < 2000; i++) {
+            program += " + " + std::to_string(i) + " * x";
+        }
+        PTR(Expr) e = parse_expr(program);
+        CHECK(e->equals(parse_expr(program)));
+        CHECK(e->has_variable());
+        CHECK(e->subst("x", NEW(Num)(2))->interp()->to_string() == "3998001");
+    }
+}
+
+TEST_CASE("Serialization")
+{
+    const std::vector<std::string> programs = {
+            "1 + 2 * 3",
+            "-7 * (3 + x)",
+            "_true == (1 == 2)",
+            "_let x = 5 _in _let y = x * x _in y + x",
+            "_if 3 == 3 _then _false _else _true",
+            "_letrec f = _fun (n) _if n == 0 _then 1 _else n * f(n + -1) _in f(10)",
+            "_let f = _fun (x, y, z) x * y + z _in f(2)(3, 4) + f(2, 3)(4)",
+            "sub(2 * 3, abs(-1)) + max(1 + 1, 3)",
+            "99999999999999999999 * -99999999999999999999 + -9223372036854775807",
+    };
+
+    SECTION("Round trips")
+    {
+        for (const std::string &program: programs) {
+            PTR(Expr) e = parse_expr(program);
+            std::string bytes = serialize(e);
+            PTR(Expr) loaded = deserialize(bytes);
+            CHECK(loaded->equals(e));
+            CHECK(loaded->to_string() == e->to_string());
+            CHECK(loaded->size_m == e->size_m);
+            CHECK(serialize(loaded) == bytes);
+        }
+        CHECK(deserialize(serialize(NEW(Num)(INT_MIN)))->equals(NEW(Num)(INT_MIN)));
+    }
+
+    SECTION("Compact")
+    {
+        /* One byte per operator, two per small number, names stored once */
+        std::string bytes = serialize(parse_expr("_let count = 1 _in count + count * 2"));
+        CHECK(bytes.size() == 5 + 7 + 1 + 12);
+    }
+
+    SECTION("Deep trees")
+    {
+        PTR(Expr) e = NEW(Var)("x");
+        for (int i = 0; i < 200000; i++) {
+            e = NEW(Add)(NEW(Num)(i), e);
+        }
+        CHECK(deserialize(serialize(e))->equals(e));
+    }
+
+    SECTION("Invalid input")
+    {
+        std::string bytes = serialize(parse_expr("_let x = 5 _in x * 2"));
+        CHECK_THROWS_WITH(deserialize(""), "deserialize(): not a serialized tree of this version");
+        CHECK_THROWS_WITH(deserialize(bytes.substr(0, bytes.size() - 1)), "deserialize(): truncated input");
+        CHECK_THROWS_WITH(deserialize(bytes + "x"), "deserialize(): trailing bytes");
+        std::string version = bytes;
+        version[4]++;
+        CHECK_THROWS_WITH(deserialize(version), "deserialize(): not a serialized tree of this version");
+        std::string num = serialize(NEW(Num)(1)); // Magic, 0 names, 1 node: tag, 1
+        REQUIRE(num.size() == 9);
+        num[7] = 99;
+        CHECK_THROWS_WITH(deserialize(num), "deserialize(): invalid tag");
+        num[7] = 6; // An Add, with no operands to add
+        CHECK_THROWS_WITH(deserialize(num), "deserialize(): missing operand");
+        std::string var = serialize(NEW(Var)("x"));
+        var.back() = 1;
+        CHECK_THROWS_WITH(deserialize(var), "deserialize(): invalid name");
+        std::string call = serialize(NEW(Num)(1));
+        call[6] = 2; // Two nodes: the Num, then a Call with 2^64 - 1 arguments
+        call += '\x0d'; // SERIAL_CALL
+        call += std::string(9, '\xff') + '\x01';
+        CHECK_THROWS_WITH(deserialize(call), "deserialize(): missing operand");
+        CHECK_THROWS(serialize(NEW(FlatRef)(FlatExpr::flatten(parse_expr("1 + 2")), 2)));
+    }
+
+    SECTION("Parse cache")
+    {
+        const std::string dir = "/tmp/msd-script-test-cache-" + std::to_string(getpid());
+        const std::string src = "_let x = 5 _in x * 2";
+        parse_cache_configure(dir);
+        const std::string path = parse_cache_path(src);
+        CHECK(path.find(dir + "/") == 0);
+        CHECK(path != parse_cache_path(src + " "));
+
+        /* A miss parses and stores the tree */
+        CHECK(parse_cached(src)->equals(parse_expr(src)));
+        CHECK(std::ifstream(path).good());
+        CHECK(parse_cached(src)->equals(parse_expr(src)));
+
+        /* A hit loads the stored tree without parsing */
+        std::string file = "MSDC";
+        file += static_cast<char>(src.size());
+        file += src;
+        file += serialize(NEW(Num)(10));
+        std::ofstream(path, std::ios::binary) << file;
+        CHECK(parse_cached(src)->equals(NEW(Num)(10)));
+
+        /* A damaged file is replaced */
+        std::ofstream(path, std::ios::binary) << file.substr(0, file.size() - 1);
+        CHECK(parse_cached(src)->equals(parse_expr(src)));
+        CHECK(parse_cached(src)->equals(parse_expr(src)));
+
+        /* So is one whose argument count overflows */
+        std::string call = serialize(NEW(Num)(1));
+        call[6] = 2;
+        call += '\x0d'; // SERIAL_CALL
+        call += std::string(9, '\xff') + '\x01';
+        std::ofstream(path, std::ios::binary) << "MSDC" + file.substr(4, 1 + src.size()) + call;
+        CHECK(parse_cached(src)->equals(parse_expr(src)));
+
+        /* Invalid input is not stored */
+        CHECK_THROWS(parse_cached("1 +"));
+        CHECK_FALSE(std::ifstream(parse_cache_path("1 +")).good());
+
+        parse_cache_configure("");
+        CHECK(parse_cached("1 + 1")->equals(parse_expr("1 + 1")));
+        CHECK(std::remove(path.c_str()) == 0);
+        CHECK(rmdir(dir.c_str()) == 0);
+    }
+}
+
+#ifdef __linux__
+
+TEST_CASE("Serve")
+{
+    const std::string path = "/tmp/msd-script-test-" + std::to_string(getpid()) + ".sock";
+    std::atomic<bool> stop(false);
+    std::thread server([&path, &stop]() { serve(path, 2, &stop); });
+
+    // Connects once the server is listening
+    auto connect_client = [&path]() {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        path.copy(address.sun_path, path.size());
+        for (int attempt = 0; attempt < 500; attempt++) {
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (connect(fd, (sockaddr *) &address, sizeof(address)) == 0) {
+                return fd;
+            }
+            close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return -1;
+    };
+
+    // Reads one reply frame as its status byte followed by its text
+    auto read_reply = [](int fd) {
+        std::string res;
+        char c;
+        while (res.size() < 4 && read(fd, &c, 1) == 1) {
+            res += c;
+        }
+        uint32_t length = 0;
+        for (char byte: res) {
+            length = (length << 8) | static_cast<unsigned char>(byte);
+        }
+        res.clear();
+        while (res.size() < length && read(fd, &c, 1) == 1) {
+            res += c;
+        }
+        return res;
+    };
+
+    int client = connect_client();
+    REQUIRE(client >= 0);
+
+    SECTION("Pipelined requests are answered in order")
+    {
+        std::string requests = encode_frame(MODE_INTERP, "_let x = 5 _in x * x") +
+                               encode_frame(MODE_PRINT, "1 + 2 * 3") +
+                               encode_frame(MODE_PRETTY_PRINT, "(1 + 2) * 3") +
+                               encode_frame(MODE_INTERP, "_true + 1") +
+                               encode_frame(9, "1") +
+                               encode_frame(MODE_INTERP, "(_fun (x) x * 2)(21)");
+        REQUIRE(write(client, requests.data(), requests.size()) == (ssize_t) requests.size());
+
+        CHECK(read_reply(client) == std::string(1, STATUS_OK) + "25");
+        CHECK(read_reply(client) == std::string(1, STATUS_OK) + "(1+(2*3))");
+        CHECK(read_reply(client) == std::string(1, STATUS_OK) + "(1 + 2) * 3");
+        CHECK(read_reply(client) == std::string(1, STATUS_ERROR) + "invalid operation on non-number");
+        CHECK(read_reply(client) == std::string(1, STATUS_ERROR) + "serve: unknown mode");
+        CHECK(read_reply(client) == std::string(1, STATUS_OK) + "42");
+    }
+
+    SECTION("Replies to requests sent before EOF are still delivered")
+    {
+        int second = connect_client();
+        std::string request = encode_frame(MODE_INTERP, "1 + 1");
+        REQUIRE(write(second, request.data(), request.size()) == (ssize_t) request.size());
+        shutdown(second, SHUT_WR);
+        CHECK(read_reply(second) == std::string(1, STATUS_OK) + "2");
+        char c;
+        CHECK(read(second, &c, 1) == 0); // then the server closes
+        close(second);
+
+        // Other connections are unaffected
+        request = encode_frame(MODE_INTERP, "2 * 3");
+        REQUIRE(write(client, request.data(), request.size()) == (ssize_t) request.size());
+        CHECK(read_reply(client) == std::string(1, STATUS_OK) + "6");
+    }
+
+    SECTION("A bad frame length closes the connection")
+    {
+        std::string bad("\0\0\0\0", 4);
+        REQUIRE(write(client, bad.data(), bad.size()) == 4);
+        CHECK(read_reply(client) == std::string(1, STATUS_ERROR) + "serve: invalid frame length");
+        char c;
+        CHECK(read(client, &c, 1) == 0);
+    }
+
+    close(client);
+    stop = true;
+    server.join();
+    CHECK(access(path.c_str(), F_OK) != 0); // the socket is removed
+}
+
+#endif /* __linux__ */
\ No newline at end of file